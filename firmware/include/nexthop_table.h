@@ -0,0 +1,100 @@
+#ifndef SENTRYFLOW_NEXTHOP_TABLE_H
+#define SENTRYFLOW_NEXTHOP_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Next-hop groups for equal-cost multipath.
+ *
+ * A route whose next hop is a group (SF_ROUTE_F_GROUP in routing_table.h)
+ * stores the group id where the next hop would be, so a route costs the same
+ * 16 bytes either way and a million routes over a few thousand groups add
+ * only the groups themselves: 16 bytes each plus 8 per member.
+ *
+ * Groups are deduplicated: members are kept sorted by next hop with repeats
+ * merged, and defining a member set that already exists returns its id.
+ * Each group counts the routes that use it. Groups no route uses are dropped
+ * when the table would otherwise grow, except those defined since the
+ * previous such collection, so a group survives until its routes arrive.
+ *
+ * An id is a slot in groups[] (low SF_NH_SLOT_BITS) and the slot's
+ * generation, bumped each time the slot is freed, so an id kept past its
+ * group's collection is refused instead of naming whatever group reuses the
+ * slot. Only after 128 reuses of one slot does an id come back.
+ *
+ * A member is picked by hash threshold (RFC 2992): the flow hash is scaled
+ * onto the cumulative weights, so a flow keeps its member as long as the
+ * group does, and changing one member moves only the flows next to it.
+ */
+
+#define SF_NH_GROUP_MAX 64u
+#define SF_NH_SLOT_BITS 24u
+#define SF_NH_SLOT_MASK ((1u << SF_NH_SLOT_BITS) - 1u)
+#define SF_NH_GEN_MASK  0x7Fu  /* ids stay below 2^31 */
+
+typedef struct sf_nh_member {
+    uint32_t next_hop_be;
+    uint16_t weight;        /* 0 counts as 1 */
+    uint16_t reserved;
+} sf_nh_member_t;
+
+/* Slots index groups[]; slot 0 is never used. A free slot has count 0. */
+typedef struct sf_nh_group {
+    uint32_t first;         /* hops[] index of the first member; free list link when free */
+    uint32_t refs;          /* routes using the group */
+    uint32_t hash;          /* of the members */
+    uint16_t count;
+    uint8_t  fresh;         /* defined since the last collection */
+    uint8_t  gen;           /* id generation of the slot, kept while it is free */
+} sf_nh_group_t;
+
+typedef struct sf_nh_hop {
+    uint32_t next_hop_be;
+    uint32_t bound;         /* sum of the weights of the group's members up to this one */
+} sf_nh_hop_t;
+
+typedef struct sf_nh_table {
+    sf_nh_group_t *groups;
+    uint32_t       group_cap;
+    uint32_t       group_used;  /* high-water mark, 0 or at least 1 */
+    uint32_t       free_group;  /* 0 = none */
+    uint32_t       live;
+    sf_nh_hop_t   *hops;
+    uint32_t       hop_cap;
+    uint32_t       hop_used;
+    uint32_t       hop_dead;    /* members of freed or redefined groups not yet compacted away */
+    uint32_t      *index;       /* group ids by hash, open addressing; 0 = empty */
+    size_t         index_cap;   /* power of two */
+} sf_nh_table_t;
+
+void     sf_nh_table_init(sf_nh_table_t *nh);
+void     sf_nh_table_free(sf_nh_table_t *nh);
+size_t   sf_nh_table_count(const sf_nh_table_t *nh);
+/* Returns the id of the group with these members in *id, defining it if
+   needed (*created then 1). -1 for no members, more than SF_NH_GROUP_MAX
+   distinct ones or no memory. */
+int      sf_nh_define(sf_nh_table_t *nh, const sf_nh_member_t *m, size_t n, uint32_t *id, int *created);
+/* Defines group id as given, replacing what its slot held (log replay and
+   replication repeat the leader's ids). Never collects. */
+int      sf_nh_define_at(sf_nh_table_t *nh, uint32_t id, const sf_nh_member_t *m, size_t n);
+/* 1 if id names a defined group (of its slot's current generation). */
+int      sf_nh_valid(const sf_nh_table_t *nh, uint32_t id);
+/* The id of the group in slot, 0 for a free one. */
+uint32_t sf_nh_id(const sf_nh_table_t *nh, uint32_t slot);
+void     sf_nh_ref(sf_nh_table_t *nh, uint32_t id);
+void     sf_nh_unref(sf_nh_table_t *nh, uint32_t id);
+/* The member for flow_hash, or 0 for an unknown group. */
+uint32_t sf_nh_select(const sf_nh_table_t *nh, uint32_t id, uint32_t flow_hash);
+/* Copies the group's members (up to SF_NH_GROUP_MAX) in stored order; 0 for
+   an unknown group. */
+size_t   sf_nh_members(const sf_nh_table_t *nh, uint32_t id, sf_nh_member_t *out);
+/* Hashes a flow key (a 5-tuple, an address, any bytes). */
+uint32_t sf_nh_flow_hash(const void *key, size_t len);
+/* Copies arrays saved from another table (a snapshot) and checks them. */
+int      sf_nh_table_load(sf_nh_table_t *nh, const sf_nh_group_t *groups, uint32_t group_used, uint32_t free_group,
+                          const sf_nh_hop_t *hops, uint32_t hop_used);
+
+int sf_nh_table_self_test(void);
+
+#endif /* SENTRYFLOW_NEXTHOP_TABLE_H */
@@ -3,10 +3,15 @@
 
 #include <stdint.h>
 
+#include "protocol_stack.h"
+
 int   sf_platform_init(void);
+void  sf_platform_configure(const sf_stack_options_t *opts);
 int   sf_platform_listen(const char *bind_addr, uint16_t port);
 int   sf_platform_accept_loop(void);
 double sf_platform_now_ms(void);
+/* Transactions through the connection handler, on the live routing table. */
+int   sf_platform_self_test(void);
 
 #endif /* SENTRYFLOW_PLATFORM_LINUX_H */
 
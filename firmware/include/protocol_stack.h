@@ -1,20 +1,67 @@
 #ifndef SENTRYFLOW_PROTOCOL_STACK_H
 #define SENTRYFLOW_PROTOCOL_STACK_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "sf_admission.h"
+#include "sf_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct sf_request_stats {
     uint64_t total_requests;
     double   last_latency_ms;
     double   avg_latency_ms;
     uint64_t bad_frames;
     uint64_t routes_installed;
+    uint64_t shed_requests;
+    uint64_t shed_connections;
+    uint64_t steer_misses;       /* connections accepted on a reactor other than their RX CPU's */
+    uint64_t busy_poll_hits;     /* wakeups found while spinning (each saved a sleep/wake) */
+    uint64_t busy_poll_spin_us;  /* CPU time spent in the busy-poll spin window */
+    uint64_t wal_records;        /* route batches appended to the WAL */
+    uint64_t wal_syncs;          /* fdatasync calls; records per sync is the group-commit factor */
+    uint64_t route_seq;          /* mutation sequence number the table is at */
+    uint64_t repl_resyncs;       /* full tables sent to (leader) or received from (follower) a peer */
+    uint64_t route_expired;      /* routes aged out by --route-ttl-ms */
+    uint64_t route_suppressed;   /* times a flapping prefix was suppressed */
+    uint64_t route_coalesced;    /* route changes replaced before they were applied */
+    uint64_t fib_routes;         /* routes in the --fib-compress FIB, 0 when off */
+    uint64_t route_cache_hits;   /* lookups answered by the --route-cache destination cache */
+    uint64_t route_cache_misses;
 } sf_request_stats_t;
 
+#define SF_MAX_REACTORS 64
+
+typedef struct sf_stack_options {
+    sf_admission_config_t admission;
+    size_t   read_budget_bytes;  /* max bytes read from one connection per readiness event */
+    uint32_t frame_budget;       /* max frames handled for one connection per lane visit */
+    sf_sched_config_t sched;     /* message classes and lane weights */
+    uint32_t workers;            /* worker pool threads for heavy handlers, 0 = run inline */
+    uint32_t offload_min_routes; /* ROUTE_UPDATE frames with at least this many records are offloaded */
+    int      cpus[SF_MAX_REACTORS]; /* one pinned reactor per listed CPU */
+    uint32_t ncpus;              /* 0 = a single unpinned reactor */
+    uint32_t busy_poll_us;       /* spin window before blocking, also SO_BUSY_POLL; 0 = off */
+    uint32_t poll_timeout_us;    /* blocking wait timeout; sub-ms values use epoll_pwait2 */
+    const char *handoff_path;    /* Unix socket for restart handoff, NULL = off */
+    uint32_t drain_timeout_ms;   /* after a handoff, connections still busy are closed after this */
+    const char *snapshot_out;    /* where SNAPSHOT writes the routing table, NULL = disabled */
+} sf_stack_options_t;
+
+void sf_stack_default_options(sf_stack_options_t *out);
+void sf_stack_set_options(const sf_stack_options_t *opts);
+
 int  sf_stack_init(const char *bind_addr, uint16_t port);
 int  sf_stack_run(void);
 int  sf_stack_self_test(void);
 void sf_stack_get_stats(sf_request_stats_t *out);
 
-#endif /* SENTRYFLOW_PROTOCOL_STACK_H */
+#ifdef __cplusplus
+}
+#endif
 
+#endif /* SENTRYFLOW_PROTOCOL_STACK_H */
@@ -3,7 +3,10 @@
 
 #include <stdint.h>
 
+#include "routing6_table.h"
 #include "routing_table.h"
+#include "sf_damp.h"
+#include "sf_vrf.h"
 
 typedef enum {
     SF_ROUTE_DIRECT = 0,
@@ -16,13 +19,229 @@ typedef struct sf_route_decision {
     uint8_t             matched_prefix_bits;
     uint16_t            metric;
     uint32_t            next_hop_be;
+    uint8_t             next_hop6[16];  /* set instead for an IPv6 peer */
 } sf_route_decision_t;
 
+/* A peer's decision, kept with its binary address for a caller that needs it
+   repeatedly. It is computed on first use and recomputed only once the tables
+   have been written since, so while they are not, using it costs a version
+   compare. */
+typedef struct sf_route_decision_cache {
+    uint64_t            epoch;      /* sf_routing_epoch() it was computed at */
+    uint8_t             family;     /* AF_INET or AF_INET6 */
+    uint8_t             addr[16];   /* network byte order; IPv4 in the first 4 bytes */
+    sf_route_decision_t decision;
+} sf_route_decision_cache_t;
+
 void sf_routing_init(void);
 void sf_routing_set_strategy(sf_route_strategy_t strategy);
 sf_route_decision_t sf_routing_decide(const char *remote_addr);
+/* Bumped by every write section on the tables and by strategy changes; never 0. */
+uint64_t sf_routing_epoch(void);
+/* Sets the peer (addr is a struct in_addr for AF_INET, in6_addr for
+   AF_INET6); its decision is left for the first sf_routing_decision(). */
+void sf_routing_decision_init(sf_route_decision_cache_t *dc, int family, const void *addr);
+/* The peer's decision, recomputed first if the tables changed since. */
+const sf_route_decision_t *sf_routing_decision(sf_route_decision_cache_t *dc);
+
+/* The engine's table is shared between reactor and worker threads. These
+   wrappers take its reader/writer lock; sf_routing_table() is for
+   single-threaded setup only. */
+#define SF_ROUTING_MAX_READERS 64
+/* Routes per write section: a batch longer than this goes in chunks, and a
+   commit longer than this into a copy of the table. */
+#define SF_ROUTING_WRITE_CHUNK 128u
 
 sf_route_table_t *sf_routing_table(void);
+/* Gives the calling thread a private read-lock slot (one per reactor). */
+void   sf_routing_register_reader(unsigned slot);
+/* *version (optional) gets the table version the answer came from. A route
+   through a next-hop group comes back with the member for flow_hash
+   (sf_nh_flow_hash() of the flow's 5-tuple or key) as its next hop;
+   sf_routing_lookup() hashes the destination address. */
+int    sf_routing_lookup(uint32_t ip_be, sf_route_entry_t *out_best, uint64_t *version);
+int    sf_routing_lookup_flow(uint32_t ip_be, uint32_t flow_hash, sf_route_entry_t *out_best, uint64_t *version);
+/* Mutation kinds, as passed to the sink and carried by the log and replication. */
+#define SF_ROUTE_OP_UPSERT   1u
+#define SF_ROUTE_OP_WITHDRAW 2u  /* entries only carry prefix_be and mask_bits */
+#define SF_ROUTE_OP_GROUP    3u  /* next-hop groups (sf_route_table_group_records) */
+#define SF_ROUTE_OP_RESET    4u  /* sink only: the table was replaced outright (no entries) */
+/* Changes dampening or coalescing held back (sf_damp.h): a mutation of their
+   own, so they are logged and the acknowledgement covers them, but the table
+   only changes when sf_routing_release() applies them as a later one. */
+#define SF_ROUTE_OP_HELD_UPSERT   5u
+#define SF_ROUTE_OP_HELD_WITHDRAW 6u
+
+/* Applies a batch in write sections of up to SF_ROUTING_WRITE_CHUNK routes,
+   with lookups let through in between; writers are serialized across them.
+   A batch that changes anything gets the next mutation sequence number
+   (*seq_out, 0 otherwise) with its last section, and is passed, still under
+   the lock, to the mutation sink, so the sink sees batches in exactly the
+   order they were applied. Lookups may see part of a batch before that.
+   Changes held back follow as an SF_ROUTE_OP_HELD_UPSERT mutation, and
+   *seq_out is the last of the two. Returns the number applied (held ones are
+   not counted), SF_COMMIT_INVALID, with nothing applied, when a route names
+   a next-hop group that is not defined, or SF_COMMIT_FULL when there is no
+   memory for the batch. */
+long sf_routing_upsert_batch(const sf_route_entry_t *entries, size_t n, uint64_t *seq_out);
+/* Removes a batch of routes the same way; a batch that neither removes nor
+   holds anything is not a mutation. */
+long sf_routing_withdraw_batch(const sf_route_entry_t *keys, size_t n, uint64_t *seq_out);
+/* Applies a batch under a sequence number assigned elsewhere (WAL replay, a
+   replication leader). A batch that advances the sequence reaches the sink.
+   A long upsert batch is applied like a commit. A held batch only moves the
+   sequence: the leader applies it later as a batch of its own. */
+size_t sf_routing_replay_batch(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n);
+uint64_t sf_routing_seq(void);
+
+typedef enum {
+    SF_COMMIT_OK = 0,
+    SF_COMMIT_INVALID = -1,   /* a route has mask_bits > 32 or an unknown next-hop group */
+    SF_COMMIT_CONFLICT = -2,  /* the table is not at *if_version */
+    SF_COMMIT_FULL = -3,      /* no memory for the batch */
+    SF_COMMIT_FROZEN = -4,
+    SF_COMMIT_NO_VRF = -5     /* the VRF does not exist */
+} sf_commit_result_t;
+
+/* Applies a whole batch or nothing: it is validated and room is reserved
+   before the first route goes in, readers see the table before or after it,
+   and it becomes one mutation with one sequence number (the table version).
+   Above SF_ROUTING_WRITE_CHUNK routes it is built on a copy of the table
+   while lookups go on and swapped in, so it needs the table's memory twice.
+   With if_version, it only applies if the table is still at that version.
+   *version_out gets the version after the commit (or the current one when it
+   fails); an empty batch leaves the table alone. */
+int    sf_routing_commit(const sf_route_entry_t *entries, size_t n, const uint64_t *if_version, uint64_t *version_out);
+
+/* Returns in *id the next-hop group with these members, defining it if it is
+   new. A new group is a mutation of its own (op GROUP, *seq_out gets its
+   sequence number, 0 otherwise), so the log and followers have it before any
+   route uses it. SF_COMMIT_INVALID for no members or too many,
+   SF_COMMIT_FULL, SF_COMMIT_FROZEN. */
+int    sf_routing_define_group(const sf_nh_member_t *members, size_t n, uint32_t *id, uint64_t *seq_out);
+
+typedef void (*sf_routing_sink_fn)(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n);
+void   sf_routing_set_sink(sf_routing_sink_fn fn);
+
+/* Copies every route (malloc'd, in prefix order) and the sequence number the
+   copy is consistent with. The copy starts with the next-hop groups as
+   *groups records. */
+int    sf_routing_export(sf_route_entry_t **out, size_t *n, size_t *groups, uint64_t *seq);
+
+typedef enum {
+    SF_ROUTE_QUERY_COVERED = 0,   /* the prefix and everything more specific */
+    SF_ROUTE_QUERY_COVERING = 1   /* the prefix and everything less specific */
+} sf_route_query_t;
+
+/* Copies the routes of VRF vrf (SF_VRF_MAIN for the main table) related to
+   prefix_be/mask_bits as mode says, into a malloc'd array (*out, NULL when
+   none match), and the version they are consistent with. Walks only the
+   part of the trie that holds the answer. -1 for a bad mask or no memory,
+   -2 for an unknown VRF. */
+int    sf_routing_query(uint32_t vrf, uint32_t prefix_be, uint8_t mask_bits, sf_route_query_t mode,
+                        sf_route_entry_t **out, size_t *n, uint64_t *version);
+
+/* Copies every route of VRF vrf (SF_VRF_MAIN for the main table) in prefix
+   order into a malloc'd array, with the version the copy is consistent with.
+   Unlike sf_routing_export() it leaves out the next-hop group records. -1 for
+   no memory, -2 for an unknown VRF. */
+int    sf_routing_dump(uint32_t vrf, sf_route_entry_t **out, size_t *n, uint64_t *version);
+
+/* Ages routes out ttl_ms after their last update (sf_expiry.h); 0 turns it
+   off. Indexes the current table, so call it once the table is loaded. */
+int    sf_routing_set_ttl(uint32_t ttl_ms);
+/* Withdraws the routes that are due at now_ms, as ordinary withdraw
+   mutations. Returns the number expired. */
+size_t sf_routing_expire(uint32_t now_ms);
+uint64_t sf_routing_expired(void);
+
+/* Serves lookups from a compressed FIB (sf_fib.h) kept in step with the
+   table, or from the table itself (on = 0, the default). Builds the FIB from
+   the current table, so call it once the table is loaded. A route a lookup
+   returns through the FIB forwards the same way, but its prefix, mask and
+   metric may be those of a less specific route that stood in for it. */
+int    sf_routing_set_fib(int on);
+/* Routes in the FIB, 0 when it is off. */
+size_t sf_routing_fib_count(void);
+/* Puts a destination cache (sf_route_cache.h) of `entries` addresses in
+   front of each reactor's main-table lookups; 0 (the default) leaves it out.
+   Every write to the tables invalidates the caches. Call it before serving;
+   -1 if entries is too large. */
+int    sf_routing_set_cache(uint32_t entries);
+/* Cache hits and misses summed over the reactors. */
+void   sf_routing_cache_stats(uint64_t *hits, uint64_t *misses);
+/* Keeps prefix-length filters (sf_route_bloom.h) on the table lookups use,
+   so that addresses no long route can match skip the trie; fpr in (0, 0.5]
+   is their false-positive rate, 0 (the default) drops them. Lookups answer
+   the same either way. -1 if fpr is out of range or they cannot be built. */
+int    sf_routing_set_bloom(double fpr);
+
+/* Turns on flap dampening and change coalescing for ROUTE_UPDATE and
+   ROUTE_WITHDRAW (sf_damp.h); -1 if cfg is inconsistent. Transactions and
+   replayed batches are not dampened. */
+int    sf_routing_set_damping(const sf_damp_config_t *cfg);
+/* Applies the held changes that may go in at now_ms, as ordinary mutations.
+   Returns the number of routes changed. */
+size_t sf_routing_release(uint32_t now_ms);
+void   sf_routing_damp_stats(uint64_t *suppressions, uint64_t *coalesced);
+
+/* Replaces the table with rt (e.g. a mapped snapshot taken at sequence seq),
+   keeping routes that were already installed; rt is left empty. */
+int    sf_routing_adopt(sf_route_table_t *rt, uint64_t seq);
+/* Replaces the table and sequence outright (a predecessor's live table, a
+   leader's full table). The sink gets it as op SF_ROUTE_OP_RESET. */
+void   sf_routing_replace(sf_route_table_t *rt, uint64_t seq);
+/* Writes a snapshot atomically to path, or to the empty fd when path is NULL.
+   *seq gets the sequence number the snapshot is consistent with. The table is
+   copied under the read lock and written after it is released, so it needs
+   the table's memory twice while it runs. */
+int    sf_routing_save_snapshot(const char *path, int fd, size_t *routes, size_t *bytes, uint64_t *seq);
+/* The IPv6 table (routing6_table.h), under the same lock. It has its own
+   version, counted per applied batch, and is not logged, replicated,
+   snapshotted or handed off: it holds what was pushed since startup. */
+sf_route6_table_t *sf_routing_table6(void);
+int    sf_routing_lookup6(const uint8_t addr[16], sf_route6_entry_t *out_best, uint64_t *version);
+/* Applies a batch in bounded write sections, like sf_routing_upsert_batch();
+   *version_out gets the IPv6 table
+   version after it. Returns the number applied (0 while frozen). */
+size_t sf_routing_upsert6_batch(const sf_route6_entry_t *entries, size_t n, uint64_t *version_out);
+
+/* Numbered VRFs (sf_vrf.h) beside the main table, under the same lock. A VRF
+   is created as a copy of another table that shares its memory until either
+   side changes. Like the IPv6 table, VRFs hold what was pushed since startup:
+   they are not logged, replicated, snapshotted or handed off, and not aged or
+   dampened. Each has its own version, counted per applied batch, and its own
+   next-hop groups: those of its source when it was created, then what is
+   defined in it. VRFs created while their source is unchanged share one
+   image of it; once the source changes the next one maps a new image, so
+   under churn each costs a full copy of its source, as a plain copy would. */
+/* Creates VRF vrf as a copy of VRF from (SF_VRF_MAIN for the main table) or
+   empty (SF_VRF_EMPTY); *routes gets its route count. SF_COMMIT_INVALID for
+   a reserved or existing vrf or an unknown source, SF_COMMIT_FULL,
+   SF_COMMIT_FROZEN. */
+int    sf_routing_vrf_create(uint32_t vrf, uint32_t from, size_t *routes);
+/* SF_COMMIT_INVALID for an unknown VRF (or the main table), SF_COMMIT_FROZEN. */
+int    sf_routing_vrf_delete(uint32_t vrf);
+/* Applies a batch of op SF_ROUTE_OP_UPSERT or SF_ROUTE_OP_WITHDRAW to a VRF
+   in bounded write sections; *applied gets the routes changed and *version
+   the VRF's version after it. SF_COMMIT_NO_VRF, SF_COMMIT_FROZEN, or
+   SF_COMMIT_INVALID, with nothing applied, for a route over a group the VRF
+   does not have. */
+int    sf_routing_vrf_apply(uint32_t vrf, uint32_t op, const sf_route_entry_t *entries, size_t n, size_t *applied,
+                            uint64_t *version);
+/* sf_routing_define_group() in a VRF: not logged, and a new group counts as
+   a change of the VRF's version (*version). SF_COMMIT_INVALID for bad
+   members, SF_COMMIT_NO_VRF, SF_COMMIT_FULL, SF_COMMIT_FROZEN. */
+int    sf_routing_vrf_define_group(uint32_t vrf, const sf_nh_member_t *members, size_t n, uint32_t *id,
+                                   uint64_t *version);
+/* sf_routing_lookup_flow() in VRF vrf (the main table for SF_VRF_MAIN);
+   -2 for an unknown VRF. */
+int    sf_routing_vrf_lookup(uint32_t vrf, uint32_t ip_be, uint32_t flow_hash, sf_route_entry_t *out_best, uint64_t *version);
+size_t sf_routing_vrf_count(void);
+
+/* While frozen (during a restart handoff) upserts apply nothing. */
+void   sf_routing_set_frozen(int frozen);
+int    sf_routing_frozen(void);
 
 #endif /* SENTRYFLOW_ROUTING_H */
 
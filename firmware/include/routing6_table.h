@@ -0,0 +1,97 @@
+#ifndef SENTRYFLOW_ROUTING6_TABLE_H
+#define SENTRYFLOW_ROUTING6_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "routing_table.h"
+
+/*
+ * IPv6 routing table: longest-prefix match over 128-bit prefixes.
+ *
+ * Shaped like the IPv4 table. Routes of /32 and shorter only ever look at the
+ * top 32 bits of an address, so they are also kept in an IPv4 table over
+ * those bits and get its first-level index. For each /32 with longer routes
+ * under it, a small hash table (the tiers) points at the /32's subtree of a
+ * path-compressed binary trie over all the routes and carries the best
+ * shorter route over the /32. A lookup probes the tier for its /32 and walks
+ * that subtree, which in a real table holds a handful of routes, or scans a
+ * flat copy of them; only addresses without a tier look up the short routes.
+ * The whole trie gives exact matches and the ordered walk.
+ */
+
+typedef struct sf_route6_entry {
+    uint8_t  prefix[16];    /* network byte order */
+    uint8_t  next_hop[16];
+    uint32_t last_updated_ms;
+    uint16_t metric;        /* lower is better */
+    uint8_t  mask_bits;     /* 0..128 */
+} sf_route6_entry_t;
+
+#define SF_ROUTE6_NONE 0xFFFFFFFFu
+
+/* Trie node; keys are host-order halves with bits past `bits` zero. */
+typedef struct sf_route6_node {
+    uint64_t key_hi;
+    uint64_t key_lo;
+    uint32_t bits;
+    uint32_t route;     /* entries[] index or SF_ROUTE6_NONE */
+    uint32_t child[2];
+} sf_route6_node_t;
+
+/* Up to this many routes of /33 to /96 under one /32 are also kept in a flat
+   array, longest first, which a lookup scans instead of walking. Entries hold
+   bits 32..95 of the prefix: the rest is the tier's key or zero. */
+#define SF_ROUTE6_BUCKET_MAX 16
+
+typedef struct sf_route6_bucket_ent {
+    uint64_t mid;
+    uint32_t route;
+    uint32_t bits;
+} sf_route6_bucket_ent_t;
+
+/* A /32 with longer routes under it. */
+typedef struct sf_route6_tier {
+    uint32_t key;       /* top 32 bits */
+    uint32_t node;      /* first trie node of length 32 or more under it */
+    uint32_t routes;    /* routes longer than /32 under it; 0 = free slot */
+    uint32_t covering;  /* best route of /32 or shorter over it, or SF_ROUTE6_NONE */
+    sf_route6_bucket_ent_t *bucket;  /* those routes if few enough, else NULL */
+} sf_route6_tier_t;
+
+typedef struct sf_route6_table {
+    sf_route6_entry_t *entries;
+    uint32_t           entry_cap;
+    uint32_t           entry_used;
+    uint32_t           free_entry;   /* free list threaded through last_updated_ms */
+    sf_route6_node_t  *nodes;
+    uint32_t           node_cap;
+    uint32_t           node_used;
+    uint32_t           free_node;    /* node 0 is the null child */
+    uint32_t           root;
+    sf_route6_tier_t  *tiers;        /* open addressing, linear probing */
+    size_t             tier_cap;     /* power of two */
+    size_t             tier_used;
+    sf_route_table_t   short_routes; /* routes of /32 and shorter by their top 32 bits;
+                                        next_hop_be holds the entries[] index */
+    uint32_t           len_count[129];  /* routes per prefix length */
+    size_t             count;
+} sf_route6_table_t;
+
+void   sf_route6_table_init(sf_route6_table_t *rt);
+void   sf_route6_table_free(sf_route6_table_t *rt);
+size_t sf_route6_table_count(const sf_route6_table_t *rt);
+/* Prefixes are stored masked, as in the IPv4 table. */
+int    sf_route6_table_upsert(sf_route6_table_t *rt, const sf_route6_entry_t *e);
+int    sf_route6_table_remove(sf_route6_table_t *rt, const uint8_t prefix[16], uint8_t mask_bits);
+int    sf_route6_table_lookup(const sf_route6_table_t *rt, const uint8_t addr[16], sf_route6_entry_t *out_best);
+/* Exact match: the route stored for prefix/mask_bits, or NULL. */
+const sf_route6_entry_t *sf_route6_table_get(const sf_route6_table_t *rt, const uint8_t prefix[16], uint8_t mask_bits);
+
+/* Visits routes in (prefix, length) order; a non-zero return stops the walk. */
+typedef int (*sf_route6_visit_fn)(const sf_route6_entry_t *e, void *ctx);
+int    sf_route6_table_foreach(const sf_route6_table_t *rt, sf_route6_visit_fn fn, void *ctx);
+
+int sf_route6_table_self_test(void);
+
+#endif /* SENTRYFLOW_ROUTING6_TABLE_H */
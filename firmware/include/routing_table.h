@@ -4,28 +4,114 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#define SF_ROUTE_TABLE_MAX 256
+#include "nexthop_table.h"
 
 typedef struct sf_route_entry {
     uint32_t prefix_be;     /* IPv4 prefix in network byte order */
     uint8_t  mask_bits;     /* 0..32 */
+    uint8_t  flags;         /* SF_ROUTE_F_* */
     uint16_t metric;        /* lower is better */
-    uint32_t next_hop_be;   /* next hop IPv4 in network byte order */
+    uint32_t next_hop_be;   /* next hop IPv4 in network byte order, or a group id */
     uint32_t last_updated_ms;
 } sf_route_entry_t;
 
+/* next_hop_be holds a next-hop group id (nexthop_table.h), in network byte order. */
+#define SF_ROUTE_F_GROUP  0x01u
+
+#define SF_ROUTE_NONE     0xFFFFFFFFu
+#define SF_ROUTE_DIR_BITS 16
+#define SF_ROUTE_DIR_SLOTS (1u << SF_ROUTE_DIR_BITS)
+
+/* Path-compressed binary trie node. Indices, not pointers, so the whole table
+   can live in a file mapping. Node 0 is reserved as the null child. */
+typedef struct sf_route_node {
+    uint32_t key;       /* prefix in host order, bits past `bits` are zero */
+    uint32_t bits;      /* prefix length, 0..32 */
+    uint32_t route;     /* entries[] index, SF_ROUTE_NONE for a pure branch node */
+    uint32_t child[2];  /* next bit 0 / 1 */
+} sf_route_node_t;
+
+/* First-level index by the top 16 address bits: where the trie walk resumes
+   and the best route found above that depth. */
+typedef struct sf_route_dir {
+    uint32_t node;
+    uint32_t route;
+} sf_route_dir_t;
+
 typedef struct sf_route_table {
-    sf_route_entry_t entries[SF_ROUTE_TABLE_MAX];
-    size_t           count;
+    sf_route_entry_t *entries;
+    uint32_t          entry_cap;
+    uint32_t          entry_used;   /* high-water mark */
+    uint32_t          free_entry;   /* free list threaded through prefix_be */
+    sf_route_node_t  *nodes;
+    uint32_t          node_cap;
+    uint32_t          node_used;
+    uint32_t          free_node;    /* free list threaded through child[0] */
+    uint32_t          root;
+    sf_route_dir_t   *dir;          /* SF_ROUTE_DIR_SLOTS entries once the table is non-empty */
+    sf_nh_table_t     nh;           /* next-hop groups the routes refer to; always on the heap */
+    struct sf_route_bloom *bloom;   /* prefix-length filters (sf_route_bloom.h), or NULL */
+    size_t            count;
+    void             *map;          /* snapshot mapping backing the arrays, if any */
+    size_t            map_len;
 } sf_route_table_t;
 
 void   sf_route_table_init(sf_route_table_t *rt);
+void   sf_route_table_free(sf_route_table_t *rt);
 size_t sf_route_table_count(const sf_route_table_t *rt);
+/* Prefixes are stored masked, so 10.1.2.3/8 and 10.0.0.0/8 are the same route.
+   A route with SF_ROUTE_F_GROUP must name a group defined in rt->nh. */
 int    sf_route_table_upsert(sf_route_table_t *rt, const sf_route_entry_t *e);
+/* Makes room for `routes` more routes, so that many upserts cannot fail for
+   lack of memory. */
+int    sf_route_table_reserve(sf_route_table_t *rt, size_t routes);
+/* Makes dst (initialized or not) a copy of src on the heap, groups and
+   filters included, with room reserved for `routes` more routes. */
+int    sf_route_table_clone(sf_route_table_t *dst, const sf_route_table_t *src, size_t routes);
 int    sf_route_table_remove(sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits);
+/* Removes the routes keyed by prefix_be/mask_bits of each entry (other fields
+   are ignored) and updates the first-level index once for the whole batch.
+   Returns the number of routes removed. */
+size_t sf_route_table_remove_batch(sf_route_table_t *rt, const sf_route_entry_t *keys, size_t n);
+/* Builds an empty table from n routes in one pass. Sorts and normalizes
+   entries in place (the first return-value entries are the distinct routes);
+   for duplicates the last one wins. Returns the route count or -1. */
+int    sf_route_table_build(sf_route_table_t *rt, sf_route_entry_t *entries, size_t n);
 int    sf_route_table_lookup(const sf_route_table_t *rt, uint32_t ip_be, sf_route_entry_t *out_best);
+/* Keeps prefix-length filters (sf_route_bloom.h) in step with the table so
+   that lookups matching no route of SF_ROUTE_DIR_BITS or longer skip the
+   trie; fpr is their false-positive rate, 0 drops them. They grow with the
+   table, and are dropped if that runs out of memory. */
+int    sf_route_table_set_bloom(sf_route_table_t *rt, double fpr);
+/* Exact match: the route stored for prefix_be/mask_bits, or NULL. */
+const sf_route_entry_t *sf_route_table_get(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits);
+
+/* Next-hop groups as route records, one per member: prefix_be holds the group
+   id, next_hop_be the member and metric its weight; a group's members are
+   consecutive. This is how the log and replication carry them. Writes the
+   records of every group to out (when not NULL) and returns their number. */
+size_t sf_route_table_group_records(const sf_route_table_t *rt, sf_route_entry_t *out);
+/* Defines the groups such records describe, under their ids. Returns the
+   number of groups or -1 if one is malformed (those before it stay defined). */
+int    sf_route_table_define_groups(sf_route_table_t *rt, const sf_route_entry_t *records, size_t n);
+
+/* Visits routes in (prefix, length) order; a non-zero return stops the walk. */
+typedef int (*sf_route_visit_fn)(const sf_route_entry_t *e, void *ctx);
+int    sf_route_table_foreach(const sf_route_table_t *rt, sf_route_visit_fn fn, void *ctx);
+/* Visits the routes inside prefix_be/mask_bits (it and everything more
+   specific) in the same order, walking only that subtree. */
+int    sf_route_table_foreach_covered(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                      sf_route_visit_fn fn, void *ctx);
+/* Visits the routes that contain prefix_be/mask_bits (it and everything less
+   specific), shortest first: the trie path down to it. */
+int    sf_route_table_foreach_covering(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                       sf_route_visit_fn fn, void *ctx);
+/* Visits the outermost routes strictly inside prefix_be/mask_bits: those no
+   other route inside it contains. They are what a route there would cover
+   directly. */
+int    sf_route_table_foreach_children(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                       sf_route_visit_fn fn, void *ctx);
 
 int sf_route_table_self_test(void);
 
 #endif /* SENTRYFLOW_ROUTING_TABLE_H */
-
@@ -0,0 +1,45 @@
+#ifndef SENTRYFLOW_ADMISSION_H
+#define SENTRYFLOW_ADMISSION_H
+
+#include <stdint.h>
+
+/*
+ * CoDel-style admission control for the reactor.
+ *
+ * Every decoded frame reports its queueing delay (time between the data
+ * becoming ready and the handler getting to it). If the minimum delay seen
+ * over a whole interval stays above the target, no request got through
+ * quickly in that window: the engine is overloaded rather than bursting, and
+ * work that has already waited more than 2x target is shed. Outside of
+ * overload only work older than the latency SLO is shed.
+ */
+
+typedef struct sf_admission_config {
+    int    enabled;
+    double target_ms;    /* acceptable standing queue delay */
+    double interval_ms;  /* window over which the minimum delay is tracked */
+    double slo_ms;       /* hard ceiling on queueing delay, 0 disables */
+} sf_admission_config_t;
+
+typedef struct sf_admission {
+    sf_admission_config_t cfg;
+    double   interval_end_ms;
+    double   min_delay_ms;
+    int      reset_min;
+    int      overloaded;
+    uint64_t shed_requests;
+    uint64_t shed_connections;
+} sf_admission_t;
+
+void sf_admission_default_config(sf_admission_config_t *out);
+void sf_admission_init(sf_admission_t *ac, const sf_admission_config_t *cfg);
+
+/* Feeds one queueing-delay sample. Returns 1 if the work should be shed. */
+int  sf_admission_should_shed(sf_admission_t *ac, double delay_ms, double now_ms);
+
+/* Returns 1 if new connections should be refused right now. */
+int  sf_admission_reject_connection(sf_admission_t *ac);
+
+int sf_admission_self_test(void);
+
+#endif /* SENTRYFLOW_ADMISSION_H */
@@ -14,15 +14,56 @@ typedef enum {
     SF_MSG_ROUTE_ACK = 8,
     SF_MSG_ROUTE_LOOKUP = 9,
     SF_MSG_ROUTE_REPLY = 10,
+    SF_MSG_SNAPSHOT = 11,
+    SF_MSG_SNAPSHOT_ACK = 12,
+    SF_MSG_REPL_SUBSCRIBE = 13,
+    SF_MSG_REPL_BATCH = 14,
+    SF_MSG_ROUTE_WITHDRAW = 15,
+    SF_MSG_ROUTE_UPDATE6 = 16,
+    SF_MSG_ROUTE_LOOKUP6 = 17,
+    SF_MSG_ROUTE_REPLY6 = 18,
+    SF_MSG_NH_GROUP = 19,
+    SF_MSG_NH_GROUP_ACK = 20,
+    SF_MSG_VRF_CREATE = 21,
+    SF_MSG_VRF_DELETE = 22,
+    SF_MSG_VRF_ACK = 23,
+    SF_MSG_ROUTE_QUERY = 24,
+    SF_MSG_ROUTE_QUERY_REPLY = 25,
+    SF_MSG_ROUTE_DUMP = 26,
+    SF_MSG_ROUTE_DUMP_REPLY = 27,
     SF_MSG_ERROR = 255
 } sf_msg_type_t;
 
 typedef enum {
     SF_FLAG_NONE = 0,
-    SF_FLAG_ACK_REQUIRED = 1 << 0
+    SF_FLAG_ACK_REQUIRED = 1 << 0,
+    /* ROUTE_UPDATE transactions: frames flagged TXN | TXN_MORE are staged, the
+       next TXN frame without TXN_MORE commits them together with its own routes.
+       IF_VERSION: the payload starts with a table version (u64) the commit
+       requires. */
+    SF_FLAG_TXN = 1 << 1,
+    SF_FLAG_TXN_MORE = 1 << 2,
+    SF_FLAG_IF_VERSION = 1 << 3,
+    /* ROUTE_UPDATE, ROUTE_WITHDRAW, ROUTE_LOOKUP, ROUTE_QUERY and ROUTE_DUMP:
+       the payload starts with a VRF id (u32, before any IF_VERSION version);
+       0 is the main table. */
+    SF_FLAG_VRF = 1 << 4,
+    /* On a reply sent in several frames (ROUTE_QUERY_REPLY, ROUTE_DUMP_REPLY):
+       more frames with the same seq follow this one. */
+    SF_FLAG_MORE = 1 << 5,
+    /* ROUTE_UPDATE: the routes are one packed block (sf_route_pack.h) instead
+       of 16-byte records. ROUTE_DUMP: reply with packed blocks; the replies
+       carry the flag too. */
+    SF_FLAG_PACKED = 1 << 6,
+    /* Priority class override: 0 = per-type default, otherwise sf_msg_class_t + 1. */
+    SF_FLAG_CLASS_MASK = 3 << 12
 } sf_msg_flags_t;
 
+#define SF_FLAG_CLASS_SHIFT 12
+
 const char *sf_msg_type_name(uint8_t type);
+/* Accepts a message type name ("PING") or number; returns -1 if unknown. */
+int sf_msg_type_parse(const char *s, uint8_t *out);
 
 #endif /* SENTRYFLOW_COMMANDS_H */
 
@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 uint32_t sf_crc32(const void *data, size_t len);
+/* Continues a CRC over another chunk: sf_crc32_update(sf_crc32(a), b) == sf_crc32(a ++ b). */
+uint32_t sf_crc32_update(uint32_t crc, const void *data, size_t len);
 
 #endif /* SENTRYFLOW_CRC32_H */
-
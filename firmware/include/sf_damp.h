@@ -0,0 +1,95 @@
+#ifndef SENTRYFLOW_DAMP_H
+#define SENTRYFLOW_DAMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Route flap dampening and change coalescing (--route-damp-*, --route-coalesce-ms).
+ *
+ * Both sit in front of ROUTE_UPDATE and ROUTE_WITHDRAW and keep one record
+ * per prefix that changed recently: the latest state asked for, a penalty and
+ * when a change was last applied.
+ *
+ * Dampening (RFC 2439 style): withdrawing a route adds 1000 to its prefix's
+ * penalty, changing its next hop or metric adds 500; the penalty halves every
+ * half-life. Above the suppress threshold the prefix is suppressed:
+ * withdrawals still apply, but announcements are held until the penalty
+ * decays below the reuse threshold, when the latest one is applied. The
+ * penalty is capped so that no prefix stays suppressed longer than the
+ * maximum suppress time after it goes quiet.
+ *
+ * Coalescing: a change to a prefix that had a change applied less than the
+ * window ago is held, and any later change replaces it; the latest is applied
+ * when the window closes. A prefix thus costs the table at most one change
+ * per window however fast it flaps.
+ *
+ * Held changes are applied by a tick (sf_damp_collect). Records with nothing
+ * held, a negligible penalty and a closed window are dropped when the store
+ * next grows. Times are 32-bit CLOCK_MONOTONIC milliseconds, as in
+ * last_updated_ms.
+ */
+
+#define SF_DAMP_WITHDRAW_PENALTY 1000u
+#define SF_DAMP_CHANGE_PENALTY   500u
+#define SF_DAMP_MAX_MS           (24u * 3600u * 1000u)  /* longest half-life, suppress time or window */
+
+typedef struct sf_damp_config {
+    uint32_t half_life_ms;     /* 0 = no dampening */
+    uint32_t suppress;         /* default 2000 */
+    uint32_t reuse;            /* default 750 */
+    uint32_t max_suppress_ms;  /* default 4 half-lives */
+    uint32_t coalesce_ms;      /* 0 = no coalescing */
+} sf_damp_config_t;
+
+/* One prefix, 24 bytes; a free slot has flags 0. */
+typedef struct sf_damp_rec {
+    uint32_t prefix_be;     /* masked */
+    uint32_t next_hop_be;   /* latest state asked for */
+    uint32_t penalty;       /* as of penalty_ms */
+    uint32_t penalty_ms;
+    uint32_t applied_ms;    /* when a change was last applied */
+    uint16_t metric;
+    uint8_t  mask_bits;
+    uint8_t  flags;
+} sf_damp_rec_t;
+
+typedef struct sf_damp {
+    sf_damp_config_t cfg;
+    uint32_t         ceiling;    /* penalty cap */
+    sf_damp_rec_t   *recs;       /* open addressing, linear probing */
+    size_t           cap;        /* power of two */
+    size_t           used;
+    uint32_t        *held;       /* indices of records with a held change */
+    size_t           nheld;
+    uint64_t         suppressions;
+    uint64_t         coalesced;  /* changes replaced before they were applied */
+} sf_damp_t;
+
+void sf_damp_default_config(sf_damp_config_t *cfg);
+/* Checks cfg (reuse < suppress < the penalty cap); -1 if it is inconsistent. */
+int  sf_damp_init(sf_damp_t *d, const sf_damp_config_t *cfg);
+void sf_damp_free(sf_damp_t *d);
+int  sf_damp_enabled(const sf_damp_t *d);
+
+/* Accounts a requested change (op is SF_ROUTE_OP_UPSERT or _WITHDRAW; rt is
+   the table it would apply to). Returns 1 if it should be applied now, 0 if
+   it is held. Without memory for a record the change is applied. */
+int  sf_damp_admit(sf_damp_t *d, const sf_route_table_t *rt, const sf_route_entry_t *e, uint32_t op, uint32_t now_ms);
+/* Records a change applied without sf_damp_admit (a transaction, an expiry):
+   it becomes the prefix's latest state and drops whatever was held. */
+void sf_damp_note(sf_damp_t *d, const sf_route_entry_t *e, uint32_t op, uint32_t now_ms);
+/* Moves held changes that may apply at now_ms into ups (stamped now_ms) and
+   wds, up to max each. Returns 1 if it stopped because one of them filled. */
+int  sf_damp_collect(sf_damp_t *d, uint32_t now_ms, sf_route_entry_t *ups, size_t *nu,
+                     sf_route_entry_t *wds, size_t *nw, size_t max);
+
+/* Applies to rt every change still held, stamped now_ms, as a restart would
+   (a snapshot of the table carries them). -1 without memory. */
+int  sf_damp_apply_held(const sf_damp_t *d, sf_route_table_t *rt, uint32_t now_ms);
+
+int sf_damp_self_test(void);
+
+#endif /* SENTRYFLOW_DAMP_H */
@@ -0,0 +1,64 @@
+#ifndef SENTRYFLOW_EXPIRY_H
+#define SENTRYFLOW_EXPIRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Route aging (--route-ttl-ms N).
+ *
+ * A route expires N ms after its last update (last_updated_ms); routes with
+ * last_updated_ms 0 (--route, --routes-file) are static and never do. With
+ * one TTL for every route, deadlines come in update order, so the index is a
+ * FIFO of (prefix, mask, stamp, due) appended on every upsert. A tick pops
+ * the entries that are due from the head and expires the routes that still
+ * carry that stamp; a route updated since has a newer entry further back, and
+ * a withdrawn one is gone, so their old entries are just dropped. A tick costs
+ * O(entries due) and never scans the table. Those stale entries are also
+ * swept out whenever the FIFO grows past twice the table's routes, so a
+ * route refreshed over and over holds at most a few entries.
+ *
+ * Times are CLOCK_MONOTONIC milliseconds truncated to 32 bits (as stored in
+ * last_updated_ms) and compared modulo 2^32.
+ */
+
+#define SF_EXPIRY_MAX_TTL_MS (7u * 24u * 3600u * 1000u)
+
+typedef struct sf_expiry_key {
+    uint32_t prefix_be;
+    uint32_t stamp_ms;   /* the route's last_updated_ms when it was indexed */
+    uint32_t due_ms;
+    uint8_t  mask_bits;
+} sf_expiry_key_t;
+
+typedef struct sf_expiry {
+    sf_expiry_key_t *ring;
+    size_t   cap;        /* power of two */
+    size_t   head;
+    size_t   len;
+    uint32_t ttl_ms;
+} sf_expiry_t;
+
+void   sf_expiry_init(sf_expiry_t *x, uint32_t ttl_ms);
+void   sf_expiry_free(sf_expiry_t *x);
+/* Indexes a route that was just upserted into rt. Static routes are skipped;
+   -1 if the index cannot grow (the route then does not age). */
+int    sf_expiry_push(sf_expiry_t *x, const sf_route_table_t *rt, const sf_route_entry_t *e);
+/* Replaces the index with every aging route of rt, oldest first. A stamp
+   from the future (a log written before a reboot) counts as updated now. */
+int    sf_expiry_index_table(sf_expiry_t *x, const sf_route_table_t *rt, uint32_t now_ms);
+/* Returns 1 if the head entry is due at now_ms. */
+int    sf_expiry_due(const sf_expiry_t *x, uint32_t now_ms);
+/* Pops up to max due entries into out; returns how many. */
+size_t sf_expiry_pop_due(sf_expiry_t *x, uint32_t now_ms, sf_expiry_key_t *out, size_t max);
+
+/* Calls tick(now_ms) every interval_ms on a background thread. */
+int  sf_expiry_ticker_start(uint32_t interval_ms, void (*tick)(uint32_t now_ms));
+void sf_expiry_ticker_stop(void);
+uint32_t sf_expiry_now_ms(void);
+
+int sf_expiry_self_test(void);
+
+#endif /* SENTRYFLOW_EXPIRY_H */
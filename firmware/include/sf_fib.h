@@ -0,0 +1,46 @@
+#ifndef SENTRYFLOW_FIB_H
+#define SENTRYFLOW_FIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * A compressed forwarding table (FIB) derived from the routing table (RIB).
+ *
+ * The FIB leaves out every route whose nearest less specific route in the
+ * RIB forwards the same way (same next hop, or same next-hop group): inside
+ * that route the longest match already gives that next hop. Longest-prefix
+ * match on the FIB therefore forwards exactly as on the RIB, through fewer
+ * routes, but the route it returns may be the aggregate that stood in for a
+ * more specific one, so only lookups that forward use it. Queries, dumps and
+ * everything else keep reading the RIB.
+ *
+ * This is the redundancy-elimination half of ORTC; it never invents
+ * prefixes, so a change to one RIB route touches only that route and the
+ * routes it directly covers.
+ */
+
+typedef struct sf_fib {
+    sf_route_table_t table;   /* group routes carry a private flag, not SF_ROUTE_F_GROUP */
+} sf_fib_t;
+
+void   sf_fib_init(sf_fib_t *f);
+void   sf_fib_free(sf_fib_t *f);
+size_t sf_fib_count(const sf_fib_t *f);
+/* Replaces the FIB with the one rib compresses to, in one pass. */
+int    sf_fib_build(sf_fib_t *f, const sf_route_table_t *rib);
+/* Brings the FIB in line after prefix_be/mask_bits was upserted into or
+   removed from rib (or neither: it is idempotent). Costs the routes that
+   prefix directly covers. -1 if memory ran out; the FIB is then
+   inconsistent and must be rebuilt or dropped. */
+int    sf_fib_update(sf_fib_t *f, const sf_route_table_t *rib, uint32_t prefix_be, uint8_t mask_bits);
+/* Longest-prefix match, as sf_route_table_lookup() on the RIB would forward:
+   next_hop_be and SF_ROUTE_F_GROUP agree with the RIB's answer (resolve
+   groups through the RIB's nh table); the prefix may be less specific. */
+int    sf_fib_lookup(const sf_fib_t *f, uint32_t ip_be, sf_route_entry_t *out_best);
+
+int sf_fib_self_test(void);
+
+#endif /* SENTRYFLOW_FIB_H */
@@ -0,0 +1,45 @@
+#ifndef SENTRYFLOW_HANDOFF_H
+#define SENTRYFLOW_HANDOFF_H
+
+#include <stddef.h>
+
+/*
+ * Zero-downtime restart.
+ *
+ * A running engine listens on a Unix socket (--handoff PATH). A successor
+ * started with the same path connects to it and receives, in one message,
+ * the listening sockets (SCM_RIGHTS) plus a memfd holding a routing table
+ * snapshot, which it maps instead of replaying ROUTE_UPDATEs. Once the successor
+ * acknowledges, the predecessor stops accepting, drains the requests it
+ * already has and exits. The listeners never close, so clients see no
+ * refused connections.
+ */
+
+#define SF_HANDOFF_MAX_FDS 64
+
+typedef struct sf_handoff_state {
+    int      listen_fds[SF_HANDOFF_MAX_FDS];
+    unsigned nfds;
+    int      state_fd;   /* memfd with the routing snapshot (sf_snapshot.h) */
+} sf_handoff_state_t;
+
+/* Binds a non-blocking listening socket at path, replacing a stale one. */
+int sf_handoff_listen(const char *path);
+
+/* Connects to a predecessor at path. Returns the connected fd, or -1 when
+   nobody is serving there (a normal cold start). */
+int sf_handoff_connect(const char *path);
+
+/* Predecessor side, on a connection accepted from sf_handoff_listen(): sends
+   the listeners and the state fd, then waits for the successor's
+   acknowledgement. Returns 0 once the successor has taken over. */
+int sf_handoff_send(int conn_fd, const int *listen_fds, unsigned nfds, int state_fd);
+
+/* Successor side: receives the state (the caller owns the received fds) and
+   acknowledges once it has been adopted. */
+int sf_handoff_receive(int conn_fd, sf_handoff_state_t *out);
+int sf_handoff_ack(int conn_fd);
+
+int sf_handoff_self_test(void);
+
+#endif /* SENTRYFLOW_HANDOFF_H */
@@ -43,6 +43,10 @@ int sf_proto_try_decode(
     size_t *payload_len
 );
 
+/* Parses the next header without consuming it.
+   Returns: 1 if a complete frame is buffered, 0 if more data is needed, -1 on parse error. */
+int sf_proto_peek(const sf_rxbuf_t *rb, sf_frame_t *out_frame);
+
 int sf_proto_self_test(void);
 
 #endif /* SENTRYFLOW_PROTOCOL_H */
@@ -0,0 +1,122 @@
+#ifndef SENTRYFLOW_REPL_H
+#define SENTRYFLOW_REPL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+#include "sf_workpool.h"
+
+/*
+ * Route replication between engines (--follow HOST:PORT).
+ *
+ * Every engine can lead: its routing mutation sink publishes each applied
+ * batch into a backlog ring of ready-to-send REPL_BATCH frames. A follower
+ * connects to the leader's normal port and sends REPL_SUBSCRIBE with the
+ * stream origin and the last sequence number it applied. The leader resumes
+ * from the backlog, or, when the follower is behind the backlog (or was
+ * following another leader process), first sends the whole table as a RESET
+ * batch, preceded by its next-hop groups as a RESET batch of op GROUP with
+ * the same seq. New batches are pushed as soon as they are applied.
+ *
+ * REPL_BATCH payload: origin (8), seq (8), op (1), flags (1), reserved (2),
+ * count (4), all big-endian, then count delta-encoded routes. A batch larger
+ * than one frame is split into parts with the same seq; all parts but the
+ * last carry SF_REPL_MORE and the follower applies the batch once complete.
+ */
+
+#define SF_REPL_HEADER_LEN  24u
+#define SF_REPL_MAX_PAYLOAD 4096u
+#define SF_REPL_MAX_RECORD  14u   /* worst-case encoded route */
+
+#define SF_REPL_OP_UPSERT   1u
+#define SF_REPL_OP_WITHDRAW 2u  /* routes carry only prefix and mask */
+#define SF_REPL_OP_GROUP    3u  /* next-hop group members (routing.h) */
+#define SF_REPL_OP_RESET    4u  /* publish only: the table was replaced outright; never sent */
+#define SF_REPL_OP_HELD     5u  /* no routes: the leader held changes back; only the sequence moves */
+
+#define SF_REPL_RESET 0x01u  /* first part of a full table (or of its groups): the follower drops its routes */
+#define SF_REPL_MORE  0x02u  /* more parts with the same seq follow */
+
+#define SF_REPL_GROUP_BIT 0x80u  /* in the mask byte: the next hop is a group id */
+
+/* Routes are encoded against the previous one in the same frame (the first
+   against zero): mask_bits (1, with SF_REPL_GROUP_BIT), then LEB128 varints of the zigzagged
+   differences of prefix, next hop and metric (host order). Consecutive routes
+   of a sorted table mostly take 4-7 bytes instead of 16. last_updated_ms is
+   not carried; the follower stamps routes when it applies them.
+   Encodes as many of the n routes as fit; returns bytes written and sets
+   *encoded to the number of routes. */
+size_t sf_repl_encode_routes(const sf_route_entry_t *e, size_t n, uint8_t *out, size_t cap, size_t *encoded);
+/* Decodes exactly count routes from exactly len bytes; -1 if malformed. */
+int    sf_repl_decode_routes(const uint8_t *in, size_t len, uint32_t count, sf_route_entry_t *out);
+
+/* Leader side. */
+
+/* Copies every route into a malloc'd array, with the sequence number the copy
+   is consistent with. The first *groups entries are the table's next-hop
+   groups as records (sf_route_table_group_records). */
+typedef int (*sf_repl_export_fn)(sf_route_entry_t **out, size_t *n, size_t *groups, uint64_t *seq);
+
+typedef struct sf_repl_leader_config {
+    size_t            backlog_bytes;  /* 0 = not serving followers */
+    sf_repl_export_fn export_routes;
+} sf_repl_leader_config_t;
+
+int  sf_repl_leader_init(const sf_repl_leader_config_t *cfg);
+void sf_repl_leader_shutdown(void);
+int  sf_repl_leading(void);
+/* Routing mutation sink: called under the table's write lock. A table
+   replaced outright (op SF_REPL_OP_RESET, a follower taking its leader's full
+   table) starts a new stream: the backlog is dropped and the origin changes,
+   so every follower of this engine resubscribes and gets the whole table. */
+void sf_repl_publish(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n);
+
+/* One subscribed connection. Owned by its reactor; zero-initialized. */
+typedef struct sf_repl_sub {
+    uint64_t   origin;     /* stream it reads; a new one ends the subscription */
+    uint64_t   cursor;     /* backlog offset of the next frame to send */
+    uint8_t   *dump;       /* full table, sent before the backlog */
+    size_t     dump_len;
+    size_t     dump_off;
+    sf_task_t *parked;     /* posted when new frames are published */
+    struct sf_repl_sub *next_parked;
+} sf_repl_sub_t;
+
+/* Positions s after from_seq, or prepares a full table when the backlog cannot
+   resume it. Returns -1 if replication is off or the table cannot be copied. */
+int  sf_repl_subscribe(sf_repl_sub_t *s, uint64_t origin, uint64_t from_seq);
+/* Copies whole frames into dst. Returns the bytes copied (0 when caught up),
+   or -1 when the subscriber fell out of the backlog, or the stream was
+   restarted, and it has to resubscribe. */
+long sf_repl_read(sf_repl_sub_t *s, uint8_t *dst, size_t cap);
+/* Posts t to t->cq once more frames are published. Returns -1 (and keeps t)
+   when some already are, so the caller reads again. */
+int  sf_repl_park(sf_repl_sub_t *s, sf_task_t *t);
+/* Releases s. Returns 1 if its parked task was withdrawn, 0 if it was never
+   parked or has already been posted (and will still be delivered). */
+int  sf_repl_unsubscribe(sf_repl_sub_t *s);
+
+/* Follower side. */
+
+typedef struct sf_repl_follow_config {
+    const char *host;
+    uint16_t    port;
+    uint32_t    retry_ms;  /* delay before reconnecting */
+    /* Applies one batch under the leader's sequence number. */
+    void (*apply)(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n);
+    /* Replaces the whole table (a RESET batch); rt is left empty. */
+    void (*replace)(sf_route_table_t *rt, uint64_t seq);
+} sf_repl_follow_config_t;
+
+/* Starts the follower thread; it reconnects and resumes until stopped. */
+int  sf_repl_follow_start(const sf_repl_follow_config_t *cfg);
+void sf_repl_follow_stop(void);
+int  sf_repl_following(void);
+
+/* Leader: full tables sent. Follower: full tables received. */
+uint64_t sf_repl_resyncs(void);
+
+int sf_repl_self_test(void);
+
+#endif /* SENTRYFLOW_REPL_H */
@@ -0,0 +1,54 @@
+#ifndef SENTRYFLOW_ROUTE_BLOOM_H
+#define SENTRYFLOW_ROUTE_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Filters that let a lookup skip the trie below the first-level index when
+ * no route there can match (routing_table.c keeps them in step with the
+ * table once sf_route_table_set_bloom() is called).
+ *
+ * Routes shorter than SF_ROUTE_DIR_BITS are already answered by the index.
+ * For the longer ones there is a mask per index slot of the lengths present
+ * under it, and one counting Bloom filter over (prefix, length) keys. Each
+ * key lives in a single 64-byte block of 128 four-bit counters, so a probe
+ * costs one cache line; counters saturate at 15 and then stay set. A lookup
+ * probes only the lengths its slot has, and if every probe says no, the
+ * answer is the slot's route from the index and the walk is skipped. Slots
+ * with a /16 route or more than SF_ROUTE_BLOOM_MAX_PROBES lengths are walked
+ * without probing.
+ */
+
+#define SF_ROUTE_BLOOM_MIN_BITS SF_ROUTE_DIR_BITS
+#define SF_ROUTE_BLOOM_MAX_FPR  0.5
+#define SF_ROUTE_BLOOM_MAX_PROBES 2
+
+typedef struct sf_route_bloom {
+    uint8_t  *blocks;     /* nblocks x 64 bytes of 4-bit counters */
+    uint32_t  nblocks;
+    uint32_t  capacity;   /* keys it was sized for */
+    uint32_t  keys;
+    uint32_t  k;          /* counters per key */
+    double    fpr;        /* target false-positive rate per probe */
+    uint32_t *lens;       /* per dir slot: bit L - SF_ROUTE_BLOOM_MIN_BITS for each length L there */
+} sf_route_bloom_t;
+
+/* Sizes the filter for `capacity` keys at false-positive rate fpr (0..0.5]. */
+int  sf_route_bloom_init(sf_route_bloom_t *b, double fpr, uint32_t capacity);
+void sf_route_bloom_free(sf_route_bloom_t *b);
+/* Makes dst an independent copy of src. */
+int  sf_route_bloom_copy(sf_route_bloom_t *dst, const sf_route_bloom_t *src);
+/* key is a masked host-order prefix, bits >= SF_ROUTE_BLOOM_MIN_BITS. */
+void sf_route_bloom_add(sf_route_bloom_t *b, uint32_t key, uint8_t bits);
+void sf_route_bloom_del(sf_route_bloom_t *b, uint32_t key, uint8_t bits);
+int  sf_route_bloom_test(const sf_route_bloom_t *b, uint32_t key, uint8_t bits);
+/* Whether some route of SF_ROUTE_BLOOM_MIN_BITS or longer may contain the
+   host-order address ip: 0 means certainly not. */
+int  sf_route_bloom_may_match(const sf_route_bloom_t *b, uint32_t ip);
+
+int sf_route_bloom_self_test(void);
+
+#endif /* SENTRYFLOW_ROUTE_BLOOM_H */
@@ -0,0 +1,59 @@
+#ifndef SENTRYFLOW_ROUTE_CACHE_H
+#define SENTRYFLOW_ROUTE_CACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * A destination cache in front of longest-prefix match: the answer for a
+ * recently looked-up address, found by hashing the address to one 64-byte
+ * set of four ways. A few thousand hot destinations fit in L1/L2 however
+ * large the table is, and a hit costs one cache line.
+ *
+ * Entries are stamped with the table epoch they were looked up at (a set
+ * holds one epoch); a set from an older epoch is empty, so every write to
+ * the table invalidates the whole cache without touching it. "No route" is
+ * cached too. A cache belongs to one thread.
+ */
+
+#define SF_ROUTE_CACHE_WAYS 4u
+#define SF_ROUTE_CACHE_MAX_ENTRIES (1u << 24)
+
+typedef struct sf_route_cache_way {
+    uint32_t ip_be;
+    uint32_t next_hop_be;
+    uint16_t metric;
+    uint8_t  mask_bits;   /* 0xFF: no route */
+    uint8_t  flags;
+} sf_route_cache_way_t;
+
+typedef struct sf_route_cache_set {
+    _Alignas(64) uint64_t epoch;
+    sf_route_cache_way_t  way[SF_ROUTE_CACHE_WAYS];
+    uint8_t               valid;   /* one bit per way */
+    uint8_t               victim;  /* next way to replace, round robin */
+} sf_route_cache_set_t;
+
+typedef struct sf_route_cache {
+    sf_route_cache_set_t *sets;
+    uint32_t              mask;    /* sets - 1 */
+    _Atomic uint64_t      hits;    /* written by the owner only; others may read */
+    _Atomic uint64_t      misses;
+} sf_route_cache_t;
+
+/* Room for at least `entries` destinations (rounded up to a power of two,
+   at most SF_ROUTE_CACHE_MAX_ENTRIES). */
+int  sf_route_cache_init(sf_route_cache_t *c, uint32_t entries);
+void sf_route_cache_free(sf_route_cache_t *c);
+/* 1 on a hit: *found says whether there is a route, and if so *out has it
+   (its prefix is ip_be under its mask, last_updated_ms is 0). 0 on a miss. */
+int  sf_route_cache_get(sf_route_cache_t *c, uint64_t epoch, uint32_t ip_be, int *found, sf_route_entry_t *out);
+/* Remembers the answer for ip_be at epoch; best is NULL for no route. */
+void sf_route_cache_put(sf_route_cache_t *c, uint64_t epoch, uint32_t ip_be, const sf_route_entry_t *best);
+
+int sf_route_cache_self_test(void);
+
+#endif /* SENTRYFLOW_ROUTE_CACHE_H */
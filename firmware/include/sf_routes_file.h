@@ -0,0 +1,38 @@
+#ifndef SENTRYFLOW_ROUTES_FILE_H
+#define SENTRYFLOW_ROUTES_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Bulk route files (--routes-file).
+ *
+ * Text: one route per line, the same fields as --route,
+ *     <prefix> <maskBits> <nextHop> <metric>     or     <prefix>/<maskBits> <nextHop> <metric>
+ * with blank lines and '#' comments ignored.
+ *
+ * Binary: a 16-byte header (magic "SFRLIST\0", version_be u32, count_be u32)
+ * followed by count ROUTE_UPDATE records (16 bytes each, see PROTOCOL.md).
+ *
+ * The file is mapped, split into chunks parsed on separate threads, and the
+ * table is built in one pass with sf_route_table_build().
+ */
+
+#define SF_ROUTES_FILE_MAGIC   "SFRLIST"
+#define SF_ROUTES_FILE_VERSION 1u
+#define SF_ROUTES_FILE_HEADER  16u
+
+/* Loads path into an empty table using up to `threads` parser threads
+   (0 = one per online CPU). On failure returns -1 and describes the problem,
+   with a line number for text files, in err. */
+int sf_routes_file_load(const char *path, unsigned threads, sf_route_table_t *out, char *err, size_t err_len);
+
+/* Parses a dotted-quad IPv4 address from [s, end); returns a pointer past it
+   or NULL. Stricter than inet_aton: exactly four decimal octets, no leading zeros. */
+const char *sf_parse_ipv4(const char *s, const char *end, uint32_t *out_host);
+
+int sf_routes_file_self_test(void);
+
+#endif /* SENTRYFLOW_ROUTES_FILE_H */
@@ -0,0 +1,65 @@
+#ifndef SENTRYFLOW_SCHED_H
+#define SENTRYFLOW_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Weighted priority lanes for the reactor.
+ *
+ * Every frame is classified (per message type, overridable via the frame's
+ * flags). Connections with a complete frame buffered wait in the queue of
+ * that frame's class, and each loop iteration runs one deficit round-robin
+ * round across the class queues, so a route push cannot starve health
+ * checks. A connection sits in at most one queue at a time, which keeps
+ * responses in per-connection order.
+ */
+
+typedef enum {
+    SF_CLASS_CONTROL = 0, /* route mutations and other control-plane work */
+    SF_CLASS_LOOKUP = 1,  /* data-plane queries */
+    SF_CLASS_PROBE = 2,   /* health checks and observability */
+    SF_CLASS_COUNT = 3
+} sf_msg_class_t;
+
+/* Bytes of credit one unit of weight buys per round. */
+#define SF_SCHED_QUANTUM_BYTES 4096u
+
+typedef struct sf_sched_config {
+    uint8_t  class_by_type[256];
+    uint32_t weight[SF_CLASS_COUNT];
+} sf_sched_config_t;
+
+typedef struct sf_sched_item {
+    struct sf_sched_item *next;
+    int                   queued;
+} sf_sched_item_t;
+
+typedef struct sf_sched {
+    sf_sched_config_t cfg;
+    sf_sched_item_t  *head[SF_CLASS_COUNT];
+    sf_sched_item_t  *tail[SF_CLASS_COUNT];
+    size_t            deficit[SF_CLASS_COUNT];
+    uint64_t          served_bytes[SF_CLASS_COUNT];
+} sf_sched_t;
+
+/* Serves one item with at most `credit` bytes of work of class `cls`. Returns
+   the bytes consumed; the callee re-queues the item if it has more work. */
+typedef size_t (*sf_sched_serve_fn)(sf_sched_item_t *item, sf_msg_class_t cls, size_t credit, void *ctx);
+
+void sf_sched_default_config(sf_sched_config_t *out);
+int  sf_sched_parse_class(const char *name, sf_msg_class_t *out);
+const char *sf_sched_class_name(sf_msg_class_t cls);
+sf_msg_class_t sf_sched_classify(const sf_sched_config_t *cfg, uint8_t type, uint16_t flags);
+
+void sf_sched_init(sf_sched_t *s, const sf_sched_config_t *cfg);
+void sf_sched_push(sf_sched_t *s, sf_sched_item_t *item, sf_msg_class_t cls);
+void sf_sched_remove(sf_sched_t *s, sf_sched_item_t *item);
+int  sf_sched_pending(const sf_sched_t *s);
+
+/* Runs one deficit round-robin round over the class queues. */
+void sf_sched_run_round(sf_sched_t *s, sf_sched_serve_fn serve, void *ctx);
+
+int sf_sched_self_test(void);
+
+#endif /* SENTRYFLOW_SCHED_H */
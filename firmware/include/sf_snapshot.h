@@ -0,0 +1,69 @@
+#ifndef SENTRYFLOW_SNAPSHOT_H
+#define SENTRYFLOW_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Binary routing table snapshot.
+ *
+ * The file is the table's own arrays (entries, trie nodes, first-level
+ * index, next-hop groups and their members) behind a versioned header, so loading is an mmap plus a checksum
+ * pass: no parsing and no rebuilding. Mutating a loaded table copies pages
+ * privately; nothing is written back to the file. Next-hop groups are
+ * copied onto the heap. Version 2 images (no groups) still load. Layout is native-endian
+ * and the header records the writer's byte order.
+ */
+
+#define SF_SNAPSHOT_MAGIC       "SFROUTE"
+#define SF_SNAPSHOT_VERSION     3u
+#define SF_SNAPSHOT_HEADER_SIZE 4096u
+
+typedef struct sf_snapshot_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t byte_order;    /* 0x01020304 as written by the producer */
+    uint32_t entry_size;
+    uint32_t node_size;
+    uint32_t dir_slots;     /* 0 for an empty table */
+    uint64_t route_count;
+    uint32_t entry_used;
+    uint32_t free_entry;
+    uint32_t node_used;
+    uint32_t free_node;
+    uint32_t root;
+    uint32_t reserved;
+    uint64_t entries_off;
+    uint64_t nodes_off;
+    uint64_t dir_off;
+    uint64_t file_size;
+    uint64_t seq;           /* last mutation sequence number included (routing.h) */
+    uint32_t payload_crc;   /* CRC-32 of bytes [header_size, file_size) */
+    uint32_t header_crc;    /* CRC-32 of this struct with header_crc = 0 (of the
+                               fields up to here in version 2) */
+    /* Version 3: next-hop groups. */
+    uint64_t groups_off;
+    uint64_t hops_off;
+    uint32_t group_used;
+    uint32_t free_group;
+    uint32_t hop_used;
+    uint32_t group_size;
+} sf_snapshot_header_t;
+
+/* Writes the image to an empty file or memfd. */
+int sf_snapshot_write_fd(int fd, const sf_route_table_t *rt, uint64_t seq, size_t *bytes_out);
+
+/* Writes path atomically: temp file, fsync, rename, fsync of the directory. */
+int sf_snapshot_save(const char *path, const sf_route_table_t *rt, uint64_t seq, size_t *bytes_out);
+
+/* Maps an image into an empty table. The table owns the mapping and releases
+   it in sf_route_table_free(). seq may be NULL. */
+int sf_snapshot_map_fd(int fd, sf_route_table_t *out, uint64_t *seq);
+int sf_snapshot_load(const char *path, sf_route_table_t *out, uint64_t *seq);
+
+int sf_snapshot_self_test(void);
+
+#endif /* SENTRYFLOW_SNAPSHOT_H */
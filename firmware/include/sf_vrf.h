@@ -0,0 +1,76 @@
+#ifndef SENTRYFLOW_VRF_H
+#define SENTRYFLOW_VRF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+
+/*
+ * Numbered routing tables (VRFs) beside the engine's main table.
+ *
+ * A VRF starts as a copy of another table, and copies share memory: the
+ * source's arrays are written once into a memfd image with room to grow, and
+ * each copy maps the image privately, as a loaded snapshot does, so it costs
+ * only the pages it has written since. A thousand VRFs cloned from one table
+ * cost that table once plus their differences. A copy is an ordinary
+ * sf_route_table_t, looked up exactly like the main table; one that outgrows
+ * the room in the image moves onto the heap (routing_table.c).
+ *
+ * VRFs are found by id through an open-addressing index; a VRF does not move
+ * while it exists.
+ */
+
+#define SF_VRF_MAIN  0u           /* the engine's main table, never in a set */
+#define SF_VRF_EMPTY 0xFFFFFFFFu  /* as a source: start empty */
+
+/* A table frozen in a memfd for copies to map. */
+typedef struct sf_vrf_image {
+    int           fd;           /* -1 for an empty source */
+    size_t        len;
+    uint64_t      nodes_off;    /* entries start at 0 */
+    uint64_t      dir_off;
+    uint32_t      entry_cap;    /* room in the image, used or not */
+    uint32_t      entry_used;
+    uint32_t      free_entry;
+    uint32_t      node_cap;
+    uint32_t      node_used;
+    uint32_t      free_node;
+    uint32_t      root;
+    size_t        count;
+    sf_nh_table_t nh;           /* the source's next-hop groups; each copy gets its own */
+} sf_vrf_image_t;
+
+typedef struct sf_vrf {
+    uint32_t         id;
+    uint64_t         version;   /* batches applied since it was created */
+    sf_route_table_t table;
+} sf_vrf_t;
+
+typedef struct sf_vrf_set {
+    sf_vrf_t **slots;   /* by id, linear probing; NULL = empty */
+    size_t     cap;     /* power of two */
+    size_t     count;
+} sf_vrf_set_t;
+
+void sf_vrf_image_init(sf_vrf_image_t *img);
+void sf_vrf_image_free(sf_vrf_image_t *img);
+/* Writes src into img (freed first) with room for `slack` more routes per
+   copy. Copies already mapped keep their pages. */
+int  sf_vrf_image_make(sf_vrf_image_t *img, const sf_route_table_t *src, uint32_t slack);
+/* Maps a copy of the image into an empty table; the table owns the mapping. */
+int  sf_vrf_image_clone(const sf_vrf_image_t *img, sf_route_table_t *out);
+
+void      sf_vrf_set_init(sf_vrf_set_t *s);
+void      sf_vrf_set_free(sf_vrf_set_t *s);
+size_t    sf_vrf_set_count(const sf_vrf_set_t *s);
+sf_vrf_t *sf_vrf_find(const sf_vrf_set_t *s, uint32_t id);
+/* Adds VRF id holding *table, which is moved in and left empty. NULL if id is
+   SF_VRF_MAIN, SF_VRF_EMPTY or taken, or memory ran out. */
+sf_vrf_t *sf_vrf_add(sf_vrf_set_t *s, uint32_t id, sf_route_table_t *table);
+/* Frees VRF id and its table; -1 if there is none. */
+int       sf_vrf_remove(sf_vrf_set_t *s, uint32_t id);
+
+int sf_vrf_self_test(void);
+
+#endif /* SENTRYFLOW_VRF_H */
@@ -0,0 +1,94 @@
+#ifndef SENTRYFLOW_WAL_H
+#define SENTRYFLOW_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "routing_table.h"
+#include "sf_workpool.h"
+
+/*
+ * Write-ahead log of route mutations (--wal PATH).
+ *
+ * Batches are appended, in routing sequence order, to an in-memory buffer
+ * while the table's write lock is held. A background writer swaps the buffer
+ * out, writes it and calls fdatasync() once for everything that accumulated
+ * while the previous sync was running (group commit). A ROUTE_ACK is held
+ * back until its batch is durable: the reactor holds the connection's output
+ * and the writer posts the connection to the reactor's completion queue after
+ * the covering sync.
+ *
+ * On startup the log is replayed on top of the last snapshot. Once it grows
+ * past the compaction threshold the writer saves a snapshot (<PATH>.snap)
+ * and truncates the log behind it.
+ *
+ * File: a header (magic, version, base_seq) followed by records
+ * {len, crc, seq, count, op} + count 16-byte ROUTE_UPDATE records (flags
+ * included) whose trailing reserved word carries last_updated_ms. Headers are native-endian.
+ */
+
+#define SF_WAL_MAGIC   "SFWAL"
+#define SF_WAL_VERSION 1u
+
+#define SF_WAL_OP_UPSERT   1u
+#define SF_WAL_OP_WITHDRAW 2u  /* records carry only prefix and mask */
+#define SF_WAL_OP_GROUP    3u  /* next-hop group members (routing.h) */
+/* Changes dampening held back when they were acknowledged (routing.h);
+   replay applies them, since the process that would have did not survive. */
+#define SF_WAL_OP_HELD_UPSERT   5u
+#define SF_WAL_OP_HELD_WITHDRAW 6u
+
+typedef struct sf_wal_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t base_seq;   /* every record in the file has seq > base_seq */
+} sf_wal_file_header_t;
+
+typedef struct sf_wal_record_header {
+    uint32_t len;        /* bytes of route records that follow */
+    uint32_t crc;        /* CRC-32 from seq through the last route record */
+    uint64_t seq;
+    uint32_t count;
+    uint32_t op;
+} sf_wal_record_header_t;
+
+/* Writes a snapshot consistent with *seq to snapshot_path. */
+typedef int (*sf_wal_compact_fn)(const char *snapshot_path, uint64_t *seq);
+
+typedef struct sf_wal_config {
+    const char       *snapshot_path;  /* compaction target */
+    uint64_t          compact_bytes;  /* compact once the log is larger than this; 0 = never */
+    sf_wal_compact_fn compact;
+    uint64_t          start_seq;      /* sequence number the table is at when the log opens */
+} sf_wal_config_t;
+
+typedef void (*sf_wal_apply_fn)(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n, void *ctx);
+
+/* Applies records with seq > after_seq in order. A torn or corrupt tail (a
+   crash mid-write) is cut off; a log that starts after after_seq, or has a
+   gap, is an error. A missing file is an empty log. Returns the number of
+   records applied or -1; *last_seq gets the last sequence number seen. */
+long sf_wal_replay(const char *path, uint64_t after_seq, sf_wal_apply_fn fn, void *ctx, uint64_t *last_seq);
+
+/* Opens (or creates) the log for appending and starts the writer thread. */
+int  sf_wal_open(const char *path, const sf_wal_config_t *cfg);
+/* Flushes what is buffered, stops the writer and closes the log. */
+void sf_wal_close(void);
+int  sf_wal_is_open(void);
+
+/* Called under the routing write lock (as its mutation sink). */
+void sf_wal_append(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n);
+
+uint64_t sf_wal_durable_seq(void);
+/* Posts t to t->cq once seq is durable. Returns -1 (and keeps t) when it
+   already is, or when no log is open, so the caller can complete inline. */
+int  sf_wal_park(uint64_t seq, sf_task_t *t);
+/* Blocks until everything appended so far is durable. */
+int  sf_wal_sync(void);
+
+void sf_wal_get_stats(uint64_t *records, uint64_t *syncs);
+
+int sf_wal_self_test(void);
+
+#endif /* SENTRYFLOW_WAL_H */
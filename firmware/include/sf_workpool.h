@@ -0,0 +1,56 @@
+#ifndef SENTRYFLOW_WORKPOOL_H
+#define SENTRYFLOW_WORKPOOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Worker pool for handlers too slow to run on a reactor thread.
+ *
+ * Each worker owns a bounded deque; submissions are spread round-robin and an
+ * idle worker steals from the others. A finished task is posted to the
+ * completion queue of the reactor that submitted it: a lock-free intrusive
+ * MPSC queue plus a notification fd (an eventfd) that the reactor polls.
+ */
+
+typedef struct sf_mpsc_node {
+    _Atomic(struct sf_mpsc_node *) next;
+} sf_mpsc_node_t;
+
+typedef struct sf_completion_queue {
+    _Atomic(sf_mpsc_node_t *) head;  /* producers swap themselves in here */
+    sf_mpsc_node_t           *tail;  /* consumer side */
+    sf_mpsc_node_t            stub;
+    atomic_int                signalled;
+    int                       notify_fd;
+} sf_completion_queue_t;
+
+typedef struct sf_task {
+    sf_mpsc_node_t          done;              /* completion queue link */
+    void                  (*run)(struct sf_task *t);  /* runs on a worker thread */
+    sf_completion_queue_t  *cq;                /* where the finished task is posted */
+} sf_task_t;
+
+#define SF_WORKPOOL_MAX_WORKERS 64
+#define SF_WORKPOOL_DEQUE_CAP   1024
+
+/* notify_fd may be -1 when the consumer polls instead of waiting. */
+void       sf_cq_init(sf_completion_queue_t *cq, int notify_fd);
+/* Any thread: posts a finished task (the pool does this after run()). */
+void       sf_cq_post(sf_completion_queue_t *cq, sf_task_t *t);
+/* Consumer only: clears the notification before draining with sf_cq_pop(). */
+void       sf_cq_rearm(sf_completion_queue_t *cq);
+sf_task_t *sf_cq_pop(sf_completion_queue_t *cq);
+
+int      sf_workpool_start(unsigned nworkers);
+void     sf_workpool_stop(void);
+unsigned sf_workpool_size(void);
+
+/* Returns -1 if the pool is not running or every deque is full; the caller
+   should then run the work inline. */
+int sf_workpool_submit(sf_task_t *t);
+
+int sf_workpool_self_test(void);
+
+#endif /* SENTRYFLOW_WORKPOOL_H */
@@ -1,11 +1,21 @@
 #include "protocol_stack.h"
 #include "routing.h"
 #include "routing_table.h"
+#include "sf_commands.h"
+#include "sf_sched.h"
+#include "sf_snapshot.h"
+#include "sf_routes_file.h"
+#include "sf_wal.h"
+#include "sf_repl.h"
+#include "sf_expiry.h"
+#include "sf_route_cache.h"
+#include "sf_route_bloom.h"
 
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static int parse_u16(const char *s, uint16_t *out) {
     if (!s || !out) return -1;
@@ -27,13 +37,119 @@ static int parse_u16_metric(const char *s, uint16_t *out) {
     return 0;
 }
 
+static int parse_u32_pos(const char *s, uint32_t *out) {
+    if (!s || !out) return -1;
+    char *end = NULL;
+    unsigned long v = strtoul(s, &end, 10);
+    if (!end || end == s || *end != '\0') return -1;
+    if (v == 0 || v > 0xFFFFFFFFul) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+static int parse_ms(const char *s, double *out) {
+    if (!s || !out) return -1;
+    char *end = NULL;
+    double v = strtod(s, &end);
+    if (!end || end == s || *end != '\0') return -1;
+    if (v < 0.0 || v > 60000.0) return -1;
+    *out = v;
+    return 0;
+}
+
+/* Log and replication ops carry the routing op values. */
+static void replay_apply(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n, void *ctx) {
+    (void)ctx;
+    /* Changes still held when the process stopped were acknowledged: apply them now. */
+    if (op == SF_WAL_OP_HELD_UPSERT) op = SF_ROUTE_OP_UPSERT;
+    else if (op == SF_WAL_OP_HELD_WITHDRAW) op = SF_ROUTE_OP_WITHDRAW;
+    sf_routing_replay_batch(seq, op, entries, n);
+}
+
+static void follow_apply(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    if (op == SF_REPL_OP_HELD) op = SF_ROUTE_OP_HELD_UPSERT;
+    sf_routing_replay_batch(seq, op, entries, n);
+}
+
+/* Every applied batch goes to the log (if any) and to the replication backlog. */
+static void route_sink(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    /* A replaced table only comes from a leader, and --follow is exclusive with --wal. */
+    if (sf_wal_is_open() && op != SF_ROUTE_OP_RESET) sf_wal_append(seq, op, entries, n);
+    /* Followers get held changes when they are applied; until then only the sequence. */
+    if (op == SF_ROUTE_OP_HELD_UPSERT || op == SF_ROUTE_OP_HELD_WITHDRAW) sf_repl_publish(seq, SF_REPL_OP_HELD, NULL, 0);
+    else sf_repl_publish(seq, op, entries, n);
+}
+
+/* One ticker ages routes out and applies changes held by dampening. */
+static void route_tick(uint32_t now_ms) {
+    sf_routing_expire(now_ms);
+    sf_routing_release(now_ms);
+}
+
+static int wal_compact(const char *snapshot_path, uint64_t *seq) {
+    return sf_routing_save_snapshot(snapshot_path, -1, NULL, NULL, seq);
+}
+
+/* Splits "<key>=<value>" in place; returns the value part or NULL. */
+static char *split_kv(char *s) {
+    char *eq = s ? strchr(s, '=') : NULL;
+    if (!eq || eq == s || eq[1] == '\0') return NULL;
+    *eq = '\0';
+    return eq + 1;
+}
+
+/* Parses a CPU list such as "0,2,4-7" into opts->cpus. */
+static int parse_cpu_list(const char *s, sf_stack_options_t *opts) {
+    if (!s || !opts) return -1;
+    opts->ncpus = 0;
+    const char *p = s;
+    while (*p) {
+        char *end = NULL;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0 || lo > 4095) return -1;
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo || hi > 4095) return -1;
+        }
+        for (long cpu = lo; cpu <= hi; ++cpu) {
+            if (opts->ncpus >= SF_MAX_REACTORS) return -1;
+            for (uint32_t k = 0; k < opts->ncpus; ++k) {
+                if (opts->cpus[k] == (int)cpu) return -1;
+            }
+            opts->cpus[opts->ncpus++] = (int)cpu;
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return opts->ncpus ? 0 : -1;
+}
+
 int main(int argc, char **argv) {
     int self_test = 0;
     const char *bind = "0.0.0.0";
     uint16_t port = 9000;
     sf_route_strategy_t strategy = SF_ROUTE_DIRECT;
+    sf_stack_options_t opts;
+    const char *snapshot_in = NULL;
+    const char *routes_file = NULL;
+    const char *wal_path = NULL;
+    uint32_t wal_compact_mb = 64;
+    char wal_snapshot[4096] = "";
+    char follow_host[256] = "";
+    uint16_t follow_port = 0;
+    uint32_t repl_backlog_mb = 16;
+    uint32_t route_ttl_ms = 0;
+    int fib_compress = 0;
+    uint32_t route_cache = 0;
+    double route_bloom_fpr = 0.0;
+    sf_damp_config_t damp;
+    sf_damp_default_config(&damp);
 
     sf_routing_init();
+    sf_stack_default_options(&opts);
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--self-test") == 0) {
@@ -53,6 +169,169 @@ int main(int argc, char **argv) {
                 fprintf(stderr, "invalid --strategy (direct|hop)\n");
                 return 2;
             }
+        } else if (strcmp(argv[i], "--codel-target-ms") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &opts.admission.target_ms) != 0 || opts.admission.target_ms <= 0.0) {
+                fprintf(stderr, "invalid --codel-target-ms\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--codel-interval-ms") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &opts.admission.interval_ms) != 0 || opts.admission.interval_ms <= 0.0) {
+                fprintf(stderr, "invalid --codel-interval-ms\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--slo-ms") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &opts.admission.slo_ms) != 0) {
+                fprintf(stderr, "invalid --slo-ms\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--no-admission") == 0) {
+            opts.admission.enabled = 0;
+        } else if (strcmp(argv[i], "--read-budget") == 0 && i + 1 < argc) {
+            uint32_t v = 0;
+            if (parse_u32_pos(argv[++i], &v) != 0) {
+                fprintf(stderr, "invalid --read-budget\n");
+                return 2;
+            }
+            opts.read_budget_bytes = v;
+        } else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &opts.frame_budget) != 0) {
+                fprintf(stderr, "invalid --frame-budget\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--msg-class") == 0 && i + 1 < argc) {
+            /* --msg-class <type>=<control|lookup|probe> */
+            char *type_s = argv[++i];
+            char *class_s = split_kv(type_s);
+            uint8_t type = 0;
+            sf_msg_class_t cls;
+            if (!class_s || sf_msg_type_parse(type_s, &type) != 0 || sf_sched_parse_class(class_s, &cls) != 0) {
+                fprintf(stderr, "invalid --msg-class (<type>=<control|lookup|probe>)\n");
+                return 2;
+            }
+            opts.sched.class_by_type[type] = (uint8_t)cls;
+        } else if (strcmp(argv[i], "--class-weight") == 0 && i + 1 < argc) {
+            /* --class-weight <control|lookup|probe>=<weight> */
+            char *class_s = argv[++i];
+            char *weight_s = split_kv(class_s);
+            sf_msg_class_t cls;
+            uint32_t weight = 0;
+            if (!weight_s || sf_sched_parse_class(class_s, &cls) != 0 || parse_u32_pos(weight_s, &weight) != 0) {
+                fprintf(stderr, "invalid --class-weight (<class>=<weight>)\n");
+                return 2;
+            }
+            opts.sched.weight[cls] = weight;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long v = strtoul(argv[++i], &end, 10);
+            if (!end || *end != '\0' || v > 64) {
+                fprintf(stderr, "invalid --workers (0..64)\n");
+                return 2;
+            }
+            opts.workers = (uint32_t)v;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            if (parse_cpu_list(argv[++i], &opts) != 0) {
+                fprintf(stderr, "invalid --cpus (e.g. 0,2,4-7; at most %d)\n", SF_MAX_REACTORS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--busy-poll") == 0) {
+            if (!opts.busy_poll_us) opts.busy_poll_us = 50;
+        } else if (strcmp(argv[i], "--busy-poll-us") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &opts.busy_poll_us) != 0 || opts.busy_poll_us > 1000000) {
+                fprintf(stderr, "invalid --busy-poll-us (1..1000000)\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--poll-timeout-us") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &opts.poll_timeout_us) != 0 || opts.poll_timeout_us > 60000000) {
+                fprintf(stderr, "invalid --poll-timeout-us (1..60000000)\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--handoff") == 0 && i + 1 < argc) {
+            opts.handoff_path = argv[++i];
+        } else if (strcmp(argv[i], "--drain-timeout-ms") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &opts.drain_timeout_ms) != 0) {
+                fprintf(stderr, "invalid --drain-timeout-ms\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--snapshot-in") == 0 && i + 1 < argc) {
+            snapshot_in = argv[++i];
+        } else if (strcmp(argv[i], "--routes-file") == 0 && i + 1 < argc) {
+            routes_file = argv[++i];
+        } else if (strcmp(argv[i], "--wal") == 0 && i + 1 < argc) {
+            wal_path = argv[++i];
+        } else if (strcmp(argv[i], "--wal-compact-mb") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &wal_compact_mb) != 0) {
+                fprintf(stderr, "invalid --wal-compact-mb\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+            /* --follow <host>:<port> */
+            const char *v = argv[++i];
+            const char *colon = strrchr(v, ':');
+            if (!colon || colon == v || (size_t)(colon - v) >= sizeof(follow_host) || parse_u16(colon + 1, &follow_port) != 0) {
+                fprintf(stderr, "invalid --follow (<host>:<port>)\n");
+                return 2;
+            }
+            memcpy(follow_host, v, (size_t)(colon - v));
+            follow_host[colon - v] = '\0';
+        } else if (strcmp(argv[i], "--repl-backlog-mb") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long v = strtoul(argv[++i], &end, 10);
+            if (!end || *end != '\0' || v > 4096) {
+                fprintf(stderr, "invalid --repl-backlog-mb (0..4096)\n");
+                return 2;
+            }
+            repl_backlog_mb = (uint32_t)v;
+        } else if (strcmp(argv[i], "--route-ttl-ms") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &route_ttl_ms) != 0 || route_ttl_ms > SF_EXPIRY_MAX_TTL_MS) {
+                fprintf(stderr, "invalid --route-ttl-ms (1..%u)\n", SF_EXPIRY_MAX_TTL_MS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-damp-half-life-ms") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &damp.half_life_ms) != 0 || damp.half_life_ms > SF_DAMP_MAX_MS) {
+                fprintf(stderr, "invalid --route-damp-half-life-ms (1..%u)\n", SF_DAMP_MAX_MS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-damp-suppress") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &damp.suppress) != 0) {
+                fprintf(stderr, "invalid --route-damp-suppress\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-damp-reuse") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &damp.reuse) != 0) {
+                fprintf(stderr, "invalid --route-damp-reuse\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-damp-max-ms") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &damp.max_suppress_ms) != 0 || damp.max_suppress_ms > SF_DAMP_MAX_MS) {
+                fprintf(stderr, "invalid --route-damp-max-ms (1..%u)\n", SF_DAMP_MAX_MS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-coalesce-ms") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &damp.coalesce_ms) != 0 || damp.coalesce_ms > SF_DAMP_MAX_MS) {
+                fprintf(stderr, "invalid --route-coalesce-ms (1..%u)\n", SF_DAMP_MAX_MS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--fib-compress") == 0) {
+            fib_compress = 1;
+        } else if (strcmp(argv[i], "--route-cache") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &route_cache) != 0 || route_cache > SF_ROUTE_CACHE_MAX_ENTRIES) {
+                fprintf(stderr, "invalid --route-cache (1..%u)\n", SF_ROUTE_CACHE_MAX_ENTRIES);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--route-bloom-fpr") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            route_bloom_fpr = strtod(argv[++i], &end);
+            if (!end || *end != '\0' || !(route_bloom_fpr > 0.0) || route_bloom_fpr > SF_ROUTE_BLOOM_MAX_FPR) {
+                fprintf(stderr, "invalid --route-bloom-fpr (above 0, at most %g)\n", SF_ROUTE_BLOOM_MAX_FPR);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--snapshot-out") == 0 && i + 1 < argc) {
+            opts.snapshot_out = argv[++i];
+        } else if (strcmp(argv[i], "--offload-min-routes") == 0 && i + 1 < argc) {
+            if (parse_u32_pos(argv[++i], &opts.offload_min_routes) != 0) {
+                fprintf(stderr, "invalid --offload-min-routes\n");
+                return 2;
+            }
         } else if (strcmp(argv[i], "--route") == 0 && i + 4 < argc) {
             /* --route <prefix> <maskBits> <nextHop> <metric> */
             const char *prefix_s = argv[++i];
@@ -82,6 +361,30 @@ int main(int argc, char **argv) {
             e.metric = metric;
             e.next_hop_be = nh.s_addr;
             sf_route_table_upsert(sf_routing_table(), &e);
+        } else if (strcmp(argv[i], "--route6") == 0 && i + 4 < argc) {
+            /* --route6 <prefix> <maskBits> <nextHop> <metric> */
+            const char *prefix_s = argv[++i];
+            const char *mask_s = argv[++i];
+            const char *nh_s = argv[++i];
+            const char *metric_s = argv[++i];
+
+            sf_route6_entry_t e;
+            memset(&e, 0, sizeof(e));
+            if (inet_pton(AF_INET6, prefix_s, e.prefix) != 1 || inet_pton(AF_INET6, nh_s, e.next_hop) != 1) {
+                fprintf(stderr, "invalid --route6 ip\n");
+                return 2;
+            }
+            if (parse_u16_metric(metric_s, &e.metric) != 0) {
+                fprintf(stderr, "invalid --route6 metric\n");
+                return 2;
+            }
+            int mask_bits = atoi(mask_s);
+            if (mask_bits < 0 || mask_bits > 128) {
+                fprintf(stderr, "invalid --route6 mask\n");
+                return 2;
+            }
+            e.mask_bits = (uint8_t)mask_bits;
+            sf_route6_table_upsert(sf_routing_table6(), &e);
         }
     }
 
@@ -89,12 +392,156 @@ int main(int argc, char **argv) {
         return sf_stack_self_test();
     }
 
+    if (follow_host[0] && wal_path) {
+        /* A follower's table is the leader's; it resyncs rather than replays. */
+        fprintf(stderr, "--follow and --wal are exclusive\n");
+        return 2;
+    }
+    if (follow_host[0] && route_ttl_ms) {
+        /* Routes age out on the leader; followers get the withdrawals. */
+        fprintf(stderr, "--follow and --route-ttl-ms are exclusive\n");
+        return 2;
+    }
+    if (follow_host[0] && (damp.half_life_ms || damp.coalesce_ms)) {
+        /* Followers take no ROUTE_UPDATE; the leader's stream is already dampened. */
+        fprintf(stderr, "--follow and --route-damp-*/--route-coalesce-ms are exclusive\n");
+        return 2;
+    }
+
+    if (wal_path) {
+        /* The log's own compaction snapshot is the default base to replay it on. */
+        snprintf(wal_snapshot, sizeof(wal_snapshot), "%s.snap", wal_path);
+        if (!snapshot_in && !routes_file && access(wal_snapshot, F_OK) == 0) snapshot_in = wal_snapshot;
+    }
+
+    if (snapshot_in) {
+        /* Mapped, not parsed: --route flags are applied on top of it. */
+        sf_route_table_t rt;
+        sf_route_table_init(&rt);
+        uint64_t seq = 0;
+        if (sf_snapshot_load(snapshot_in, &rt, &seq) != 0 || sf_routing_adopt(&rt, seq) != 0) {
+            fprintf(stderr, "cannot load --snapshot-in %s\n", snapshot_in);
+            sf_route_table_free(&rt);
+            return 1;
+        }
+        printf("loaded %zu routes from %s\n", sf_route_table_count(sf_routing_table()), snapshot_in);
+    }
+
+    if (routes_file) {
+        /* Parsed in parallel and built in one pass; --route flags are applied on top. */
+        if (snapshot_in) {
+            fprintf(stderr, "--routes-file and --snapshot-in are exclusive\n");
+            return 2;
+        }
+        char err[128] = "cannot install routes";
+        sf_route_table_t rt;
+        sf_route_table_init(&rt);
+        if (sf_routes_file_load(routes_file, 0, &rt, err, sizeof(err)) != 0 || sf_routing_adopt(&rt, 0) != 0) {
+            fprintf(stderr, "cannot load --routes-file %s: %s\n", routes_file, err);
+            sf_route_table_free(&rt);
+            return 1;
+        }
+        printf("loaded %zu routes from %s\n", sf_route_table_count(sf_routing_table()), routes_file);
+    }
+
     sf_routing_set_strategy(strategy);
+    sf_routing_set_cache(route_cache);
+    sf_stack_set_options(&opts);
 
     if (sf_stack_init(bind, port) != 0) {
         return 1;
     }
+
+    if (wal_path) {
+        /* After a handoff the table is already at the predecessor's sequence and nothing replays. */
+        uint64_t last = 0;
+        long replayed = sf_wal_replay(wal_path, sf_routing_seq(), replay_apply, NULL, &last);
+        if (replayed < 0) {
+            fprintf(stderr, "cannot replay --wal %s\n", wal_path);
+            return 1;
+        }
+        if (replayed) printf("replayed %ld route batches from %s\n", replayed, wal_path);
+        sf_wal_config_t wcfg;
+        memset(&wcfg, 0, sizeof(wcfg));
+        wcfg.snapshot_path = wal_snapshot;
+        wcfg.compact_bytes = (uint64_t)wal_compact_mb << 20;
+        wcfg.compact = wal_compact;
+        wcfg.start_seq = sf_routing_seq();
+        if (sf_wal_open(wal_path, &wcfg) != 0) {
+            fprintf(stderr, "cannot open --wal %s\n", wal_path);
+            return 1;
+        }
+    }
+
+    /* Every engine can lead, followers included (they relay the leader's stream). */
+    sf_repl_leader_config_t lcfg;
+    lcfg.backlog_bytes = (size_t)repl_backlog_mb << 20;
+    lcfg.export_routes = sf_routing_export;
+    if (sf_repl_leader_init(&lcfg) != 0) {
+        fprintf(stderr, "cannot allocate --repl-backlog-mb %u\n", repl_backlog_mb);
+        return 1;
+    }
+    sf_routing_set_sink(route_sink);
+
+    if (damp.half_life_ms || damp.coalesce_ms) {
+        if (sf_routing_set_damping(&damp) != 0) {
+            fprintf(stderr, "invalid dampening: need 0 < --route-damp-reuse < --route-damp-suppress, "
+                            "and --route-damp-max-ms long enough to ever suppress\n");
+            return 2;
+        }
+    }
+    if (route_ttl_ms && sf_routing_set_ttl(route_ttl_ms) != 0) {
+        /* Indexed once everything is loaded. */
+        fprintf(stderr, "cannot start --route-ttl-ms\n");
+        return 1;
+    }
+    if (fib_compress) {
+        /* Built from the loaded table, then kept in step with every change. */
+        if (sf_routing_set_fib(1) != 0) {
+            fprintf(stderr, "cannot build --fib-compress\n");
+            return 1;
+        }
+        printf("fib: %zu of %zu routes\n", sf_routing_fib_count(), sf_route_table_count(sf_routing_table()));
+    }
+    if (route_bloom_fpr > 0.0 && sf_routing_set_bloom(route_bloom_fpr) != 0) {
+        /* After the FIB: the filters go on whichever table lookups use. */
+        fprintf(stderr, "cannot build --route-bloom-fpr\n");
+        return 1;
+    }
+    if (route_ttl_ms || damp.half_life_ms || damp.coalesce_ms) {
+        /* Ticks run at a tenth of the TTL or half-life and half the window, at most every 100 ms. */
+        uint32_t tick_ms = 100;
+        if (route_ttl_ms && route_ttl_ms / 10 < tick_ms) tick_ms = route_ttl_ms / 10;
+        if (damp.half_life_ms && damp.half_life_ms / 10 < tick_ms) tick_ms = damp.half_life_ms / 10;
+        if (damp.coalesce_ms && damp.coalesce_ms / 2 < tick_ms) tick_ms = damp.coalesce_ms / 2;
+        if (tick_ms == 0) tick_ms = 1;
+        if (sf_expiry_ticker_start(tick_ms, route_tick) != 0) {
+            fprintf(stderr, "cannot start the route ticker\n");
+            return 1;
+        }
+    }
+
+    if (follow_host[0]) {
+        sf_repl_follow_config_t fcfg;
+        memset(&fcfg, 0, sizeof(fcfg));
+        fcfg.host = follow_host;
+        fcfg.port = follow_port;
+        fcfg.retry_ms = 200;
+        fcfg.apply = follow_apply;
+        fcfg.replace = sf_routing_replace;
+        if (sf_repl_follow_start(&fcfg) != 0) {
+            fprintf(stderr, "cannot start --follow %s:%u\n", follow_host, follow_port);
+            return 1;
+        }
+    }
+
     printf("SentryFlow firmware starting main loop (%s:%u)\n", bind, port);
-    return sf_stack_run();
+    int rc = sf_stack_run();
+    sf_repl_follow_stop();
+    sf_expiry_ticker_stop();
+    sf_routing_set_sink(NULL);
+    sf_wal_close();
+    sf_repl_leader_shutdown();
+    return rc;
 }
 
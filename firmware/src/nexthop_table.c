@@ -0,0 +1,446 @@
+#include "nexthop_table.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t sf_nh_flow_hash(const void *key, size_t len) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 16777619u;
+    return mix32(h ^ (uint32_t)len);
+}
+
+void sf_nh_table_init(sf_nh_table_t *nh) {
+    if (nh) memset(nh, 0, sizeof(*nh));
+}
+
+void sf_nh_table_free(sf_nh_table_t *nh) {
+    if (!nh) return;
+    free(nh->groups);
+    free(nh->hops);
+    free(nh->index);
+    sf_nh_table_init(nh);
+}
+
+size_t sf_nh_table_count(const sf_nh_table_t *nh) {
+    return nh ? nh->live : 0;
+}
+
+/* Sorts members by next hop and merges repeats into out, as hops with
+   running weight bounds. Returns the member count or -1. */
+static int canonical(const sf_nh_member_t *m, size_t n, sf_nh_hop_t *out) {
+    if (!m || n == 0 || n > SF_NH_GROUP_MAX) return -1;
+    sf_nh_member_t s[SF_NH_GROUP_MAX];
+    for (size_t i = 0; i < n; ++i) {
+        sf_nh_member_t v = m[i];
+        if (v.weight == 0) v.weight = 1;
+        size_t j = i;
+        while (j && ntohl(s[j - 1].next_hop_be) > ntohl(v.next_hop_be)) {
+            s[j] = s[j - 1];
+            j--;
+        }
+        s[j] = v;
+    }
+    int k = 0;
+    uint32_t bound = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t w = s[i].weight;
+        if (k && out[k - 1].next_hop_be == s[i].next_hop_be) {
+            uint32_t prev = k > 1 ? out[k - 2].bound : 0;
+            if (out[k - 1].bound - prev + w > 0xFFFFu) w = 0xFFFFu - (out[k - 1].bound - prev);
+            out[k - 1].bound += w;
+            bound += w;
+            continue;
+        }
+        bound += w;
+        out[k].next_hop_be = s[i].next_hop_be;
+        out[k].bound = bound;
+        k++;
+    }
+    return k;
+}
+
+static uint32_t hops_hash(const sf_nh_hop_t *h, uint32_t count) {
+    uint32_t x = 0x9E3779B9u ^ count;
+    for (uint32_t i = 0; i < count; ++i) x = mix32(x ^ h[i].next_hop_be) + h[i].bound;
+    return mix32(x);
+}
+
+static int same_hops(const sf_nh_table_t *nh, const sf_nh_group_t *g, const sf_nh_hop_t *h, uint32_t count) {
+    return g->count == count && memcmp(&nh->hops[g->first], h, count * sizeof(*h)) == 0;
+}
+
+static void index_put(sf_nh_table_t *nh, uint32_t id) {
+    size_t i = nh->groups[id].hash & (nh->index_cap - 1);
+    while (nh->index[i]) i = (i + 1) & (nh->index_cap - 1);
+    nh->index[i] = id;
+}
+
+/* Sizes the index for live + 1 groups and refills it. */
+static int index_rebuild(sf_nh_table_t *nh) {
+    size_t cap = 16;
+    while (cap < 2 * ((size_t)nh->live + 1)) cap *= 2;
+    uint32_t *index = (uint32_t *)calloc(cap, sizeof(*index));
+    if (!index) return -1;
+    free(nh->index);
+    nh->index = index;
+    nh->index_cap = cap;
+    for (uint32_t id = 1; id < nh->group_used; ++id) {
+        if (nh->groups[id].count) index_put(nh, id);
+    }
+    return 0;
+}
+
+static uint32_t index_find(const sf_nh_table_t *nh, const sf_nh_hop_t *h, uint32_t count, uint32_t hash) {
+    if (!nh->index_cap) return 0;
+    for (size_t i = hash & (nh->index_cap - 1); nh->index[i]; i = (i + 1) & (nh->index_cap - 1)) {
+        const sf_nh_group_t *g = &nh->groups[nh->index[i]];
+        if (g->hash == hash && same_hops(nh, g, h, count)) return nh->index[i];
+    }
+    return 0;
+}
+
+/* Copies live members into a fresh array with room for `need` more. */
+static int hops_compact(sf_nh_table_t *nh, uint32_t need) {
+    uint32_t cap = 64;
+    while (cap < nh->hop_used - nh->hop_dead + need) cap *= 2;
+    sf_nh_hop_t *hops = (sf_nh_hop_t *)malloc(cap * sizeof(*hops));
+    if (!hops) return -1;
+    uint32_t used = 0;
+    for (uint32_t id = 1; id < nh->group_used; ++id) {
+        sf_nh_group_t *g = &nh->groups[id];
+        if (!g->count) continue;
+        memcpy(&hops[used], &nh->hops[g->first], g->count * sizeof(*hops));
+        g->first = used;
+        used += g->count;
+    }
+    free(nh->hops);
+    nh->hops = hops;
+    nh->hop_cap = cap;
+    nh->hop_used = used;
+    nh->hop_dead = 0;
+    return 0;
+}
+
+static int hops_reserve(sf_nh_table_t *nh, uint32_t need) {
+    if (nh->hop_used + need <= nh->hop_cap) return 0;
+    if (nh->hop_dead >= nh->hop_used / 2) return hops_compact(nh, need);
+    uint32_t cap = nh->hop_cap ? nh->hop_cap : 64;
+    while (cap < nh->hop_used + need) cap *= 2;
+    sf_nh_hop_t *p = (sf_nh_hop_t *)realloc(nh->hops, cap * sizeof(*p));
+    if (!p) return -1;
+    nh->hops = p;
+    nh->hop_cap = cap;
+    return 0;
+}
+
+static int groups_reserve(sf_nh_table_t *nh, uint32_t used) {
+    if (used <= nh->group_cap) return 0;
+    uint32_t cap = nh->group_cap ? nh->group_cap : 64;
+    while (cap < used) cap *= 2;
+    sf_nh_group_t *p = (sf_nh_group_t *)realloc(nh->groups, cap * sizeof(*p));
+    if (!p) return -1;
+    memset(p + nh->group_cap, 0, (cap - nh->group_cap) * sizeof(*p));
+    nh->groups = p;
+    nh->group_cap = cap;
+    return 0;
+}
+
+static void group_release(sf_nh_table_t *nh, uint32_t id) {
+    sf_nh_group_t *g = &nh->groups[id];
+    uint8_t gen = (uint8_t)((g->gen + 1u) & SF_NH_GEN_MASK);
+    nh->hop_dead += g->count;
+    nh->live--;
+    memset(g, 0, sizeof(*g));
+    g->first = nh->free_group;
+    g->gen = gen;
+    nh->free_group = id;
+}
+
+/* Drops groups no route uses that were already there at the previous
+   collection. Returns the number dropped. */
+static uint32_t collect(sf_nh_table_t *nh) {
+    uint32_t dropped = 0;
+    for (uint32_t id = 1; id < nh->group_used; ++id) {
+        sf_nh_group_t *g = &nh->groups[id];
+        if (!g->count) continue;
+        if (!g->refs && !g->fresh) {
+            group_release(nh, id);
+            dropped++;
+        } else {
+            g->fresh = 0;
+        }
+    }
+    if (dropped) index_rebuild(nh);
+    return dropped;
+}
+
+static void group_store(sf_nh_table_t *nh, uint32_t id, const sf_nh_hop_t *h, uint32_t count, uint32_t hash) {
+    sf_nh_group_t *g = &nh->groups[id];
+    memcpy(&nh->hops[nh->hop_used], h, count * sizeof(*h));
+    g->first = nh->hop_used;
+    g->count = (uint16_t)count;
+    g->hash = hash;
+    g->fresh = 1;
+    nh->hop_used += count;
+    nh->live++;
+}
+
+int sf_nh_define(sf_nh_table_t *nh, const sf_nh_member_t *m, size_t n, uint32_t *id, int *created) {
+    sf_nh_hop_t h[SF_NH_GROUP_MAX];
+    int count = nh && id ? canonical(m, n, h) : -1;
+    if (count < 0) return -1;
+    uint32_t hash = hops_hash(h, (uint32_t)count);
+    uint32_t x = index_find(nh, h, (uint32_t)count, hash);
+    if (created) *created = !x;
+    if (x) {
+        nh->groups[x].fresh = 1;
+        *id = sf_nh_id(nh, x);
+        return 0;
+    }
+
+    if (!nh->free_group && nh->group_used == nh->group_cap && nh->live) collect(nh);
+    if (!nh->free_group && nh->group_used > SF_NH_SLOT_MASK) return -1;
+    if (!nh->free_group && groups_reserve(nh, nh->group_used ? nh->group_used + 1 : 2) != 0) return -1;
+    if ((nh->live + 1) * 2 > nh->index_cap && index_rebuild(nh) != 0) return -1;
+    if (hops_reserve(nh, (uint32_t)count) != 0) return -1;
+    if (nh->free_group) {
+        x = nh->free_group;
+        nh->free_group = nh->groups[x].first;
+    } else {
+        if (!nh->group_used) nh->group_used = 1;
+        x = nh->group_used++;
+    }
+    group_store(nh, x, h, (uint32_t)count, hash);
+    index_put(nh, x);
+    *id = sf_nh_id(nh, x);
+    return 0;
+}
+
+int sf_nh_define_at(sf_nh_table_t *nh, uint32_t id, const sf_nh_member_t *m, size_t n) {
+    sf_nh_hop_t h[SF_NH_GROUP_MAX];
+    uint32_t gen = id >> SF_NH_SLOT_BITS;
+    id &= SF_NH_SLOT_MASK;
+    int count = nh && id && gen <= SF_NH_GEN_MASK ? canonical(m, n, h) : -1;
+    if (count < 0) return -1;
+    if (groups_reserve(nh, id + 1) != 0 || hops_reserve(nh, (uint32_t)count) != 0) return -1;
+    if (!nh->group_used) nh->group_used = 1;
+    while (nh->group_used <= id) {
+        uint32_t x = nh->group_used++;
+        nh->groups[x].first = nh->free_group;
+        nh->free_group = x;
+    }
+    sf_nh_group_t *g = &nh->groups[id];
+    uint32_t refs = g->refs;
+    if (g->count) {
+        nh->hop_dead += g->count;
+        nh->live--;
+    } else {
+        /* Take it off the free list. */
+        for (uint32_t *link = &nh->free_group; *link; link = &nh->groups[*link].first) {
+            if (*link == id) {
+                *link = g->first;
+                break;
+            }
+        }
+    }
+    group_store(nh, id, h, (uint32_t)count, hops_hash(h, (uint32_t)count));
+    g->refs = refs;
+    g->gen = (uint8_t)gen;
+    return index_rebuild(nh);
+}
+
+int sf_nh_valid(const sf_nh_table_t *nh, uint32_t id) {
+    uint32_t slot = id & SF_NH_SLOT_MASK;
+    return nh && slot && slot < nh->group_used && nh->groups[slot].count != 0 &&
+           nh->groups[slot].gen == id >> SF_NH_SLOT_BITS;
+}
+
+uint32_t sf_nh_id(const sf_nh_table_t *nh, uint32_t slot) {
+    if (!nh || !slot || slot >= nh->group_used || !nh->groups[slot].count) return 0;
+    return slot | (uint32_t)nh->groups[slot].gen << SF_NH_SLOT_BITS;
+}
+
+void sf_nh_ref(sf_nh_table_t *nh, uint32_t id) {
+    if (sf_nh_valid(nh, id)) nh->groups[id & SF_NH_SLOT_MASK].refs++;
+}
+
+void sf_nh_unref(sf_nh_table_t *nh, uint32_t id) {
+    if (sf_nh_valid(nh, id) && nh->groups[id & SF_NH_SLOT_MASK].refs) nh->groups[id & SF_NH_SLOT_MASK].refs--;
+}
+
+uint32_t sf_nh_select(const sf_nh_table_t *nh, uint32_t id, uint32_t flow_hash) {
+    if (!sf_nh_valid(nh, id)) return 0;
+    const sf_nh_group_t *g = &nh->groups[id & SF_NH_SLOT_MASK];
+    const sf_nh_hop_t *h = &nh->hops[g->first];
+    uint32_t pick = (uint32_t)(((uint64_t)flow_hash * h[g->count - 1].bound) >> 32);
+    uint32_t lo = 0, hi = g->count - 1u;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (h[mid].bound > pick) hi = mid;
+        else lo = mid + 1;
+    }
+    return h[lo].next_hop_be;
+}
+
+size_t sf_nh_members(const sf_nh_table_t *nh, uint32_t id, sf_nh_member_t *out) {
+    if (!sf_nh_valid(nh, id) || !out) return 0;
+    const sf_nh_group_t *g = &nh->groups[id & SF_NH_SLOT_MASK];
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < g->count; ++i) {
+        const sf_nh_hop_t *h = &nh->hops[g->first + i];
+        out[i].next_hop_be = h->next_hop_be;
+        out[i].weight = (uint16_t)(h->bound - prev);
+        out[i].reserved = 0;
+        prev = h->bound;
+    }
+    return g->count;
+}
+
+int sf_nh_table_load(sf_nh_table_t *nh, const sf_nh_group_t *groups, uint32_t group_used, uint32_t free_group,
+                     const sf_nh_hop_t *hops, uint32_t hop_used) {
+    if (!nh || (group_used && (!groups || group_used > SF_NH_SLOT_MASK + 1u)) || (hop_used && !hops)) return -1;
+    if (free_group >= (group_used ? group_used : 1)) return -1;
+    uint32_t live = 0, members = 0;
+    for (uint32_t id = 1; id < group_used; ++id) {
+        const sf_nh_group_t *g = &groups[id];
+        if (g->gen > SF_NH_GEN_MASK) return -1;
+        if (!g->count) continue;
+        if (g->count > SF_NH_GROUP_MAX || g->first > hop_used || hop_used - g->first < g->count) return -1;
+        for (uint32_t i = 0, prev = 0; i < g->count; prev = hops[g->first + i].bound, ++i) {
+            if (hops[g->first + i].bound <= prev) return -1;
+        }
+        live++;
+        members += g->count;
+    }
+    uint32_t steps = 0;
+    for (uint32_t x = free_group; x; x = groups[x].first) {
+        if (x >= group_used || groups[x].count || ++steps > group_used) return -1;
+    }
+
+    sf_nh_table_t t;
+    sf_nh_table_init(&t);
+    if (groups_reserve(&t, group_used) != 0 || hops_reserve(&t, hop_used) != 0) {
+        sf_nh_table_free(&t);
+        return -1;
+    }
+    if (group_used) memcpy(t.groups, groups, group_used * sizeof(*groups));
+    if (hop_used) memcpy(t.hops, hops, hop_used * sizeof(*hops));
+    t.group_used = group_used;
+    t.free_group = free_group;
+    t.live = live;
+    t.hop_used = hop_used;
+    t.hop_dead = hop_used - members;
+    if (index_rebuild(&t) != 0) {
+        sf_nh_table_free(&t);
+        return -1;
+    }
+    sf_nh_table_free(nh);
+    *nh = t;
+    return 0;
+}
+
+static sf_nh_member_t test_member(uint32_t next_hop, uint16_t weight) {
+    sf_nh_member_t m;
+    memset(&m, 0, sizeof(m));
+    m.next_hop_be = htonl(next_hop);
+    m.weight = weight;
+    return m;
+}
+
+int sf_nh_table_self_test(void) {
+    sf_nh_table_t nh;
+    sf_nh_table_init(&nh);
+    sf_nh_member_t a[3] = {test_member(0x0A000003u, 1), test_member(0x0A000001u, 1), test_member(0x0A000002u, 2)};
+    sf_nh_member_t b[4] = {test_member(0x0A000002u, 1), test_member(0x0A000001u, 0), test_member(0x0A000003u, 1),
+                           test_member(0x0A000002u, 1)};
+    uint32_t ia = 0, ib = 0, ic = 0;
+    int created = 0;
+    /* The same members in another order, with a repeat and a default weight, are the same group. */
+    if (sf_nh_define(&nh, a, 3, &ia, &created) != 0 || !created) return -1;
+    if (sf_nh_define(&nh, b, 4, &ib, &created) != 0 || created || ib != ia) return -1;
+    sf_nh_member_t got[SF_NH_GROUP_MAX];
+    if (sf_nh_members(&nh, ia, got) != 3 || got[0].next_hop_be != htonl(0x0A000001u) || got[1].weight != 2) return -1;
+
+    /* Weights hold within a few percent, and a flow always gets the same member. */
+    uint32_t hits[3] = {0, 0, 0};
+    for (uint32_t f = 0; f < 40000; ++f) {
+        uint32_t h = sf_nh_flow_hash(&f, sizeof(f));
+        uint32_t hop = sf_nh_select(&nh, ia, h);
+        if (hop != sf_nh_select(&nh, ia, h)) return -1;
+        uint32_t k = ntohl(hop) - 0x0A000001u;
+        if (k > 2) return -1;
+        hits[k]++;
+    }
+    if (hits[0] < 9000 || hits[0] > 11000 || hits[1] < 19000 || hits[1] > 21000) return -1;
+
+    /* Adding a member moves flows by at most one member. */
+    sf_nh_member_t c[4] = {a[0], a[1], a[2], test_member(0x0A000004u, 1)};
+    if (sf_nh_define(&nh, c, 4, &ic, &created) != 0 || !created || ic == ia) return -1;
+    for (uint32_t f = 0; f < 10000; ++f) {
+        uint32_t h = sf_nh_flow_hash(&f, sizeof(f));
+        uint32_t before = sf_nh_select(&nh, ia, h), after = sf_nh_select(&nh, ic, h);
+        if (before != after && after != htonl(0x0A000004u) && ntohl(before) + 1 != ntohl(after)) return -1;
+    }
+
+    sf_nh_member_t big[SF_NH_GROUP_MAX + 1];
+    for (uint32_t i = 0; i <= SF_NH_GROUP_MAX; ++i) big[i] = test_member(0xC0A80000u + i, 1);
+    if (sf_nh_define(&nh, big, SF_NH_GROUP_MAX + 1, &ib, NULL) != -1) return -1;
+    if (sf_nh_define(&nh, big, 0, &ib, NULL) != -1 || sf_nh_select(&nh, 999, 1) != 0) return -1;
+
+    /* Unused groups go once the table fills, but not the ones just defined;
+       the id of one that went is refused rather than naming its successor. */
+    sf_nh_ref(&nh, ia);
+    uint32_t ids[500];
+    for (uint32_t i = 0; i < 500; ++i) {
+        big[0] = test_member(0xAC100000u + i, 1);
+        if (sf_nh_define(&nh, big, 1, &ids[i], NULL) != 0 || !sf_nh_valid(&nh, ids[i])) return -1;
+    }
+    if (!sf_nh_valid(&nh, ia) || sf_nh_table_count(&nh) >= 500) return -1;
+    uint32_t stale = 0;
+    for (uint32_t i = 0; i < 500; ++i) {
+        if (!sf_nh_valid(&nh, ids[i])) {
+            if (sf_nh_select(&nh, ids[i], 1) != 0 || sf_nh_members(&nh, ids[i], got) != 0) return -1;
+            stale++;
+        } else if (sf_nh_members(&nh, ids[i], got) != 1 || got[0].next_hop_be != htonl(0xAC100000u + i)) {
+            return -1;
+        }
+    }
+    if (stale == 0 || stale >= 500) return -1;
+    big[0] = test_member(0xAC100000u, 1);
+    if (sf_nh_define(&nh, big, 1, &ib, &created) != 0 || !created) return -1;
+    sf_nh_unref(&nh, ia);
+
+    /* Explicit ids (replay) and a saved copy agree with the original. */
+    sf_nh_table_t r, copy;
+    sf_nh_table_init(&r);
+    sf_nh_table_init(&copy);
+    int ok = sf_nh_define_at(&r, 7, a, 3) == 0 && sf_nh_define_at(&r, 3, c, 4) == 0 && sf_nh_valid(&r, 7) &&
+             !sf_nh_valid(&r, 5) && sf_nh_define(&r, b, 4, &ib, &created) == 0 && ib == 7 && !created &&
+             sf_nh_define(&r, big, 1, &ib, NULL) == 0 && ib != 3 && ib != 7 && ib < 7;
+    if (ok) ok = sf_nh_define_at(&r, 7, big, 1) == 0 && sf_nh_members(&r, 7, got) == 1;
+    /* A leader's id from a reused slot replaces the slot under its generation. */
+    uint32_t reused = 7u | 3u << SF_NH_SLOT_BITS;
+    if (ok) ok = sf_nh_define_at(&r, reused, a, 3) == 0 && sf_nh_valid(&r, reused) && !sf_nh_valid(&r, 7) &&
+                 sf_nh_id(&r, 7) == reused && sf_nh_define_at(&r, 7u | 0x80u << SF_NH_SLOT_BITS, a, 3) == -1;
+    if (ok) ok = sf_nh_table_load(&copy, r.groups, r.group_used, r.free_group, r.hops, r.hop_used) == 0 &&
+                 sf_nh_table_count(&copy) == sf_nh_table_count(&r) && sf_nh_select(&copy, 3, 12345u) == sf_nh_select(&r, 3, 12345u);
+    if (ok) {
+        r.hops[r.groups[3].first + 1].bound = 0;
+        ok = sf_nh_table_load(&copy, r.groups, r.group_used, r.free_group, r.hops, r.hop_used) == -1;
+    }
+    sf_nh_table_free(&copy);
+    sf_nh_table_free(&r);
+    sf_nh_table_free(&nh);
+    return ok ? 0 : -1;
+}
@@ -1,27 +1,68 @@
+#define _GNU_SOURCE
+
 #include "platform_linux.h"
 #include "protocol_stack.h"
 #include "routing.h"
+#include "sf_handoff.h"
+#include "sf_snapshot.h"
+#include "sf_wal.h"
+#include "sf_repl.h"
+#include "sf_route_pack.h"
 #include "routing_table.h"
 #include "sf_commands.h"
 #include "sf_protocol.h"
+#include "sf_admission.h"
+#include "sf_sched.h"
+#include "sf_workpool.h"
 #include "hal.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
 #define SF_EP_SERVER ((void*)1)
+#define SF_EP_COMPLETION ((void*)2)
+#define SF_EP_HANDOFF ((void*)3)
+#define SF_EP_HANDOFF_DONE ((void*)4)
+
+#define SF_CACHE_LINE 64u
+#define SF_CONN_SLAB  16u   /* connections carved out of one slab allocation */
 
-static int server_fd = -1;
-static sf_request_stats_t g_stats = {0};
+static sf_stack_options_t g_opts;
+static int g_opts_set = 0;
+static unsigned g_nreactors = 1;
+static int g_listen_fds[SF_MAX_REACTORS];
+static pthread_t g_reactor_threads[SF_MAX_REACTORS];
+
+/* Restart handoff: reactor 0 serves the Unix socket; once a successor has the
+   listeners every reactor stops accepting and exits when its connections drain. */
+static int g_handoff_fd = -1;
+/* A handoff in progress runs on its own thread (syncing the log, writing the
+   snapshot and waiting on the successor would stall reactor 0) and posts its
+   result on this eventfd. */
+static int g_handoff_done_fd = -1;
+static pthread_t g_handoff_thread;
+static int g_handoff_cfd = -1;
+static int g_handoff_ok;
+static size_t g_handoff_routes;
+static atomic_int g_draining;
+static double g_drain_deadline_ms;
 
 static double now_ms(void) {
     struct timespec ts;
@@ -47,15 +88,158 @@ static uint64_t htonll_u64(uint64_t x) {
 #endif
 }
 
+/* Largest request payload handled and largest reply payload produced. */
+#define SF_MAX_PAYLOAD 4096u
+#define SF_MAX_REPLY   2048u
+
+/* Worst-case encoded response; decoding stops while tx cannot hold another one. */
+#define SF_MAX_RESPONSE (SF_PROTO_HEADER_LEN + SF_MAX_REPLY)
+
+typedef struct sf_reply {
+    uint8_t  type;
+    size_t   len;
+    uint8_t  payload[SF_MAX_REPLY];
+    uint64_t routes_installed;
+    uint64_t log_seq;         /* mutation sequence of an applied route change; acked once durable */
+} sf_reply_t;
+
+/* Largest ROUTE_UPDATE transaction, in routes. */
+#define SF_TXN_MAX_ROUTES (1u << 20)
+/* Room all open transactions may hold together, in routes; staging past it
+   is answered "busy". */
+#define SF_TXN_STAGED_MAX_ROUTES (1u << 22)
+
+/* Routes staged by a connection's open ROUTE_UPDATE transaction. */
+typedef struct sf_txn {
+    sf_route_entry_t *entries;
+    size_t   n;
+    size_t   cap;
+    int      conditional;     /* commit only at if_version */
+    uint64_t if_version;
+    int      failed;          /* a frame was rejected: refuse the rest of the transaction */
+} sf_txn_t;
+
+/* A reply sent in several frames with the same seq (ROUTE_QUERY_REPLY,
+   ROUTE_DUMP_REPLY): each carries the version and as many route records as
+   fit, and all but the last are flagged MORE. Frames are produced as tx
+   drains, one buffer's worth per reactor pass, so a large answer never sits
+   encoded in memory and never holds up the reactor's other connections. */
+typedef struct sf_stream {
+    int       active;
+    uint8_t   type;
+    uint16_t  flags;          /* PACKED: ROUTE_DUMP_REPLY records are a packed block */
+    uint32_t  seq;
+    uint64_t  version;
+    sf_route_entry_t *routes;  /* owned */
+    size_t    n;
+    size_t    pos;
+} sf_stream_t;
+
+/* Most routes one ROUTE_UPDATE frame can carry (packed, at 4 bytes a route). */
+#define SF_MAX_FRAME_ROUTES (SF_MAX_PAYLOAD / SF_ROUTE_PACK_MIN_RECORD)
+
+/* Route records per streamed frame, after the version. */
+#define SF_STREAM_RECORDS ((SF_MAX_REPLY - 8) / 16)
+
+/* Covered queries for prefixes shorter than this may copy much of the table
+   (0.0.0.0/0 copies all of it) and run on the worker pool. */
+#define SF_QUERY_INLINE_MASK 24u
+
+struct sf_reactor;
+
 typedef struct sf_conn {
+    sf_sched_item_t sched;    /* lane membership while a complete frame is buffered */
+    struct sf_reactor *r;     /* owning reactor; the connection never migrates */
+    struct sf_conn *free_next;
+    struct sf_conn *live_prev; /* reactor's list of open connections, for draining */
+    struct sf_conn *live_next;
     int       fd;
     sf_rxbuf_t rx;
     uint8_t   tx[8192];
     size_t    tx_len;
     size_t    tx_off;
-    char      remote_addr[64];
+    uint32_t  ep_events;      /* interest currently registered with epoll */
+    double    ready_ms;       /* when the buffered input became ready (admission delay origin) */
+    struct sf_offload *inflight; /* frame being handled on the worker pool, if any */
+    int       closed;         /* fd already closed; freed once the in-flight frame completes */
+    int       rd_closed;      /* peer sent FIN: what it sent is still answered before closing */
+    uint64_t  tx_hold_seq;    /* tx is not sent before this WAL sequence is durable */
+    sf_task_t durable;        /* posted by the WAL writer once tx_hold_seq is durable */
+    int       durable_parked;
+    int       subscribed;     /* a follower: output is the replication stream */
+    int       repl_parked;
+    sf_repl_sub_t repl;
+    sf_task_t repl_task;      /* posted by the backlog when new batches are published */
+    sf_txn_t  txn;
+    sf_stream_t stream;       /* while active, no further frames are served */
 } sf_conn_t;
 
+/* A frame handed to the worker pool. The connection is not served again until
+   it completes, which keeps responses in per-connection order. */
+typedef struct sf_offload {
+    sf_task_t  task;
+    sf_conn_t *conn;
+    sf_frame_t frame;
+    double     start_ms;
+    size_t     payload_len;
+    uint8_t    payload[SF_MAX_PAYLOAD];
+    sf_route_entry_t *txn;    /* a transaction to commit instead of the frame; owned */
+    size_t     txn_n;
+    size_t     txn_cap;       /* its share of the staging budget */
+    int        conditional;
+    uint64_t   if_version;
+    sf_reply_t reply;
+    sf_stream_t stream;       /* ROUTE_DUMP: the stream to start instead of sending reply */
+    sf_repl_sub_t repl;       /* REPL_SUBSCRIBE: the subscription to start instead, when subscribed */
+    int        subscribed;
+} sf_offload_t;
+
+#define SF_CONN_OF(item) ((sf_conn_t *)((char *)(item) - offsetof(sf_conn_t, sched)))
+
+/* Per-reactor counters. Only the owning reactor writes them, with plain relaxed
+   load/store pairs rather than locked read-modify-writes, so the shard's cache
+   line stays on its core; GET_STATS sums all shards. */
+typedef struct sf_stats_shard {
+    _Atomic uint64_t total_requests;
+    _Atomic uint64_t bad_frames;
+    _Atomic uint64_t routes_installed;
+    _Atomic uint64_t shed_requests;
+    _Atomic uint64_t shed_connections;
+    _Atomic uint64_t steer_misses;
+    _Atomic uint64_t busy_poll_hits;    /* wakeups found by spinning instead of sleeping */
+    _Atomic uint64_t busy_poll_spin_us; /* time burnt in the spin window */
+    _Atomic double   last_latency_ms;
+    _Atomic double   avg_latency_ms;
+} sf_stats_shard_t;
+
+/* One event loop. Allocated by its own thread after pinning, so first-touch
+   places it (and the connection slab it carves) on the local NUMA node. */
+typedef struct sf_reactor {
+    _Alignas(SF_CACHE_LINE) sf_stats_shard_t stats;
+    _Alignas(SF_CACHE_LINE) unsigned index;
+    int       cpu;            /* pinned CPU, -1 if unpinned */
+    int       listen_fd;
+    int       epfd;
+    int       cq_fd;
+    sf_completion_queue_t cq;
+    sf_admission_t admission;
+    sf_sched_t sched;
+    double    batch_origin_ms; /* earliest time the current epoll batch could have become ready */
+    sf_conn_t *free_conns;
+    sf_conn_t *live;
+    int       accepting;
+} sf_reactor_t;
+
+static sf_reactor_t *_Atomic g_reactors[SF_MAX_REACTORS];
+
+static void stat_add(_Atomic uint64_t *v, uint64_t d) {
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + d, memory_order_relaxed);
+}
+
+static uint64_t stat_get(_Atomic uint64_t *v) {
+    return atomic_load_explicit(v, memory_order_relaxed);
+}
+
 static int set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags < 0) return -1;
@@ -63,87 +247,455 @@ static int set_nonblocking(int fd) {
     return 0;
 }
 
+/* Lets the kernel poll the device queue from our recv/epoll calls instead of
+   waiting for the interrupt. Values above net.core.busy_read need CAP_NET_ADMIN,
+   so a refusal is reported once and the spin window still applies. */
+static void set_busy_poll(int fd) {
+    static atomic_int warned;
+    if (!g_opts.busy_poll_us) return;
+    int us = (int)g_opts.busy_poll_us;
+    int one = 1;
+    if ((setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0 ||
+         setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) != 0) &&
+        !atomic_exchange(&warned, 1)) {
+        perror("setsockopt SO_BUSY_POLL/SO_PREFER_BUSY_POLL (spinning in user space only)");
+    }
+}
+
+void sf_platform_configure(const sf_stack_options_t *opts) {
+    if (!opts) return;
+    g_opts = *opts;
+    g_opts_set = 1;
+}
+
 int sf_platform_init(void) {
     sf_hal_init();
-    memset(&g_stats, 0, sizeof(g_stats));
+    if (!g_opts_set) sf_stack_default_options(&g_opts);
+    g_nreactors = g_opts.ncpus ? g_opts.ncpus : 1;
+    for (unsigned i = 0; i < SF_MAX_REACTORS; ++i) {
+        g_listen_fds[i] = -1;
+        atomic_store(&g_reactors[i], NULL);
+    }
+
+    if (g_opts.workers > 0 && sf_workpool_start(g_opts.workers) != 0) {
+        fprintf(stderr, "worker pool start failed\n");
+        return -1;
+    }
     return 0;
 }
 
-int sf_platform_listen(const char *bind_addr, uint16_t port) {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
+/* Builds a reuseport program that sends each new connection to the listener of
+   the reactor pinned to the CPU that processed its SYN (cpu % n otherwise). */
+static int attach_cpu_steering(int fd) {
+    struct sock_filter code[2 + 2 * SF_MAX_REACTORS + 2];
+    unsigned n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+    for (unsigned i = 0; i < g_nreactors; ++i) {
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)g_opts.cpus[i], 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, g_nreactors);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+    struct sock_fprog prog;
+    prog.len = (unsigned short)n;
+    prog.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+/* bind_addr is an IPv4 or IPv6 address; an IPv6 listener also takes IPv4
+   peers (as ::ffff:a.b.c.d), so "::" serves both stacks. */
+static int listen_one(const char *bind_addr, uint16_t port, int cpu) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in *a4 = (struct sockaddr_in *)&addr;
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&addr;
+    if (inet_pton(AF_INET, bind_addr, &a4->sin_addr) == 1) {
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(port);
+        addr_len = sizeof(*a4);
+    } else if (inet_pton(AF_INET6, bind_addr, &a6->sin6_addr) == 1) {
+        a6->sin6_family = AF_INET6;
+        a6->sin6_port = htons(port);
+        addr_len = sizeof(*a6);
+    } else {
+        fprintf(stderr, "bind: bad address %s\n", bind_addr);
+        return -1;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
         perror("socket");
         return -1;
     }
 
-    if (set_nonblocking(server_fd) != 0) {
+    if (set_nonblocking(fd) != 0) {
         perror("fcntl");
+        close(fd);
         return -1;
     }
 
     int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = inet_addr(bind_addr);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (g_nreactors > 1) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0) {
+            perror("setsockopt SO_REUSEPORT");
+            close(fd);
+            return -1;
+        }
+    }
+    if (cpu >= 0) {
+        /* Steering hint for kernels that consult it when picking a reuseport socket. */
+        setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+    }
+    set_busy_poll(fd);
+    if (addr.ss_family == AF_INET6) {
+        int v6only = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
 
-    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (bind(fd, (struct sockaddr *)&addr, addr_len) < 0) {
         perror("bind");
+        close(fd);
         return -1;
     }
-    if (listen(server_fd, 128) < 0) {
+    if (listen(fd, 128) < 0) {
         perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Adopts the listeners and routes of a running predecessor. Returns 1 on
+   takeover, 0 if there is none, -1 if its state cannot be used. */
+static int take_over(const char *path) {
+    int fd = sf_handoff_connect(path);
+    if (fd < 0) return 0;
+
+    sf_handoff_state_t st;
+    if (sf_handoff_receive(fd, &st) != 0) {
+        fprintf(stderr, "handoff: bad state from predecessor\n");
+        close(fd);
         return -1;
     }
+    if (st.nfds != g_nreactors) {
+        /* The reuseport group and its steering program are sized for the old reactor count. */
+        fprintf(stderr, "handoff: predecessor has %u listeners, --cpus asks for %u reactors\n", st.nfds,
+                g_nreactors);
+        for (unsigned i = 0; i < st.nfds; ++i) close(st.listen_fds[i]);
+        close(st.state_fd);
+        close(fd);
+        return -1;
+    }
+    /* The predecessor's live table is authoritative: it replaces whatever
+       startup loaded, and its sequence number continues the shared WAL. */
+    sf_route_table_t rt;
+    sf_route_table_init(&rt);
+    uint64_t seq = 0;
+    if (sf_snapshot_map_fd(st.state_fd, &rt, &seq) != 0) {
+        fprintf(stderr, "handoff: cannot load the predecessor's routing snapshot\n");
+        sf_route_table_free(&rt);
+        for (unsigned i = 0; i < st.nfds; ++i) close(st.listen_fds[i]);
+        close(st.state_fd);
+        close(fd);
+        return -1;
+    }
+    sf_routing_replace(&rt, seq);
+    close(st.state_fd);
+    for (unsigned i = 0; i < st.nfds; ++i) {
+        g_listen_fds[i] = st.listen_fds[i];
+        set_nonblocking(g_listen_fds[i]);
+        set_busy_poll(g_listen_fds[i]);
+    }
+    size_t applied = sf_route_table_count(sf_routing_table());
+    int acked = sf_handoff_ack(fd);
+    close(fd);
+    if (acked != 0) {
+        /* The predecessor gave up waiting and keeps serving; both processes now
+           share the listeners, which is harmless. */
+        fprintf(stderr, "handoff: predecessor did not see the acknowledgement\n");
+    }
+    printf("SentryFlow firmware took over %u listener%s and %zu routes via %s\n", g_nreactors,
+           g_nreactors == 1 ? "" : "s", applied, path);
+    return 1;
+}
 
-    printf("SentryFlow firmware (epoll) listening on %s:%u\n", bind_addr, port);
+int sf_platform_listen(const char *bind_addr, uint16_t port) {
+    if (g_opts.handoff_path) {
+        int r = take_over(g_opts.handoff_path);
+        if (r < 0) return -1;
+        g_handoff_fd = sf_handoff_listen(g_opts.handoff_path);
+        if (g_handoff_fd < 0) {
+            perror("handoff socket");
+            return -1;
+        }
+        if (r == 1) return 0;
+    }
+
+    /* One SO_REUSEPORT listener per reactor, bound in reactor order so that the
+       group index matches the reactor index used by the steering program. */
+    for (unsigned i = 0; i < g_nreactors; ++i) {
+        int cpu = g_opts.ncpus ? g_opts.cpus[i] : -1;
+        g_listen_fds[i] = listen_one(bind_addr, port, cpu);
+        if (g_listen_fds[i] < 0) return -1;
+    }
+    if (g_opts.ncpus > 1 && attach_cpu_steering(g_listen_fds[0]) != 0) {
+        perror("setsockopt SO_ATTACH_REUSEPORT_CBPF (falling back to hash steering)");
+    }
+
+    printf("SentryFlow firmware (epoll) listening on %s:%u (%u reactor%s)\n",
+           bind_addr, port, g_nreactors, g_nreactors == 1 ? "" : "s");
     return 0;
 }
 
-static void close_conn(int epfd, sf_conn_t *c) {
-    if (!c) return;
-    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+/* Capacity of every connection's staged transaction, against SF_TXN_STAGED_MAX_ROUTES. */
+static atomic_size_t g_txn_staged;
+
+static void txn_unstage(size_t cap) {
+    if (cap) atomic_fetch_sub_explicit(&g_txn_staged, cap, memory_order_relaxed);
+}
+
+static void txn_reset(sf_txn_t *t) {
+    free(t->entries);
+    txn_unstage(t->cap);
+    memset(t, 0, sizeof(*t));
+}
+
+static sf_conn_t *conn_alloc(sf_reactor_t *r) {
+    if (!r->free_conns) {
+        size_t sz = SF_CONN_SLAB * sizeof(sf_conn_t);
+        sz = (sz + SF_CACHE_LINE - 1) / SF_CACHE_LINE * SF_CACHE_LINE;
+        sf_conn_t *slab = (sf_conn_t *)aligned_alloc(SF_CACHE_LINE, sz);
+        if (!slab) return NULL;
+        /* Slabs are never returned; they stay on this reactor's free list. */
+        for (unsigned i = 0; i < SF_CONN_SLAB; ++i) {
+            slab[i].free_next = r->free_conns;
+            r->free_conns = &slab[i];
+        }
+    }
+    sf_conn_t *c = r->free_conns;
+    r->free_conns = c->free_next;
+    memset(c, 0, sizeof(*c));
+    c->r = r;
+    c->live_next = r->live;
+    if (r->live) r->live->live_prev = c;
+    r->live = c;
+    return c;
+}
+
+static void conn_release(sf_conn_t *c) {
+    sf_reactor_t *r = c->r;
+    txn_reset(&c->txn);
+    free(c->stream.routes);
+    if (c->live_prev) c->live_prev->live_next = c->live_next;
+    else r->live = c->live_next;
+    if (c->live_next) c->live_next->live_prev = c->live_prev;
+    c->free_next = r->free_conns;
+    r->free_conns = c;
+}
+
+/* A closed connection is freed once no worker, WAL writer or backlog still
+   holds one of its tasks; the last completion frees it. */
+static void conn_release_unowned(sf_conn_t *c) {
+    if (!c->inflight && !c->durable_parked && !c->repl_parked) conn_release(c);
+}
+
+static void close_conn(sf_conn_t *c) {
+    if (!c || c->closed) return;
+    sf_sched_remove(&c->r->sched, &c->sched);
+    epoll_ctl(c->r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
     close(c->fd);
-    free(c);
+    c->closed = 1;
+    if (c->subscribed && sf_repl_unsubscribe(&c->repl)) c->repl_parked = 0;
+    conn_release_unowned(c);
 }
 
-static int queue_response(sf_conn_t *c, uint8_t type, uint32_t seq, const uint8_t *payload, size_t payload_len) {
+static int tx_has_room(const sf_conn_t *c) {
+    return sizeof(c->tx) - c->tx_len >= SF_MAX_RESPONSE;
+}
+
+static int queue_frame(sf_conn_t *c, uint8_t type, uint16_t flags, uint32_t seq, const uint8_t *payload,
+                       size_t payload_len) {
     if (!c) return -1;
-    if (c->tx_len != 0) return -1;
+    if (c->tx_off != 0 && sizeof(c->tx) - c->tx_len < SF_PROTO_HEADER_LEN + payload_len) {
+        memmove(c->tx, c->tx + c->tx_off, c->tx_len - c->tx_off);
+        c->tx_len -= c->tx_off;
+        c->tx_off = 0;
+    }
 
     sf_frame_t rf;
     memset(&rf, 0, sizeof(rf));
     rf.version = SF_PROTO_VERSION;
     rf.type = type;
-    rf.flags = 0;
+    rf.flags = flags;
     rf.seq = seq;
 
     size_t out_len = 0;
-    if (sf_proto_encode(c->tx, sizeof(c->tx), &rf, payload, payload_len, &out_len) != 0) {
+    if (sf_proto_encode(c->tx + c->tx_len, sizeof(c->tx) - c->tx_len, &rf, payload, payload_len, &out_len) != 0) {
         return -1;
     }
-    c->tx_len = out_len;
-    c->tx_off = 0;
+    c->tx_len += out_len;
     return 0;
 }
 
-static int handle_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len) {
-    uint8_t out_payload[2048];
+static int queue_response(sf_conn_t *c, uint8_t type, uint32_t seq, const uint8_t *payload, size_t payload_len) {
+    return queue_frame(c, type, 0, seq, payload, payload_len);
+}
+
+static void reply_error(sf_reply_t *r, const char *msg) {
+    r->type = SF_MSG_ERROR;
+    r->len = strlen(msg);
+    memcpy(r->payload, msg, r->len);
+}
+
+/* ROUTE_ACK: applied(u32), table version(u64). */
+static void reply_route_ack(sf_reply_t *r, size_t applied, uint64_t version) {
+    uint32_t applied_be = htonl((uint32_t)applied);
+    uint64_t version_be = htonll_u64(version);
+    memcpy(r->payload, &applied_be, 4);
+    memcpy(r->payload + 4, &version_be, 8);
+    r->type = SF_MSG_ROUTE_ACK;
+    r->len = 12;
+}
+
+/* Decodes the 16-byte ROUTE_UPDATE records of a payload into out (room for
+   payload_len / 16 routes). */
+static size_t parse_routes(const uint8_t *payload, size_t payload_len, sf_route_entry_t *out) {
+    size_t n = 0;
+    uint32_t now_ms_u32 = (uint32_t)now_u64_ms();
+    for (size_t off = 0; off + 16 <= payload_len; off += 16) {
+        sf_route_entry_t e;
+        memset(&e, 0, sizeof(e));
+        memcpy(&e.prefix_be, payload + off + 0, 4);
+        e.mask_bits = payload[off + 4];
+        e.flags = payload[off + 5] & SF_ROUTE_F_GROUP;
+        uint16_t metric_be;
+        memcpy(&metric_be, payload + off + 6, 2);
+        e.metric = ntohs(metric_be);
+        memcpy(&e.next_hop_be, payload + off + 8, 4);
+        e.last_updated_ms = now_ms_u32;
+        out[n++] = e;
+    }
+    return n;
+}
+
+/* Routes in a ROUTE_UPDATE payload: 16-byte records, or a packed block
+   (sf_route_pack.h) when the frame is flagged PACKED. */
+static size_t count_routes(uint16_t flags, const uint8_t *payload, size_t payload_len) {
+    if (!(flags & SF_FLAG_PACKED)) return payload_len / 16;
+    long n = sf_route_pack_count(payload, payload_len);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+/* Decodes a ROUTE_UPDATE payload of either layout into out (room for cap
+   routes); -1 for a malformed packed block. */
+static long parse_update(uint16_t flags, const uint8_t *payload, size_t payload_len, sf_route_entry_t *out, size_t cap) {
+    if (!(flags & SF_FLAG_PACKED)) return (long)parse_routes(payload, payload_len, out);
+    long n = sf_route_unpack(payload, payload_len, out, cap);
+    uint32_t now_ms_u32 = (uint32_t)now_u64_ms();
+    for (long i = 0; i < n; ++i) out[i].last_updated_ms = now_ms_u32;
+    return n;
+}
+
+/* Decodes the 8-byte ROUTE_WITHDRAW records of a payload into out (room for
+   payload_len / 8 keys). */
+static size_t parse_withdraws(const uint8_t *payload, size_t payload_len, sf_route_entry_t *out) {
+    size_t n = 0;
+    for (size_t off = 0; off + 8 <= payload_len; off += 8) {
+        memset(&out[n], 0, sizeof(out[n]));
+        memcpy(&out[n].prefix_be, payload + off, 4);
+        out[n].mask_bits = payload[off + 4];
+        n++;
+    }
+    return n;
+}
+
+/* ROUTE_UPDATE or ROUTE_WITHDRAW into a VRF other than the main table. VRFs
+   are this node's own, so followers take them too. */
+static void apply_vrf(const sf_frame_t *f, uint32_t vrf, const uint8_t *payload, size_t payload_len, sf_reply_t *r) {
+    uint8_t type = f->type;
+    sf_route_entry_t entries[SF_MAX_FRAME_ROUTES];
+    long parsed = type == SF_MSG_ROUTE_WITHDRAW ? (long)parse_withdraws(payload, payload_len, entries)
+                                                : parse_update(f->flags, payload, payload_len, entries, SF_MAX_FRAME_ROUTES);
+    if (parsed < 0) {
+        reply_error(r, "bad payload");
+        return;
+    }
+    size_t n = (size_t)parsed;
+    uint32_t op = type == SF_MSG_ROUTE_WITHDRAW ? SF_ROUTE_OP_WITHDRAW : SF_ROUTE_OP_UPSERT;
+    size_t applied = 0;
+    uint64_t version = 0;
+    switch (sf_routing_vrf_apply(vrf, op, n ? entries : NULL, n, &applied, &version)) {
+    case SF_COMMIT_OK:      break;
+    case SF_COMMIT_NO_VRF:  reply_error(r, "unknown vrf"); return;
+    case SF_COMMIT_INVALID: reply_error(r, "bad route"); return;
+    default:                reply_error(r, "draining"); return;
+    }
+    r->routes_installed = op == SF_ROUTE_OP_UPSERT ? applied : 0;
+    reply_route_ack(r, applied, version);
+}
+
+/* Commits a transaction into `r`; like process_frame() it touches no
+   connection state, so it runs on the worker pool too. */
+static void commit_txn(const sf_route_entry_t *entries, size_t n, const uint64_t *if_version, sf_reply_t *r) {
+    uint64_t version = 0;
+    int rc = sf_routing_commit(entries, n, if_version, &version);
+    r->routes_installed = 0;
+    r->log_seq = 0;
+    switch (rc) {
+    case SF_COMMIT_OK:
+        if (n) {
+            r->routes_installed = n;
+            r->log_seq = version;
+        }
+        reply_route_ack(r, n, version);
+        break;
+    case SF_COMMIT_CONFLICT: reply_error(r, "version mismatch"); break;
+    case SF_COMMIT_INVALID:  reply_error(r, "bad route"); break;
+    case SF_COMMIT_FULL:     reply_error(r, "table full"); break;
+    default:                 reply_error(r, "draining"); break;
+    }
+}
+
+/* Runs the handler for one frame into `r`. Apart from GET_STATS (which reads
+   reactor counters and is never offloaded) it touches no connection or reactor
+   state, so it is safe to call from a worker thread. */
+static void process_frame(const sf_frame_t *f, const uint8_t *payload, size_t payload_len, sf_reply_t *r) {
+    uint8_t *out_payload = r->payload;
+    r->routes_installed = 0;
+    r->log_seq = 0;
     size_t out_len = 0;
     uint8_t out_type = SF_MSG_ERROR;
 
+    uint32_t vrf = SF_VRF_MAIN;
+    if ((f->flags & SF_FLAG_VRF) && (f->type == SF_MSG_ROUTE_UPDATE || f->type == SF_MSG_ROUTE_WITHDRAW ||
+                                     f->type == SF_MSG_ROUTE_LOOKUP || f->type == SF_MSG_NH_GROUP)) {
+        uint32_t vrf_be;
+        if (payload_len < 4) {
+            reply_error(r, "bad payload");
+            return;
+        }
+        memcpy(&vrf_be, payload, 4);
+        vrf = ntohl(vrf_be);
+        payload += 4;
+        payload_len -= 4;
+        if (vrf != SF_VRF_MAIN && (f->type == SF_MSG_ROUTE_UPDATE || f->type == SF_MSG_ROUTE_WITHDRAW)) {
+            apply_vrf(f, vrf, payload, payload_len, r);
+            return;
+        }
+    }
+
     if (f->type == SF_MSG_PING) {
         out_type = SF_MSG_PONG;
         out_len = payload_len;
-        if (out_len > sizeof(out_payload)) out_len = sizeof(out_payload);
+        if (out_len > sizeof(r->payload)) out_len = sizeof(r->payload);
         if (out_len) memcpy(out_payload, payload, out_len);
     } else if (f->type == SF_MSG_ECHO) {
         out_type = SF_MSG_ECHO_REPLY;
         out_len = payload_len;
-        if (out_len > sizeof(out_payload)) out_len = sizeof(out_payload);
+        if (out_len > sizeof(r->payload)) out_len = sizeof(r->payload);
         if (out_len) memcpy(out_payload, payload, out_len);
     } else if (f->type == SF_MSG_GET_STATS) {
         out_type = SF_MSG_STATS_REPLY;
@@ -151,17 +703,25 @@ static int handle_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payloa
         sf_hal_telemetry_t tel;
         sf_hal_get_telemetry(&tel);
 
+        sf_request_stats_t st;
+        sf_stack_get_stats(&st);
+
         /* Binary reply:
            total_requests(u64), bad_frames(u64), routes_installed(u64), uptime_ms(u64),
-           last_latency_us(u32), avg_latency_us(u32)
+           last_latency_us(u32), avg_latency_us(u32),
+           shed_requests(u64), shed_connections(u64), steer_misses(u64),
+           busy_poll_hits(u64), busy_poll_spin_us(u64), wal_records(u64), wal_syncs(u64),
+           route_seq(u64), repl_resyncs(u64), route_expired(u64),
+           route_suppressed(u64), route_coalesced(u64), fib_routes(u64),
+           route_cache_hits(u64), route_cache_misses(u64)
          */
-        uint64_t tr = htonll_u64(g_stats.total_requests);
-        uint64_t bf = htonll_u64(g_stats.bad_frames);
-        uint64_t ri = htonll_u64(g_stats.routes_installed);
+        uint64_t tr = htonll_u64(st.total_requests);
+        uint64_t bf = htonll_u64(st.bad_frames);
+        uint64_t ri = htonll_u64(st.routes_installed);
         uint64_t up = htonll_u64(tel.uptime_ms);
 
-        uint32_t last_us = htonl((uint32_t)(g_stats.last_latency_ms * 1000.0));
-        uint32_t avg_us = htonl((uint32_t)(g_stats.avg_latency_ms * 1000.0));
+        uint32_t last_us = htonl((uint32_t)(st.last_latency_ms * 1000.0));
+        uint32_t avg_us = htonl((uint32_t)(st.avg_latency_ms * 1000.0));
 
         memcpy(out_payload + 0, &tr, 8);
         memcpy(out_payload + 8, &bf, 8);
@@ -169,59 +729,262 @@ static int handle_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payloa
         memcpy(out_payload + 24, &up, 8);
         memcpy(out_payload + 32, &last_us, 4);
         memcpy(out_payload + 36, &avg_us, 4);
-        out_len = 40;
+
+        uint64_t sr = htonll_u64(st.shed_requests);
+        uint64_t sc = htonll_u64(st.shed_connections);
+        uint64_t sm = htonll_u64(st.steer_misses);
+        memcpy(out_payload + 40, &sr, 8);
+        memcpy(out_payload + 48, &sc, 8);
+        uint64_t bh = htonll_u64(st.busy_poll_hits);
+        uint64_t bs = htonll_u64(st.busy_poll_spin_us);
+        memcpy(out_payload + 56, &sm, 8);
+        memcpy(out_payload + 64, &bh, 8);
+        memcpy(out_payload + 72, &bs, 8);
+        uint64_t wr = htonll_u64(st.wal_records);
+        uint64_t ws = htonll_u64(st.wal_syncs);
+        memcpy(out_payload + 80, &wr, 8);
+        memcpy(out_payload + 88, &ws, 8);
+        uint64_t rq = htonll_u64(st.route_seq);
+        uint64_t rr = htonll_u64(st.repl_resyncs);
+        memcpy(out_payload + 96, &rq, 8);
+        memcpy(out_payload + 104, &rr, 8);
+        uint64_t rx = htonll_u64(st.route_expired);
+        memcpy(out_payload + 112, &rx, 8);
+        uint64_t rs = htonll_u64(st.route_suppressed);
+        uint64_t co = htonll_u64(st.route_coalesced);
+        memcpy(out_payload + 120, &rs, 8);
+        memcpy(out_payload + 128, &co, 8);
+        uint64_t fr = htonll_u64(st.fib_routes);
+        memcpy(out_payload + 136, &fr, 8);
+        uint64_t ch = htonll_u64(st.route_cache_hits);
+        uint64_t cm = htonll_u64(st.route_cache_misses);
+        memcpy(out_payload + 144, &ch, 8);
+        memcpy(out_payload + 152, &cm, 8);
+        out_len = 160;
     } else if (f->type == SF_MSG_ROUTE_UPDATE) {
         out_type = SF_MSG_ROUTE_ACK;
+        if (sf_repl_following()) {
+            /* The table mirrors a leader; pushes go there. */
+            const char *msg = "follower";
+            r->type = SF_MSG_ERROR;
+            r->len = strlen(msg);
+            memcpy(out_payload, msg, r->len);
+            return;
+        }
 
-        size_t applied = 0;
-        size_t off = 0;
+        sf_route_entry_t entries[SF_MAX_FRAME_ROUTES];
+        long parsed = parse_update(f->flags, payload, payload_len, entries, SF_MAX_FRAME_ROUTES);
+        if (parsed < 0) {
+            reply_error(r, "bad payload");
+            return;
+        }
+        size_t n = (size_t)parsed;
+
+        /* Parse outside the table lock; apply the whole frame in one write section. */
+        long applied = sf_routing_upsert_batch(entries, n, &r->log_seq);
+        if (applied < 0) {
+            reply_error(r, applied == SF_COMMIT_INVALID ? "bad route" : "table full");
+            return;
+        }
+        if (applied == 0 && n > 0 && sf_routing_frozen()) {
+            /* Handed off to a successor: the client should retry on a new connection. */
+            const char *msg = "draining";
+            r->type = SF_MSG_ERROR;
+            r->len = strlen(msg);
+            memcpy(out_payload, msg, r->len);
+            return;
+        }
+        r->routes_installed = (size_t)applied;
+        reply_route_ack(r, (size_t)applied, r->log_seq ? r->log_seq : sf_routing_seq());
+        return;
+    } else if (f->type == SF_MSG_ROUTE_WITHDRAW) {
+        /* 8-byte records: prefix(u32), mask_bits(u8), reserved(3). */
+        if (sf_repl_following()) {
+            reply_error(r, "follower");
+            return;
+        }
+        sf_route_entry_t keys[SF_MAX_PAYLOAD / 8];
+        size_t n = parse_withdraws(payload, payload_len, keys);
+        long removed = sf_routing_withdraw_batch(keys, n, &r->log_seq);
+        if (removed < 0) {
+            reply_error(r, "table full");
+            return;
+        }
+        if (removed == 0 && n > 0 && sf_routing_frozen()) {
+            reply_error(r, "draining");
+            return;
+        }
+        reply_route_ack(r, (size_t)removed, r->log_seq ? r->log_seq : sf_routing_seq());
+        return;
+    } else if (f->type == SF_MSG_NH_GROUP) {
+        /* 8-byte members: next_hop(u32), weight(u16), reserved(2). Replies
+           NH_GROUP_ACK: group id(u32), table version(u64). A VRF's groups
+           are this node's own, like its routes. */
+        if (vrf == SF_VRF_MAIN && sf_repl_following()) {
+            reply_error(r, "follower");
+            return;
+        }
+        sf_nh_member_t members[SF_NH_GROUP_MAX];
+        size_t n = payload_len / 8;
+        if (n == 0 || n > SF_NH_GROUP_MAX) {
+            reply_error(r, "bad group");
+            return;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            uint16_t weight_be;
+            memset(&members[i], 0, sizeof(members[i]));
+            memcpy(&members[i].next_hop_be, payload + 8 * i, 4);
+            memcpy(&weight_be, payload + 8 * i + 4, 2);
+            members[i].weight = ntohs(weight_be);
+        }
+        uint32_t id = 0;
+        uint64_t version = 0;
+        int rc = vrf == SF_VRF_MAIN ? sf_routing_define_group(members, n, &id, &r->log_seq)
+                                    : sf_routing_vrf_define_group(vrf, members, n, &id, &version);
+        switch (rc) {
+        case SF_COMMIT_OK: break;
+        case SF_COMMIT_INVALID: reply_error(r, "bad group"); return;
+        case SF_COMMIT_NO_VRF:  reply_error(r, "unknown vrf"); return;
+        case SF_COMMIT_FULL:    reply_error(r, "table full"); return;
+        default:                reply_error(r, "draining"); return;
+        }
+        if (vrf == SF_VRF_MAIN) version = r->log_seq ? r->log_seq : sf_routing_seq();
+        uint32_t id_be = htonl(id);
+        uint64_t version_be = htonll_u64(version);
+        memcpy(out_payload, &id_be, 4);
+        memcpy(out_payload + 4, &version_be, 8);
+        out_type = SF_MSG_NH_GROUP_ACK;
+        out_len = 12;
+    } else if (f->type == SF_MSG_VRF_CREATE || f->type == SF_MSG_VRF_DELETE) {
+        /* VRF_CREATE: vrf(u32), source(u32: 0 = the main table, 0xFFFFFFFF =
+           empty). VRF_DELETE: vrf(u32). Replies VRF_ACK: vrf(u32), routes(u32). */
+        uint32_t vrf_be, from_be = 0;
+        if (payload_len < (f->type == SF_MSG_VRF_CREATE ? 8u : 4u)) {
+            reply_error(r, "bad payload");
+            return;
+        }
+        memcpy(&vrf_be, payload, 4);
+        if (f->type == SF_MSG_VRF_CREATE) memcpy(&from_be, payload + 4, 4);
+        size_t routes = 0;
+        int rc = f->type == SF_MSG_VRF_CREATE ? sf_routing_vrf_create(ntohl(vrf_be), ntohl(from_be), &routes)
+                                              : sf_routing_vrf_delete(ntohl(vrf_be));
+        switch (rc) {
+        case SF_COMMIT_OK:      break;
+        case SF_COMMIT_INVALID: reply_error(r, f->type == SF_MSG_VRF_CREATE ? "bad vrf" : "unknown vrf"); return;
+        case SF_COMMIT_FULL:    reply_error(r, "table full"); return;
+        default:                reply_error(r, "draining"); return;
+        }
+        uint32_t routes_be = htonl((uint32_t)routes);
+        memcpy(out_payload, &vrf_be, 4);
+        memcpy(out_payload + 4, &routes_be, 4);
+        out_type = SF_MSG_VRF_ACK;
+        out_len = 8;
+    } else if (f->type == SF_MSG_ROUTE_UPDATE6) {
+        /* 40-byte records: prefix(16), mask_bits(u8), reserved(1), metric(u16),
+           next_hop(16), reserved(4). The IPv6 table is this node's own: not
+           logged or replicated, so followers take pushes too. */
+        sf_route6_entry_t entries[SF_MAX_PAYLOAD / 40];
+        size_t n = 0;
         uint32_t now_ms_u32 = (uint32_t)now_u64_ms();
-        while (off + 16 <= payload_len) {
-            sf_route_entry_t e;
-            memset(&e, 0, sizeof(e));
-            memcpy(&e.prefix_be, payload + off + 0, 4);
-            e.mask_bits = payload[off + 4];
+        for (size_t off = 0; off + 40 <= payload_len; off += 40) {
+            sf_route6_entry_t *e = &entries[n++];
+            memset(e, 0, sizeof(*e));
+            memcpy(e->prefix, payload + off, 16);
+            e->mask_bits = payload[off + 16];
             uint16_t metric_be;
-            memcpy(&metric_be, payload + off + 6, 2);
-            e.metric = ntohs(metric_be);
-            memcpy(&e.next_hop_be, payload + off + 8, 4);
-            e.last_updated_ms = now_ms_u32;
-
-            if (sf_route_table_upsert(sf_routing_table(), &e) == 0) {
-                applied++;
-                g_stats.routes_installed++;
-            }
-            off += 16;
+            memcpy(&metric_be, payload + off + 18, 2);
+            e->metric = ntohs(metric_be);
+            memcpy(e->next_hop, payload + off + 20, 16);
+            e->last_updated_ms = now_ms_u32;
         }
-
-        uint32_t applied_be = htonl((uint32_t)applied);
-        memcpy(out_payload, &applied_be, 4);
-        out_len = 4;
+        uint64_t version = 0;
+        size_t applied = sf_routing_upsert6_batch(entries, n, &version);
+        if (applied == 0 && n > 0 && sf_routing_frozen()) {
+            reply_error(r, "draining");
+            return;
+        }
+        r->routes_installed = applied;
+        reply_route_ack(r, applied, version);
+        return;
+    } else if (f->type == SF_MSG_ROUTE_LOOKUP6) {
+        if (payload_len < 16) {
+            reply_error(r, "bad payload");
+            return;
+        }
+        /* ROUTE_REPLY6: mask_bits(u8), reserved(1), metric(u16), next_hop(16),
+           reserved(4), version(u64); mask 0 and metric 0xFFFF when nothing matches. */
+        sf_route6_entry_t best;
+        uint64_t version = 0;
+        memset(out_payload, 0, 32);
+        if (sf_routing_lookup6(payload, &best, &version) != 0) {
+            uint16_t metric = htons(0xFFFFu);
+            memcpy(out_payload + 2, &metric, 2);
+        } else {
+            out_payload[0] = best.mask_bits;
+            uint16_t metric_be = htons(best.metric);
+            memcpy(out_payload + 2, &metric_be, 2);
+            memcpy(out_payload + 4, best.next_hop, 16);
+        }
+        uint64_t version_be = htonll_u64(version);
+        memcpy(out_payload + 24, &version_be, 8);
+        out_type = SF_MSG_ROUTE_REPLY6;
+        out_len = 32;
+    } else if (f->type == SF_MSG_SNAPSHOT) {
+        size_t routes = 0, bytes = 0;
+        const char *msg = NULL;
+        if (!g_opts.snapshot_out) msg = "no snapshot path";
+        else if (sf_routing_save_snapshot(g_opts.snapshot_out, -1, &routes, &bytes, NULL) != 0) msg = "snapshot failed";
+        if (msg) {
+            r->type = SF_MSG_ERROR;
+            r->len = strlen(msg);
+            memcpy(out_payload, msg, r->len);
+            return;
+        }
+        /* routes(u32), bytes(u64) */
+        out_type = SF_MSG_SNAPSHOT_ACK;
+        uint32_t routes_be = htonl((uint32_t)routes);
+        uint64_t bytes_be = htonll_u64((uint64_t)bytes);
+        memcpy(out_payload, &routes_be, 4);
+        memcpy(out_payload + 4, &bytes_be, 8);
+        out_len = 12;
     } else if (f->type == SF_MSG_ROUTE_LOOKUP) {
         out_type = SF_MSG_ROUTE_REPLY;
         if (payload_len < 4) {
             const char *msg = "bad payload";
-            return queue_response(c, SF_MSG_ERROR, f->seq, (const uint8_t *)msg, strlen(msg));
+            r->type = SF_MSG_ERROR;
+            r->len = strlen(msg);
+            memcpy(out_payload, msg, r->len);
+            return;
         }
+        /* An optional flow key (e.g. a 5-tuple) after the address picks the
+           member of a next-hop group; without one the address does. */
         uint32_t ip_be;
         memcpy(&ip_be, payload, 4);
+        uint32_t flow = payload_len > 4 ? sf_nh_flow_hash(payload + 4, payload_len - 4) : sf_nh_flow_hash(&ip_be, 4);
         sf_route_entry_t best;
-        if (sf_route_table_lookup(sf_routing_table(), ip_be, &best) != 0) {
+        uint64_t version = 0;
+        int found = sf_routing_vrf_lookup(vrf, ip_be, flow, &best, &version);
+        if (found == -2) {
+            reply_error(r, "unknown vrf");
+            return;
+        }
+        if (found != 0) {
             uint32_t zero = 0;
             uint16_t metric = htons(0xFFFFu);
             out_payload[0] = 0;
             out_payload[1] = 0;
             memcpy(out_payload + 2, &metric, 2);
             memcpy(out_payload + 4, &zero, 4);
-            out_len = 8;
         } else {
             out_payload[0] = best.mask_bits;
             out_payload[1] = 0;
             uint16_t metric_be = htons(best.metric);
             memcpy(out_payload + 2, &metric_be, 2);
             memcpy(out_payload + 4, &best.next_hop_be, 4);
-            out_len = 8;
         }
+        uint64_t version_be = htonll_u64(version);
+        memcpy(out_payload + 8, &version_be, 8);
+        out_len = 16;
     } else {
         const char *msg = "unknown message type";
         out_type = SF_MSG_ERROR;
@@ -229,178 +992,1340 @@ static int handle_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payloa
         memcpy(out_payload, msg, out_len);
     }
 
-    return queue_response(c, out_type, f->seq, out_payload, out_len);
+    r->type = out_type;
+    r->len = out_len;
 }
 
-static int update_epoll_interest(int epfd, sf_conn_t *c) {
+static int update_epoll_interest(sf_conn_t *c) {
+    /* Stop reading while the response buffer is full so a client that never
+       reads its replies cannot make us buffer without bound. */
+    uint32_t want = EPOLLHUP;
+    if (!c->rd_closed) want |= EPOLLRDHUP | (tx_has_room(c) ? EPOLLIN : 0);
+    if ((c->tx_len != 0 || c->stream.active) && !c->tx_hold_seq) want |= EPOLLOUT;
+    if (want == c->ep_events) return 0;
+
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     ev.data.ptr = c;
-    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP;
-    if (c->tx_len != 0) ev.events |= EPOLLOUT;
-    return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    ev.events = want;
+    if (epoll_ctl(c->r->epfd, EPOLL_CTL_MOD, c->fd, &ev) != 0) return -1;
+    c->ep_events = want;
+    return 0;
 }
 
-static void handle_readable(int epfd, sf_conn_t *c) {
-    for (;;) {
-        uint8_t tmp[2048];
-        ssize_t n = recv(c->fd, tmp, sizeof(tmp), 0);
-        if (n == 0) {
-            close_conn(epfd, c);
-            return;
+static void durable_ready(sf_task_t *t) {
+    (void)t; /* never run: only tags the task on the completion queue */
+}
+
+/* Sends as much of the pending output as the socket takes. Returns -1 on error.
+   With a WAL, everything queued behind a ROUTE_ACK waits until that batch is
+   durable; the connection keeps being served meanwhile, so a pipelining client
+   gets all of its acks from one group commit instead of paying a sync per frame. */
+static int flush_tx(sf_conn_t *c) {
+    if (c->tx_hold_seq) {
+        if (c->tx_hold_seq > sf_wal_durable_seq()) {
+            if (c->durable_parked) return 0;
+            c->durable.run = durable_ready;
+            c->durable.cq = &c->r->cq;
+            if (sf_wal_park(c->tx_hold_seq, &c->durable) == 0) {
+                c->durable_parked = 1;
+                return 0;
+            }
         }
+        c->tx_hold_seq = 0;
+    }
+    while (c->tx_off < c->tx_len) {
+        ssize_t n = send(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, MSG_NOSIGNAL);
         if (n < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            close_conn(epfd, c);
-            return;
+            return -1;
+        }
+        c->tx_off += (size_t)n;
+    }
+    if (c->tx_off >= c->tx_len) {
+        c->tx_len = 0;
+        c->tx_off = 0;
+    }
+    return 0;
+}
+
+static void repl_ready(sf_task_t *t) {
+    (void)t; /* never run: only tags the task on the completion queue */
+}
+
+/* Streams replication frames into a follower's output until its socket is
+   full or it has caught up, then parks on the backlog. Returns -1 on error or
+   when the follower fell out of the backlog (it reconnects and resubscribes). */
+static int pump_repl(sf_conn_t *c) {
+    for (;;) {
+        if (c->tx_off != 0) {
+            memmove(c->tx, c->tx + c->tx_off, c->tx_len - c->tx_off);
+            c->tx_len -= c->tx_off;
+            c->tx_off = 0;
+        }
+        long n = sf_repl_read(&c->repl, c->tx + c->tx_len, sizeof(c->tx) - c->tx_len);
+        if (n < 0) return -1;
+        c->tx_len += (size_t)n;
+        if (flush_tx(c) != 0) return -1;
+        if (c->tx_len != 0) return 0; /* socket full; EPOLLOUT resumes */
+        if (n > 0) continue;
+        if (c->repl_parked) return 0;
+        c->repl_task.run = repl_ready;
+        c->repl_task.cq = &c->r->cq;
+        if (sf_repl_park(&c->repl, &c->repl_task) == 0) {
+            c->repl_parked = 1;
+            return 0;
         }
+    }
+}
+
+/* Queues the next frame of the connection's stream; the last one ends it. */
+static int stream_next(sf_conn_t *c) {
+    sf_stream_t *st = &c->stream;
+    uint8_t payload[SF_MAX_REPLY];
+    uint64_t version_be = htonll_u64(st->version);
+    memcpy(payload, &version_be, 8);
+    size_t len = 8;
+    if (st->type == SF_MSG_ROUTE_DUMP_REPLY && (st->flags & SF_FLAG_PACKED)) {
+        size_t k = 0;
+        len += sf_route_pack(st->routes + st->pos, st->n - st->pos, payload + 8, sizeof(payload) - 8, &k);
+        st->pos += k;
+    } else if (st->type == SF_MSG_ROUTE_DUMP_REPLY) {
+        /* count(4), then routes delta-encoded as in replication (sf_repl.h). */
+        size_t k = 0;
+        len += 4 + sf_repl_encode_routes(st->routes + st->pos, st->n - st->pos, payload + 12, sizeof(payload) - 12, &k);
+        uint32_t count_be = htonl((uint32_t)k);
+        memcpy(payload + 8, &count_be, 4);
+        st->pos += k;
+    }
+    for (size_t k = 0; st->type == SF_MSG_ROUTE_QUERY_REPLY && k < SF_STREAM_RECORDS && st->pos < st->n;
+         ++k, ++st->pos, len += 16) {
+        const sf_route_entry_t *e = &st->routes[st->pos];
+        uint16_t metric_be = htons(e->metric);
+        memcpy(payload + len, &e->prefix_be, 4);
+        payload[len + 4] = e->mask_bits;
+        payload[len + 5] = e->flags;
+        memcpy(payload + len + 6, &metric_be, 2);
+        memcpy(payload + len + 8, &e->next_hop_be, 4);
+        memset(payload + len + 12, 0, 4);
+    }
+    int last = st->pos >= st->n;
+    if (queue_frame(c, st->type, (uint16_t)(st->flags | (last ? 0 : SF_FLAG_MORE)), st->seq, payload, len) != 0) return -1;
+    if (last) {
+        free(st->routes);
+        memset(st, 0, sizeof(*st));
+    }
+    return 0;
+}
+
+/* Tops tx up with the stream's next frames and sends them. The stream keeps
+   EPOLLOUT registered, so the reactor comes back for the rest after serving
+   its other connections. */
+static int pump_stream(sf_conn_t *c) {
+    if (c->tx_off != 0) {
+        memmove(c->tx, c->tx + c->tx_off, c->tx_len - c->tx_off);
+        c->tx_len -= c->tx_off;
+        c->tx_off = 0;
+    }
+    while (c->stream.active && tx_has_room(c)) {
+        if (stream_next(c) != 0) return -1;
+    }
+    return flush_tx(c);
+}
+
+/* Sends pending output, topped up from the replication stream for followers
+   or from a multi-frame reply. */
+static int conn_output(sf_conn_t *c) {
+    if (c->subscribed) return pump_repl(c);
+    return c->stream.active ? pump_stream(c) : flush_tx(c);
+}
+
+/* Queues the connection in the lane of its next buffered frame, if it has one
+   and there is room for the response. */
+static void schedule_conn(sf_conn_t *c) {
+    if (c->inflight || c->stream.active || !tx_has_room(c)) return;
+    sf_frame_t f;
+    int r = sf_proto_peek(&c->rx, &f);
+    if (r == 0) return;
+    /* A corrupt header still gets scheduled so that serving it closes the connection. */
+    sf_msg_class_t cls = (r > 0) ? sf_sched_classify(&g_opts.sched, f.type, f.flags) : SF_CLASS_CONTROL;
+    sf_sched_push(&c->r->sched, &c->sched, cls);
+}
+
+static void account_request(sf_reactor_t *r, double start_ms, uint64_t routes_installed) {
+    sf_stats_shard_t *st = &r->stats;
+    double latency = now_ms() - start_ms;
+    stat_add(&st->total_requests, 1);
+    stat_add(&st->routes_installed, routes_installed);
+    double avg = atomic_load_explicit(&st->avg_latency_ms, memory_order_relaxed);
+    avg += (latency - avg) / (double)stat_get(&st->total_requests);
+    atomic_store_explicit(&st->last_latency_ms, latency, memory_order_relaxed);
+    atomic_store_explicit(&st->avg_latency_ms, avg, memory_order_relaxed);
+}
+
+/* ROUTE_QUERY for the routes under a short prefix. */
+static int broad_query(const sf_frame_t *f, const uint8_t *payload, size_t payload_len) {
+    size_t at = (f->flags & SF_FLAG_VRF) ? 4 : 0;
+    return payload_len >= at + 8 && payload[at + 5] == SF_ROUTE_QUERY_COVERED && payload[at + 4] < SF_QUERY_INLINE_MASK;
+}
+
+static int should_offload(const sf_frame_t *f, const uint8_t *payload, size_t payload_len) {
+    if (!sf_workpool_size()) return 0;
+    if (f->type == SF_MSG_SNAPSHOT) return 1; /* file I/O and fsync */
+    if (f->type == SF_MSG_ROUTE_DUMP) return 1; /* copies the whole table */
+    if (f->type == SF_MSG_ROUTE_QUERY) return broad_query(f, payload, payload_len);
+    if (f->type == SF_MSG_REPL_SUBSCRIBE) return 1; /* may copy and encode the whole table */
+    if (f->type == SF_MSG_VRF_CREATE) return 1; /* may copy the source table */
+    if (f->type == SF_MSG_ROUTE_WITHDRAW) return payload_len / 8 >= g_opts.offload_min_routes;
+    if (f->type == SF_MSG_ROUTE_UPDATE6) return payload_len / 40 >= g_opts.offload_min_routes;
+    return f->type == SF_MSG_ROUTE_UPDATE && count_routes(f->flags, payload, payload_len) >= g_opts.offload_min_routes;
+}
 
-        if (sf_rxbuf_append(&c->rx, tmp, (size_t)n) != 0) {
-            close_conn(epfd, c);
+/* ROUTE_DUMP: an optional VRF id; PACKED asks for packed records. Copies the table into st (active on
+   success) or puts an error into r; touches no connection state. */
+static void open_dump(const sf_frame_t *f, const uint8_t *payload, size_t payload_len, sf_stream_t *st, sf_reply_t *r) {
+    uint32_t vrf_be = 0;
+    memset(st, 0, sizeof(*st));
+    if ((f->flags & SF_FLAG_VRF) ? payload_len != 4 : payload_len != 0) {
+        reply_error(r, "bad payload");
+        return;
+    }
+    if (payload_len) memcpy(&vrf_be, payload, 4);
+    switch (sf_routing_dump(ntohl(vrf_be), &st->routes, &st->n, &st->version)) {
+    case 0:  break;
+    case -2: reply_error(r, "unknown vrf"); return;
+    default: reply_error(r, "table full"); return;
+    }
+    st->active = 1;
+    st->type = SF_MSG_ROUTE_DUMP_REPLY;
+    st->flags = f->flags & SF_FLAG_PACKED;
+    st->seq = f->seq;
+}
+
+/* ROUTE_QUERY: prefix(4), mask_bits(1), mode(1: 0 covered, 1 covering),
+   reserved(2), after an optional VRF id. Copies the answer into st (active
+   on success) or puts an error into r; touches no connection state. */
+static void open_query(const sf_frame_t *f, const uint8_t *payload, size_t payload_len, sf_stream_t *st, sf_reply_t *r) {
+    uint32_t vrf = SF_VRF_MAIN;
+    memset(st, 0, sizeof(*st));
+    if (f->flags & SF_FLAG_VRF) {
+        uint32_t vrf_be;
+        if (payload_len < 4) {
+            reply_error(r, "bad payload");
             return;
         }
+        memcpy(&vrf_be, payload, 4);
+        vrf = ntohl(vrf_be);
+        payload += 4;
+        payload_len -= 4;
+    }
+    if (payload_len < 8 || payload[4] > 32 || payload[5] > SF_ROUTE_QUERY_COVERING) {
+        reply_error(r, "bad payload");
+        return;
+    }
+    uint32_t prefix_be;
+    memcpy(&prefix_be, payload, 4);
+    switch (sf_routing_query(vrf, prefix_be, payload[4], (sf_route_query_t)payload[5], &st->routes, &st->n,
+                             &st->version)) {
+    case 0:  break;
+    case -2: reply_error(r, "unknown vrf"); return;
+    default: reply_error(r, "table full"); return;
+    }
+    st->active = 1;
+    st->type = SF_MSG_ROUTE_QUERY_REPLY;
+    st->seq = f->seq;
+}
 
-        for (;;) {
-            sf_frame_t f;
-            uint8_t payload[4096];
-            size_t payload_len = 0;
-            int r = sf_proto_try_decode(&c->rx, &f, payload, sizeof(payload), &payload_len);
-            if (r == 0) break;
-            if (r < 0) {
-                g_stats.bad_frames++;
-                close_conn(epfd, c);
-                return;
-            }
+/* REPL_SUBSCRIBE: origin(8), from_seq(8). Positions sub in the backlog, or
+   encodes the whole table into it when the backlog cannot resume the
+   follower; sets *ok or puts an error into r. Touches no connection state. */
+static void open_replication(const uint8_t *payload, size_t payload_len, sf_repl_sub_t *sub, int *ok, sf_reply_t *r) {
+    uint64_t origin_be, from_be;
+    *ok = 0;
+    if (payload_len < 16) {
+        reply_error(r, "bad payload");
+        return;
+    }
+    memcpy(&origin_be, payload, 8);
+    memcpy(&from_be, payload + 8, 8);
+    if (sf_repl_subscribe(sub, htonll_u64(origin_be), htonll_u64(from_be)) != 0) {
+        reply_error(r, "resync failed");
+        return;
+    }
+    *ok = 1;
+}
 
-            double start = now_ms();
-            if (handle_frame(c, &f, payload, payload_len) != 0) {
-                close_conn(epfd, c);
-                return;
-            }
-            double end = now_ms();
-            double latency = end - start;
-
-            g_stats.total_requests++;
-            g_stats.last_latency_ms = latency;
-            g_stats.avg_latency_ms =
-                g_stats.avg_latency_ms +
-                (latency - g_stats.avg_latency_ms) / (double)g_stats.total_requests;
-
-            if (update_epoll_interest(epfd, c) != 0) {
-                close_conn(epfd, c);
-                return;
+static void offload_run(sf_task_t *t) {
+    sf_offload_t *o = (sf_offload_t *)t;
+    if (o->frame.type == SF_MSG_ROUTE_DUMP) open_dump(&o->frame, o->payload, o->payload_len, &o->stream, &o->reply);
+    else if (o->frame.type == SF_MSG_ROUTE_QUERY)
+        open_query(&o->frame, o->payload, o->payload_len, &o->stream, &o->reply);
+    else if (o->frame.type == SF_MSG_REPL_SUBSCRIBE)
+        open_replication(o->payload, o->payload_len, &o->repl, &o->subscribed, &o->reply);
+    else if (o->txn) commit_txn(o->txn, o->txn_n, o->conditional ? &o->if_version : NULL, &o->reply);
+    else process_frame(&o->frame, o->payload, o->payload_len, &o->reply);
+}
+
+static sf_offload_t *offload_new(sf_conn_t *c, const sf_frame_t *f, double start) {
+    sf_offload_t *o = (sf_offload_t *)malloc(sizeof(*o));
+    if (!o) return NULL;
+    memset(&o->task, 0, sizeof(o->task));
+    o->task.run = offload_run;
+    o->task.cq = &c->r->cq;
+    o->conn = c;
+    o->frame = *f;
+    o->start_ms = start;
+    o->payload_len = 0;
+    o->txn = NULL;
+    o->txn_cap = 0;
+    o->reply.routes_installed = 0;
+    o->reply.log_seq = 0;
+    o->stream.active = 0;
+    o->stream.routes = NULL;
+    o->subscribed = 0;
+    return o;
+}
+
+static int offload_submit(sf_conn_t *c, sf_offload_t *o) {
+    if (sf_workpool_submit(&o->task) != 0) return -1;
+    c->inflight = o;
+    return 0;
+}
+
+/* Hands the frame to the worker pool. Returns -1 if it has to run inline. */
+static int offload_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len, double start) {
+    sf_offload_t *o = offload_new(c, f, start);
+    if (!o) return -1;
+    o->payload_len = payload_len;
+    memcpy(o->payload, payload, payload_len);
+    if (offload_submit(c, o) != 0) {
+        free(o);
+        return -1;
+    }
+    return 0;
+}
+
+/* Holds the connection's output until the update behind reply is durable. */
+static void hold_for_log(sf_conn_t *c, const sf_reply_t *reply) {
+    if (reply->log_seq > c->tx_hold_seq && sf_wal_is_open()) c->tx_hold_seq = reply->log_seq;
+}
+
+/* Appends a frame's routes to the transaction. Returns an error message or NULL. */
+static const char *txn_stage(sf_txn_t *t, uint16_t flags, const uint8_t *payload, size_t payload_len) {
+    size_t more = count_routes(flags, payload, payload_len);
+    if (sf_repl_following()) return "follower";
+    if (t->n + more > SF_TXN_MAX_ROUTES) return "transaction too large";
+    if (t->n + more > t->cap) {
+        size_t cap = t->cap ? t->cap : 256;
+        while (cap < t->n + more) cap *= 2;
+        size_t grow = cap - t->cap;
+        size_t staged = atomic_fetch_add_explicit(&g_txn_staged, grow, memory_order_relaxed) + grow;
+        if (staged > SF_TXN_STAGED_MAX_ROUTES) {
+            txn_unstage(grow);
+            return "busy";
+        }
+        sf_route_entry_t *p = (sf_route_entry_t *)realloc(t->entries, cap * sizeof(*p));
+        if (!p) {
+            txn_unstage(grow);
+            return "table full";
+        }
+        t->entries = p;
+        t->cap = cap;
+    }
+    long n = parse_update(flags, payload, payload_len, t->entries + t->n, more);
+    if (n < 0) return "bad payload";
+    t->n += (size_t)n;
+    return NULL;
+}
+
+/* A ROUTE_UPDATE flagged TXN or IF_VERSION. Staged frames are acked with 0
+   routes and the current version; the last frame commits the transaction (on
+   the worker pool when it is large). After a rejected frame the rest of the
+   transaction is refused too, so a pipelined tail never commits on its own. */
+static int handle_txn_frame(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len, double start) {
+    sf_txn_t *t = &c->txn;
+    int last = !(f->flags & SF_FLAG_TXN_MORE);
+    const char *msg = NULL;
+    if (t->failed) {
+        msg = "transaction aborted";
+    } else if (f->flags & SF_FLAG_VRF) {
+        /* Transactions are for the main table only. */
+        uint32_t vrf_be = 0;
+        if (payload_len >= 4) memcpy(&vrf_be, payload, 4);
+        if (payload_len < 4) {
+            msg = "bad payload";
+        } else if (vrf_be != 0) {
+            msg = "bad vrf";
+        } else {
+            payload += 4;
+            payload_len -= 4;
+        }
+    }
+    if (!msg && (f->flags & SF_FLAG_IF_VERSION)) {
+        uint64_t version_be;
+        if (payload_len < 8) {
+            msg = "bad payload";
+        } else {
+            memcpy(&version_be, payload, 8);
+            t->if_version = htonll_u64(version_be);
+            t->conditional = 1;
+            payload += 8;
+            payload_len -= 8;
+        }
+    }
+    if (!msg) msg = txn_stage(t, f->flags, payload, payload_len);
+    if (msg) {
+        txn_reset(t);
+        t->failed = !last;
+        if (queue_response(c, SF_MSG_ERROR, f->seq, (const uint8_t *)msg, strlen(msg)) != 0) return -1;
+        account_request(c->r, start, 0);
+        return 1;
+    }
+
+    sf_reply_t reply;
+    if (!last) {
+        reply_route_ack(&reply, 0, sf_routing_seq());
+        if (queue_response(c, reply.type, f->seq, reply.payload, reply.len) != 0) return -1;
+        account_request(c->r, start, 0);
+        return 1;
+    }
+    if (sf_workpool_size() && t->n >= g_opts.offload_min_routes) {
+        sf_offload_t *o = offload_new(c, f, start);
+        if (o) {
+            o->txn = t->entries;
+            o->txn_n = t->n;
+            o->txn_cap = t->cap;
+            o->conditional = t->conditional;
+            o->if_version = t->if_version;
+            if (offload_submit(c, o) == 0) {
+                memset(t, 0, sizeof(*t)); /* the entries went with o */
+                return 1;
             }
+            free(o);
+        }
+    }
+    commit_txn(t->entries, t->n, t->conditional ? &t->if_version : NULL, &reply);
+    txn_reset(t);
+    if (queue_response(c, reply.type, f->seq, reply.payload, reply.len) != 0) return -1;
+    hold_for_log(c, &reply);
+    account_request(c->r, start, reply.routes_installed);
+    return 1;
+}
+
+/* REPL_SUBSCRIBE: origin(u64), from_seq(u64). From here on the connection's
+   output is the replication stream (conn_output() pumps it). */
+static int start_replication(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len, double start) {
+    const char *msg = NULL;
+    if (c->subscribed) msg = "already subscribed";
+    else if (!sf_repl_leading()) msg = "replication disabled";
+    if (msg) return queue_response(c, SF_MSG_ERROR, f->seq, (const uint8_t *)msg, strlen(msg)) == 0 ? 1 : -1;
+    /* A follower outside the backlog gets the whole table: exported and encoded on the worker pool. */
+    if (should_offload(f, payload, payload_len) && offload_frame(c, f, payload, payload_len, start) == 0) return 1;
+    sf_reply_t reply;
+    int ok;
+    open_replication(payload, payload_len, &c->repl, &ok, &reply);
+    if (!ok) return queue_response(c, reply.type, f->seq, reply.payload, reply.len) == 0 ? 1 : -1;
+    c->subscribed = 1;
+    account_request(c->r, start, 0);
+    return 1;
+}
+
+/* ROUTE_QUERY: answered by a stream of ROUTE_QUERY_REPLY frames
+   (conn_output() pumps it). A broad one is copied on the worker pool when
+   there is one, like a dump. */
+static int start_query(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len, double start) {
+    if (c->subscribed) {
+        /* The output is the replication stream. */
+        const char *msg = "already subscribed";
+        return queue_response(c, SF_MSG_ERROR, f->seq, (const uint8_t *)msg, strlen(msg)) == 0 ? 1 : -1;
+    }
+    if (should_offload(f, payload, payload_len) && offload_frame(c, f, payload, payload_len, start) == 0) return 1;
+    sf_reply_t reply;
+    open_query(f, payload, payload_len, &c->stream, &reply);
+    if (!c->stream.active && queue_response(c, reply.type, f->seq, reply.payload, reply.len) != 0) return -1;
+    account_request(c->r, start, 0);
+    return 1;
+}
 
-            if (c->tx_len != 0) break;
+/* ROUTE_DUMP: the table is copied on the worker pool when there is one, then
+   streamed as ROUTE_DUMP_REPLY frames. */
+static int start_dump(sf_conn_t *c, const sf_frame_t *f, const uint8_t *payload, size_t payload_len, double start) {
+    if (c->subscribed) {
+        const char *msg = "already subscribed";
+        return queue_response(c, SF_MSG_ERROR, f->seq, (const uint8_t *)msg, strlen(msg)) == 0 ? 1 : -1;
+    }
+    if (should_offload(f, payload, payload_len) && offload_frame(c, f, payload, payload_len, start) == 0) return 1;
+    sf_reply_t reply;
+    open_dump(f, payload, payload_len, &c->stream, &reply);
+    if (!c->stream.active && queue_response(c, reply.type, f->seq, reply.payload, reply.len) != 0) return -1;
+    account_request(c->r, start, 0);
+    return 1;
+}
+
+/* Decodes and handles the next buffered frame. Returns 1 if a frame was
+   handled (or handed off), 0 if no complete frame is buffered, -1 on error. */
+static int handle_next_frame(sf_conn_t *c, size_t *consumed) {
+    sf_frame_t f;
+    uint8_t payload[SF_MAX_PAYLOAD];
+    size_t payload_len = 0;
+    int r = sf_proto_try_decode(&c->rx, &f, payload, sizeof(payload), &payload_len);
+    if (r <= 0) {
+        if (r < 0) stat_add(&c->r->stats.bad_frames, 1);
+        return r;
+    }
+    *consumed = SF_PROTO_HEADER_LEN + payload_len;
+
+    double start = now_ms();
+    /* Probe-class types (PING, ECHO, GET_STATS by default) are never shed, so health checks stay answered. */
+    if (g_opts.sched.class_by_type[f.type] != SF_CLASS_PROBE &&
+        sf_admission_should_shed(&c->r->admission, start - c->ready_ms, start)) {
+        /* Over the latency budget: answer with a cheap BUSY error instead of doing the work. */
+        const char *msg = "busy";
+        stat_add(&c->r->stats.shed_requests, 1);
+        if (f.type == SF_MSG_ROUTE_UPDATE && (f.flags & (SF_FLAG_TXN | SF_FLAG_IF_VERSION))) {
+            /* A shed frame fails its transaction as a rejected one would (handle_txn_frame()). */
+            txn_reset(&c->txn);
+            c->txn.failed = (f.flags & SF_FLAG_TXN_MORE) != 0;
         }
+        return queue_response(c, SF_MSG_ERROR, f.seq, (const uint8_t *)msg, strlen(msg)) == 0 ? 1 : -1;
+    }
+    if (f.type == SF_MSG_REPL_SUBSCRIBE) return start_replication(c, &f, payload, payload_len, start);
+    if (f.type == SF_MSG_ROUTE_QUERY) return start_query(c, &f, payload, payload_len, start);
+    if (f.type == SF_MSG_ROUTE_DUMP) return start_dump(c, &f, payload, payload_len, start);
+    if (f.type == SF_MSG_ROUTE_UPDATE && (f.flags & (SF_FLAG_TXN | SF_FLAG_IF_VERSION))) {
+        return handle_txn_frame(c, &f, payload, payload_len, start);
+    }
+    if (should_offload(&f, payload, payload_len) && offload_frame(c, &f, payload, payload_len, start) == 0) {
+        return 1;
     }
+
+    sf_reply_t reply;
+    process_frame(&f, payload, payload_len, &reply);
+    if (queue_response(c, reply.type, f.seq, reply.payload, reply.len) != 0) return -1;
+    hold_for_log(c, &reply);
+    account_request(c->r, start, reply.routes_installed);
+    return 1;
 }
 
-static void handle_writable(int epfd, sf_conn_t *c) {
-    while (c->tx_off < c->tx_len) {
-        ssize_t n = send(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, 0);
+/* A half-closed connection is closed once every frame it sent has been
+   answered and the answers have left tx; a partial frame left over is dropped.
+   A follower keeps streaming until the socket fails. */
+static int conn_done(sf_conn_t *c) {
+    sf_frame_t f;
+    return c->rd_closed && !c->subscribed && !c->inflight && !c->stream.active && !c->durable_parked &&
+           c->tx_len == 0 && sf_proto_peek(&c->rx, &f) == 0;
+}
+
+/* Lane service: handles consecutive frames of one class from one connection,
+   within the lane's credit and the per-visit frame budget. */
+static size_t serve_conn(sf_sched_item_t *item, sf_msg_class_t cls, size_t credit, void *ctx) {
+    (void)ctx;
+    sf_conn_t *c = SF_CONN_OF(item);
+    size_t used = 0;
+    uint32_t frames = 0;
+
+    while (frames < g_opts.frame_budget && used < credit && tx_has_room(c) && !c->inflight &&
+           !c->stream.active) {
+        sf_frame_t f;
+        int r = sf_proto_peek(&c->rx, &f);
+        if (r == 0) break;
+        if (r > 0 && frames > 0 && sf_sched_classify(&g_opts.sched, f.type, f.flags) != cls) break;
+
+        size_t consumed = 0;
+        if (handle_next_frame(c, &consumed) < 0) {
+            close_conn(c);
+            return used;
+        }
+        used += consumed;
+        frames++;
+    }
+
+    if (conn_output(c) != 0 || update_epoll_interest(c) != 0 || conn_done(c)) {
+        close_conn(c);
+        return used;
+    }
+    schedule_conn(c);
+    return used;
+}
+
+/* Reads at most one budget's worth of input; anything left in the socket is
+   reported again by (level-triggered) epoll. Complete frames are handed to the
+   lane scheduler rather than handled inline. Returns -1 if the connection was closed. */
+static int handle_readable(sf_conn_t *c) {
+    size_t bytes = 0;
+
+    while (bytes < g_opts.read_budget_bytes) {
+        uint8_t tmp[2048];
+        size_t want = sizeof(tmp);
+        size_t room = sizeof(c->rx.data) - c->rx.len;
+        if (want > room) want = room;
+        if (want > g_opts.read_budget_bytes - bytes) want = g_opts.read_budget_bytes - bytes;
+        if (want == 0) break; /* rx full: frames must be served before reading more */
+
+        ssize_t n = recv(c->fd, tmp, want, 0);
+        if (n == 0) {
+            c->rd_closed = 1; /* stop reading; queued and buffered requests still get their replies */
+            break;
+        }
         if (n < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            close_conn(epfd, c);
-            return;
+            goto fail;
         }
-        c->tx_off += (size_t)n;
+        if (sf_rxbuf_append(&c->rx, tmp, (size_t)n) != 0) goto fail;
+        bytes += (size_t)n;
     }
-    if (c->tx_off >= c->tx_len) {
-        c->tx_len = 0;
-        c->tx_off = 0;
-        if (update_epoll_interest(epfd, c) != 0) {
-            close_conn(epfd, c);
-            return;
+
+    sf_frame_t head;
+    if (c->rx.len == sizeof(c->rx.data) && sf_proto_peek(&c->rx, &head) == 0) {
+        goto fail; /* rx full without a complete frame */
+    }
+    if (c->rd_closed && (update_epoll_interest(c) != 0 || conn_done(c))) goto fail;
+    schedule_conn(c);
+    return 0;
+
+fail:
+    close_conn(c);
+    return -1;
+}
+
+static int handle_writable(sf_conn_t *c) {
+    if (conn_output(c) != 0 || update_epoll_interest(c) != 0 || conn_done(c)) {
+        close_conn(c);
+        return -1;
+    }
+    /* Room freed up: frames held back behind the full tx buffer can run again. */
+    schedule_conn(c);
+    return 0;
+}
+
+/* Delivers worker results back onto their connections, in submission order per connection. */
+static void drain_completions(sf_reactor_t *r) {
+    sf_cq_rearm(&r->cq);
+    sf_task_t *t;
+    while ((t = sf_cq_pop(&r->cq)) != NULL) {
+        if (t->run == durable_ready || t->run == repl_ready) {
+            sf_conn_t *c;
+            if (t->run == durable_ready) {
+                c = (sf_conn_t *)((char *)t - offsetof(sf_conn_t, durable));
+                c->durable_parked = 0;
+            } else {
+                c = (sf_conn_t *)((char *)t - offsetof(sf_conn_t, repl_task));
+                c->repl_parked = 0;
+            }
+            if (c->closed) {
+                conn_release_unowned(c);
+            } else if (conn_output(c) != 0 || update_epoll_interest(c) != 0 || conn_done(c)) {
+                close_conn(c);
+            } else {
+                schedule_conn(c);
+            }
+            continue;
         }
+        sf_offload_t *o = (sf_offload_t *)t;
+        sf_conn_t *c = o->conn;
+        c->inflight = NULL;
+        account_request(r, o->start_ms, o->reply.routes_installed);
+        if (c->closed) {
+            free(o->stream.routes);
+            if (o->subscribed) sf_repl_unsubscribe(&o->repl);
+            conn_release_unowned(c);
+        } else if (o->stream.active || o->subscribed) {
+            /* Never parked yet, so the subscription can move to the connection. */
+            if (o->subscribed) {
+                c->repl = o->repl;
+                c->subscribed = 1;
+            } else {
+                c->stream = o->stream;
+            }
+            if (conn_output(c) != 0 || update_epoll_interest(c) != 0 || conn_done(c)) close_conn(c);
+            else schedule_conn(c);
+        } else if (queue_response(c, o->reply.type, o->frame.seq, o->reply.payload, o->reply.len) != 0) {
+            close_conn(c);
+        } else {
+            hold_for_log(c, &o->reply);
+            if (conn_output(c) != 0 || update_epoll_interest(c) != 0 || conn_done(c)) close_conn(c);
+            else schedule_conn(c);
+        }
+        free(o->txn);
+        txn_unstage(o->txn_cap);
+        free(o);
     }
 }
 
-int sf_platform_accept_loop(void) {
-    if (server_fd < 0) return -1;
+static void accept_ready(sf_reactor_t *r) {
+    for (;;) {
+        int cfd = accept(r->listen_fd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("accept");
+            break;
+        }
+        if (sf_admission_reject_connection(&r->admission)) {
+            stat_add(&r->stats.shed_connections, 1);
+            close(cfd);
+            continue;
+        }
+        if (set_nonblocking(cfd) != 0) {
+            close(cfd);
+            continue;
+        }
+        set_busy_poll(cfd);
+        if (r->cpu >= 0) {
+            int cpu = -1;
+            socklen_t len = sizeof(cpu);
+            if (getsockopt(cfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0 && cpu != r->cpu) {
+                stat_add(&r->stats.steer_misses, 1);
+            }
+        }
+
+        sf_conn_t *c = conn_alloc(r);
+        if (!c) {
+            close(cfd);
+            continue;
+        }
+        c->fd = cfd;
+        sf_rxbuf_init(&c->rx);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.data.ptr = c;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, cfd, &ev) != 0) {
+            close(cfd);
+            conn_release(c);
+            continue;
+        }
+        c->ep_events = ev.events;
+    }
+}
 
-    int epfd = epoll_create1(0);
-    if (epfd < 0) {
+static int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static sf_reactor_t *reactor_create(unsigned index) {
+    size_t sz = (sizeof(sf_reactor_t) + SF_CACHE_LINE - 1) / SF_CACHE_LINE * SF_CACHE_LINE;
+    sf_reactor_t *r = (sf_reactor_t *)aligned_alloc(SF_CACHE_LINE, sz);
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    r->index = index;
+    r->cpu = g_opts.ncpus ? g_opts.cpus[index] : -1;
+    r->listen_fd = g_listen_fds[index];
+    r->accepting = 1;
+    r->cq_fd = -1;
+    sf_admission_init(&r->admission, &g_opts.admission);
+    sf_sched_init(&r->sched, &g_opts.sched);
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
         perror("epoll_create1");
-        return -1;
+        free(r);
+        return NULL;
     }
 
     struct epoll_event sev;
     memset(&sev, 0, sizeof(sev));
     sev.data.ptr = SF_EP_SERVER;
     sev.events = EPOLLIN;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &sev) != 0) {
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listen_fd, &sev) != 0) {
         perror("epoll_ctl ADD server");
-        close(epfd);
-        return -1;
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+
+    if (sf_workpool_size() > 0) {
+        r->cq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event cev;
+        memset(&cev, 0, sizeof(cev));
+        cev.data.ptr = SF_EP_COMPLETION;
+        cev.events = EPOLLIN;
+        if (r->cq_fd < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->cq_fd, &cev) != 0) {
+            perror("completion eventfd");
+            if (r->cq_fd >= 0) close(r->cq_fd);
+            close(r->epfd);
+            free(r);
+            return NULL;
+        }
+    }
+    sf_cq_init(&r->cq, r->cq_fd);
+
+    if (index == 0 && g_handoff_fd >= 0) {
+        struct epoll_event hev;
+        memset(&hev, 0, sizeof(hev));
+        hev.data.ptr = SF_EP_HANDOFF;
+        hev.events = EPOLLIN;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, g_handoff_fd, &hev) != 0) perror("epoll_ctl ADD handoff");
+        g_handoff_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        hev.data.ptr = SF_EP_HANDOFF_DONE;
+        if (g_handoff_done_fd < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, g_handoff_done_fd, &hev) != 0) {
+            perror("handoff eventfd");
+        }
     }
+    return r;
+}
+
+/* Sends the listeners and routes to the successor accepted on g_handoff_cfd. */
+static void *handoff_thread(void *arg) {
+    (void)arg;
+    /* Mutations stop here so the snapshot is final; the successor takes them from now on. */
+    sf_routing_set_frozen(1);
+    size_t n = 0;
+    int mfd = memfd_create("sentryflow-routes", MFD_CLOEXEC);
+    /* The successor appends to the same log, so ours must be complete first. */
+    sf_wal_sync();
+    int ok = mfd >= 0 && sf_routing_save_snapshot(NULL, mfd, &n, NULL, NULL) == 0 &&
+             sf_handoff_send(g_handoff_cfd, g_listen_fds, g_nreactors, mfd) == 0;
+    if (mfd >= 0) close(mfd);
+    close(g_handoff_cfd);
+    g_handoff_cfd = -1;
+    if (!ok) sf_routing_set_frozen(0);
+    g_handoff_ok = ok;
+    g_handoff_routes = n;
+    uint64_t one = 1;
+    if (write(g_handoff_done_fd, &one, sizeof(one)) < 0) perror("handoff eventfd");
+    return NULL;
+}
+
+/* A successor connected on the handoff socket: hands it the listeners and
+   routes off the reactor. The socket is not watched until that is done. */
+static void handoff_ready(sf_reactor_t *r) {
+    if (g_handoff_done_fd < 0) return;
+    int cfd = accept4(g_handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (cfd < 0) return;
+    g_handoff_cfd = cfd;
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, g_handoff_fd, NULL);
+    if (pthread_create(&g_handoff_thread, NULL, handoff_thread, NULL) != 0) {
+        perror("pthread_create handoff");
+        close(cfd);
+        g_handoff_cfd = -1;
+        struct epoll_event hev;
+        memset(&hev, 0, sizeof(hev));
+        hev.data.ptr = SF_EP_HANDOFF;
+        hev.events = EPOLLIN;
+        epoll_ctl(r->epfd, EPOLL_CTL_ADD, g_handoff_fd, &hev);
+    }
+}
+
+/* The handoff thread finished: drain if the successor took over, otherwise
+   serve on and watch the handoff socket again. */
+static void handoff_done(sf_reactor_t *r) {
+    uint64_t v;
+    if (read(g_handoff_done_fd, &v, sizeof(v)) != (ssize_t)sizeof(v)) return;
+    pthread_join(g_handoff_thread, NULL);
+    if (!g_handoff_ok) {
+        fprintf(stderr, "handoff: successor did not take over, still serving\n");
+        struct epoll_event hev;
+        memset(&hev, 0, sizeof(hev));
+        hev.data.ptr = SF_EP_HANDOFF;
+        hev.events = EPOLLIN;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, g_handoff_fd, &hev) != 0) perror("epoll_ctl ADD handoff");
+        return;
+    }
+
+    printf("SentryFlow firmware handed off %zu routes, draining\n", g_handoff_routes);
+    fflush(stdout);
+    /* The path now belongs to the successor, so it is not unlinked here. */
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, g_handoff_done_fd, NULL);
+    close(g_handoff_done_fd);
+    g_handoff_done_fd = -1;
+    close(g_handoff_fd);
+    g_handoff_fd = -1;
+    g_drain_deadline_ms = now_ms() + (double)g_opts.drain_timeout_ms;
+    atomic_store(&g_draining, 1);
+}
+
+/* One draining pass: stop accepting, close connections that have nothing
+   left to answer. Returns 1 once the reactor has no connections. */
+static int reactor_drain(sf_reactor_t *r) {
+    if (r->accepting) {
+        /* The successor holds its own references; this only drops ours. */
+        epoll_ctl(r->epfd, EPOLL_CTL_DEL, r->listen_fd, NULL);
+        close(r->listen_fd);
+        r->listen_fd = -1;
+        r->accepting = 0;
+    }
+    int expired = now_ms() >= g_drain_deadline_ms;
+    sf_conn_t *next;
+    for (sf_conn_t *c = r->live; c; c = next) {
+        next = c->live_next;
+        if (c->closed) continue; /* waiting for its worker */
+        int idle = !c->inflight && !c->sched.queued && c->tx_len == 0 && c->rx.len == 0;
+        if (idle || expired) close_conn(c);
+    }
+    return r->live == NULL;
+}
+
+/* Blocking wait with microsecond resolution where the kernel has epoll_pwait2. */
+static int epoll_wait_us(int epfd, struct epoll_event *events, int max, uint32_t timeout_us) {
+#ifdef SYS_epoll_pwait2
+    static atomic_int no_pwait2;
+    if (timeout_us % 1000u != 0 && !atomic_load_explicit(&no_pwait2, memory_order_relaxed)) {
+        struct timespec ts;
+        ts.tv_sec = timeout_us / 1000000u;
+        ts.tv_nsec = (long)(timeout_us % 1000000u) * 1000L;
+        int n = (int)syscall(SYS_epoll_pwait2, epfd, events, max, &ts, NULL, (size_t)0);
+        if (n >= 0 || errno != ENOSYS) return n;
+        atomic_store(&no_pwait2, 1);
+    }
+#endif
+    return epoll_wait(epfd, events, max, (int)((timeout_us + 999u) / 1000u));
+}
+
+/* Waits for the next batch and sets *origin_ms to the earliest time its events
+   could have become ready. */
+static int reactor_wait(sf_reactor_t *r, struct epoll_event *events, int max, double prev_ready_ms,
+                        double *origin_ms) {
+    double enter_ms = now_ms();
+    if (sf_sched_pending(&r->sched)) {
+        /* Lanes still hold work: just pick up whatever else became ready meanwhile. */
+        int n = epoll_wait(r->epfd, events, max, 0);
+        *origin_ms = prev_ready_ms;
+        return n;
+    }
+
+    if (g_opts.busy_poll_us) {
+        double spin_end_ms = enter_ms + (double)g_opts.busy_poll_us / 1000.0;
+        double poll_ms = enter_ms;
+        for (;;) {
+            int n = epoll_wait(r->epfd, events, max, 0);
+            double t = now_ms();
+            if (n != 0 || t >= spin_end_ms) {
+                stat_add(&r->stats.busy_poll_spin_us, (uint64_t)((t - enter_ms) * 1000.0));
+                if (n > 0) {
+                    /* The first poll finds backlog from the previous batch; later ones
+                       find events that arrived since the poll before. */
+                    *origin_ms = (poll_ms == enter_ms) ? prev_ready_ms : poll_ms;
+                    if (poll_ms != enter_ms) stat_add(&r->stats.busy_poll_hits, 1);
+                    return n;
+                }
+                if (n < 0) return n;
+                break;
+            }
+            poll_ms = t;
+        }
+    }
+
+    uint32_t timeout_us = g_opts.poll_timeout_us;
+    if (atomic_load_explicit(&g_draining, memory_order_relaxed) && timeout_us > 10000u) timeout_us = 10000u;
+    int n = epoll_wait_us(r->epfd, events, max, timeout_us);
+    /* If the wait returned without blocking, the readiness piled up while the
+       previous batch was being processed, so that is where queueing started. */
+    double ready_ms = now_ms();
+    *origin_ms = (ready_ms - enter_ms < 0.05) ? prev_ready_ms : ready_ms;
+    return n;
+}
+
+static int reactor_run(unsigned index) {
+    if (g_opts.ncpus && pin_to_cpu(g_opts.cpus[index]) != 0) {
+        fprintf(stderr, "reactor %u: cannot pin to cpu %d\n", index, g_opts.cpus[index]);
+    }
+    /* Allocate only after pinning so first-touch puts reactor memory on the local node. */
+    sf_reactor_t *r = reactor_create(index);
+    if (!r) return -1;
+    sf_routing_register_reader(index);
+    atomic_store(&g_reactors[index], r);
 
     struct epoll_event events[64];
+    double prev_ready_ms = now_ms();
     for (;;) {
-        int n = epoll_wait(epfd, events, (int)(sizeof(events) / sizeof(events[0])), 1000);
+        int n = reactor_wait(r, events, (int)(sizeof(events) / sizeof(events[0])), prev_ready_ms,
+                             &r->batch_origin_ms);
         if (n < 0) {
             if (errno == EINTR) continue;
             perror("epoll_wait");
-            close(epfd);
             return -1;
         }
+        prev_ready_ms = now_ms();
 
         for (int i = 0; i < n; ++i) {
-            if (events[i].data.ptr == SF_EP_SERVER) {
-                for (;;) {
-                    struct sockaddr_in client_addr;
-                    socklen_t addrlen = sizeof(client_addr);
-                    int cfd = accept(server_fd, (struct sockaddr *)&client_addr, &addrlen);
-                    if (cfd < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-                        perror("accept");
-                        break;
-                    }
-                    if (set_nonblocking(cfd) != 0) {
-                        close(cfd);
-                        continue;
-                    }
-
-                    sf_conn_t *c = (sf_conn_t *)calloc(1, sizeof(sf_conn_t));
-                    if (!c) {
-                        close(cfd);
-                        continue;
-                    }
-                    c->fd = cfd;
-                    sf_rxbuf_init(&c->rx);
-
-                    inet_ntop(AF_INET, &client_addr.sin_addr, c->remote_addr, sizeof(c->remote_addr));
-
-                    struct epoll_event ev;
-                    memset(&ev, 0, sizeof(ev));
-                    ev.data.ptr = c;
-                    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP;
-                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) != 0) {
-                        close(cfd);
-                        free(c);
-                        continue;
-                    }
-                }
+            if (events[i].data.ptr == SF_EP_COMPLETION) {
+                drain_completions(r);
+            } else if (events[i].data.ptr == SF_EP_SERVER) {
+                if (r->accepting) accept_ready(r);
+            } else if (events[i].data.ptr == SF_EP_HANDOFF) {
+                handoff_ready(r);
+            } else if (events[i].data.ptr == SF_EP_HANDOFF_DONE) {
+                handoff_done(r);
             } else {
                 sf_conn_t *c = (sf_conn_t *)events[i].data.ptr;
                 uint32_t ev = events[i].events;
-                if (ev & (EPOLLHUP | EPOLLRDHUP)) {
-                    close_conn(epfd, c);
+                /* Both directions gone (or an error): nothing can be answered. A FIN
+                   alone (EPOLLRDHUP) is read like data, so the replies still go out. */
+                if (ev & (EPOLLHUP | EPOLLERR)) {
+                    close_conn(c);
                     continue;
                 }
-                if (ev & EPOLLIN) {
-                    handle_readable(epfd, c);
-                }
                 if (ev & EPOLLOUT) {
-                    handle_writable(epfd, c);
+                    if (handle_writable(c) != 0) continue;
+                }
+                if (ev & (EPOLLIN | EPOLLRDHUP)) {
+                    c->ready_ms = r->batch_origin_ms;
+                    handle_readable(c);
                 }
             }
         }
+
+        sf_sched_run_round(&r->sched, serve_conn, NULL);
+
+        if (atomic_load_explicit(&g_draining, memory_order_relaxed) && reactor_drain(r)) return 0;
+    }
+}
+
+static void *reactor_thread(void *arg) {
+    unsigned index = (unsigned)(uintptr_t)arg;
+    if (reactor_run(index) != 0) {
+        fprintf(stderr, "reactor %u exited\n", index);
+    }
+    return NULL;
+}
+
+int sf_platform_accept_loop(void) {
+    if (g_listen_fds[0] < 0) return -1;
+
+    /* Reactor 0 runs on the calling thread; the others get their own. */
+    for (unsigned i = 1; i < g_nreactors; ++i) {
+        if (pthread_create(&g_reactor_threads[i], NULL, reactor_thread, (void *)(uintptr_t)i) != 0) {
+            perror("pthread_create reactor");
+            return -1;
+        }
     }
+    int rc = reactor_run(0);
+    /* Only a completed drain returns cleanly; wait for the other reactors' drains. */
+    if (rc == 0) {
+        for (unsigned i = 1; i < g_nreactors; ++i) pthread_join(g_reactor_threads[i], NULL);
+        sf_workpool_stop();
+    }
+    return rc;
 }
 
 void sf_stack_get_stats(sf_request_stats_t *out) {
     if (!out) return;
-    *out = g_stats;
+    memset(out, 0, sizeof(*out));
+    double latency_sum = 0.0;
+    for (unsigned i = 0; i < g_nreactors; ++i) {
+        sf_reactor_t *r = atomic_load(&g_reactors[i]);
+        if (!r) continue;
+        sf_stats_shard_t *st = &r->stats;
+        uint64_t total = stat_get(&st->total_requests);
+        double last = atomic_load_explicit(&st->last_latency_ms, memory_order_relaxed);
+        out->total_requests += total;
+        out->bad_frames += stat_get(&st->bad_frames);
+        out->routes_installed += stat_get(&st->routes_installed);
+        out->shed_requests += stat_get(&st->shed_requests);
+        out->shed_connections += stat_get(&st->shed_connections);
+        out->steer_misses += stat_get(&st->steer_misses);
+        out->busy_poll_hits += stat_get(&st->busy_poll_hits);
+        out->busy_poll_spin_us += stat_get(&st->busy_poll_spin_us);
+        latency_sum += atomic_load_explicit(&st->avg_latency_ms, memory_order_relaxed) * (double)total;
+        if (last > out->last_latency_ms) out->last_latency_ms = last;
+    }
+    if (out->total_requests) out->avg_latency_ms = latency_sum / (double)out->total_requests;
+    sf_wal_get_stats(&out->wal_records, &out->wal_syncs);
+    out->route_seq = sf_routing_seq();
+    out->repl_resyncs = sf_repl_resyncs();
+    out->route_expired = sf_routing_expired();
+    sf_routing_damp_stats(&out->route_suppressed, &out->route_coalesced);
+    out->fib_routes = sf_routing_fib_count();
+    sf_routing_cache_stats(&out->route_cache_hits, &out->route_cache_misses);
+}
+
+
+/* Self-test: transactions driven through handle_txn_frame() and a streamed
+   dump, on a connection with no socket, against the process's routing table. */
+
+/* Pops the reply queued on c into type and payload (up to cap bytes). */
+static int test_reply(sf_conn_t *c, uint8_t *type, uint8_t *payload, size_t cap, size_t *len) {
+    sf_rxbuf_t rx;
+    sf_frame_t f;
+    sf_rxbuf_init(&rx);
+    if (sf_rxbuf_append(&rx, c->tx + c->tx_off, c->tx_len - c->tx_off) != 0) return -1;
+    c->tx_len = c->tx_off = 0;
+    if (sf_proto_try_decode(&rx, &f, payload, cap, len) != 1 || rx.len != 0) return -1;
+    *type = f.type;
+    return 0;
+}
+
+/* Sends one ROUTE_UPDATE; returns 1 for an ack (applied and version set), 0
+   for an error whose text is err, -1 for anything else. */
+static int test_txn(sf_conn_t *c, uint16_t flags, const uint8_t *payload, size_t len, const char *err,
+                    uint32_t *applied, uint64_t *version) {
+    sf_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.type = SF_MSG_ROUTE_UPDATE;
+    f.flags = flags;
+    f.seq = 7;
+    if (handle_txn_frame(c, &f, payload, len, now_ms()) != 1) return -1;
+    uint8_t type, out[SF_MAX_REPLY];
+    size_t n = 0;
+    if (test_reply(c, &type, out, sizeof(out), &n) != 0) return -1;
+    if (type == SF_MSG_ERROR) return err && n == strlen(err) && memcmp(out, err, n) == 0 ? 0 : -1;
+    if (type != SF_MSG_ROUTE_ACK || n != 12 || err) return -1;
+    uint32_t applied_be;
+    uint64_t version_be;
+    memcpy(&applied_be, out, 4);
+    memcpy(&version_be, out + 4, 8);
+    *applied = ntohl(applied_be);
+    *version = htonll_u64(version_be);
+    return 1;
+}
+
+/* Feeds one frame through handle_next_frame() and pops its reply as test_reply() does. */
+static int test_frame(sf_conn_t *c, uint8_t type, uint16_t flags, const uint8_t *payload, size_t len,
+                      uint8_t *rtype, uint8_t *out, size_t cap, size_t *n) {
+    sf_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.version = SF_PROTO_VERSION;
+    f.type = type;
+    f.flags = flags;
+    f.seq = 11;
+    uint8_t buf[SF_PROTO_HEADER_LEN + 256];
+    size_t buf_len = 0, consumed = 0;
+    if (sf_proto_encode(buf, sizeof(buf), &f, payload, len, &buf_len) != 0) return -1;
+    if (sf_rxbuf_append(&c->rx, buf, buf_len) != 0) return -1;
+    if (handle_next_frame(c, &consumed) != 1 || consumed != buf_len) return -1;
+    return test_reply(c, rtype, out, cap, n);
+}
+
+/* k 16-byte records for 198.18.<base + i>.0/24 (mask 33 for a bad one). */
+static size_t test_routes(uint8_t *out, uint32_t base, size_t k, uint8_t mask) {
+    for (size_t i = 0; i < k; ++i) {
+        uint8_t *r = out + 16 * i;
+        memset(r, 0, 16);
+        uint32_t prefix_be = htonl(0xC6120000u | ((base + (uint32_t)i) & 0xFFu) << 8);
+        uint32_t nh_be = htonl(0x0A000001u);
+        memcpy(r, &prefix_be, 4);
+        r[4] = mask;
+        r[7] = 1;
+        memcpy(r + 8, &nh_be, 4);
+    }
+    return 16 * k;
 }
 
+static int test_installed(uint32_t base, size_t k) {
+    size_t found = 0;
+    for (size_t i = 0; i < k; ++i) {
+        sf_route_entry_t best;
+        uint32_t ip_be = htonl(0xC6120001u | ((base + (uint32_t)i) & 0xFFu) << 8);
+        if (sf_routing_lookup(ip_be, &best, NULL) == 0 && best.mask_bits == 24) found++;
+    }
+    return found == k ? 1 : found == 0 ? 0 : -1;
+}
+
+/* Streams a ROUTE_DUMP of the main table through stream_next() and checks it
+   against sf_routing_export(): every frame but the last flagged MORE, one
+   version throughout, and count routes that decode back to the table. */
+static int test_dump(sf_conn_t *c) {
+    sf_frame_t f;
+    sf_reply_t reply;
+    memset(&f, 0, sizeof(f));
+    f.type = SF_MSG_ROUTE_DUMP;
+    f.seq = 9;
+    open_dump(&f, NULL, 0, &c->stream, &reply);
+    if (!c->stream.active) return -1;
+    sf_route_entry_t *want = NULL, *got = (sf_route_entry_t *)malloc((c->stream.n ? c->stream.n : 1) * sizeof(*got));
+    size_t nwant = 0, groups = 0, ngot = 0, frames = 0;
+    uint64_t version = c->stream.version, seq = 0;
+    int rc = -1, more = 1;
+    if (!got || sf_routing_export(&want, &nwant, &groups, &seq) != 0) goto out;
+    while (more) {
+        uint8_t payload[SF_MAX_REPLY];
+        size_t len = 0;
+        sf_rxbuf_t rx;
+        sf_frame_t rf;
+        if (!c->stream.active || stream_next(c) != 0) goto out;
+        sf_rxbuf_init(&rx);
+        if (sf_rxbuf_append(&rx, c->tx + c->tx_off, c->tx_len - c->tx_off) != 0) goto out;
+        c->tx_len = c->tx_off = 0;
+        if (sf_proto_try_decode(&rx, &rf, payload, sizeof(payload), &len) != 1 || rx.len != 0) goto out;
+        if (rf.type != SF_MSG_ROUTE_DUMP_REPLY || rf.seq != f.seq || len < 12) goto out;
+        more = (rf.flags & SF_FLAG_MORE) != 0;
+        uint64_t version_be;
+        uint32_t count_be;
+        memcpy(&version_be, payload, 8);
+        memcpy(&count_be, payload + 8, 4);
+        uint32_t count = ntohl(count_be);
+        if (htonll_u64(version_be) != version || count > nwant - groups - ngot) goto out;
+        if ((more && count == 0) || sf_repl_decode_routes(payload + 12, len - 12, count, got + ngot) != 0) goto out;
+        ngot += count;
+        frames++;
+    }
+    if (c->stream.active || frames < 2 || seq != version || ngot != nwant - groups) goto out;
+    for (size_t i = 0; i < ngot; ++i) {
+        const sf_route_entry_t *a = &got[i], *b = &want[groups + i];
+        if (a->prefix_be != b->prefix_be || a->mask_bits != b->mask_bits || a->next_hop_be != b->next_hop_be ||
+            a->metric != b->metric || (a->flags & SF_ROUTE_F_GROUP) != (b->flags & SF_ROUTE_F_GROUP))
+            goto out;
+    }
+    rc = 0;
+out:
+    free(c->stream.routes);
+    memset(&c->stream, 0, sizeof(c->stream));
+    c->tx_len = c->tx_off = 0;
+    free(want);
+    free(got);
+    return rc;
+}
+
+/* Routes in 100.64.0.0/14 for the dump test, several frames' worth. */
+#define SF_TEST_DUMP_ROUTES 1024u
+
+int sf_platform_self_test(void) {
+    size_t sz = (sizeof(sf_reactor_t) + SF_CACHE_LINE - 1) / SF_CACHE_LINE * SF_CACHE_LINE;
+    sf_reactor_t *r = (sf_reactor_t *)aligned_alloc(SF_CACHE_LINE, sz);
+    if (!r) return -1;
+    memset(r, 0, sizeof(*r));
+    sf_conn_t *c = conn_alloc(r);
+    int ok = 0;
+    uint8_t p[16 * 8 + 12];
+    uint32_t applied = 0;
+    uint64_t v = 0, v0 = sf_routing_seq();
+    static sf_route_entry_t dump[SF_TEST_DUMP_ROUTES];
+    size_t ndump = 0;
+    do {
+        if (!c) break;
+        /* Staged frames are acked with nothing applied and change nothing
+           until the last frame commits them all as one version. */
+        size_t len = test_routes(p, 0, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, NULL, &applied, &v) != 1 || applied || v != v0) break;
+        len = test_routes(p, 4, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, NULL, &applied, &v) != 1 || applied) break;
+        if (test_installed(0, 8) != 0 || sf_routing_seq() != v0) break;
+        len = test_routes(p, 8, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN, p, len, NULL, &applied, &v) != 1 || applied != 12 || v != v0 + 1) break;
+        if (test_installed(0, 12) != 1 || sf_routing_seq() != v0 + 1) break;
+
+        /* IF_VERSION: a stale version refuses the commit, the current one takes it. */
+        uint64_t stale_be = htonll_u64(v0), cur_be = htonll_u64(v0 + 1);
+        memcpy(p, &stale_be, 8);
+        len = 8 + test_routes(p + 8, 20, 4, 24);
+        if (test_txn(c, SF_FLAG_IF_VERSION, p, len, "version mismatch", &applied, &v) != 0) break;
+        if (test_installed(20, 4) != 0 || sf_routing_seq() != v0 + 1) break;
+        memcpy(p, &cur_be, 8);
+        if (test_txn(c, SF_FLAG_IF_VERSION, p, len, NULL, &applied, &v) != 1 || applied != 4 || v != v0 + 2) break;
+        if (test_installed(20, 4) != 1) break;
+
+        /* A rejected frame aborts the rest of its transaction, last frame
+           included; the next transaction starts clean. */
+        len = test_routes(p, 40, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, NULL, &applied, &v) != 1) break;
+        uint32_t vrf_be = htonl(5);
+        memcpy(p, &vrf_be, 4);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE | SF_FLAG_VRF, p, 4 + 16, "bad vrf", &applied, &v) != 0) break;
+        len = test_routes(p, 44, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, "transaction aborted", &applied, &v) != 0) break;
+        if (test_txn(c, SF_FLAG_TXN, p, len, "transaction aborted", &applied, &v) != 0) break;
+        if (test_installed(40, 8) != 0 || sf_routing_seq() != v0 + 2) break;
+
+        /* A route the commit refuses fails the whole transaction. */
+        len = test_routes(p, 60, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, NULL, &applied, &v) != 1) break;
+        len = test_routes(p, 64, 4, 24);
+        test_routes(p + 32, 66, 1, 33);
+        if (test_txn(c, SF_FLAG_TXN, p, len, "bad route", &applied, &v) != 0) break;
+        if (test_installed(60, 6) != 0 || sf_routing_seq() != v0 + 2) break;
+
+        /* Staging past the budget all transactions share is refused as busy. */
+        size_t staged = atomic_load(&g_txn_staged);
+        atomic_store(&g_txn_staged, SF_TXN_STAGED_MAX_ROUTES - 8);
+        len = test_routes(p, 80, 4, 24);
+        int busy = test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, "busy", &applied, &v) == 0 &&
+                   atomic_load(&g_txn_staged) == SF_TXN_STAGED_MAX_ROUTES - 8 &&
+                   test_txn(c, SF_FLAG_TXN, p, len, "transaction aborted", &applied, &v) == 0;
+        atomic_store(&g_txn_staged, staged);
+        if (!busy || test_installed(80, 4) != 0) break;
+        if (test_txn(c, SF_FLAG_TXN, p, len, NULL, &applied, &v) != 1 || applied != 4 || c->txn.cap) break;
+        if (atomic_load(&g_txn_staged) != staged) break;
+
+        /* A dump too big for one frame streams as MORE frames of one version. */
+        for (size_t i = 0; i < SF_TEST_DUMP_ROUTES; ++i) {
+            memset(&dump[i], 0, sizeof(dump[i]));
+            dump[i].prefix_be = htonl(0x64400000u | (uint32_t)i << 8);
+            dump[i].mask_bits = 24;
+            dump[i].metric = (uint16_t)(1 + i % 7);
+            dump[i].next_hop_be = htonl(0x0A000001u + (uint32_t)(i % 3));
+        }
+        ndump = SF_TEST_DUMP_ROUTES;
+        if (sf_routing_upsert_batch(dump, ndump, NULL) != (long)ndump) break;
+        if (test_dump(c) != 0) break;
+
+        /* A peer's decision is computed on first use, kept while the table is
+           unchanged and recomputed after a write. */
+        sf_route_decision_cache_t dc;
+        struct in_addr peer;
+        peer.s_addr = htonl(0xC612C801u);
+        sf_routing_decision_init(&dc, AF_INET, &peer);
+        if (dc.epoch != 0) break;
+        const sf_route_decision_t *d = sf_routing_decision(&dc);
+        uint64_t epoch = sf_routing_epoch();
+        if (dc.epoch != epoch || d->matched_prefix_bits >= 24) break;
+        if (sf_routing_decision(&dc) != d || dc.epoch != epoch) break;
+        len = test_routes(p, 200, 1, 24);
+        if (test_txn(c, 0, p, len, NULL, &applied, &v) != 1 || applied != 1) break;
+        if (sf_routing_epoch() == epoch) break;
+        d = sf_routing_decision(&dc);
+        if (dc.epoch != sf_routing_epoch() || d->matched_prefix_bits != 24 || d->next_hop_be != htonl(0x0A000001u)) break;
+
+        /* Past the latency SLO lookups are shed with busy; probes are still answered. */
+        sf_admission_config_t ac;
+        sf_admission_default_config(&ac);
+        ac.slo_ms = 1.0;
+        sf_admission_init(&r->admission, &ac);
+        sf_sched_config_t sched = g_opts.sched;
+        sf_sched_default_config(&g_opts.sched);
+        c->ready_ms = now_ms() - 1000.0;
+        uint8_t type, out[64];
+        size_t n = 0;
+        uint32_t ip_be = htonl(0xC612C801u);
+        int shed = test_frame(c, SF_MSG_ROUTE_LOOKUP, 0, (const uint8_t *)&ip_be, 4, &type, out, sizeof(out), &n) == 0 &&
+                   type == SF_MSG_ERROR && n == 4 && memcmp(out, "busy", 4) == 0 &&
+                   test_frame(c, SF_MSG_PING, 0, (const uint8_t *)"hc", 2, &type, out, sizeof(out), &n) == 0 &&
+                   type == SF_MSG_PONG && n == 2;
+        g_opts.sched = sched;
+        memset(&r->admission, 0, sizeof(r->admission));
+        if (!shed) break;
+
+        /* A frame shed inside a transaction aborts it: the last frame commits nothing. */
+        len = test_routes(p, 96, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, NULL, &applied, &v) != 1) break;
+        sf_admission_init(&r->admission, &ac);
+        c->ready_ms = now_ms() - 1000.0;
+        len = test_routes(p, 100, 4, 24);
+        shed = test_frame(c, SF_MSG_ROUTE_UPDATE, SF_FLAG_TXN | SF_FLAG_TXN_MORE, p, len, &type, out, sizeof(out), &n) == 0 &&
+               type == SF_MSG_ERROR && n == 4 && memcmp(out, "busy", 4) == 0;
+        memset(&r->admission, 0, sizeof(r->admission));
+        if (!shed) break;
+        len = test_routes(p, 104, 4, 24);
+        if (test_txn(c, SF_FLAG_TXN, p, len, "transaction aborted", &applied, &v) != 0) break;
+        if (test_installed(96, 12) != 0 || c->txn.failed) break;
+        ok = 1;
+    } while (0);
+
+    /* Leave the table as it was found. */
+    sf_route_entry_t keys[36];
+    uint32_t bases[] = {0, 20, 80, 96, 200};
+    size_t counts[] = {12, 4, 4, 12, 1}, nk = 0;
+    for (size_t b = 0; b < 5; ++b) {
+        for (size_t i = 0; i < counts[b]; ++i, ++nk) {
+            memset(&keys[nk], 0, sizeof(keys[nk]));
+            keys[nk].prefix_be = htonl(0xC6120000u | ((bases[b] + (uint32_t)i) & 0xFFu) << 8);
+            keys[nk].mask_bits = 24;
+        }
+    }
+    sf_routing_withdraw_batch(keys, nk, NULL);
+    if (ndump) sf_routing_withdraw_batch(dump, ndump, NULL);
+    if (c) {
+        conn_release(c);
+        /* conn_alloc() carved one slab; it starts at its lowest connection. */
+        sf_conn_t *slab = r->free_conns;
+        for (sf_conn_t *x = r->free_conns; x; x = x->free_next) {
+            if (x < slab) slab = x;
+        }
+        free(slab);
+    }
+    free(r);
+    return ok ? 0 : -1;
+}
@@ -2,6 +2,23 @@
 #include "platform_linux.h"
 #include "sf_protocol.h"
 #include "routing_table.h"
+#include "nexthop_table.h"
+#include "routing6_table.h"
+#include "sf_admission.h"
+#include "sf_sched.h"
+#include "sf_workpool.h"
+#include "sf_handoff.h"
+#include "sf_snapshot.h"
+#include "sf_vrf.h"
+#include "sf_routes_file.h"
+#include "sf_wal.h"
+#include "sf_repl.h"
+#include "sf_route_pack.h"
+#include "sf_expiry.h"
+#include "sf_damp.h"
+#include "sf_fib.h"
+#include "sf_route_cache.h"
+#include "sf_route_bloom.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -9,6 +26,23 @@
 static char g_bind_addr[32] = "0.0.0.0";
 static unsigned short g_port = 9000;
 
+void sf_stack_default_options(sf_stack_options_t *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    sf_admission_default_config(&out->admission);
+    out->read_budget_bytes = 16384;
+    out->frame_budget = 32;
+    sf_sched_default_config(&out->sched);
+    out->workers = 2;
+    out->offload_min_routes = 16;
+    out->poll_timeout_us = 1000000;
+    out->drain_timeout_ms = 5000;
+}
+
+void sf_stack_set_options(const sf_stack_options_t *opts) {
+    sf_platform_configure(opts);
+}
+
 int sf_stack_init(const char *bind_addr, unsigned short port) {
     if (bind_addr && *bind_addr) {
         strncpy(g_bind_addr, bind_addr, sizeof(g_bind_addr) - 1);
@@ -37,10 +71,82 @@ int sf_stack_self_test(void) {
         fprintf(stderr, "self-test failed: protocol framing\n");
         ok = 0;
     }
+    if (sf_nh_table_self_test() != 0) {
+        fprintf(stderr, "self-test failed: next-hop groups\n");
+        ok = 0;
+    }
     if (sf_route_table_self_test() != 0) {
         fprintf(stderr, "self-test failed: routing table\n");
         ok = 0;
     }
+    if (sf_route6_table_self_test() != 0) {
+        fprintf(stderr, "self-test failed: IPv6 routing table\n");
+        ok = 0;
+    }
+    if (sf_admission_self_test() != 0) {
+        fprintf(stderr, "self-test failed: admission control\n");
+        ok = 0;
+    }
+    if (sf_sched_self_test() != 0) {
+        fprintf(stderr, "self-test failed: priority lanes\n");
+        ok = 0;
+    }
+    if (sf_workpool_self_test() != 0) {
+        fprintf(stderr, "self-test failed: worker pool\n");
+        ok = 0;
+    }
+    if (sf_handoff_self_test() != 0) {
+        fprintf(stderr, "self-test failed: restart handoff\n");
+        ok = 0;
+    }
+    if (sf_snapshot_self_test() != 0) {
+        fprintf(stderr, "self-test failed: route snapshot\n");
+        ok = 0;
+    }
+    if (sf_vrf_self_test() != 0) {
+        fprintf(stderr, "self-test failed: VRF tables\n");
+        ok = 0;
+    }
+    if (sf_routes_file_self_test() != 0) {
+        fprintf(stderr, "self-test failed: routes file\n");
+        ok = 0;
+    }
+    if (sf_wal_self_test() != 0) {
+        fprintf(stderr, "self-test failed: write-ahead log\n");
+        ok = 0;
+    }
+    if (sf_repl_self_test() != 0) {
+        fprintf(stderr, "self-test failed: route replication\n");
+        ok = 0;
+    }
+    if (sf_route_pack_self_test() != 0) {
+        fprintf(stderr, "self-test failed: packed routes\n");
+        ok = 0;
+    }
+    if (sf_expiry_self_test() != 0) {
+        fprintf(stderr, "self-test failed: route expiry\n");
+        ok = 0;
+    }
+    if (sf_damp_self_test() != 0) {
+        fprintf(stderr, "self-test failed: route dampening\n");
+        ok = 0;
+    }
+    if (sf_fib_self_test() != 0) {
+        fprintf(stderr, "self-test failed: compressed FIB\n");
+        ok = 0;
+    }
+    if (sf_route_cache_self_test() != 0) {
+        fprintf(stderr, "self-test failed: destination cache\n");
+        ok = 0;
+    }
+    if (sf_route_bloom_self_test() != 0) {
+        fprintf(stderr, "self-test failed: prefix-length filters\n");
+        ok = 0;
+    }
+    if (sf_platform_self_test() != 0) {
+        fprintf(stderr, "self-test failed: connection handler\n");
+        ok = 0;
+    }
     if (!ok) return 1;
     printf("SentryFlow firmware self-test: OK\n");
     return 0;
@@ -1,33 +1,1062 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "routing.h"
+#include "sf_damp.h"
+#include "sf_fib.h"
+#include "sf_route_cache.h"
+#include "sf_route_bloom.h"
+#include "sf_expiry.h"
+#include "sf_snapshot.h"
+#include "sf_vrf.h"
 
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 
 static sf_route_strategy_t current_strategy = SF_ROUTE_DIRECT;
 static sf_route_table_t g_table;
+static sf_route6_table_t g_table6;
+
+/* Big-reader lock: one rwlock per reactor on its own cache line, plus a shared
+   slot for unregistered threads. Readers only touch their own slot, so lookups
+   on different cores never bounce a lock line; writers take every slot in order. */
+#define SF_READER_SLOTS (SF_ROUTING_MAX_READERS + 1)
+
+typedef struct {
+    _Alignas(64) pthread_rwlock_t lock;
+} sf_reader_slot_t;
+
+static sf_reader_slot_t g_slots[SF_READER_SLOTS];
+static pthread_once_t g_slots_once = PTHREAD_ONCE_INIT;
+static atomic_int g_frozen;  /* set while the table is being handed to a successor */
+static _Atomic uint64_t g_seq;  /* last mutation sequence number; written under the write lock */
+static _Atomic uint64_t g_seq6;  /* IPv6 table version; likewise */
+static sf_routing_sink_fn g_sink;
+static sf_expiry_t g_expiry;  /* aging index; under g_writer */
+static _Atomic uint64_t g_expired;
+static sf_damp_t g_damp;  /* dampening and coalescing records; under g_writer (the counters under the write lock) */
+static sf_fib_t g_fib;  /* compressed copy of g_table for lookups; under the write lock */
+static int g_fib_on;
+static double g_bloom_fpr;  /* prefix-length filters on the table lookups use, 0 = off; under the write lock */
+static _Thread_local unsigned t_slot = SF_ROUTING_MAX_READERS;
+static sf_vrf_set_t g_vrfs;  /* under the write lock */
+static _Atomic uint64_t g_vrf_changes;  /* bumped under the write lock when a VRF changes or the
+                                           main table is replaced */
+/* The last table copied into VRFs, reused while the table is unchanged. Built
+   under a read lock, so it has a lock of its own. A new one replaces it once
+   the source changed; VRFs still mapping the old one keep it alive, so the
+   images alive number at most the VRFs. */
+static pthread_mutex_t g_image_lock = PTHREAD_MUTEX_INITIALIZER;
+static sf_vrf_image_t g_image = {.fd = -1};
+static uint32_t g_image_src = SF_VRF_EMPTY;  /* none */
+static uint64_t g_image_seq, g_image_changes;
+static _Atomic uint64_t g_epoch = 1;  /* bumped as each write section ends; cached decisions check it */
+static uint32_t g_cache_entries;  /* destination cache size per reactor, 0 = off; set before serving */
+static sf_route_cache_t *_Atomic g_caches[SF_ROUTING_MAX_READERS];  /* each allocated by its reactor */
+
+/* Writers take g_writer, then every slot (the write lock). A write that
+   needs longer than one short write section keeps g_writer throughout and
+   blocks readers only in sections: a batch goes in chunks, a large commit
+   into a copy that is swapped in. No other write lands in between, so
+   mutations still reach the sink in the order they are applied. State that
+   only writers read (the aging index, held changes) needs only g_writer. */
+static pthread_mutex_t g_writer = PTHREAD_MUTEX_INITIALIZER;
+
+static void slots_init(void) {
+    for (unsigned i = 0; i < SF_READER_SLOTS; ++i) pthread_rwlock_init(&g_slots[i].lock, NULL);
+}
+
+/* Under g_writer: starts and ends a write section. */
+static void readers_block(void) {
+    pthread_once(&g_slots_once, slots_init);
+    for (unsigned i = 0; i < SF_READER_SLOTS; ++i) pthread_rwlock_wrlock(&g_slots[i].lock);
+}
+
+static void readers_resume(void) {
+    atomic_fetch_add_explicit(&g_epoch, 1, memory_order_release);
+    for (unsigned i = SF_READER_SLOTS; i-- > 0;) pthread_rwlock_unlock(&g_slots[i].lock);
+}
+
+static void table_write_lock(void) {
+    pthread_mutex_lock(&g_writer);
+    readers_block();
+}
+
+static void table_write_unlock(void) {
+    readers_resume();
+    pthread_mutex_unlock(&g_writer);
+}
+
+void sf_routing_register_reader(unsigned slot) {
+    t_slot = slot < SF_ROUTING_MAX_READERS ? slot : SF_ROUTING_MAX_READERS;
+}
 
 void sf_routing_init(void) {
     sf_routing_set_strategy(SF_ROUTE_DIRECT);
     sf_route_table_init(&g_table);
+    sf_route6_table_init(&g_table6);
 }
 
 void sf_routing_set_strategy(sf_route_strategy_t strategy) {
     current_strategy = strategy;
+    atomic_fetch_add_explicit(&g_epoch, 1, memory_order_release);
+}
+
+uint64_t sf_routing_epoch(void) {
+    return atomic_load_explicit(&g_epoch, memory_order_acquire);
 }
 
 sf_route_table_t *sf_routing_table(void) {
     return &g_table;
 }
 
-sf_route_decision_t sf_routing_decide(const char *remote_addr) {
+int sf_routing_lookup(uint32_t ip_be, sf_route_entry_t *out_best, uint64_t *version) {
+    return sf_routing_lookup_flow(ip_be, sf_nh_flow_hash(&ip_be, sizeof(ip_be)), out_best, version);
+}
+
+/* Under a read lock: resolves a route through a group to its member. */
+static int resolve(const sf_nh_table_t *nh, int r, uint32_t flow_hash, sf_route_entry_t *out_best) {
+    if (r == 0 && (out_best->flags & SF_ROUTE_F_GROUP)) {
+        out_best->next_hop_be = sf_nh_select(nh, ntohl(out_best->next_hop_be), flow_hash);
+        out_best->flags &= (uint8_t)~SF_ROUTE_F_GROUP;
+    }
+    return r;
+}
+
+static int lookup_in(const sf_route_table_t *rt, uint32_t ip_be, uint32_t flow_hash, sf_route_entry_t *out_best) {
+    return resolve(&rt->nh, sf_route_table_lookup(rt, ip_be, out_best), flow_hash, out_best);
+}
+
+/* Under a read lock: the calling reactor's destination cache, if there is one. */
+static sf_route_cache_t *reader_cache(void) {
+    if (!g_cache_entries || t_slot >= SF_ROUTING_MAX_READERS) return NULL;
+    sf_route_cache_t *c = atomic_load_explicit(&g_caches[t_slot], memory_order_relaxed);
+    if (c) return c;
+    /* Allocated by the reactor itself, so it lands on the reactor's NUMA node. */
+    c = (sf_route_cache_t *)malloc(sizeof(*c));
+    if (!c || sf_route_cache_init(c, g_cache_entries) != 0) {
+        free(c);
+        return NULL;
+    }
+    atomic_store_explicit(&g_caches[t_slot], c, memory_order_release);
+    return c;
+}
+
+/* Under a read lock: the main table's answer before groups are resolved,
+   from the reactor's cache, the FIB or the table itself. */
+static int lookup_main(uint32_t ip_be, sf_route_entry_t *out_best) {
+    sf_route_cache_t *c = reader_cache();
+    /* Writers bump the epoch while holding every slot, so it is stable here. */
+    uint64_t epoch = atomic_load_explicit(&g_epoch, memory_order_relaxed);
+    int found;
+    if (c && sf_route_cache_get(c, epoch, ip_be, &found, out_best)) return found ? 0 : -1;
+    int r = g_fib_on ? sf_fib_lookup(&g_fib, ip_be, out_best) : sf_route_table_lookup(&g_table, ip_be, out_best);
+    if (c) sf_route_cache_put(c, epoch, ip_be, r == 0 ? out_best : NULL);
+    return r;
+}
+
+int sf_routing_lookup_flow(uint32_t ip_be, uint32_t flow_hash, sf_route_entry_t *out_best, uint64_t *version) {
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    int r = resolve(&g_table.nh, lookup_main(ip_be, out_best), flow_hash, out_best);
+    if (version) *version = atomic_load_explicit(&g_seq, memory_order_relaxed);
+    pthread_rwlock_unlock(lock);
+    return r;
+}
+
+int sf_routing_vrf_lookup(uint32_t vrf, uint32_t ip_be, uint32_t flow_hash, sf_route_entry_t *out_best, uint64_t *version) {
+    if (vrf == SF_VRF_MAIN) return sf_routing_lookup_flow(ip_be, flow_hash, out_best, version);
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    const sf_vrf_t *v = sf_vrf_find(&g_vrfs, vrf);
+    int r = v ? lookup_in(&v->table, ip_be, flow_hash, out_best) : -2;
+    if (version) *version = v ? v->version : 0;
+    pthread_rwlock_unlock(lock);
+    return r;
+}
+
+/* Every group the routes use is defined in nh. */
+static int nh_known(const sf_nh_table_t *nh, const sf_route_entry_t *entries, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if ((entries[i].flags & SF_ROUTE_F_GROUP) && !sf_nh_valid(nh, ntohl(entries[i].next_hop_be))) return 0;
+    }
+    return 1;
+}
+
+/* Under a read lock and g_image_lock: makes g_image a copy of src as it is now. */
+static int image_of(uint32_t src_id, const sf_route_table_t *src) {
+    uint64_t seq = atomic_load(&g_seq), changes = atomic_load(&g_vrf_changes);
+    if (g_image_src == src_id && g_image_seq == seq && g_image_changes == changes &&
+        (g_image.fd >= 0 || !src->dir)) {
+        return 0;
+    }
+    /* Room for a few thousand changes per copy before it has to move. */
+    if (sf_vrf_image_make(&g_image, src, 4096u + src->entry_used / 16u) != 0) {
+        g_image_src = SF_VRF_EMPTY;
+        return -1;
+    }
+    g_image_src = src_id;
+    g_image_seq = seq;
+    g_image_changes = changes;
+    return 0;
+}
+
+int sf_routing_vrf_create(uint32_t vrf, uint32_t from, size_t *routes) {
+    if (vrf == SF_VRF_MAIN || vrf == SF_VRF_EMPTY) return SF_COMMIT_INVALID;
+    pthread_once(&g_slots_once, slots_init);
+    int rc = SF_COMMIT_OK;
+    sf_route_table_t t;
+    sf_route_table_init(&t);
+    if (from != SF_VRF_EMPTY) {
+        /* The copy is taken under a read lock, so lookups go on meanwhile. */
+        pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+        pthread_mutex_lock(&g_image_lock);
+        pthread_rwlock_rdlock(lock);
+        const sf_vrf_t *p = from == SF_VRF_MAIN ? NULL : sf_vrf_find(&g_vrfs, from);
+        const sf_route_table_t *src = from == SF_VRF_MAIN ? &g_table : p ? &p->table : NULL;
+        if (!src) rc = SF_COMMIT_INVALID;
+        else if (image_of(from, src) != 0 || sf_vrf_image_clone(&g_image, &t) != 0) rc = SF_COMMIT_FULL;
+        pthread_rwlock_unlock(lock);
+        pthread_mutex_unlock(&g_image_lock);
+    }
+    if (rc == SF_COMMIT_OK) {
+        table_write_lock();
+        size_t count = t.count;
+        if (atomic_load(&g_frozen)) rc = SF_COMMIT_FROZEN;
+        else if (sf_vrf_find(&g_vrfs, vrf)) rc = SF_COMMIT_INVALID;
+        else if (!sf_vrf_add(&g_vrfs, vrf, &t)) rc = SF_COMMIT_FULL;
+        else atomic_fetch_add(&g_vrf_changes, 1);
+        if (rc == SF_COMMIT_OK && routes) *routes = count;
+        table_write_unlock();
+    }
+    sf_route_table_free(&t);
+    return rc;
+}
+
+int sf_routing_vrf_delete(uint32_t vrf) {
+    int rc = SF_COMMIT_OK;
+    table_write_lock();
+    if (atomic_load(&g_frozen)) rc = SF_COMMIT_FROZEN;
+    else if (sf_vrf_remove(&g_vrfs, vrf) != 0) rc = SF_COMMIT_INVALID;
+    else atomic_fetch_add(&g_vrf_changes, 1);
+    table_write_unlock();
+    return rc;
+}
+
+int sf_routing_vrf_apply(uint32_t vrf, uint32_t op, const sf_route_entry_t *entries, size_t n, size_t *applied,
+                         uint64_t *version) {
+    if (applied) *applied = 0;
+    if (version) *version = 0;
+    if (!entries && n) return SF_COMMIT_INVALID;
+    int rc = SF_COMMIT_OK;
+    /* VRFs and the frozen flag only change under the write lock, so g_writer holds them still. */
+    pthread_mutex_lock(&g_writer);
+    sf_vrf_t *v = sf_vrf_find(&g_vrfs, vrf);
+    if (atomic_load(&g_frozen)) {
+        rc = SF_COMMIT_FROZEN;
+    } else if (!v) {
+        rc = SF_COMMIT_NO_VRF;
+    } else if (op == SF_ROUTE_OP_UPSERT && !nh_known(&v->table.nh, entries, n)) {
+        rc = SF_COMMIT_INVALID;
+    } else {
+        size_t done = 0;
+        for (size_t at = 0; at < n;) {
+            size_t k = n - at < SF_ROUTING_WRITE_CHUNK ? n - at : SF_ROUTING_WRITE_CHUNK;
+            readers_block();
+            if (op == SF_ROUTE_OP_WITHDRAW) {
+                done += sf_route_table_remove_batch(&v->table, entries + at, k);
+            } else {
+                for (size_t i = at; i < at + k; ++i) {
+                    if (sf_route_table_upsert(&v->table, &entries[i]) == 0) done++;
+                }
+            }
+            at += k;
+            if (at == n && done) {
+                v->version++;
+                atomic_fetch_add(&g_vrf_changes, 1);
+            }
+            readers_resume();
+        }
+        if (applied) *applied = done;
+    }
+    if (version && v) *version = v->version;
+    pthread_mutex_unlock(&g_writer);
+    return rc;
+}
+
+int sf_routing_vrf_define_group(uint32_t vrf, const sf_nh_member_t *members, size_t n, uint32_t *id,
+                                uint64_t *version) {
+    if (version) *version = 0;
+    if (!members || !id || n == 0 || n > SF_NH_GROUP_MAX) return SF_COMMIT_INVALID;
+    int rc = SF_COMMIT_OK, created = 0;
+    table_write_lock();
+    sf_vrf_t *v = sf_vrf_find(&g_vrfs, vrf);
+    if (atomic_load(&g_frozen)) rc = SF_COMMIT_FROZEN;
+    else if (!v) rc = SF_COMMIT_NO_VRF;
+    else if (sf_nh_define(&v->table.nh, members, n, id, &created) != 0) rc = SF_COMMIT_FULL;
+    if (rc == SF_COMMIT_OK && created) {
+        v->version++;
+        atomic_fetch_add(&g_vrf_changes, 1);
+    }
+    if (version && v) *version = v->version;
+    table_write_unlock();
+    return rc;
+}
+
+size_t sf_routing_vrf_count(void) {
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    size_t n = sf_vrf_set_count(&g_vrfs);
+    pthread_rwlock_unlock(lock);
+    return n;
+}
+
+sf_route6_table_t *sf_routing_table6(void) {
+    return &g_table6;
+}
+
+int sf_routing_lookup6(const uint8_t addr[16], sf_route6_entry_t *out_best, uint64_t *version) {
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    int r = sf_route6_table_lookup(&g_table6, addr, out_best);
+    if (version) *version = atomic_load_explicit(&g_seq6, memory_order_relaxed);
+    pthread_rwlock_unlock(lock);
+    return r;
+}
+
+size_t sf_routing_upsert6_batch(const sf_route6_entry_t *entries, size_t n, uint64_t *version_out) {
+    size_t applied = 0;
+    pthread_mutex_lock(&g_writer);
+    for (size_t at = 0; at < n && !atomic_load(&g_frozen);) {
+        size_t k = n - at < SF_ROUTING_WRITE_CHUNK ? n - at : SF_ROUTING_WRITE_CHUNK;
+        readers_block();
+        for (size_t i = at; i < at + k; ++i) {
+            if (sf_route6_table_upsert(&g_table6, &entries[i]) == 0) applied++;
+        }
+        at += k;
+        if (at == n && applied) {
+            atomic_store_explicit(&g_seq6, atomic_load_explicit(&g_seq6, memory_order_relaxed) + 1, memory_order_release);
+        }
+        readers_resume();
+    }
+    if (version_out) *version_out = atomic_load_explicit(&g_seq6, memory_order_relaxed);
+    pthread_mutex_unlock(&g_writer);
+    return applied;
+}
+
+/* Under the write lock: puts the prefix-length filters on whichever table
+   lookups use, FIB or g_table, and takes them off the other. A table that
+   already has them keeps them. */
+static int bloom_apply(void) {
+    if (!g_fib_on) return sf_route_table_set_bloom(&g_table, g_bloom_fpr);
+    sf_route_table_set_bloom(&g_table, 0.0);
+    return sf_route_table_set_bloom(&g_fib.table, g_bloom_fpr);
+}
+
+/* Under the write lock: brings the FIB in line with a change to one prefix
+   of g_table. If it runs out of memory, lookups go back to g_table. */
+static void fib_note(const sf_route_entry_t *e) {
+    if (g_fib_on && sf_fib_update(&g_fib, &g_table, e->prefix_be, e->mask_bits) != 0) {
+        g_fib_on = 0;
+        sf_fib_free(&g_fib);
+        bloom_apply();
+    }
+}
+
+/* Under the write lock: after g_table was replaced wholesale. */
+static void fib_rebuild(void) {
+    if (g_fib_on && sf_fib_build(&g_fib, &g_table) != 0) {
+        g_fib_on = 0;
+        sf_fib_free(&g_fib);
+    }
+    bloom_apply();
+}
+
+/* Under the write lock: upserts entries and moves the ones the table took
+   to the front. Routes it refused are left out of what is logged: a group
+   collected here may still be defined where it is replayed. */
+static size_t install_upserts(sf_route_entry_t *entries, size_t n) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (sf_route_table_upsert(&g_table, &entries[i]) != 0) continue;
+        sf_expiry_push(&g_expiry, &g_table, &entries[i]);
+        fib_note(&entries[i]);
+        entries[m++] = entries[i];
+    }
+    return m;
+}
+
+/* Under the write lock. */
+static size_t install_withdraws(const sf_route_entry_t *keys, size_t n) {
+    size_t removed = n ? sf_route_table_remove_batch(&g_table, keys, n) : 0;
+    for (size_t i = 0; removed && i < n; ++i) fib_note(&keys[i]);
+    return removed;
+}
+
+/* Under the write lock: what changed the table becomes the next mutation. */
+static uint64_t publish(uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    uint64_t seq = atomic_load_explicit(&g_seq, memory_order_relaxed) + 1;
+    atomic_store_explicit(&g_seq, seq, memory_order_release);
+    if (g_sink) g_sink(seq, op, entries, n);
+    return seq;
+}
+
+/* Under the write lock: every group the routes use is defined. */
+static int groups_known(const sf_route_entry_t *entries, size_t n) {
+    return nh_known(&g_table.nh, entries, n);
+}
+
+/* Under the write lock: copies to out the changes dampening and coalescing
+   let through now and to held the rest, which wait for sf_routing_release(). */
+static size_t damp_filter(const sf_route_entry_t *in, size_t n, uint32_t op, sf_route_entry_t *out,
+                          sf_route_entry_t *held, size_t *nheld) {
+    uint32_t now_ms = sf_expiry_now_ms();
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (sf_damp_admit(&g_damp, &g_table, &in[i], op, now_ms)) out[m++] = in[i];
+        else held[(*nheld)++] = in[i];
+    }
+    return m;
+}
+
+/* A batch goes in SF_ROUTING_WRITE_CHUNK routes per write section and is
+   one mutation, published with its last chunk. Lookups in between may see
+   part of it; the version moves once it is all in. What was held back is
+   published after it as a mutation of its own, so it is logged (and the
+   acknowledgement waits for it) although the table does not change yet. */
+static long submit(const sf_route_entry_t *entries, size_t n, uint32_t op, uint64_t *seq_out) {
+    if (seq_out) *seq_out = 0;
+    if (!entries || !n) return 0;
+    /* What went in, gathered for the sink, then what was held. */
+    sf_route_entry_t *done = (sf_route_entry_t *)malloc(2 * n * sizeof(*done));
+    if (!done) return SF_COMMIT_FULL;
+    sf_route_entry_t *held = done + n;
+    size_t applied = 0, m = 0, nheld = 0;
+    pthread_mutex_lock(&g_writer);
+    /* An id that is not (or no longer) a group fails the batch, as it fails a commit. */
+    if (op == SF_ROUTE_OP_UPSERT && !groups_known(entries, n)) {
+        pthread_mutex_unlock(&g_writer);
+        free(done);
+        return SF_COMMIT_INVALID;
+    }
+    for (size_t at = 0; at < n && !atomic_load(&g_frozen);) {
+        size_t k = n - at < SF_ROUTING_WRITE_CHUNK ? n - at : SF_ROUTING_WRITE_CHUNK;
+        readers_block();
+        size_t got = damp_filter(entries + at, k, op, done + m, held, &nheld);
+        if (op == SF_ROUTE_OP_WITHDRAW) {
+            applied += install_withdraws(done + m, got);
+        } else {
+            got = install_upserts(done + m, got);
+            applied += got;
+        }
+        m += got;
+        at += k;
+        if (at == n) {
+            uint64_t seq = 0;
+            if (applied) seq = publish(op, done, m);
+            if (nheld) {
+                seq = publish(op == SF_ROUTE_OP_WITHDRAW ? SF_ROUTE_OP_HELD_WITHDRAW : SF_ROUTE_OP_HELD_UPSERT,
+                              held, nheld);
+            }
+            if (seq_out) *seq_out = seq;
+        }
+        readers_resume();
+    }
+    pthread_mutex_unlock(&g_writer);
+    free(done);
+    return (long)applied;
+}
+
+long sf_routing_upsert_batch(const sf_route_entry_t *entries, size_t n, uint64_t *seq_out) {
+    return submit(entries, n, SF_ROUTE_OP_UPSERT, seq_out);
+}
+
+long sf_routing_withdraw_batch(const sf_route_entry_t *keys, size_t n, uint64_t *seq_out) {
+    return submit(keys, n, SF_ROUTE_OP_WITHDRAW, seq_out);
+}
+
+/* The main table (and FIB) with a long run of upserts applied, built under
+   g_writer alone while lookups go on; aside_swap() puts it in place. */
+typedef struct {
+    sf_route_table_t table;
+    sf_fib_t         fib;
+    int              fib_ok;   /* fib is current (when the FIB is on) */
+} sf_aside_t;
+
+static void aside_init(sf_aside_t *a) {
+    sf_route_table_init(&a->table);
+    sf_fib_init(&a->fib);
+    a->fib_ok = 0;
+}
+
+/* Under g_writer. Returns the number of routes applied, or -1 without memory
+   for the copy; took (n bytes) gets 1 for each route the table took. */
+static long aside_build(sf_aside_t *a, const sf_route_entry_t *entries, size_t n, uint8_t *took) {
+    if (sf_route_table_clone(&a->table, &g_table, n) != 0) return -1;
+    a->fib_ok = g_fib_on && sf_route_table_clone(&a->fib.table, &g_fib.table, 0) == 0;
+    long applied = 0;
+    for (size_t i = 0; i < n; ++i) {
+        took[i] = sf_route_table_upsert(&a->table, &entries[i]) == 0;
+        if (!took[i]) continue;
+        applied++;
+        if (a->fib_ok && sf_fib_update(&a->fib, &a->table, entries[i].prefix_be, entries[i].mask_bits) != 0) a->fib_ok = 0;
+    }
+    /* Out of memory for the FIB: lookups go back to the table, filters and all. */
+    if (g_fib_on && !a->fib_ok) sf_route_table_set_bloom(&a->table, g_bloom_fpr);
+    return applied;
+}
+
+/* Under the write lock: the copy becomes the table; a holds the old one. */
+static void aside_swap(sf_aside_t *a) {
+    sf_route_table_t t = g_table;
+    g_table = a->table;
+    a->table = t;
+    if (!g_fib_on) return;
+    sf_fib_t f = g_fib;
+    if (a->fib_ok) {
+        g_fib = a->fib;
+    } else {
+        sf_fib_init(&g_fib);
+        g_fib_on = 0;
+    }
+    a->fib = f;
+}
+
+static void aside_free(sf_aside_t *a) {
+    sf_route_table_free(&a->table);
+    sf_fib_free(&a->fib);
+}
+
+size_t sf_routing_replay_batch(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    if (op == SF_ROUTE_OP_HELD_UPSERT || op == SF_ROUTE_OP_HELD_WITHDRAW) {
+        /* Held back where it was submitted: only the sequence moves here. */
+        table_write_lock();
+        if (seq > atomic_load_explicit(&g_seq, memory_order_relaxed)) {
+            atomic_store(&g_seq, seq);
+            if (g_sink) g_sink(seq, op, entries, n);
+        }
+        table_write_unlock();
+        return 0;
+    }
+    if (!entries) return 0;
+    if (op == SF_ROUTE_OP_UPSERT && n > SF_ROUTING_WRITE_CHUNK) {
+        /* A leader's large commit: lookups here see it whole, as they do there. */
+        uint8_t *took = (uint8_t *)malloc(n);
+        sf_aside_t a;
+        aside_init(&a);
+        pthread_mutex_lock(&g_writer);
+        long applied = took ? aside_build(&a, entries, n, took) : -1;
+        if (applied >= 0) {
+            readers_block();
+            aside_swap(&a);
+            if (seq > atomic_load_explicit(&g_seq, memory_order_relaxed)) {
+                atomic_store(&g_seq, seq);
+                if (g_sink) g_sink(seq, op, entries, n);
+            }
+            readers_resume();
+            /* Against the table that now holds them. */
+            for (size_t i = 0; i < n; ++i) {
+                if (took[i]) sf_expiry_push(&g_expiry, &g_table, &entries[i]);
+            }
+        }
+        pthread_mutex_unlock(&g_writer);
+        aside_free(&a);
+        free(took);
+        if (applied >= 0) return (size_t)applied;
+        /* No memory for a copy: apply it in place. */
+    }
+    size_t applied = 0;
+    table_write_lock();
+    if (op == SF_ROUTE_OP_WITHDRAW) {
+        applied = sf_route_table_remove_batch(&g_table, entries, n);
+        for (size_t i = 0; applied && i < n; ++i) fib_note(&entries[i]);
+    } else if (op == SF_ROUTE_OP_GROUP) {
+        int groups = sf_route_table_define_groups(&g_table, entries, n);
+        applied = groups > 0 ? (size_t)groups : 0;
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            if (sf_route_table_upsert(&g_table, &entries[i]) == 0) {
+                sf_expiry_push(&g_expiry, &g_table, &entries[i]);
+                fib_note(&entries[i]);
+                applied++;
+            }
+        }
+    }
+    if (seq > atomic_load_explicit(&g_seq, memory_order_relaxed)) {
+        atomic_store(&g_seq, seq);
+        if (g_sink) g_sink(seq, op, entries, n);
+    }
+    table_write_unlock();
+    return applied;
+}
+
+int sf_routing_commit(const sf_route_entry_t *entries, size_t n, const uint64_t *if_version, uint64_t *version_out) {
+    for (size_t i = 0; i < n; ++i) {
+        if (entries[i].mask_bits > 32) {
+            if (version_out) *version_out = sf_routing_seq();
+            return SF_COMMIT_INVALID;
+        }
+    }
+    int rc = SF_COMMIT_OK;
+    /* A long commit is applied to a copy, swapped in afterwards; a short one in place. */
+    int aside = n > SF_ROUTING_WRITE_CHUNK;
+    uint8_t *took = aside ? (uint8_t *)malloc(n) : NULL;
+    sf_aside_t a;
+    aside_init(&a);
+    pthread_mutex_lock(&g_writer);
+    uint64_t seq = atomic_load_explicit(&g_seq, memory_order_relaxed);
+    if (atomic_load(&g_frozen)) rc = SF_COMMIT_FROZEN;
+    else if (if_version && *if_version != seq) rc = SF_COMMIT_CONFLICT;
+    else if (!groups_known(entries, n)) rc = SF_COMMIT_INVALID;
+    else if (aside && (!took || aside_build(&a, entries, n, took) < 0)) rc = SF_COMMIT_FULL;
+    if (rc == SF_COMMIT_OK && n) {
+        /* Validated, and reserved or applied to the copy: none of this can
+           fail halfway. */
+        readers_block();
+        if (aside) {
+            aside_swap(&a);
+        } else if (sf_route_table_reserve(&g_table, n) != 0) {
+            rc = SF_COMMIT_FULL;
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                sf_route_table_upsert(&g_table, &entries[i]);
+                fib_note(&entries[i]);
+            }
+        }
+        if (rc == SF_COMMIT_OK) {
+            atomic_store_explicit(&g_seq, ++seq, memory_order_release);
+            if (g_sink) g_sink(seq, SF_ROUTE_OP_UPSERT, entries, n);
+        }
+        readers_resume();
+    }
+    if (rc == SF_COMMIT_OK) {
+        /* Transactions bypass dampening, but replace whatever it holds for their prefixes. */
+        uint32_t now_ms = sf_expiry_now_ms();
+        for (size_t i = 0; i < n; ++i) {
+            sf_expiry_push(&g_expiry, &g_table, &entries[i]);
+            sf_damp_note(&g_damp, &entries[i], SF_ROUTE_OP_UPSERT, now_ms);
+        }
+    }
+    pthread_mutex_unlock(&g_writer);
+    aside_free(&a);
+    free(took);
+    if (version_out) *version_out = seq;
+    return rc;
+}
+
+int sf_routing_define_group(const sf_nh_member_t *members, size_t n, uint32_t *id, uint64_t *seq_out) {
+    if (seq_out) *seq_out = 0;
+    if (!members || !id || n == 0 || n > SF_NH_GROUP_MAX) return SF_COMMIT_INVALID;
+    int rc = SF_COMMIT_OK, created = 0;
+    table_write_lock();
+    if (atomic_load(&g_frozen)) rc = SF_COMMIT_FROZEN;
+    else if (sf_nh_define(&g_table.nh, members, n, id, &created) != 0) rc = SF_COMMIT_FULL;
+    if (rc == SF_COMMIT_OK && created) {
+        sf_route_entry_t rec[SF_NH_GROUP_MAX];
+        sf_nh_member_t m[SF_NH_GROUP_MAX];
+        size_t k = sf_nh_members(&g_table.nh, *id, m);
+        for (size_t i = 0; i < k; ++i) {
+            memset(&rec[i], 0, sizeof(rec[i]));
+            rec[i].prefix_be = htonl(*id);
+            rec[i].next_hop_be = m[i].next_hop_be;
+            rec[i].metric = m[i].weight;
+        }
+        uint64_t seq = atomic_load_explicit(&g_seq, memory_order_relaxed) + 1;
+        atomic_store_explicit(&g_seq, seq, memory_order_release);
+        if (g_sink) g_sink(seq, SF_ROUTE_OP_GROUP, rec, k);
+        if (seq_out) *seq_out = seq;
+    }
+    table_write_unlock();
+    return rc;
+}
+
+int sf_routing_set_ttl(uint32_t ttl_ms) {
+    table_write_lock();
+    sf_expiry_free(&g_expiry);
+    sf_expiry_init(&g_expiry, ttl_ms);
+    int rc = sf_expiry_index_table(&g_expiry, &g_table, sf_expiry_now_ms());
+    table_write_unlock();
+    return rc;
+}
+
+size_t sf_routing_expire(uint32_t now_ms) {
+    /* Most ticks find nothing due; checking under g_writer alone keeps them
+       from stalling lookups. */
+    pthread_mutex_lock(&g_writer);
+    int due = sf_expiry_due(&g_expiry, now_ms);
+    pthread_mutex_unlock(&g_writer);
+    if (!due) return 0;
+
+    sf_expiry_key_t keys[SF_ROUTING_WRITE_CHUNK];
+    sf_route_entry_t gone[SF_ROUTING_WRITE_CHUNK];
+    size_t total = 0;
+    /* One withdraw mutation per write section; readers and other writers get
+       in between. */
+    while (due) {
+        pthread_mutex_lock(&g_writer);
+        if (atomic_load(&g_frozen)) {
+            pthread_mutex_unlock(&g_writer);
+            break;
+        }
+        size_t n = sf_expiry_pop_due(&g_expiry, now_ms, keys, SF_ROUTING_WRITE_CHUNK);
+        size_t m = 0;
+        for (size_t i = 0; i < n; ++i) {
+            /* Updated since (another entry covers it now) or already withdrawn. */
+            const sf_route_entry_t *r = sf_route_table_get(&g_table, keys[i].prefix_be, keys[i].mask_bits);
+            if (!r || r->last_updated_ms != keys[i].stamp_ms) continue;
+            memset(&gone[m], 0, sizeof(gone[m]));
+            gone[m].prefix_be = keys[i].prefix_be;
+            gone[m].mask_bits = keys[i].mask_bits;
+            sf_damp_note(&g_damp, &gone[m], SF_ROUTE_OP_WITHDRAW, now_ms);
+            m++;
+        }
+        if (m) {
+            readers_block();
+            size_t removed = install_withdraws(gone, m);
+            if (removed) publish(SF_ROUTE_OP_WITHDRAW, gone, m);
+            readers_resume();
+            atomic_fetch_add_explicit(&g_expired, removed, memory_order_relaxed);
+            total += removed;
+        }
+        due = sf_expiry_due(&g_expiry, now_ms);
+        pthread_mutex_unlock(&g_writer);
+    }
+    return total;
+}
+
+int sf_routing_set_fib(int on) {
+    table_write_lock();
+    g_fib_on = 0;
+    sf_fib_free(&g_fib);
+    int rc = on ? sf_fib_build(&g_fib, &g_table) : 0;
+    g_fib_on = on && rc == 0;
+    bloom_apply();
+    table_write_unlock();
+    return rc;
+}
+
+size_t sf_routing_fib_count(void) {
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    size_t n = g_fib_on ? sf_fib_count(&g_fib) : 0;
+    pthread_rwlock_unlock(lock);
+    return n;
+}
+
+int sf_routing_set_bloom(double fpr) {
+    if (fpr < 0.0 || fpr > SF_ROUTE_BLOOM_MAX_FPR) return -1;
+    table_write_lock();
+    g_bloom_fpr = fpr;
+    int rc = bloom_apply();
+    table_write_unlock();
+    return rc;
+}
+
+int sf_routing_set_cache(uint32_t entries) {
+    if (entries > SF_ROUTE_CACHE_MAX_ENTRIES) return -1;
+    g_cache_entries = entries;
+    return 0;
+}
+
+void sf_routing_cache_stats(uint64_t *hits, uint64_t *misses) {
+    uint64_t h = 0, m = 0;
+    for (unsigned i = 0; i < SF_ROUTING_MAX_READERS; ++i) {
+        const sf_route_cache_t *c = atomic_load_explicit(&g_caches[i], memory_order_acquire);
+        if (!c) continue;
+        h += atomic_load_explicit(&c->hits, memory_order_relaxed);
+        m += atomic_load_explicit(&c->misses, memory_order_relaxed);
+    }
+    if (hits) *hits = h;
+    if (misses) *misses = m;
+}
+
+uint64_t sf_routing_expired(void) {
+    return atomic_load_explicit(&g_expired, memory_order_relaxed);
+}
+
+int sf_routing_set_damping(const sf_damp_config_t *cfg) {
+    sf_damp_t d;
+    if (sf_damp_init(&d, cfg) != 0) return -1;
+    table_write_lock();
+    sf_damp_free(&g_damp);
+    g_damp = d;
+    table_write_unlock();
+    return 0;
+}
+
+size_t sf_routing_release(uint32_t now_ms) {
+    pthread_mutex_lock(&g_writer);
+    int held = g_damp.nheld != 0;
+    pthread_mutex_unlock(&g_writer);
+    if (!held) return 0;
+
+    sf_route_entry_t ups[SF_ROUTING_WRITE_CHUNK];
+    sf_route_entry_t wds[SF_ROUTING_WRITE_CHUNK];
+    size_t nu, nw, total = 0;
+    int more = 1;
+    while (more) {
+        pthread_mutex_lock(&g_writer);
+        if (atomic_load(&g_frozen)) {
+            pthread_mutex_unlock(&g_writer);
+            break;
+        }
+        more = sf_damp_collect(&g_damp, now_ms, ups, &nu, wds, &nw, SF_ROUTING_WRITE_CHUNK);
+        if (nu || nw) {
+            readers_block();
+            size_t got = install_upserts(ups, nu);
+            if (got) publish(SF_ROUTE_OP_UPSERT, ups, got);
+            size_t removed = install_withdraws(wds, nw);
+            if (removed) publish(SF_ROUTE_OP_WITHDRAW, wds, nw);
+            readers_resume();
+            total += got + removed;
+        }
+        pthread_mutex_unlock(&g_writer);
+    }
+    return total;
+}
+
+void sf_routing_damp_stats(uint64_t *suppressions, uint64_t *coalesced) {
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    if (suppressions) *suppressions = g_damp.suppressions;
+    if (coalesced) *coalesced = g_damp.coalesced;
+    pthread_rwlock_unlock(lock);
+}
+
+uint64_t sf_routing_seq(void) {
+    return atomic_load_explicit(&g_seq, memory_order_acquire);
+}
+
+void sf_routing_set_sink(sf_routing_sink_fn fn) {
+    table_write_lock();
+    g_sink = fn;
+    table_write_unlock();
+}
+
+typedef struct {
+    sf_route_entry_t *out;
+    size_t            n;
+} export_cursor_t;
+
+static int export_visit(const sf_route_entry_t *e, void *ctx) {
+    export_cursor_t *cur = (export_cursor_t *)ctx;
+    cur->out[cur->n++] = *e;
+    return 0;
+}
+
+typedef struct {
+    sf_route_entry_t *out;
+    size_t            n, cap;
+} query_cursor_t;
+
+static int query_visit(const sf_route_entry_t *e, void *ctx) {
+    query_cursor_t *cur = (query_cursor_t *)ctx;
+    if (cur->n == cur->cap) {
+        size_t cap = cur->cap ? cur->cap * 2 : 64;
+        sf_route_entry_t *grown = (sf_route_entry_t *)realloc(cur->out, cap * sizeof(*grown));
+        if (!grown) return -1;
+        cur->out = grown;
+        cur->cap = cap;
+    }
+    cur->out[cur->n++] = *e;
+    return 0;
+}
+
+int sf_routing_query(uint32_t vrf, uint32_t prefix_be, uint8_t mask_bits, sf_route_query_t mode,
+                     sf_route_entry_t **out, size_t *n, uint64_t *version) {
+    if (!out || !n || mask_bits > 32) return -1;
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    const sf_vrf_t *v = vrf == SF_VRF_MAIN ? NULL : sf_vrf_find(&g_vrfs, vrf);
+    if (vrf != SF_VRF_MAIN && !v) {
+        pthread_rwlock_unlock(lock);
+        return -2;
+    }
+    const sf_route_table_t *rt = v ? &v->table : &g_table;
+    query_cursor_t cur = {NULL, 0, 0};
+    int r = mode == SF_ROUTE_QUERY_COVERING ? sf_route_table_foreach_covering(rt, prefix_be, mask_bits, query_visit, &cur)
+                                            : sf_route_table_foreach_covered(rt, prefix_be, mask_bits, query_visit, &cur);
+    if (version) *version = v ? v->version : atomic_load(&g_seq);
+    pthread_rwlock_unlock(lock);
+    if (r) {
+        free(cur.out);
+        return -1;
+    }
+    *out = cur.out;
+    *n = cur.n;
+    return 0;
+}
+
+int sf_routing_export(sf_route_entry_t **out, size_t *n, size_t *groups, uint64_t *seq) {
+    if (!out || !n) return -1;
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    size_t records = sf_route_table_group_records(&g_table, NULL);
+    export_cursor_t cur;
+    cur.out = (sf_route_entry_t *)malloc((g_table.count + records ? g_table.count + records : 1) * sizeof(*cur.out));
+    cur.n = 0;
+    if (cur.out) {
+        cur.n = sf_route_table_group_records(&g_table, cur.out);
+        sf_route_table_foreach(&g_table, export_visit, &cur);
+    }
+    if (groups) *groups = cur.out ? records : 0;
+    if (seq) *seq = atomic_load(&g_seq);
+    pthread_rwlock_unlock(lock);
+    *out = cur.out;
+    *n = cur.n;
+    return cur.out ? 0 : -1;
+}
+
+int sf_routing_dump(uint32_t vrf, sf_route_entry_t **out, size_t *n, uint64_t *version) {
+    if (!out || !n) return -1;
+    pthread_once(&g_slots_once, slots_init);
+    pthread_rwlock_t *lock = &g_slots[t_slot].lock;
+    pthread_rwlock_rdlock(lock);
+    const sf_vrf_t *v = vrf == SF_VRF_MAIN ? NULL : sf_vrf_find(&g_vrfs, vrf);
+    if (vrf != SF_VRF_MAIN && !v) {
+        pthread_rwlock_unlock(lock);
+        return -2;
+    }
+    const sf_route_table_t *rt = v ? &v->table : &g_table;
+    export_cursor_t cur;
+    cur.out = (sf_route_entry_t *)malloc((rt->count ? rt->count : 1) * sizeof(*cur.out));
+    cur.n = 0;
+    if (cur.out) sf_route_table_foreach(rt, export_visit, &cur);
+    if (version) *version = v ? v->version : atomic_load(&g_seq);
+    pthread_rwlock_unlock(lock);
+    *out = cur.out;
+    *n = cur.n;
+    return cur.out ? 0 : -1;
+}
+
+int sf_routing_adopt(sf_route_table_t *rt, uint64_t seq) {
+    if (!rt) return -1;
+    table_write_lock();
+    /* Routes already installed (from --route) are applied on top of the adopted table. */
+    export_cursor_t cur;
+    cur.out = (sf_route_entry_t *)malloc((g_table.count ? g_table.count : 1) * sizeof(*cur.out));
+    cur.n = 0;
+    int rc = -1;
+    if (cur.out) {
+        sf_route_table_foreach(&g_table, export_visit, &cur);
+        rc = 0;
+        for (size_t i = 0; i < cur.n; ++i) {
+            if (sf_route_table_upsert(rt, &cur.out[i]) != 0) rc = -1;
+        }
+        if (rc == 0) {
+            sf_route_table_free(&g_table);
+            g_table = *rt;
+            sf_route_table_init(rt);
+            if (seq > atomic_load_explicit(&g_seq, memory_order_relaxed)) atomic_store(&g_seq, seq);
+            atomic_fetch_add(&g_vrf_changes, 1);
+            if (g_expiry.ttl_ms) sf_expiry_index_table(&g_expiry, &g_table, sf_expiry_now_ms());
+            fib_rebuild();
+        }
+        free(cur.out);
+    }
+    table_write_unlock();
+    return rc;
+}
+
+void sf_routing_replace(sf_route_table_t *rt, uint64_t seq) {
+    if (!rt) return;
+    table_write_lock();
+    sf_route_table_free(&g_table);
+    g_table = *rt;
+    sf_route_table_init(rt);
+    atomic_store(&g_seq, seq);
+    atomic_fetch_add(&g_vrf_changes, 1);
+    if (g_expiry.ttl_ms) sf_expiry_index_table(&g_expiry, &g_table, sf_expiry_now_ms());
+    fib_rebuild();
+    if (g_sink) g_sink(seq, SF_ROUTE_OP_RESET, NULL, 0);
+    table_write_unlock();
+}
+
+int sf_routing_save_snapshot(const char *path, int fd, size_t *routes, size_t *bytes, uint64_t *seq) {
+    sf_route_table_t copy;
+    sf_route_table_init(&copy);
+    pthread_mutex_lock(&g_writer);
+    /* Writers are excluded, so the table, g_seq and what dampening holds
+       agree. The table is copied and written after the lock is dropped, so
+       writers wait for a memcpy rather than the write and fsync; without
+       memory for the copy it is written in place. Held changes were
+       acknowledged and the log behind the snapshot may go, so they are
+       written as applied; with some held, there is no snapshot without the
+       copy. */
+    uint64_t at = atomic_load(&g_seq);
+    int copied = sf_route_table_clone(&copy, &g_table, 0) == 0;
+    if (copied && sf_damp_apply_held(&g_damp, &copy, sf_expiry_now_ms()) != 0) {
+        pthread_mutex_unlock(&g_writer);
+        sf_route_table_free(&copy);
+        return -1;
+    }
+    size_t count = copied ? copy.count : g_table.count;
+    int rc = 0;
+    if (!copied) {
+        if (g_damp.nheld) rc = -1;
+        else rc = path ? sf_snapshot_save(path, &g_table, at, bytes) : sf_snapshot_write_fd(fd, &g_table, at, bytes);
+    }
+    pthread_mutex_unlock(&g_writer);
+    if (copied) {
+        rc = path ? sf_snapshot_save(path, &copy, at, bytes) : sf_snapshot_write_fd(fd, &copy, at, bytes);
+        sf_route_table_free(&copy);
+    }
+    if (routes) *routes = count;
+    if (seq) *seq = at;
+    return rc;
+}
+
+void sf_routing_set_frozen(int frozen) {
+    table_write_lock();
+    atomic_store(&g_frozen, frozen ? 1 : 0);
+    table_write_unlock();
+}
+
+int sf_routing_frozen(void) {
+    return atomic_load(&g_frozen);
+}
+
+/* family is AF_INET or AF_INET6 (addr a struct in_addr or in6_addr), or 0
+   for a peer without an address. */
+static sf_route_decision_t decide(int family, const void *peer) {
     sf_route_decision_t d;
     memset(&d, 0, sizeof(d));
     d.strategy = current_strategy;
 
     struct in_addr addr;
-    if (remote_addr && inet_pton(AF_INET, remote_addr, &addr) == 1) {
+    struct in6_addr addr6;
+    int v4 = family == AF_INET;
+    if (v4) memcpy(&addr, peer, sizeof(addr));
+    if (family == AF_INET6) {
+        memcpy(&addr6, peer, sizeof(addr6));
+        if (IN6_IS_ADDR_V4MAPPED(&addr6)) {
+            /* ::ffff:a.b.c.d, as dual-stack sockets report IPv4 peers. */
+            memcpy(&addr.s_addr, addr6.s6_addr + 12, 4);
+            v4 = 1;
+        } else {
+            sf_route6_entry_t best;
+            if (sf_routing_lookup6(addr6.s6_addr, &best, NULL) == 0) {
+                d.matched_prefix_bits = best.mask_bits;
+                d.metric = best.metric;
+                memcpy(d.next_hop6, best.next_hop, 16);
+                d.hops = (current_strategy == SF_ROUTE_DIRECT) ? 1 : (uint8_t)(1 + (best.metric / 5u));
+                return d;
+            }
+        }
+    }
+    if (v4) {
         sf_route_entry_t best;
-        if (sf_route_table_lookup(&g_table, addr.s_addr, &best) == 0) {
+        if (sf_routing_lookup(addr.s_addr, &best, NULL) == 0) {
             d.matched_prefix_bits = best.mask_bits;
             d.metric = best.metric;
             d.next_hop_be = best.next_hop_be;
@@ -43,3 +1072,32 @@ sf_route_decision_t sf_routing_decide(const char *remote_addr) {
     return d;
 }
 
+sf_route_decision_t sf_routing_decide(const char *remote_addr) {
+    uint8_t addr[16];
+    int family = 0;
+    if (remote_addr && inet_pton(AF_INET, remote_addr, addr) == 1) family = AF_INET;
+    else if (remote_addr && inet_pton(AF_INET6, remote_addr, addr) == 1) family = AF_INET6;
+    return decide(family, addr);
+}
+
+void sf_routing_decision_init(sf_route_decision_cache_t *dc, int family, const void *addr) {
+    if (!dc) return;
+    memset(dc, 0, sizeof(*dc));
+    if (addr && (family == AF_INET || family == AF_INET6)) {
+        dc->family = (uint8_t)family;
+        memcpy(dc->addr, addr, family == AF_INET ? 4 : 16);
+    }
+    /* Epoch 0 is never current, so the first sf_routing_decision() computes it. */
+}
+
+const sf_route_decision_t *sf_routing_decision(sf_route_decision_cache_t *dc) {
+    /* The epoch is read first: a write that lands during the lookup bumps it
+       past what is stored, so the next call recomputes. */
+    uint64_t epoch = sf_routing_epoch();
+    if (dc->epoch != epoch) {
+        dc->decision = decide(dc->family, dc->addr);
+        dc->epoch = epoch;
+    }
+    return &dc->decision;
+}
+
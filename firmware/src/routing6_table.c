@@ -0,0 +1,626 @@
+#include "routing6_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* Keys are handled as host-order halves. */
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} key128_t;
+
+static key128_t key_load(const uint8_t b[16]) {
+    key128_t k = {0, 0};
+    for (int i = 0; i < 8; ++i) k.hi = (k.hi << 8) | b[i];
+    for (int i = 8; i < 16; ++i) k.lo = (k.lo << 8) | b[i];
+    return k;
+}
+
+static void key_store(key128_t k, uint8_t b[16]) {
+    for (int i = 7; i >= 0; --i, k.hi >>= 8) b[i] = (uint8_t)k.hi;
+    for (int i = 15; i >= 8; --i, k.lo >>= 8) b[i] = (uint8_t)k.lo;
+}
+
+static key128_t key_mask(key128_t k, unsigned bits) {
+    if (bits == 0) {
+        k.hi = 0;
+        k.lo = 0;
+    } else if (bits < 64) {
+        k.hi &= ~0ull << (64 - bits);
+        k.lo = 0;
+    } else if (bits == 64) {
+        k.lo = 0;
+    } else if (bits < 128) {
+        k.lo &= ~0ull << (128 - bits);
+    }
+    return k;
+}
+
+static unsigned key_bit(key128_t k, unsigned i) {
+    return (unsigned)(i < 64 ? (k.hi >> (63u - i)) & 1u : (k.lo >> (127u - i)) & 1u);
+}
+
+static unsigned key_common(key128_t a, key128_t b) {
+    uint64_t d = a.hi ^ b.hi;
+    if (d) return (unsigned)__builtin_clzll(d);
+    d = a.lo ^ b.lo;
+    return d ? 64u + (unsigned)__builtin_clzll(d) : 128u;
+}
+
+static key128_t node_key(const sf_route6_node_t *n) {
+    key128_t k = {n->key_hi, n->key_lo};
+    return k;
+}
+
+static int node_covers(const sf_route6_node_t *n, key128_t k) {
+    key128_t m = key_mask(k, n->bits);
+    return m.hi == n->key_hi && m.lo == n->key_lo;
+}
+
+void sf_route6_table_init(sf_route6_table_t *rt) {
+    if (!rt) return;
+    memset(rt, 0, sizeof(*rt));
+    rt->free_entry = SF_ROUTE6_NONE;
+    sf_route_table_init(&rt->short_routes);
+}
+
+void sf_route6_table_free(sf_route6_table_t *rt) {
+    if (!rt) return;
+    free(rt->entries);
+    free(rt->nodes);
+    for (size_t i = 0; i < rt->tier_cap; ++i) free(rt->tiers[i].bucket);
+    free(rt->tiers);
+    sf_route_table_free(&rt->short_routes);
+    sf_route6_table_init(rt);
+}
+
+size_t sf_route6_table_count(const sf_route6_table_t *rt) {
+    return rt ? rt->count : 0;
+}
+
+/* The tier table, keyed by the top 32 bits. */
+static size_t tier_home(const sf_route6_table_t *rt, uint32_t key) {
+    uint64_t h = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (rt->tier_cap - 1);
+}
+
+static sf_route6_tier_t *tier_find(const sf_route6_table_t *rt, uint32_t key) {
+    if (!rt->tier_cap) return NULL;
+    for (size_t i = tier_home(rt, key);; i = (i + 1) & (rt->tier_cap - 1)) {
+        sf_route6_tier_t *t = &rt->tiers[i];
+        if (!t->routes) return NULL;
+        if (t->key == key) return t;
+    }
+}
+
+static sf_route6_tier_t *tier_add(sf_route6_table_t *rt, uint32_t key) {
+    size_t i = tier_home(rt, key);
+    while (rt->tiers[i].routes) i = (i + 1) & (rt->tier_cap - 1);
+    sf_route6_tier_t *t = &rt->tiers[i];
+    t->key = key;
+    t->node = 0;
+    t->routes = 0;
+    t->bucket = NULL;
+    rt->tier_used++;
+    return t;
+}
+
+static void tier_del(sf_route6_table_t *rt, sf_route6_tier_t *t) {
+    size_t mask = rt->tier_cap - 1;
+    size_t i = (size_t)(t - rt->tiers);
+    free(t->bucket);
+    rt->tier_used--;
+    for (size_t j = (i + 1) & mask; rt->tiers[j].routes; j = (j + 1) & mask) {
+        size_t h = tier_home(rt, rt->tiers[j].key);
+        /* Entry j may fill the hole unless its home lies cyclically in (i, j]. */
+        int stays = i <= j ? (h > i && h <= j) : (h > i || h <= j);
+        if (!stays) {
+            rt->tiers[i] = rt->tiers[j];
+            i = j;
+        }
+    }
+    rt->tiers[i].routes = 0;
+    rt->tiers[i].bucket = NULL;
+}
+
+static int tiers_grow(sf_route6_table_t *rt, size_t need) {
+    size_t cap = rt->tier_cap ? rt->tier_cap : 256;
+    while (need * 2 > cap) cap *= 2;
+    if (cap == rt->tier_cap) return 0;
+    sf_route6_tier_t *old = rt->tiers;
+    size_t old_cap = rt->tier_cap;
+    rt->tiers = (sf_route6_tier_t *)calloc(cap, sizeof(*rt->tiers));
+    if (!rt->tiers) {
+        rt->tiers = old;
+        return -1;
+    }
+    rt->tier_cap = cap;
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (!old[i].routes) continue;
+        size_t j = tier_home(rt, old[i].key);
+        while (rt->tiers[j].routes) j = (j + 1) & (cap - 1);
+        rt->tiers[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static int reserve(sf_route6_table_t *rt, uint32_t entries, uint32_t nodes, size_t tiers) {
+    if (rt->free_entry == SF_ROUTE6_NONE && rt->entry_used + entries > rt->entry_cap) {
+        uint32_t cap = rt->entry_cap ? rt->entry_cap : 64;
+        while (cap < rt->entry_used + entries) cap *= 2;
+        sf_route6_entry_t *p = (sf_route6_entry_t *)realloc(rt->entries, cap * sizeof(*p));
+        if (!p) return -1;
+        rt->entries = p;
+        rt->entry_cap = cap;
+    }
+    if (rt->node_used + nodes > rt->node_cap) {
+        uint32_t cap = rt->node_cap ? rt->node_cap : 128;
+        while (cap < rt->node_used + nodes) cap *= 2;
+        sf_route6_node_t *p = (sf_route6_node_t *)realloc(rt->nodes, cap * sizeof(*p));
+        if (!p) return -1;
+        rt->nodes = p;
+        rt->node_cap = cap;
+        if (rt->node_used == 0) {
+            memset(&rt->nodes[0], 0, sizeof(rt->nodes[0])); /* null child sentinel */
+            rt->node_used = 1;
+        }
+    }
+    return tiers_grow(rt, rt->tier_used + tiers);
+}
+
+static uint32_t node_new(sf_route6_table_t *rt, key128_t key, unsigned bits) {
+    uint32_t x;
+    if (rt->free_node) {
+        x = rt->free_node;
+        rt->free_node = rt->nodes[x].child[0];
+    } else {
+        x = rt->node_used++;
+    }
+    sf_route6_node_t *n = &rt->nodes[x];
+    n->key_hi = key.hi;
+    n->key_lo = key.lo;
+    n->bits = bits;
+    n->route = SF_ROUTE6_NONE;
+    n->child[0] = n->child[1] = 0;
+    return x;
+}
+
+static void node_free(sf_route6_table_t *rt, uint32_t x) {
+    rt->nodes[x].child[0] = rt->free_node;
+    rt->free_node = x;
+}
+
+static uint32_t entry_new(sf_route6_table_t *rt) {
+    if (rt->free_entry != SF_ROUTE6_NONE) {
+        uint32_t i = rt->free_entry;
+        rt->free_entry = rt->entries[i].last_updated_ms;
+        return i;
+    }
+    return rt->entry_used++;
+}
+
+static void entry_free(sf_route6_table_t *rt, uint32_t i) {
+    rt->entries[i].last_updated_ms = rt->free_entry;
+    rt->free_entry = i;
+}
+
+/* Finds or creates the node for key/bits. Capacity for two nodes must be reserved. */
+static uint32_t node_insert(sf_route6_table_t *rt, key128_t key, unsigned bits) {
+    uint32_t *link = &rt->root;
+    while (*link) {
+        sf_route6_node_t *n = &rt->nodes[*link];
+        key128_t nk = node_key(n);
+        unsigned common = key_common(key, nk);
+        if (common > bits) common = bits;
+        if (common > n->bits) common = n->bits;
+
+        if (common == n->bits) {
+            if (n->bits == bits) return *link;
+            link = &n->child[key_bit(key, n->bits)];
+            continue;
+        }
+        uint32_t old = *link;
+        if (common == bits) {
+            /* The new prefix sits above the existing subtree. */
+            uint32_t x = node_new(rt, key, bits);
+            rt->nodes[x].child[key_bit(nk, bits)] = old;
+            *link = x;
+            return x;
+        }
+        uint32_t br = node_new(rt, key_mask(key, common), common);
+        uint32_t leaf = node_new(rt, key, bits);
+        rt->nodes[br].child[key_bit(key, common)] = leaf;
+        rt->nodes[br].child[key_bit(nk, common)] = old;
+        *link = br;
+        return leaf;
+    }
+    *link = node_new(rt, key, bits);
+    return *link;
+}
+
+static uint32_t node_find(const sf_route6_table_t *rt, key128_t key, unsigned bits) {
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route6_node_t *n = &rt->nodes[x];
+        if (n->bits > bits || !node_covers(n, key)) return 0;
+        if (n->bits == bits) return x;
+        x = n->child[key_bit(key, n->bits)];
+    }
+    return 0;
+}
+
+static uint32_t top32(key128_t k) {
+    return (uint32_t)(k.hi >> 32);
+}
+
+/* Bits 32..95, as bucket entries hold them. */
+static uint64_t mid64(key128_t k) {
+    return k.hi << 32 | k.lo >> 32;
+}
+
+/* The first node of length 32 or more on the path to the /32 top. */
+static uint32_t tier_node(const sf_route6_table_t *rt, uint32_t top) {
+    key128_t k = {(uint64_t)top << 32, 0};
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route6_node_t *n = &rt->nodes[x];
+        if (n->bits >= 32) return (uint32_t)(n->key_hi >> 32) == top ? x : 0;
+        if (!node_covers(n, k)) return 0;
+        x = n->child[key_bit(k, n->bits)];
+    }
+    return 0;
+}
+
+/* The best route of /32 or shorter over the /32 top. */
+static uint32_t short_best(const sf_route6_table_t *rt, uint32_t top) {
+    sf_route_entry_t s;
+    if (sf_route_table_lookup(&rt->short_routes, htonl(top), &s) != 0) return SF_ROUTE6_NONE;
+    return s.next_hop_be;
+}
+
+/* A route of /32 or shorter at key/bits changed: the tiers under it take
+   their covering route from the short table again. */
+static void short_changed(sf_route6_table_t *rt, key128_t key, unsigned bits) {
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route6_node_t *n = &rt->nodes[x];
+        if (n->bits >= bits) {
+            if (key_common(node_key(n), key) < bits) x = 0;
+            break;
+        }
+        if (!node_covers(n, key)) return;
+        x = n->child[key_bit(key, n->bits)];
+    }
+    if (!x) return;
+    uint32_t stack[260];
+    size_t sp = 0;
+    stack[sp++] = x;
+    while (sp) {
+        const sf_route6_node_t *n = &rt->nodes[stack[--sp]];
+        if (n->bits >= 32) {
+            sf_route6_tier_t *t = tier_find(rt, (uint32_t)(n->key_hi >> 32));
+            if (t) t->covering = short_best(rt, t->key);
+            continue;
+        }
+        if (n->child[0]) stack[sp++] = n->child[0];
+        if (n->child[1]) stack[sp++] = n->child[1];
+    }
+}
+
+/* After a change under the tier's /32: where its subtree starts, and the
+   bucket. Without memory for a bucket lookups walk the subtree instead. */
+static void tier_refresh(sf_route6_table_t *rt, sf_route6_tier_t *t) {
+    t->node = tier_node(rt, t->key);
+    t->covering = short_best(rt, t->key);
+    if (t->routes > SF_ROUTE6_BUCKET_MAX) {
+        free(t->bucket);
+        t->bucket = NULL;
+        return;
+    }
+    if (!t->bucket) {
+        t->bucket = (sf_route6_bucket_ent_t *)malloc(SF_ROUTE6_BUCKET_MAX * sizeof(*t->bucket));
+        if (!t->bucket) return;
+    }
+    uint32_t stack[260];
+    size_t sp = 0, n = 0;
+    stack[sp++] = t->node;
+    while (sp) {
+        const sf_route6_node_t *x = &rt->nodes[stack[--sp]];
+        if (x->child[0]) stack[sp++] = x->child[0];
+        if (x->child[1]) stack[sp++] = x->child[1];
+        if (x->route == SF_ROUTE6_NONE || x->bits == 32) continue;
+        if (x->bits > 96) {
+            free(t->bucket);
+            t->bucket = NULL;
+            return;
+        }
+        /* Longest first, so the first match is the best. */
+        size_t i = n++;
+        for (; i > 0 && t->bucket[i - 1].bits < x->bits; --i) t->bucket[i] = t->bucket[i - 1];
+        t->bucket[i].mid = mid64(node_key(x));
+        t->bucket[i].route = x->route;
+        t->bucket[i].bits = x->bits;
+    }
+}
+
+int sf_route6_table_upsert(sf_route6_table_t *rt, const sf_route6_entry_t *e) {
+    if (!rt || !e || e->mask_bits > 128) return -1;
+    unsigned bits = e->mask_bits;
+    key128_t key = key_mask(key_load(e->prefix), bits);
+    uint32_t x = node_find(rt, key, bits);
+    if (x && rt->nodes[x].route != SF_ROUTE6_NONE) {
+        /* Same prefix: only the entry changes. */
+        uint32_t route = rt->nodes[x].route;
+        rt->entries[route] = *e;
+        key_store(key, rt->entries[route].prefix);
+        return 0;
+    }
+    if (reserve(rt, 1, 2, 1) != 0) return -1;
+    if (bits <= 32 && sf_route_table_reserve(&rt->short_routes, 1) != 0) return -1;
+
+    uint32_t route = entry_new(rt);
+    rt->entries[route] = *e;
+    key_store(key, rt->entries[route].prefix);
+    x = node_insert(rt, key, bits);
+    rt->nodes[x].route = route;
+    rt->count++;
+    rt->len_count[bits]++;
+    if (bits <= 32) {
+        sf_route_entry_t s;
+        memset(&s, 0, sizeof(s));
+        s.prefix_be = htonl(top32(key));
+        s.next_hop_be = route;
+        s.mask_bits = (uint8_t)bits;
+        sf_route_table_upsert(&rt->short_routes, &s);
+        short_changed(rt, key, bits);
+    }
+    if (bits >= 32) {
+        /* The trie around this /32 may have changed shape. */
+        sf_route6_tier_t *t = tier_find(rt, top32(key));
+        if (!t && bits > 32) t = tier_add(rt, top32(key));
+        if (t) {
+            t->routes += bits > 32;
+            tier_refresh(rt, t);
+        }
+    }
+    return 0;
+}
+
+int sf_route6_table_remove(sf_route6_table_t *rt, const uint8_t prefix[16], uint8_t mask_bits) {
+    if (!rt || !prefix || mask_bits > 128 || rt->count == 0) return -1;
+    unsigned bits = mask_bits;
+    key128_t key = key_mask(key_load(prefix), bits);
+    uint32_t x = node_find(rt, key, bits);
+    if (!x || rt->nodes[x].route == SF_ROUTE6_NONE) return -1;
+    uint32_t route = rt->nodes[x].route;
+
+    /* Unlink the trie node, as in the IPv4 table. */
+    uint32_t *plink = NULL;
+    uint32_t *link = &rt->root;
+    while (*link != x) {
+        plink = link;
+        link = &rt->nodes[*link].child[key_bit(key, rt->nodes[*link].bits)];
+    }
+    sf_route6_node_t *n = &rt->nodes[x];
+    entry_free(rt, route);
+    n->route = SF_ROUTE6_NONE;
+    rt->count--;
+    rt->len_count[bits]--;
+    if (n->child[0] && n->child[1]) {
+        /* Still needed as a branch. */
+    } else if (n->child[0] || n->child[1]) {
+        *link = n->child[0] ? n->child[0] : n->child[1];
+        node_free(rt, x);
+    } else {
+        *link = 0;
+        node_free(rt, x);
+        if (plink) {
+            uint32_t p = *plink;
+            sf_route6_node_t *pn = &rt->nodes[p];
+            if (pn->route == SF_ROUTE6_NONE) {
+                *plink = pn->child[0] ? pn->child[0] : pn->child[1];
+                node_free(rt, p);
+            }
+        }
+    }
+
+    if (bits <= 32) {
+        sf_route_table_remove(&rt->short_routes, htonl(top32(key)), (uint8_t)bits);
+        short_changed(rt, key, bits);
+    }
+    if (bits >= 32) {
+        sf_route6_tier_t *t = tier_find(rt, top32(key));
+        if (t && bits > 32 && --t->routes == 0) {
+            tier_del(rt, t);
+        } else if (t) {
+            tier_refresh(rt, t);
+        }
+    }
+    return 0;
+}
+
+int sf_route6_table_lookup(const sf_route6_table_t *rt, const uint8_t addr[16], sf_route6_entry_t *out_best) {
+    if (!rt || !addr || !out_best || rt->count == 0) return -1;
+    key128_t a = key_load(addr);
+    uint32_t best = SF_ROUTE6_NONE;
+    const sf_route6_tier_t *t = tier_find(rt, top32(a));
+    if (t && t->bucket) {
+        uint64_t m = mid64(a);
+        for (uint32_t i = 0; i < t->routes; ++i) {
+            const sf_route6_bucket_ent_t *b = &t->bucket[i];
+            if (((m ^ b->mid) & (~0ull << (96 - b->bits))) == 0) {
+                best = b->route;
+                break;
+            }
+        }
+    } else if (t) {
+        /* The walk below the first-level index, as in the IPv4 table. */
+        uint32_t x = t->node;
+        while (x) {
+            const sf_route6_node_t *n = &rt->nodes[x];
+            if (!node_covers(n, a)) break;
+            if (n->route != SF_ROUTE6_NONE) best = n->route;
+            if (n->bits == 128) break;
+            x = n->child[key_bit(a, n->bits)];
+        }
+    }
+    if (best == SF_ROUTE6_NONE) best = t ? t->covering : short_best(rt, top32(a));
+    if (best == SF_ROUTE6_NONE) return -1;
+    *out_best = rt->entries[best];
+    return 0;
+}
+
+const sf_route6_entry_t *sf_route6_table_get(const sf_route6_table_t *rt, const uint8_t prefix[16], uint8_t mask_bits) {
+    if (!rt || !prefix || mask_bits > 128) return NULL;
+    uint32_t x = node_find(rt, key_mask(key_load(prefix), mask_bits), mask_bits);
+    if (!x || rt->nodes[x].route == SF_ROUTE6_NONE) return NULL;
+    return &rt->entries[rt->nodes[x].route];
+}
+
+int sf_route6_table_foreach(const sf_route6_table_t *rt, sf_route6_visit_fn fn, void *ctx) {
+    if (!rt || !fn || !rt->root) return 0;
+    /* At most 129 nodes deep, with one pending sibling per level. */
+    uint32_t stack[260];
+    size_t sp = 0;
+    stack[sp++] = rt->root;
+    while (sp) {
+        const sf_route6_node_t *n = &rt->nodes[stack[--sp]];
+        if (n->route != SF_ROUTE6_NONE) {
+            int r = fn(&rt->entries[n->route], ctx);
+            if (r) return r;
+        }
+        if (n->child[1]) stack[sp++] = n->child[1];
+        if (n->child[0]) stack[sp++] = n->child[0];
+    }
+    return 0;
+}
+
+/* Self-test: random clustered prefixes against a linear scan. */
+
+static uint64_t test_rand(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int ref_lookup(const sf_route6_entry_t *ref, const int *live, size_t n, key128_t a) {
+    int best = -1;
+    for (size_t i = 0; i < n; ++i) {
+        if (!live[i]) continue;
+        key128_t p = key_load(ref[i].prefix), m = key_mask(a, ref[i].mask_bits);
+        if (m.hi != p.hi || m.lo != p.lo) continue;
+        if (best < 0 || ref[i].mask_bits > ref[best].mask_bits) best = (int)i;
+    }
+    return best;
+}
+
+static int check_against(const sf_route6_table_t *rt, const sf_route6_entry_t *ref, const int *live, size_t n, uint64_t *seed) {
+    for (int t = 0; t < 4000; ++t) {
+        /* Mostly addresses inside some prefix, so that deep matches are exercised. */
+        key128_t a = key_load(ref[test_rand(seed) % n].prefix);
+        if (t & 1) a.lo ^= test_rand(seed) >> (test_rand(seed) % 64);
+        else a.hi ^= test_rand(seed) >> (16 + test_rand(seed) % 48);
+        uint8_t ab[16];
+        key_store(a, ab);
+        int want = ref_lookup(ref, live, n, a);
+        sf_route6_entry_t got;
+        int rc = sf_route6_table_lookup(rt, ab, &got);
+        if (want < 0) {
+            if (rc == 0) return -1;
+        } else if (rc != 0 || got.mask_bits != ref[want].mask_bits || memcmp(got.next_hop, ref[want].next_hop, 16) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int order_visit(const sf_route6_entry_t *e, void *ctx) {
+    sf_route6_entry_t *prev = (sf_route6_entry_t *)ctx;
+    int c = memcmp(prev->prefix, e->prefix, 16);
+    if (prev->mask_bits != 0xFF && (c > 0 || (c == 0 && prev->mask_bits >= e->mask_bits))) return 1;
+    *prev = *e;
+    return 0;
+}
+
+int sf_route6_table_self_test(void) {
+    enum { N = 1500 };
+    static const uint8_t lens[] = {0, 16, 19, 29, 32, 36, 40, 44, 48, 56, 64, 80, 127, 128};
+    sf_route6_entry_t *ref = (sf_route6_entry_t *)calloc(N, sizeof(*ref));
+    int *live = (int *)calloc(N, sizeof(*live));
+    if (!ref || !live) {
+        free(ref);
+        free(live);
+        return -1;
+    }
+    sf_route6_table_t rt;
+    sf_route6_table_init(&rt);
+    uint64_t seed = 0x5EED6;
+    int rc = 0;
+
+    /* Clustered like real tables: a few /16s, many routes per /32. */
+    for (size_t i = 0; i < N && rc == 0; ++i) {
+        key128_t k;
+        k.hi = (0x2001ull << 48) | ((test_rand(&seed) % 4) << 48) | ((test_rand(&seed) % 64) << 32) | (test_rand(&seed) & 0xFFFFFFFFull);
+        k.lo = test_rand(&seed);
+        unsigned bits = lens[i < 3 ? i : test_rand(&seed) % sizeof(lens)];
+        if (i == 0) bits = 0;
+        k = key_mask(k, bits);
+        key_store(k, ref[i].prefix);
+        ref[i].mask_bits = (uint8_t)bits;
+        ref[i].metric = (uint16_t)i;
+        ref[i].next_hop[15] = (uint8_t)i;
+        ref[i].next_hop[14] = (uint8_t)(i >> 8);
+        /* Duplicates of an earlier prefix are updates of it. */
+        for (size_t j = 0; j < i; ++j) {
+            if (live[j] && ref[j].mask_bits == bits && memcmp(ref[j].prefix, ref[i].prefix, 16) == 0) live[j] = 0;
+        }
+        live[i] = 1;
+    }
+    /* Longer routes first, so that shorter ones land over existing tiers. */
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < N && rc == 0; ++i) {
+            if ((ref[i].mask_bits > 32) == (pass == 0) && sf_route6_table_upsert(&rt, &ref[i]) != 0) rc = -1;
+        }
+    }
+    size_t alive = 0;
+    for (size_t i = 0; i < N; ++i) alive += (size_t)live[i];
+    if (rc == 0 && (rt.count != alive || check_against(&rt, ref, live, N, &seed) != 0)) rc = -1;
+
+    /* Exact match, in-order walk and the hash bookkeeping. */
+    for (size_t i = 0; i < N && rc == 0; ++i) {
+        if (!live[i]) continue;
+        const sf_route6_entry_t *g = sf_route6_table_get(&rt, ref[i].prefix, ref[i].mask_bits);
+        if (!g || memcmp(g->next_hop, ref[i].next_hop, 16) != 0 || g->metric != ref[i].metric) rc = -1;
+    }
+    sf_route6_entry_t prev;
+    memset(&prev, 0, sizeof(prev));
+    prev.mask_bits = 0xFF;
+    if (rc == 0 && sf_route6_table_foreach(&rt, order_visit, &prev) != 0) rc = -1;
+    size_t sum = 0, tiered = 0;
+    for (int b = 0; b <= 128; ++b) sum += rt.len_count[b];
+    for (size_t i = 0; i < rt.tier_cap; ++i) tiered += rt.tiers[i].routes;
+    for (int b = 33; b <= 128; ++b) tiered -= rt.len_count[b];
+    if (rc == 0 && (sum != rt.count || tiered != 0)) rc = -1;
+
+    /* Remove every other route (the default route first), then all of them. */
+    for (size_t i = 0; i < N && rc == 0; i += 2) {
+        if (!live[i]) continue;
+        live[i] = 0;
+        if (sf_route6_table_remove(&rt, ref[i].prefix, ref[i].mask_bits) != 0) rc = -1;
+    }
+    if (rc == 0 && check_against(&rt, ref, live, N, &seed) != 0) rc = -1;
+    for (size_t i = 0; i < N && rc == 0; ++i) {
+        if (live[i] && sf_route6_table_remove(&rt, ref[i].prefix, ref[i].mask_bits) != 0) rc = -1;
+        live[i] = 0;
+    }
+    if (rc == 0 && (rt.count != 0 || rt.tier_used != 0 || sf_route_table_count(&rt.short_routes) != 0 || rt.root != 0)) rc = -1;
+    if (rc == 0 && sf_route6_table_remove(&rt, ref[1].prefix, ref[1].mask_bits) == 0) rc = -1;
+
+    sf_route6_table_free(&rt);
+    free(ref);
+    free(live);
+    return rc;
+}
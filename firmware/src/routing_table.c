@@ -1,6 +1,9 @@
 #include "routing_table.h"
+#include "sf_route_bloom.h"
 
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 
 static uint32_t mask_from_bits(uint8_t bits) {
@@ -9,73 +12,755 @@ static uint32_t mask_from_bits(uint8_t bits) {
     return 0xFFFFFFFFu << (32 - bits);
 }
 
+static unsigned bit_at(uint32_t key, uint32_t i) {
+    return (unsigned)((key >> (31u - i)) & 1u);
+}
+
+/* The next-hop group a route uses, or 0. */
+static uint32_t route_group(const sf_route_entry_t *e) {
+    return (e->flags & SF_ROUTE_F_GROUP) ? ntohl(e->next_hop_be) : 0u;
+}
+
 void sf_route_table_init(sf_route_table_t *rt) {
     if (!rt) return;
     memset(rt, 0, sizeof(*rt));
+    rt->free_entry = SF_ROUTE_NONE;
+}
+
+void sf_route_table_free(sf_route_table_t *rt) {
+    if (!rt) return;
+    if (rt->map) {
+        munmap(rt->map, rt->map_len);
+    } else {
+        free(rt->entries);
+        free(rt->nodes);
+        free(rt->dir);
+    }
+    sf_nh_table_free(&rt->nh);
+    sf_route_bloom_free(rt->bloom);
+    free(rt->bloom);
+    sf_route_table_init(rt);
 }
 
 size_t sf_route_table_count(const sf_route_table_t *rt) {
     return rt ? rt->count : 0;
 }
 
+/* Moves arrays that live in a snapshot mapping onto the heap so they can grow. */
+static int own_arrays(sf_route_table_t *rt) {
+    if (!rt->map) return 0;
+    sf_route_entry_t *entries = (sf_route_entry_t *)malloc((rt->entry_cap ? rt->entry_cap : 1) * sizeof(*entries));
+    sf_route_node_t *nodes = (sf_route_node_t *)malloc((rt->node_cap ? rt->node_cap : 1) * sizeof(*nodes));
+    sf_route_dir_t *dir = (sf_route_dir_t *)malloc(SF_ROUTE_DIR_SLOTS * sizeof(*dir));
+    if (!entries || !nodes || !dir) {
+        free(entries);
+        free(nodes);
+        free(dir);
+        return -1;
+    }
+    memcpy(entries, rt->entries, rt->entry_used * sizeof(*entries));
+    memcpy(nodes, rt->nodes, rt->node_used * sizeof(*nodes));
+    memcpy(dir, rt->dir, SF_ROUTE_DIR_SLOTS * sizeof(*dir));
+    munmap(rt->map, rt->map_len);
+    rt->map = NULL;
+    rt->map_len = 0;
+    rt->entries = entries;
+    rt->nodes = nodes;
+    rt->dir = dir;
+    return 0;
+}
+
+static int reserve(sf_route_table_t *rt, uint32_t entries, uint32_t nodes) {
+    int grow_entries = rt->free_entry == SF_ROUTE_NONE && rt->entry_used + entries > rt->entry_cap;
+    int grow_nodes = rt->node_used + nodes > rt->node_cap;
+    if ((grow_entries || grow_nodes || !rt->dir) && own_arrays(rt) != 0) return -1;
+
+    if (!rt->dir) {
+        rt->dir = (sf_route_dir_t *)malloc(SF_ROUTE_DIR_SLOTS * sizeof(*rt->dir));
+        if (!rt->dir) return -1;
+        for (uint32_t s = 0; s < SF_ROUTE_DIR_SLOTS; ++s) {
+            rt->dir[s].node = 0;
+            rt->dir[s].route = SF_ROUTE_NONE;
+        }
+    }
+    if (grow_entries) {
+        uint32_t cap = rt->entry_cap ? rt->entry_cap : 64;
+        while (cap < rt->entry_used + entries) cap *= 2;
+        sf_route_entry_t *p = (sf_route_entry_t *)realloc(rt->entries, cap * sizeof(*p));
+        if (!p) return -1;
+        rt->entries = p;
+        rt->entry_cap = cap;
+    }
+    if (grow_nodes) {
+        uint32_t cap = rt->node_cap ? rt->node_cap : 128;
+        while (cap < rt->node_used + nodes) cap *= 2;
+        sf_route_node_t *p = (sf_route_node_t *)realloc(rt->nodes, cap * sizeof(*p));
+        if (!p) return -1;
+        rt->nodes = p;
+        rt->node_cap = cap;
+        if (rt->node_used == 0) {
+            memset(&rt->nodes[0], 0, sizeof(rt->nodes[0])); /* null child sentinel */
+            rt->node_used = 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t node_new(sf_route_table_t *rt, uint32_t key, uint32_t bits) {
+    uint32_t x;
+    if (rt->free_node) {
+        x = rt->free_node;
+        rt->free_node = rt->nodes[x].child[0];
+    } else {
+        x = rt->node_used++;
+    }
+    sf_route_node_t *n = &rt->nodes[x];
+    n->key = key;
+    n->bits = bits;
+    n->route = SF_ROUTE_NONE;
+    n->child[0] = n->child[1] = 0;
+    return x;
+}
+
+static void node_free(sf_route_table_t *rt, uint32_t x) {
+    rt->nodes[x].child[0] = rt->free_node;
+    rt->free_node = x;
+}
+
+static uint32_t entry_new(sf_route_table_t *rt) {
+    if (rt->free_entry != SF_ROUTE_NONE) {
+        uint32_t i = rt->free_entry;
+        rt->free_entry = rt->entries[i].prefix_be;
+        return i;
+    }
+    return rt->entry_used++;
+}
+
+static void entry_free(sf_route_table_t *rt, uint32_t i) {
+    rt->entries[i].prefix_be = rt->free_entry;
+    rt->free_entry = i;
+}
+
+/* Fills dir slots [lo, hi) from subtree x, with `best` the route inherited from above. */
+static void dir_fill(sf_route_table_t *rt, uint32_t x, uint32_t best, uint32_t lo, uint32_t hi) {
+    if (lo >= hi) return;
+    const sf_route_node_t *n = x ? &rt->nodes[x] : NULL;
+    if (n && n->bits >= SF_ROUTE_DIR_BITS) {
+        uint32_t slot = n->key >> (32 - SF_ROUTE_DIR_BITS);
+        for (uint32_t s = lo; s < hi; ++s) {
+            rt->dir[s].node = (s == slot) ? x : 0;
+            rt->dir[s].route = best;
+        }
+        return;
+    }
+    uint32_t a = 0, b = 0;
+    if (n) {
+        a = n->key >> (32 - SF_ROUTE_DIR_BITS);
+        b = a + (1u << (SF_ROUTE_DIR_BITS - n->bits));
+    }
+    if (!n || b <= lo || a >= hi) {
+        for (uint32_t s = lo; s < hi; ++s) {
+            rt->dir[s].node = 0;
+            rt->dir[s].route = best;
+        }
+        return;
+    }
+    for (uint32_t s = lo; s < a; ++s) {
+        rt->dir[s].node = 0;
+        rt->dir[s].route = best;
+    }
+    for (uint32_t s = b; s < hi; ++s) {
+        rt->dir[s].node = 0;
+        rt->dir[s].route = best;
+    }
+    if (n->route != SF_ROUTE_NONE) best = n->route;
+    uint32_t mid = a + (b - a) / 2;
+    uint32_t l = lo > a ? lo : a;
+    uint32_t h = hi < b ? hi : b;
+    dir_fill(rt, n->child[0], best, l, h < mid ? h : mid);
+    dir_fill(rt, n->child[1], best, l > mid ? l : mid, h);
+}
+
+/* Recomputes the dir slots under prefix key/bits. */
+static void dir_refresh(sf_route_table_t *rt, uint32_t key, uint32_t bits) {
+    uint32_t lo = key >> (32 - SF_ROUTE_DIR_BITS);
+    uint32_t hi = lo + 1;
+    if (bits < SF_ROUTE_DIR_BITS) {
+        lo &= ~((1u << (SF_ROUTE_DIR_BITS - bits)) - 1u);
+        hi = lo + (1u << (SF_ROUTE_DIR_BITS - bits));
+    }
+    uint32_t best = SF_ROUTE_NONE;
+    uint32_t x = rt->root;
+    /* Descend through nodes whose block strictly contains [lo, hi). */
+    while (x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if (n->bits >= SF_ROUTE_DIR_BITS || n->bits >= bits) break;
+        uint32_t a = n->key >> (32 - SF_ROUTE_DIR_BITS);
+        uint32_t b = a + (1u << (SF_ROUTE_DIR_BITS - n->bits));
+        if (b <= lo || a >= hi) {
+            x = 0;
+            break;
+        }
+        if (n->route != SF_ROUTE_NONE) best = n->route;
+        x = n->child[lo >= a + (b - a) / 2];
+    }
+    dir_fill(rt, x, best, lo, hi);
+}
+
+/* Finds or creates the node for key/bits; *touched gets the shortest prefix
+   length whose structure changed. Capacity for two nodes must be reserved. */
+static uint32_t node_insert(sf_route_table_t *rt, uint32_t key, uint32_t bits, uint32_t *touched) {
+    uint32_t *link = &rt->root;
+    *touched = bits;
+    while (*link) {
+        sf_route_node_t *n = &rt->nodes[*link];
+        uint32_t diff = key ^ n->key;
+        uint32_t common = diff ? (uint32_t)__builtin_clz(diff) : 32u;
+        if (common > bits) common = bits;
+        if (common > n->bits) common = n->bits;
+
+        if (common == n->bits) {
+            if (n->bits == bits) return *link;
+            link = &n->child[bit_at(key, n->bits)];
+            continue;
+        }
+        uint32_t old = *link;
+        uint32_t old_key = n->key;
+        if (common == bits) {
+            /* The new prefix sits above the existing subtree. */
+            uint32_t x = node_new(rt, key, bits);
+            rt->nodes[x].child[bit_at(old_key, bits)] = old;
+            *link = x;
+            return x;
+        }
+        uint32_t br = node_new(rt, key & mask_from_bits((uint8_t)common), common);
+        uint32_t leaf = node_new(rt, key, bits);
+        rt->nodes[br].child[bit_at(key, common)] = leaf;
+        rt->nodes[br].child[bit_at(old_key, common)] = old;
+        *link = br;
+        *touched = common;
+        return leaf;
+    }
+    *link = node_new(rt, key, bits);
+    return *link;
+}
+
+static void bloom_drop(sf_route_table_t *rt) {
+    sf_route_bloom_free(rt->bloom);
+    free(rt->bloom);
+    rt->bloom = NULL;
+}
+
+/* (Re)builds the filters from the table, sized for `capacity` keys. */
+static int bloom_build(sf_route_table_t *rt, double fpr, uint32_t capacity) {
+    sf_route_bloom_t *b = (sf_route_bloom_t *)malloc(sizeof(*b));
+    if (!b || sf_route_bloom_init(b, fpr, capacity) != 0) {
+        free(b);
+        return -1;
+    }
+    /* Nodes on the free list never hold a route, so a scan of the array will do. */
+    for (uint32_t x = 1; x < rt->node_used; ++x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if (n->route != SF_ROUTE_NONE && n->bits >= SF_ROUTE_BLOOM_MIN_BITS) sf_route_bloom_add(b, n->key, (uint8_t)n->bits);
+    }
+    bloom_drop(rt);
+    rt->bloom = b;
+    return 0;
+}
+
+/* Recomputes the lengths under dir slot `slot` from its subtree. */
+static void bloom_rescan(sf_route_table_t *rt, uint32_t slot) {
+    uint32_t lens = 0;
+    uint32_t stack[64];
+    size_t sp = 0;
+    if (rt->dir[slot].node) stack[sp++] = rt->dir[slot].node;
+    while (sp) {
+        const sf_route_node_t *n = &rt->nodes[stack[--sp]];
+        if (n->route != SF_ROUTE_NONE) lens |= 1u << (n->bits - SF_ROUTE_BLOOM_MIN_BITS);
+        if (n->child[1]) stack[sp++] = n->child[1];
+        if (n->child[0]) stack[sp++] = n->child[0];
+    }
+    rt->bloom->lens[slot] = lens;
+}
+
+int sf_route_table_set_bloom(sf_route_table_t *rt, double fpr) {
+    if (!rt || fpr < 0.0 || fpr > SF_ROUTE_BLOOM_MAX_FPR) return -1;
+    if (fpr == 0.0) {
+        bloom_drop(rt);
+        return 0;
+    }
+    if (rt->bloom && rt->bloom->fpr == fpr) return 0;
+    size_t want = 2 * rt->count;
+    return bloom_build(rt, fpr, want > UINT32_MAX / 2 ? UINT32_MAX / 2 : (uint32_t)want);
+}
+
+int sf_route_table_reserve(sf_route_table_t *rt, size_t routes) {
+    if (!rt || routes > UINT32_MAX / 2) return -1;
+    if (routes == 0) return 0;
+    /* Ignore the free list: every route may be new, and each adds at most two nodes. */
+    uint32_t free_entry = rt->free_entry;
+    rt->free_entry = SF_ROUTE_NONE;
+    int rc = reserve(rt, (uint32_t)routes, 2u * (uint32_t)routes);
+    rt->free_entry = free_entry;
+    return rc;
+}
+
+int sf_route_table_clone(sf_route_table_t *dst, const sf_route_table_t *src, size_t routes) {
+    if (!dst || !src) return -1;
+    sf_route_table_init(dst);
+    const sf_nh_table_t *nh = &src->nh;
+    if (sf_nh_table_load(&dst->nh, nh->groups, nh->group_used, nh->free_group, nh->hops, nh->hop_used) != 0) goto fail;
+    if (src->dir) {
+        dst->entries = (sf_route_entry_t *)malloc((src->entry_cap ? src->entry_cap : 1) * sizeof(*dst->entries));
+        dst->nodes = (sf_route_node_t *)malloc((src->node_cap ? src->node_cap : 1) * sizeof(*dst->nodes));
+        dst->dir = (sf_route_dir_t *)malloc(SF_ROUTE_DIR_SLOTS * sizeof(*dst->dir));
+        if (!dst->entries || !dst->nodes || !dst->dir) goto fail;
+        memcpy(dst->entries, src->entries, src->entry_used * sizeof(*dst->entries));
+        memcpy(dst->nodes, src->nodes, src->node_used * sizeof(*dst->nodes));
+        memcpy(dst->dir, src->dir, SF_ROUTE_DIR_SLOTS * sizeof(*dst->dir));
+        dst->entry_cap = src->entry_cap;
+        dst->entry_used = src->entry_used;
+        dst->free_entry = src->free_entry;
+        dst->node_cap = src->node_cap;
+        dst->node_used = src->node_used;
+        dst->free_node = src->free_node;
+        dst->root = src->root;
+        dst->count = src->count;
+    }
+    if (src->bloom) {
+        dst->bloom = (sf_route_bloom_t *)malloc(sizeof(*dst->bloom));
+        if (!dst->bloom || sf_route_bloom_copy(dst->bloom, src->bloom) != 0) {
+            free(dst->bloom);
+            dst->bloom = NULL;
+            goto fail;
+        }
+    }
+    if (sf_route_table_reserve(dst, routes) == 0) return 0;
+fail:
+    sf_route_table_free(dst);
+    return -1;
+}
+
 int sf_route_table_upsert(sf_route_table_t *rt, const sf_route_entry_t *e) {
     if (!rt || !e) return -1;
     if (e->mask_bits > 32) return -1;
+    if ((e->flags & SF_ROUTE_F_GROUP) && !sf_nh_valid(&rt->nh, route_group(e))) return -1;
+    if (reserve(rt, 1, 2) != 0) return -1;
+
+    uint32_t key = ntohl(e->prefix_be) & mask_from_bits(e->mask_bits);
+    uint32_t touched;
+    uint32_t x = node_insert(rt, key, e->mask_bits, &touched);
+    sf_route_node_t *n = &rt->nodes[x];
+    if (n->route == SF_ROUTE_NONE) {
+        n->route = entry_new(rt);
+        rt->count++;
+        if (rt->bloom && e->mask_bits >= SF_ROUTE_BLOOM_MIN_BITS) {
+            sf_route_bloom_add(rt->bloom, key, e->mask_bits);
+        }
+    } else {
+        sf_nh_unref(&rt->nh, route_group(&rt->entries[n->route]));
+    }
+    sf_nh_ref(&rt->nh, route_group(e));
+    sf_route_entry_t *slot = &rt->entries[n->route];
+    *slot = *e;
+    slot->prefix_be = htonl(key);
+    dir_refresh(rt, key, touched);
+    /* Full filters answer yes too often: rebuild them twice the size. */
+    if (rt->bloom && rt->bloom->keys > rt->bloom->capacity &&
+        bloom_build(rt, rt->bloom->fpr, rt->bloom->capacity * 2) != 0) {
+        bloom_drop(rt);
+    }
+    return 0;
+}
 
-    for (size_t i = 0; i < rt->count; ++i) {
-        if (rt->entries[i].prefix_be == e->prefix_be && rt->entries[i].mask_bits == e->mask_bits) {
-            rt->entries[i] = *e;
-            return 0;
+/* Stable LSD radix sort by (key, bits); entries already hold masked host-order keys in prefix_be. */
+static void sort_by_prefix(sf_route_entry_t *a, sf_route_entry_t *tmp, size_t n) {
+    size_t count[256];
+    for (int pass = 0; pass < 5; ++pass) {
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; ++i) {
+            unsigned d = pass == 0 ? a[i].mask_bits : (a[i].prefix_be >> ((pass - 1) * 8)) & 0xFFu;
+            count[d]++;
         }
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            unsigned d = pass == 0 ? a[i].mask_bits : (a[i].prefix_be >> ((pass - 1) * 8)) & 0xFFu;
+            tmp[count[d]++] = a[i];
+        }
+        sf_route_entry_t *t = a;
+        a = tmp;
+        tmp = t;
     }
+    /* Five passes: the sorted data ended up in the scratch buffer. */
+    memcpy(tmp, a, n * sizeof(*a));
+}
 
-    if (rt->count >= SF_ROUTE_TABLE_MAX) return -1;
-    rt->entries[rt->count++] = *e;
+int sf_route_table_build(sf_route_table_t *rt, sf_route_entry_t *entries, size_t n) {
+    if (!rt || (!entries && n) || rt->count || rt->map || n > 0x7FFFFFFFu) return -1;
+    for (size_t i = 0; i < n; ++i) {
+        if (entries[i].mask_bits > 32) return -1;
+        if ((entries[i].flags & SF_ROUTE_F_GROUP) && !sf_nh_valid(&rt->nh, route_group(&entries[i]))) return -1;
+        entries[i].prefix_be = ntohl(entries[i].prefix_be) & mask_from_bits(entries[i].mask_bits);
+    }
+    sf_route_entry_t *tmp = (sf_route_entry_t *)malloc((n ? n : 1) * sizeof(*tmp));
+    if (!tmp) return -1;
+    sort_by_prefix(entries, tmp, n);
+    free(tmp);
+
+    /* Duplicates are adjacent and in input order; the last one wins, as with upserts. */
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (m && entries[m - 1].prefix_be == entries[i].prefix_be && entries[m - 1].mask_bits == entries[i].mask_bits) {
+            entries[m - 1] = entries[i];
+        } else {
+            entries[m++] = entries[i];
+        }
+    }
+    if (reserve(rt, (uint32_t)m + 1, 2 * (uint32_t)m + 2) != 0) return -1;
+
+    /* Pre-order input keeps the insertion path hot in cache; the first-level
+       index is filled once at the end instead of after every insert. */
+    uint32_t touched;
+    for (size_t i = 0; i < m; ++i) {
+        uint32_t key = entries[i].prefix_be;
+        uint32_t x = node_insert(rt, key, entries[i].mask_bits, &touched);
+        uint32_t slot = entry_new(rt);
+        rt->nodes[x].route = slot;
+        rt->entries[slot] = entries[i];
+        rt->entries[slot].prefix_be = htonl(key);
+        sf_nh_ref(&rt->nh, route_group(&entries[i]));
+        entries[i].prefix_be = htonl(key);
+    }
+    rt->count = m;
+    dir_fill(rt, rt->root, SF_ROUTE_NONE, 0, SF_ROUTE_DIR_SLOTS);
+    if (rt->bloom && bloom_build(rt, rt->bloom->fpr, 2 * (uint32_t)m) != 0) bloom_drop(rt);
+    return (int)m;
+}
+
+/* Takes the route key/mask_bits out of the trie without touching the dir;
+   *touched gets the shortest prefix length whose structure changed. */
+static int node_remove(sf_route_table_t *rt, uint32_t key, uint8_t mask_bits, uint32_t *touched) {
+    uint32_t *plink = NULL;
+    uint32_t *link = &rt->root;
+    while (*link) {
+        sf_route_node_t *n = &rt->nodes[*link];
+        if (n->bits > mask_bits || (key & mask_from_bits((uint8_t)n->bits)) != n->key) return -1;
+        if (n->bits == mask_bits) break;
+        plink = link;
+        link = &n->child[bit_at(key, n->bits)];
+    }
+    if (!*link) return -1;
+    uint32_t x = *link;
+    sf_route_node_t *n = &rt->nodes[x];
+    if (n->route == SF_ROUTE_NONE) return -1;
+    /* Removing a route from a mapped snapshot writes into the private mapping. */
+    sf_nh_unref(&rt->nh, route_group(&rt->entries[n->route]));
+    entry_free(rt, n->route);
+    n->route = SF_ROUTE_NONE;
+    rt->count--;
+
+    *touched = mask_bits;
+    if (n->child[0] && n->child[1]) {
+        /* Still needed as a branch. */
+    } else if (n->child[0] || n->child[1]) {
+        *link = n->child[0] ? n->child[0] : n->child[1];
+        node_free(rt, x);
+    } else {
+        *link = 0;
+        node_free(rt, x);
+        if (plink) {
+            /* A routeless parent left with one child is no longer a branch point. */
+            uint32_t p = *plink;
+            sf_route_node_t *pn = &rt->nodes[p];
+            if (pn->route == SF_ROUTE_NONE) {
+                *plink = pn->child[0] ? pn->child[0] : pn->child[1];
+                *touched = pn->bits;
+                node_free(rt, p);
+            }
+        }
+    }
     return 0;
 }
 
 int sf_route_table_remove(sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits) {
-    if (!rt) return -1;
-    for (size_t i = 0; i < rt->count; ++i) {
-        if (rt->entries[i].prefix_be == prefix_be && rt->entries[i].mask_bits == mask_bits) {
-            rt->entries[i] = rt->entries[rt->count - 1];
-            rt->count--;
-            return 0;
+    if (!rt || mask_bits > 32 || rt->count == 0) return -1;
+    uint32_t key = ntohl(prefix_be) & mask_from_bits(mask_bits);
+    uint32_t touched;
+    if (node_remove(rt, key, mask_bits, &touched) != 0) return -1;
+    if (rt->dir) dir_refresh(rt, key & mask_from_bits((uint8_t)touched), touched);
+    if (rt->bloom && mask_bits >= SF_ROUTE_BLOOM_MIN_BITS) {
+        sf_route_bloom_del(rt->bloom, key, mask_bits);
+        bloom_rescan(rt, key >> (32 - SF_ROUTE_DIR_BITS));
+    }
+    return 0;
+}
+
+/* Walks up to 16 keys (host order, in prefix_be) down the trie in lockstep,
+   prefetching each one's next node, so that their cache misses overlap rather
+   than queue up one after another in the removals that follow. */
+static void prefetch_paths(const sf_route_table_t *rt, const sf_route_entry_t *k, size_t n) {
+    uint32_t x[16];
+    for (size_t i = 0; i < n; ++i) x[i] = rt->root;
+    for (size_t live = n; live;) {
+        live = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (!x[i]) continue;
+            const sf_route_node_t *nd = &rt->nodes[x[i]];
+            if (nd->bits >= k[i].mask_bits || (k[i].prefix_be & mask_from_bits((uint8_t)nd->bits)) != nd->key) {
+                x[i] = 0;
+                continue;
+            }
+            x[i] = nd->child[bit_at(k[i].prefix_be, nd->bits)];
+            if (x[i]) {
+                __builtin_prefetch(&rt->nodes[x[i]]);
+                live++;
+            }
         }
     }
-    return -1;
+}
+
+size_t sf_route_table_remove_batch(sf_route_table_t *rt, const sf_route_entry_t *keys, size_t n) {
+    if (!rt || !keys || !n) return 0;
+    /* Sorted, consecutive removals walk mostly the same (cached) trie path.
+       The dir is brought up to date once at the end: range by range while
+       that is cheaper than refilling all of it, in one pass otherwise. */
+    sf_route_entry_t *sorted = (sf_route_entry_t *)malloc(2 * n * sizeof(*sorted));
+    if (!sorted) {
+        size_t removed = 0;
+        for (size_t i = 0; i < n; ++i) removed += sf_route_table_remove(rt, keys[i].prefix_be, keys[i].mask_bits) == 0;
+        return removed;
+    }
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (keys[i].mask_bits > 32) continue;
+        sorted[m].prefix_be = ntohl(keys[i].prefix_be) & mask_from_bits(keys[i].mask_bits);
+        sorted[m].mask_bits = keys[i].mask_bits;
+        m++;
+    }
+    sort_by_prefix(sorted, sorted + n, m);
+
+    /* The touched ranges go where the keys were: entry i is done with by then.
+       `rescan` marks the slots whose filter lengths are recomputed once the
+       dir is up to date. */
+    uint64_t rescan[SF_ROUTE_DIR_SLOTS / 64];
+    if (rt->bloom) memset(rescan, 0, sizeof(rescan));
+    size_t removed = 0, cost = 0;
+    for (size_t i = 0; i < m && rt->count; ++i) {
+        if (i % 16 == 0) prefetch_paths(rt, sorted + i, m - i < 16 ? m - i : 16);
+        uint32_t touched;
+        if (node_remove(rt, sorted[i].prefix_be, sorted[i].mask_bits, &touched) != 0) continue;
+        if (rt->bloom && sorted[i].mask_bits >= SF_ROUTE_BLOOM_MIN_BITS) {
+            uint32_t slot = sorted[i].prefix_be >> (32 - SF_ROUTE_DIR_BITS);
+            sf_route_bloom_del(rt->bloom, sorted[i].prefix_be, sorted[i].mask_bits);
+            rescan[slot / 64] |= 1ull << (slot % 64);
+        }
+        sorted[removed].prefix_be = sorted[i].prefix_be & mask_from_bits((uint8_t)touched);
+        sorted[removed].mask_bits = (uint8_t)touched;
+        cost += (touched < SF_ROUTE_DIR_BITS ? 1u << (SF_ROUTE_DIR_BITS - touched) : 1u) + SF_ROUTE_DIR_BITS;
+        removed++;
+    }
+    if (rt->dir && removed) {
+        if (cost < 8 * SF_ROUTE_DIR_SLOTS) {
+            for (size_t i = 0; i < removed; ++i) dir_refresh(rt, sorted[i].prefix_be, sorted[i].mask_bits);
+        } else {
+            dir_fill(rt, rt->root, SF_ROUTE_NONE, 0, SF_ROUTE_DIR_SLOTS);
+        }
+    }
+    if (rt->bloom && removed) {
+        for (uint32_t w = 0; w < SF_ROUTE_DIR_SLOTS / 64; ++w) {
+            for (uint64_t bits = rescan[w]; bits; bits &= bits - 1) bloom_rescan(rt, w * 64 + (uint32_t)__builtin_ctzll(bits));
+        }
+    }
+    free(sorted);
+    return removed;
 }
 
 int sf_route_table_lookup(const sf_route_table_t *rt, uint32_t ip_be, sf_route_entry_t *out_best) {
     if (!rt || !out_best) return -1;
     if (rt->count == 0) return -1;
 
-    uint32_t ip = ip_be;
-    int found = 0;
-    sf_route_entry_t best = {0};
+    uint32_t ip = ntohl(ip_be);
+    const sf_route_dir_t *d = &rt->dir[ip >> (32 - SF_ROUTE_DIR_BITS)];
+    uint32_t best = d->route;
+    uint32_t x = d->node;
+    /* No route below the index can match: the index has the answer. */
+    if (x && rt->bloom && !sf_route_bloom_may_match(rt->bloom, ip)) x = 0;
+    while (x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if ((ip & mask_from_bits((uint8_t)n->bits)) != n->key) break;
+        if (n->route != SF_ROUTE_NONE) best = n->route;
+        if (n->bits == 32) break;
+        x = n->child[bit_at(ip, n->bits)];
+    }
 
-    for (size_t i = 0; i < rt->count; ++i) {
-        sf_route_entry_t e = rt->entries[i];
-        uint32_t mask = htonl(mask_from_bits(e.mask_bits));
-        if ((ip & mask) == (e.prefix_be & mask)) {
-            if (!found) {
-                best = e;
-                found = 1;
-            } else {
-                if (e.mask_bits > best.mask_bits) {
-                    best = e;
-                } else if (e.mask_bits == best.mask_bits && e.metric < best.metric) {
-                    best = e;
-                }
-            }
+    if (best == SF_ROUTE_NONE) return -1;
+    *out_best = rt->entries[best];
+    return 0;
+}
+
+const sf_route_entry_t *sf_route_table_get(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits) {
+    if (!rt || mask_bits > 32) return NULL;
+    uint32_t key = ntohl(prefix_be) & mask_from_bits(mask_bits);
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if (n->bits > mask_bits || (key & mask_from_bits((uint8_t)n->bits)) != n->key) return NULL;
+        if (n->bits == mask_bits) return n->route == SF_ROUTE_NONE ? NULL : &rt->entries[n->route];
+        x = n->child[bit_at(key, n->bits)];
+    }
+    return NULL;
+}
+
+/* Visits the subtree under node x in (prefix, length) order. */
+static int walk(const sf_route_table_t *rt, uint32_t x, sf_route_visit_fn fn, void *ctx) {
+    /* A path-compressed trie over 32-bit keys is at most 33 nodes deep. */
+    uint32_t stack[64];
+    size_t sp = 0;
+    stack[sp++] = x;
+    while (sp) {
+        const sf_route_node_t *n = &rt->nodes[stack[--sp]];
+        if (n->route != SF_ROUTE_NONE) {
+            int r = fn(&rt->entries[n->route], ctx);
+            if (r) return r;
         }
+        if (n->child[1]) stack[sp++] = n->child[1];
+        if (n->child[0]) stack[sp++] = n->child[0];
     }
+    return 0;
+}
 
-    if (!found) return -1;
-    *out_best = best;
+int sf_route_table_foreach(const sf_route_table_t *rt, sf_route_visit_fn fn, void *ctx) {
+    if (!rt || !fn || !rt->root) return 0;
+    return walk(rt, rt->root, fn, ctx);
+}
+
+int sf_route_table_foreach_covered(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                   sf_route_visit_fn fn, void *ctx) {
+    if (!rt || !fn || mask_bits > 32) return 0;
+    uint32_t key = ntohl(prefix_be) & mask_from_bits(mask_bits);
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if (n->bits >= mask_bits) {
+            /* The first node at or below the prefix roots everything inside it. */
+            return (n->key & mask_from_bits(mask_bits)) == key ? walk(rt, x, fn, ctx) : 0;
+        }
+        if ((key & mask_from_bits((uint8_t)n->bits)) != n->key) return 0;
+        x = n->child[bit_at(key, n->bits)];
+    }
+    return 0;
+}
+
+int sf_route_table_foreach_covering(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                    sf_route_visit_fn fn, void *ctx) {
+    if (!rt || !fn || mask_bits > 32) return 0;
+    uint32_t key = ntohl(prefix_be) & mask_from_bits(mask_bits);
+    uint32_t x = rt->root;
+    while (x) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if (n->bits > mask_bits || (key & mask_from_bits((uint8_t)n->bits)) != n->key) return 0;
+        if (n->route != SF_ROUTE_NONE) {
+            int r = fn(&rt->entries[n->route], ctx);
+            if (r) return r;
+        }
+        if (n->bits == mask_bits) return 0;
+        x = n->child[bit_at(key, n->bits)];
+    }
     return 0;
 }
 
+int sf_route_table_foreach_children(const sf_route_table_t *rt, uint32_t prefix_be, uint8_t mask_bits,
+                                    sf_route_visit_fn fn, void *ctx) {
+    if (!rt || !fn || mask_bits > 32) return 0;
+    uint32_t key = ntohl(prefix_be) & mask_from_bits(mask_bits);
+    uint32_t x = rt->root;
+    while (x && rt->nodes[x].bits < mask_bits) {
+        const sf_route_node_t *n = &rt->nodes[x];
+        if ((key & mask_from_bits((uint8_t)n->bits)) != n->key) return 0;
+        x = n->child[bit_at(key, n->bits)];
+    }
+    if (!x || (rt->nodes[x].key & mask_from_bits(mask_bits)) != key) return 0;
+    /* The subtree walk, stopping at the first route down each branch. */
+    uint32_t stack[64];
+    size_t sp = 0;
+    stack[sp++] = x;
+    while (sp) {
+        const sf_route_node_t *n = &rt->nodes[stack[--sp]];
+        if (n->route != SF_ROUTE_NONE && n->bits > mask_bits) {
+            int r = fn(&rt->entries[n->route], ctx);
+            if (r) return r;
+            continue;
+        }
+        if (n->child[1]) stack[sp++] = n->child[1];
+        if (n->child[0]) stack[sp++] = n->child[0];
+    }
+    return 0;
+}
+
+size_t sf_route_table_group_records(const sf_route_table_t *rt, sf_route_entry_t *out) {
+    if (!rt) return 0;
+    size_t n = 0;
+    sf_nh_member_t m[SF_NH_GROUP_MAX];
+    for (uint32_t slot = 1; slot < rt->nh.group_used; ++slot) {
+        uint32_t id = sf_nh_id(&rt->nh, slot);
+        size_t k = id ? sf_nh_members(&rt->nh, id, m) : 0;
+        for (size_t i = 0; out && i < k; ++i) {
+            sf_route_entry_t *e = &out[n + i];
+            memset(e, 0, sizeof(*e));
+            e->prefix_be = htonl(id);
+            e->next_hop_be = m[i].next_hop_be;
+            e->metric = m[i].weight;
+        }
+        n += k;
+    }
+    return n;
+}
+
+int sf_route_table_define_groups(sf_route_table_t *rt, const sf_route_entry_t *records, size_t n) {
+    if (!rt || (!records && n)) return -1;
+    sf_nh_member_t m[SF_NH_GROUP_MAX];
+    int groups = 0;
+    for (size_t i = 0; i < n;) {
+        size_t k = 0;
+        uint32_t id = records[i].prefix_be;
+        for (; i < n && records[i].prefix_be == id; ++i) {
+            if (k == SF_NH_GROUP_MAX) return -1;
+            memset(&m[k], 0, sizeof(m[k]));
+            m[k].next_hop_be = records[i].next_hop_be;
+            m[k].weight = records[i].metric;
+            k++;
+        }
+        if (sf_nh_define_at(&rt->nh, ntohl(id), m, k) != 0) return -1;
+        groups++;
+    }
+    return groups;
+}
+
+static int count_visit(const sf_route_entry_t *e, void *ctx) {
+    (void)e;
+    (*(size_t *)ctx)++;
+    return 0;
+}
+
+/* Brute-force reference for the randomized check below. */
+static int reference_lookup(const sf_route_entry_t *set, size_t n, uint32_t ip, uint8_t *bits) {
+    int found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (set[i].mask_bits == 0xFF) continue;
+        uint32_t m = mask_from_bits(set[i].mask_bits);
+        if ((ip & m) == (ntohl(set[i].prefix_be) & m) && (!found || set[i].mask_bits > *bits)) {
+            *bits = set[i].mask_bits;
+            found = 1;
+        }
+    }
+    return found;
+}
+
 int sf_route_table_self_test(void) {
     sf_route_table_t rt;
     sf_route_table_init(&rt);
@@ -103,6 +788,198 @@ int sf_route_table_self_test(void) {
     if (best.mask_bits != 8) return -1;
     if (best.next_hop_be != e1.next_hop_be) return -1;
 
+    /* Host bits are masked off: this replaces e1 rather than adding a route. */
+    sf_route_entry_t e3 = e1;
+    e3.prefix_be = htonl(0x0A0B0C0Du);
+    e3.metric = 1;
+    if (sf_route_table_upsert(&rt, &e3) != 0) return -1;
+    if (sf_route_table_count(&rt) != 2) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0x0A020203u), &best) != 0 || best.metric != 1) return -1;
+    if (best.prefix_be != htonl(0x0A000000u)) return -1;
+
+    if (!sf_route_table_get(&rt, htonl(0x0A010000u), 16) || sf_route_table_get(&rt, htonl(0x0A010000u), 15)) return -1;
+    if (sf_route_table_remove(&rt, htonl(0x0A010000u), 16) != 0) return -1;
+    if (sf_route_table_remove(&rt, htonl(0x0A010000u), 16) != -1) return -1;
+    if (sf_route_table_get(&rt, htonl(0x0A010000u), 16)) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0x0A010203u), &best) != 0 || best.mask_bits != 8) return -1;
+    sf_route_table_free(&rt);
+
+    /* Random prefixes with inserts and removals against a brute-force reference,
+       through prefix-length filters loose enough to answer yes wrongly often. */
+    enum { N = 400 };
+    static sf_route_entry_t set[N];
+    uint32_t seed = 12345u;
+    sf_route_table_init(&rt);
+    if (sf_route_table_set_bloom(&rt, 0.5) != 0 || !rt.bloom) return -1;
+    for (size_t i = 0; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t key = (seed & 0x0F0F0000u) | ((seed >> 8) & 0xFFu);
+        seed = seed * 1103515245u + 12345u;
+        uint8_t bits = (uint8_t)((seed >> 16) % 33u);
+        memset(&set[i], 0, sizeof(set[i]));
+        set[i].prefix_be = htonl(key & mask_from_bits(bits));
+        set[i].mask_bits = bits;
+        set[i].next_hop_be = (uint32_t)i;
+        for (size_t k = 0; k < i; ++k) {
+            if (set[k].prefix_be == set[i].prefix_be && set[k].mask_bits == bits) set[k].mask_bits = 0xFF;
+        }
+        if (sf_route_table_upsert(&rt, &set[i]) != 0) return -1;
+    }
+    for (size_t i = 0; i < N; i += 3) {
+        if (set[i].mask_bits == 0xFF) continue;
+        if (sf_route_table_remove(&rt, set[i].prefix_be, set[i].mask_bits) != 0) return -1;
+        set[i].mask_bits = 0xFF;
+    }
+    size_t live = 0, visited = 0;
+    for (size_t i = 0; i < N; ++i) live += set[i].mask_bits != 0xFF;
+    sf_route_table_foreach(&rt, count_visit, &visited);
+    if (live != sf_route_table_count(&rt) || visited != live) return -1;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t ip = seed & 0x0F0F00FFu;
+        if (i & 1) ip |= seed & 0x0000FF00u;
+        uint8_t ref_bits = 0;
+        int ref = reference_lookup(set, N, ip, &ref_bits);
+        int got = sf_route_table_lookup(&rt, htonl(ip), &best);
+        if (ref != (got == 0)) return -1;
+        if (ref && best.mask_bits != ref_bits) return -1;
+    }
+    /* Covered and covering walks visit exactly the routes a filter over the
+       whole set finds, including for query prefixes that are not routes. */
+    for (uint32_t i = 0; i < 400; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint8_t qbits = (uint8_t)((seed >> 16) % 33u);
+        uint32_t q = (i & 1) ? ntohl(set[i % N].prefix_be) : (seed & 0x0F0F00FFu);
+        q &= mask_from_bits(qbits);
+        size_t inside = 0, around = 0, got_inside = 0, got_around = 0;
+        for (size_t k = 0; k < N; ++k) {
+            if (set[k].mask_bits == 0xFF) continue;
+            uint32_t p = ntohl(set[k].prefix_be);
+            uint8_t b = set[k].mask_bits;
+            if (b >= qbits && (p & mask_from_bits(qbits)) == q) inside++;
+            if (b <= qbits && (q & mask_from_bits(b)) == p) around++;
+        }
+        sf_route_table_foreach_covered(&rt, htonl(q), qbits, count_visit, &got_inside);
+        sf_route_table_foreach_covering(&rt, htonl(q), qbits, count_visit, &got_around);
+        if (got_inside != inside || got_around != around) return -1;
+        if (i % 4) continue;
+        /* Children: strictly inside, with no other route strictly inside between. */
+        size_t outer = 0, got_outer = 0;
+        for (size_t k = 0; k < N; ++k) {
+            uint8_t b = set[k].mask_bits;
+            uint32_t p = ntohl(set[k].prefix_be);
+            if (b == 0xFF || b <= qbits || (p & mask_from_bits(qbits)) != q) continue;
+            int nested = 0;
+            for (size_t j = 0; j < N && !nested; ++j) {
+                uint8_t c = set[j].mask_bits;
+                nested = c != 0xFF && c > qbits && c < b && (p & mask_from_bits(c)) == ntohl(set[j].prefix_be);
+            }
+            outer += !nested;
+        }
+        sf_route_table_foreach_children(&rt, htonl(q), qbits, count_visit, &got_outer);
+        if (got_outer != outer) return -1;
+    }
+    sf_route_table_free(&rt);
+
+    /* Bulk build agrees with the same routes upserted one by one, duplicates included. */
+    static sf_route_entry_t bulk[N];
+    sf_route_table_t inc;
+    sf_route_table_init(&inc);
+    sf_route_table_init(&rt);
+    if (sf_route_table_set_bloom(&rt, 0.01) != 0) return -1;
+    for (size_t i = 0; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        memset(&bulk[i], 0, sizeof(bulk[i]));
+        bulk[i].prefix_be = htonl(seed & 0x0F0FF0F0u);
+        bulk[i].mask_bits = (uint8_t)((seed >> 3) % 33u);
+        bulk[i].next_hop_be = (uint32_t)i;
+        if (sf_route_table_upsert(&inc, &bulk[i]) != 0) return -1;
+    }
+    if (sf_route_table_build(&rt, bulk, N) != (int)sf_route_table_count(&inc)) return -1;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        sf_route_entry_t a, b;
+        int ra = sf_route_table_lookup(&inc, htonl(seed & 0x0F0FFFFFu), &a);
+        int rb = sf_route_table_lookup(&rt, htonl(seed & 0x0F0FFFFFu), &b);
+        if (ra != rb || (ra == 0 && (a.next_hop_be != b.next_hop_be || a.prefix_be != b.prefix_be))) return -1;
+    }
+    e1.prefix_be = htonl(0xC0000000u);
+    if (sf_route_table_upsert(&rt, &e1) != 0 || sf_route_table_lookup(&rt, htonl(0xC0000001u), &best) != 0) return -1;
+    if (sf_route_table_build(&rt, bulk, 1) != -1) return -1; /* only into an empty table */
+    if (!rt.bloom || rt.bloom->keys > sf_route_table_count(&rt)) return -1;
+
+    /* A clone answers like its source and changes independently of it. */
+    sf_route_table_t copy;
+    if (sf_route_table_clone(&copy, &rt, 100) != 0 || !copy.bloom || copy.count != rt.count) return -1;
+    e1.next_hop_be = htonl(0x01020304u);
+    if (sf_route_table_upsert(&copy, &e1) != 0) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0xC0000001u), &best) != 0 || best.next_hop_be == e1.next_hop_be) return -1;
+    if (sf_route_table_lookup(&copy, htonl(0xC0000001u), &best) != 0 || best.next_hop_be != e1.next_hop_be) return -1;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        sf_route_entry_t a, b;
+        int ra = sf_route_table_lookup(&rt, htonl(seed & 0x0F0FFFFFu), &a);
+        int rb = sf_route_table_lookup(&copy, htonl(seed & 0x0F0FFFFFu), &b);
+        if (ra != rb || (ra == 0 && a.prefix_be != b.prefix_be)) return -1;
+    }
+    sf_route_table_free(&copy);
+
+    /* A reservation covers that many new routes without growing the arrays. */
+    if (sf_route_table_reserve(&inc, 100) != 0) return -1;
+    uint32_t entry_cap = inc.entry_cap, node_cap = inc.node_cap;
+    for (uint32_t i = 0; i < 100; ++i) {
+        e1.prefix_be = htonl(0xE0000000u + (i << 8));
+        e1.mask_bits = 24;
+        if (sf_route_table_upsert(&inc, &e1) != 0) return -1;
+    }
+    if (inc.entry_cap != entry_cap || inc.node_cap != node_cap) return -1;
+
+    /* Batch removal (small and large enough to refill the whole dir) agrees
+       with removing the same routes one by one. */
+    sf_route_table_t one;
+    sf_route_table_init(&one);
+    sf_route_table_free(&rt);
+    sf_route_table_init(&rt);
+    for (size_t i = 0; i < N; ++i) {
+        if (sf_route_table_upsert(&one, &bulk[i]) != 0 || sf_route_table_upsert(&rt, &bulk[i]) != 0) return -1;
+    }
+    if (sf_route_table_set_bloom(&rt, 0.05) != 0) return -1;
+    for (size_t step = 0; step < 2; ++step) {
+        size_t from = step ? 4 : 0, len = step ? N - 8 : 4, expect = 0;
+        for (size_t i = from; i < from + len; ++i) expect += sf_route_table_remove(&one, bulk[i].prefix_be, bulk[i].mask_bits) == 0;
+        if (sf_route_table_remove_batch(&rt, bulk + from, len) != expect) return -1;
+        if (sf_route_table_count(&rt) != sf_route_table_count(&one)) return -1;
+        for (uint32_t i = 0; i < 20000; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            sf_route_entry_t a, b;
+            int ra = sf_route_table_lookup(&one, htonl(seed & 0x0F0FFFFFu), &a);
+            int rb = sf_route_table_lookup(&rt, htonl(seed & 0x0F0FFFFFu), &b);
+            if (ra != rb || (ra == 0 && a.prefix_be != b.prefix_be)) return -1;
+        }
+    }
+    sf_route_table_free(&one);
+    sf_route_table_free(&inc);
+    sf_route_table_free(&rt);
+
+    /* Routes through a group count as its users; an unknown group is refused. */
+    sf_route_table_init(&rt);
+    sf_nh_member_t m[2] = {{htonl(0x0A000001u), 1, 0}, {htonl(0x0A000002u), 1, 0}};
+    uint32_t g = 0;
+    if (sf_nh_define(&rt.nh, m, 2, &g, NULL) != 0) return -1;
+    e1.prefix_be = htonl(0x0A000000u);
+    e1.mask_bits = 8;
+    e1.flags = SF_ROUTE_F_GROUP;
+    e1.next_hop_be = htonl(g + 1);
+    if (sf_route_table_upsert(&rt, &e1) != -1) return -1;
+    e1.next_hop_be = htonl(g);
+    e2.flags = SF_ROUTE_F_GROUP;
+    e2.next_hop_be = htonl(g);
+    if (sf_route_table_upsert(&rt, &e1) != 0 || sf_route_table_upsert(&rt, &e2) != 0) return -1;
+    if (rt.nh.groups[g].refs != 2) return -1;
+    e2.flags = 0;
+    if (sf_route_table_upsert(&rt, &e2) != 0 || rt.nh.groups[g].refs != 1) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0x0A020304u), &best) != 0 || !(best.flags & SF_ROUTE_F_GROUP)) return -1;
+    if (sf_route_table_remove_batch(&rt, &e1, 1) != 1 || rt.nh.groups[g].refs != 0) return -1;
+    sf_route_table_free(&rt);
     return 0;
 }
-
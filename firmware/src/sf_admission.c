@@ -0,0 +1,79 @@
+#include "sf_admission.h"
+
+#include <string.h>
+
+void sf_admission_default_config(sf_admission_config_t *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    out->enabled = 1;
+    out->target_ms = 5.0;
+    out->interval_ms = 100.0;
+    out->slo_ms = 100.0;
+}
+
+void sf_admission_init(sf_admission_t *ac, const sf_admission_config_t *cfg) {
+    if (!ac) return;
+    memset(ac, 0, sizeof(*ac));
+    if (cfg) ac->cfg = *cfg;
+    else sf_admission_default_config(&ac->cfg);
+    ac->reset_min = 1;
+}
+
+int sf_admission_should_shed(sf_admission_t *ac, double delay_ms, double now_ms) {
+    if (!ac || !ac->cfg.enabled) return 0;
+
+    if (now_ms >= ac->interval_end_ms) {
+        /* Close the window: overloaded iff nothing got through under target. */
+        if (!ac->reset_min) ac->overloaded = ac->min_delay_ms > ac->cfg.target_ms;
+        ac->interval_end_ms = now_ms + ac->cfg.interval_ms;
+        ac->reset_min = 1;
+    }
+    if (ac->reset_min || delay_ms < ac->min_delay_ms) {
+        ac->min_delay_ms = delay_ms;
+        ac->reset_min = 0;
+    }
+
+    int shed = 0;
+    if (ac->overloaded && delay_ms > 2.0 * ac->cfg.target_ms) shed = 1;
+    else if (ac->cfg.slo_ms > 0 && delay_ms > ac->cfg.slo_ms) shed = 1;
+
+    if (shed) ac->shed_requests++;
+    return shed;
+}
+
+int sf_admission_reject_connection(sf_admission_t *ac) {
+    if (!ac || !ac->cfg.enabled || !ac->overloaded) return 0;
+    ac->shed_connections++;
+    return 1;
+}
+
+int sf_admission_self_test(void) {
+    sf_admission_config_t cfg;
+    sf_admission_default_config(&cfg);
+    sf_admission_t ac;
+    sf_admission_init(&ac, &cfg);
+
+    /* Healthy queue: nothing is shed. */
+    double t = 0.0;
+    for (int i = 0; i < 100; ++i, t += 5.0) {
+        if (sf_admission_should_shed(&ac, 1.0, t) != 0) return -1;
+    }
+    if (sf_admission_reject_connection(&ac) != 0) return -1;
+
+    /* A delay above the SLO is shed even without a standing queue. */
+    if (sf_admission_should_shed(&ac, 150.0, t) != 1) return -1;
+
+    /* Standing queue for more than an interval: overload, shed > 2x target. */
+    for (int i = 0; i < 60; ++i, t += 5.0) sf_admission_should_shed(&ac, 20.0, t);
+    if (!ac.overloaded) return -1;
+    if (sf_admission_should_shed(&ac, 20.0, t) != 1) return -1;
+    if (sf_admission_should_shed(&ac, 8.0, t) != 0) return -1;
+    if (sf_admission_reject_connection(&ac) != 1) return -1;
+
+    /* Queue drains: overload clears after the next full interval. */
+    for (int i = 0; i < 60; ++i, t += 5.0) sf_admission_should_shed(&ac, 1.0, t);
+    if (ac.overloaded) return -1;
+    if (sf_admission_reject_connection(&ac) != 0) return -1;
+
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include "sf_commands.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 const char *sf_msg_type_name(uint8_t type) {
     switch (type) {
         case SF_MSG_PING: return "PING";
@@ -12,8 +15,43 @@ const char *sf_msg_type_name(uint8_t type) {
         case SF_MSG_ROUTE_ACK: return "ROUTE_ACK";
         case SF_MSG_ROUTE_LOOKUP: return "ROUTE_LOOKUP";
         case SF_MSG_ROUTE_REPLY: return "ROUTE_REPLY";
+        case SF_MSG_SNAPSHOT: return "SNAPSHOT";
+        case SF_MSG_SNAPSHOT_ACK: return "SNAPSHOT_ACK";
+        case SF_MSG_REPL_SUBSCRIBE: return "REPL_SUBSCRIBE";
+        case SF_MSG_REPL_BATCH: return "REPL_BATCH";
+        case SF_MSG_ROUTE_WITHDRAW: return "ROUTE_WITHDRAW";
+        case SF_MSG_ROUTE_UPDATE6: return "ROUTE_UPDATE6";
+        case SF_MSG_ROUTE_LOOKUP6: return "ROUTE_LOOKUP6";
+        case SF_MSG_ROUTE_REPLY6: return "ROUTE_REPLY6";
+        case SF_MSG_NH_GROUP: return "NH_GROUP";
+        case SF_MSG_NH_GROUP_ACK: return "NH_GROUP_ACK";
+        case SF_MSG_VRF_CREATE: return "VRF_CREATE";
+        case SF_MSG_VRF_DELETE: return "VRF_DELETE";
+        case SF_MSG_VRF_ACK: return "VRF_ACK";
+        case SF_MSG_ROUTE_QUERY: return "ROUTE_QUERY";
+        case SF_MSG_ROUTE_QUERY_REPLY: return "ROUTE_QUERY_REPLY";
+        case SF_MSG_ROUTE_DUMP: return "ROUTE_DUMP";
+        case SF_MSG_ROUTE_DUMP_REPLY: return "ROUTE_DUMP_REPLY";
         case SF_MSG_ERROR: return "ERROR";
         default: return "UNKNOWN";
     }
 }
 
+
+int sf_msg_type_parse(const char *s, uint8_t *out) {
+    if (!s || !out || !*s) return -1;
+    char *end = NULL;
+    long v = strtol(s, &end, 10);
+    if (end && *end == '\0') {
+        if (v < 0 || v > 255) return -1;
+        *out = (uint8_t)v;
+        return 0;
+    }
+    for (int t = 0; t < 256; ++t) {
+        if (strcmp(sf_msg_type_name((uint8_t)t), s) == 0 && strcmp(s, "UNKNOWN") != 0) {
+            *out = (uint8_t)t;
+            return 0;
+        }
+    }
+    return -1;
+}
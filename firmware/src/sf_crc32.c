@@ -1,15 +1,51 @@
 #include "sf_crc32.h"
 
-uint32_t sf_crc32(const void *data, size_t len) {
-    const unsigned char *p = (const unsigned char *)data;
-    uint32_t crc = 0xFFFFFFFFu;
-    for (size_t i = 0; i < len; ++i) {
-        crc ^= (uint32_t)p[i];
+#include <pthread.h>
+#include <string.h>
+
+/* Slicing-by-8 tables for the reflected 0xEDB88320 polynomial. */
+static uint32_t g_crc_table[8][256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
         for (int bit = 0; bit < 8; ++bit) {
             uint32_t mask = (uint32_t)(-(int)(crc & 1u));
             crc = (crc >> 1) ^ (0xEDB88320u & mask);
         }
+        g_crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            uint32_t prev = g_crc_table[k - 1][i];
+            g_crc_table[k][i] = (prev >> 8) ^ g_crc_table[0][prev & 0xFFu];
+        }
     }
+}
+
+uint32_t sf_crc32_update(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&g_crc_once, crc_table_init);
+    const unsigned char *p = (const unsigned char *)data;
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = g_crc_table[7][lo & 0xFFu] ^ g_crc_table[6][(lo >> 8) & 0xFFu] ^
+              g_crc_table[5][(lo >> 16) & 0xFFu] ^ g_crc_table[4][lo >> 24] ^
+              g_crc_table[3][hi & 0xFFu] ^ g_crc_table[2][(hi >> 8) & 0xFFu] ^
+              g_crc_table[1][(hi >> 16) & 0xFFu] ^ g_crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) crc = (crc >> 8) ^ g_crc_table[0][(crc ^ *p++) & 0xFFu];
     return ~crc;
 }
 
+uint32_t sf_crc32(const void *data, size_t len) {
+    return sf_crc32_update(0, data, len);
+}
@@ -0,0 +1,400 @@
+#include "sf_damp.h"
+#include "routing.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define DAMP_USED       0x01u
+#define DAMP_PRESENT    0x02u  /* the latest state asked for is a route (else withdrawn) */
+#define DAMP_SUPPRESSED 0x04u
+#define DAMP_HELD       0x08u  /* the latest state has not been applied */
+#define DAMP_LISTED     0x10u  /* in d->held (may outlive DAMP_HELD until the next collect) */
+#define DAMP_APPLIED    0x20u  /* applied_ms is set */
+#define DAMP_GROUP      0x40u  /* next_hop_be is a next-hop group (SF_ROUTE_F_GROUP) */
+
+/* 2^(-k/64) in 1/65536ths: decay within a half-life without libm. */
+static const uint32_t k_half[64] = {
+    65536, 64830, 64132, 63441, 62757, 62081, 61413, 60751,
+    60097, 59449, 58809, 58176, 57549, 56929, 56316, 55709,
+    55109, 54515, 53928, 53347, 52773, 52204, 51642, 51085,
+    50535, 49991, 49452, 48920, 48393, 47871, 47356, 46846,
+    46341, 45842, 45348, 44859, 44376, 43898, 43425, 42958,
+    42495, 42037, 41584, 41136, 40693, 40255, 39821, 39392,
+    38968, 38548, 38133, 37722, 37316, 36914, 36516, 36123,
+    35734, 35349, 34968, 34591, 34219, 33850, 33486, 33125,
+};
+
+static uint32_t mask_prefix(uint32_t prefix_be, uint8_t mask_bits) {
+    uint32_t mask = mask_bits ? 0xFFFFFFFFu << (32 - mask_bits) : 0;
+    return htonl(ntohl(prefix_be) & mask);
+}
+
+/* Milliseconds from a to b, 0 if b is not after a. */
+static uint32_t elapsed(uint32_t a, uint32_t b) {
+    return (int32_t)(b - a) > 0 ? b - a : 0;
+}
+
+static uint32_t decay(uint32_t p, uint32_t dt, uint32_t half_life) {
+    if (!p || !half_life) return p;
+    uint32_t q = dt / half_life;
+    if (q >= 32) return 0;
+    p >>= q;
+    uint32_t k = (uint32_t)((uint64_t)(dt % half_life) * 64u / half_life);
+    return (uint32_t)(((uint64_t)p * k_half[k]) >> 16);
+}
+
+void sf_damp_default_config(sf_damp_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->suppress = 2000;
+    cfg->reuse = 750;
+}
+
+int sf_damp_init(sf_damp_t *d, const sf_damp_config_t *cfg) {
+    memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+    uint32_t h = cfg->half_life_ms;
+    if (h > SF_DAMP_MAX_MS || cfg->coalesce_ms > SF_DAMP_MAX_MS || cfg->max_suppress_ms > SF_DAMP_MAX_MS) return -1;
+    if (!h) return 0;
+    if (!d->cfg.max_suppress_ms) d->cfg.max_suppress_ms = h <= SF_DAMP_MAX_MS / 4 ? 4 * h : SF_DAMP_MAX_MS;
+    if (cfg->reuse == 0 || cfg->reuse >= cfg->suppress) return -1;
+    /* A quiet prefix decays from the cap to reuse in max_suppress_ms. */
+    uint32_t q = d->cfg.max_suppress_ms / h;
+    uint64_t c = q >= 20 ? 0x7FFFFFFFu : (uint64_t)cfg->reuse << q;
+    c = c * 65536u / k_half[(uint64_t)(d->cfg.max_suppress_ms % h) * 64u / h];
+    d->ceiling = c > 0x7FFFFFFFu ? 0x7FFFFFFFu : (uint32_t)c;
+    return d->ceiling > cfg->suppress ? 0 : -1;
+}
+
+void sf_damp_free(sf_damp_t *d) {
+    free(d->recs);
+    free(d->held);
+    sf_damp_config_t cfg = d->cfg;
+    uint32_t ceiling = d->ceiling;
+    memset(d, 0, sizeof(*d));
+    d->cfg = cfg;
+    d->ceiling = ceiling;
+}
+
+int sf_damp_enabled(const sf_damp_t *d) {
+    return d->cfg.half_life_ms || d->cfg.coalesce_ms;
+}
+
+static size_t slot_of(const sf_damp_t *d, uint32_t prefix_be, uint8_t mask_bits) {
+    uint32_t x = prefix_be ^ ((uint32_t)mask_bits * 0x9E3779B9u);
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x & (d->cap - 1);
+}
+
+static sf_damp_rec_t *find(sf_damp_t *d, uint32_t prefix_be, uint8_t mask_bits) {
+    if (!d->cap) return NULL;
+    for (size_t i = slot_of(d, prefix_be, mask_bits);; i = (i + 1) & (d->cap - 1)) {
+        sf_damp_rec_t *r = &d->recs[i];
+        if (!r->flags) return NULL;
+        if (r->prefix_be == prefix_be && r->mask_bits == mask_bits) return r;
+    }
+}
+
+static void refresh(const sf_damp_t *d, sf_damp_rec_t *r, uint32_t now_ms) {
+    r->penalty = decay(r->penalty, elapsed(r->penalty_ms, now_ms), d->cfg.half_life_ms);
+    r->penalty_ms = now_ms;
+    if ((r->flags & DAMP_SUPPRESSED) && r->penalty < d->cfg.reuse) r->flags &= (uint8_t)~DAMP_SUPPRESSED;
+}
+
+static int window_open(const sf_damp_t *d, const sf_damp_rec_t *r, uint32_t now_ms) {
+    return d->cfg.coalesce_ms && (r->flags & DAMP_APPLIED) && elapsed(r->applied_ms, now_ms) < d->cfg.coalesce_ms;
+}
+
+/* Nothing held, not suppressed, the window closed and the penalty below half
+   of reuse: the table alone says everything the record does. */
+static int reclaimable(const sf_damp_t *d, sf_damp_rec_t *r, uint32_t now_ms) {
+    if (r->flags & DAMP_HELD) return 0;
+    refresh(d, r, now_ms);
+    return !(r->flags & DAMP_SUPPRESSED) && r->penalty < d->cfg.reuse / 2 && !window_open(d, r, now_ms);
+}
+
+/* Rehashes into a table sized for the records still worth keeping. */
+static int rehash(sf_damp_t *d, uint32_t now_ms) {
+    size_t keep = 0;
+    for (size_t i = 0; i < d->cap; ++i) {
+        if (d->recs[i].flags && !reclaimable(d, &d->recs[i], now_ms)) keep++;
+    }
+    size_t cap = 1024;
+    while (cap < 4 * (keep + 1)) cap *= 2;
+    sf_damp_rec_t *recs = (sf_damp_rec_t *)calloc(cap, sizeof(*recs));
+    uint32_t *held = (uint32_t *)malloc(cap / 2 * sizeof(*held));
+    if (!recs || !held) {
+        free(recs);
+        free(held);
+        return -1;
+    }
+    sf_damp_t n = *d;
+    n.recs = recs;
+    n.cap = cap;
+    n.used = 0;
+    n.held = held;
+    n.nheld = 0;
+    for (size_t i = 0; i < d->cap; ++i) {
+        sf_damp_rec_t *r = &d->recs[i];
+        if (!r->flags || reclaimable(d, r, now_ms)) continue;
+        size_t j = slot_of(&n, r->prefix_be, r->mask_bits);
+        while (recs[j].flags) j = (j + 1) & (cap - 1);
+        recs[j] = *r;
+        recs[j].flags &= (uint8_t)~DAMP_LISTED;
+        if (recs[j].flags & DAMP_HELD) {
+            recs[j].flags |= DAMP_LISTED;
+            held[n.nheld++] = (uint32_t)j;
+        }
+        n.used++;
+    }
+    free(d->recs);
+    free(d->held);
+    *d = n;
+    return 0;
+}
+
+static sf_damp_rec_t *insert(sf_damp_t *d, uint32_t prefix_be, uint8_t mask_bits, uint32_t now_ms) {
+    if ((d->used + 1) * 2 > d->cap && rehash(d, now_ms) != 0) return NULL;
+    size_t i = slot_of(d, prefix_be, mask_bits);
+    while (d->recs[i].flags) i = (i + 1) & (d->cap - 1);
+    sf_damp_rec_t *r = &d->recs[i];
+    memset(r, 0, sizeof(*r));
+    r->prefix_be = prefix_be;
+    r->mask_bits = mask_bits;
+    r->penalty_ms = now_ms;
+    r->flags = DAMP_USED;
+    d->used++;
+    return r;
+}
+
+static void set_state(sf_damp_rec_t *r, const sf_route_entry_t *e, uint32_t op) {
+    if (op == SF_ROUTE_OP_WITHDRAW) {
+        r->flags &= (uint8_t)~DAMP_PRESENT;
+        return;
+    }
+    r->flags = (uint8_t)((r->flags & ~DAMP_GROUP) | DAMP_PRESENT | ((e->flags & SF_ROUTE_F_GROUP) ? DAMP_GROUP : 0));
+    r->next_hop_be = e->next_hop_be;
+    r->metric = e->metric;
+}
+
+static uint32_t change_cost(const sf_damp_rec_t *r, const sf_route_entry_t *e, uint32_t op) {
+    if (!(r->flags & DAMP_PRESENT)) return 0;
+    if (op == SF_ROUTE_OP_WITHDRAW) return SF_DAMP_WITHDRAW_PENALTY;
+    int group = (e->flags & SF_ROUTE_F_GROUP) != 0;
+    return (r->next_hop_be != e->next_hop_be || r->metric != e->metric || group != ((r->flags & DAMP_GROUP) != 0))
+               ? SF_DAMP_CHANGE_PENALTY : 0;
+}
+
+int sf_damp_admit(sf_damp_t *d, const sf_route_table_t *rt, const sf_route_entry_t *e, uint32_t op, uint32_t now_ms) {
+    if (!sf_damp_enabled(d) || e->mask_bits > 32) return 1;
+    uint32_t prefix_be = mask_prefix(e->prefix_be, e->mask_bits);
+    sf_damp_rec_t *r = find(d, prefix_be, e->mask_bits);
+    if (!r) {
+        sf_damp_rec_t cur;
+        memset(&cur, 0, sizeof(cur));
+        const sf_route_entry_t *in = sf_route_table_get(rt, prefix_be, e->mask_bits);
+        if (in) {
+            cur.flags = (uint8_t)(DAMP_PRESENT | ((in->flags & SF_ROUTE_F_GROUP) ? DAMP_GROUP : 0));
+            cur.next_hop_be = in->next_hop_be;
+            cur.metric = in->metric;
+        }
+        /* A change that neither costs a penalty nor opens a window needs no record. */
+        if (!d->cfg.coalesce_ms && (!d->cfg.half_life_ms || change_cost(&cur, e, op) == 0)) return 1;
+        r = insert(d, prefix_be, e->mask_bits, now_ms);
+        if (!r) return 1;
+        r->flags |= cur.flags;
+        r->next_hop_be = cur.next_hop_be;
+        r->metric = cur.metric;
+    }
+
+    refresh(d, r, now_ms);
+    if (d->cfg.half_life_ms) {
+        uint64_t p = (uint64_t)r->penalty + change_cost(r, e, op);
+        r->penalty = p > d->ceiling ? d->ceiling : (uint32_t)p;
+        if (!(r->flags & DAMP_SUPPRESSED) && r->penalty > d->cfg.suppress) {
+            r->flags |= DAMP_SUPPRESSED;
+            d->suppressions++;
+        }
+    }
+    set_state(r, e, op);
+    if (r->flags & DAMP_HELD) d->coalesced++;
+
+    /* Withdrawals get through suppression: traffic must not follow a dead route. */
+    int hold = ((r->flags & DAMP_SUPPRESSED) && op != SF_ROUTE_OP_WITHDRAW) || window_open(d, r, now_ms);
+    if (!hold) {
+        r->flags = (uint8_t)((r->flags & ~DAMP_HELD) | DAMP_APPLIED);
+        r->applied_ms = now_ms;
+        return 1;
+    }
+    r->flags |= DAMP_HELD;
+    if (!(r->flags & DAMP_LISTED)) {
+        r->flags |= DAMP_LISTED;
+        d->held[d->nheld++] = (uint32_t)(r - d->recs);
+    }
+    return 0;
+}
+
+void sf_damp_note(sf_damp_t *d, const sf_route_entry_t *e, uint32_t op, uint32_t now_ms) {
+    if (!d->cap || e->mask_bits > 32) return;
+    sf_damp_rec_t *r = find(d, mask_prefix(e->prefix_be, e->mask_bits), e->mask_bits);
+    if (!r) return;
+    set_state(r, e, op);
+    r->flags = (uint8_t)((r->flags & ~DAMP_HELD) | DAMP_APPLIED);
+    r->applied_ms = now_ms;
+}
+
+int sf_damp_collect(sf_damp_t *d, uint32_t now_ms, sf_route_entry_t *ups, size_t *nu,
+                    sf_route_entry_t *wds, size_t *nw, size_t max) {
+    *nu = 0;
+    *nw = 0;
+    size_t i = 0;
+    while (i < d->nheld) {
+        sf_damp_rec_t *r = &d->recs[d->held[i]];
+        if (r->flags & DAMP_HELD) {
+            refresh(d, r, now_ms);
+            int present = (r->flags & DAMP_PRESENT) != 0;
+            if ((present && (r->flags & DAMP_SUPPRESSED)) || window_open(d, r, now_ms)) {
+                i++;
+                continue;
+            }
+            if (present ? *nu == max : *nw == max) return 1;
+            sf_route_entry_t *out = present ? &ups[(*nu)++] : &wds[(*nw)++];
+            memset(out, 0, sizeof(*out));
+            out->prefix_be = r->prefix_be;
+            out->mask_bits = r->mask_bits;
+            if (present) {
+                out->next_hop_be = r->next_hop_be;
+                out->flags = (r->flags & DAMP_GROUP) ? SF_ROUTE_F_GROUP : 0;
+                out->metric = r->metric;
+                out->last_updated_ms = now_ms;
+            }
+            r->flags = (uint8_t)((r->flags & ~DAMP_HELD) | DAMP_APPLIED);
+            r->applied_ms = now_ms;
+        }
+        r->flags &= (uint8_t)~DAMP_LISTED;
+        d->held[i] = d->held[--d->nheld];
+    }
+    return 0;
+}
+
+int sf_damp_apply_held(const sf_damp_t *d, sf_route_table_t *rt, uint32_t now_ms) {
+    for (size_t i = 0; i < d->nheld; ++i) {
+        const sf_damp_rec_t *r = &d->recs[d->held[i]];
+        if (!(r->flags & DAMP_HELD)) continue;
+        if (!(r->flags & DAMP_PRESENT)) {
+            sf_route_table_remove(rt, r->prefix_be, r->mask_bits);
+            continue;
+        }
+        sf_route_entry_t e;
+        memset(&e, 0, sizeof(e));
+        e.prefix_be = r->prefix_be;
+        e.mask_bits = r->mask_bits;
+        e.next_hop_be = r->next_hop_be;
+        e.flags = (r->flags & DAMP_GROUP) ? SF_ROUTE_F_GROUP : 0;
+        e.metric = r->metric;
+        e.last_updated_ms = now_ms;
+        /* A group dropped meanwhile: released, the change would be refused too. */
+        if ((e.flags & SF_ROUTE_F_GROUP) && !sf_nh_valid(&rt->nh, ntohl(e.next_hop_be))) continue;
+        if (sf_route_table_upsert(rt, &e) != 0) return -1;
+    }
+    return 0;
+}
+
+static sf_route_entry_t test_route(uint32_t prefix, uint32_t next_hop) {
+    sf_route_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.prefix_be = htonl(prefix);
+    e.mask_bits = 24;
+    e.next_hop_be = htonl(next_hop);
+    e.metric = 1;
+    return e;
+}
+
+int sf_damp_self_test(void) {
+    sf_damp_t d;
+    sf_damp_config_t cfg;
+    sf_route_table_t rt;
+    sf_route_entry_t ups[4], wds[4];
+    size_t nu, nw;
+
+    sf_damp_default_config(&cfg);
+    cfg.reuse = 2000;
+    cfg.half_life_ms = 1000;
+    if (sf_damp_init(&d, &cfg) == 0) return -1;
+    if (decay(1000, 1000, 1000) != 500 || decay(1000, 500, 1000) != 707 || decay(1000, 40000, 1000) != 0) return -1;
+
+    /* Dampening: the third withdrawal suppresses; withdrawals still apply,
+       the announcement is held until the penalty decays below reuse. */
+    sf_damp_default_config(&cfg);
+    cfg.half_life_ms = 1000;
+    if (sf_damp_init(&d, &cfg) != 0 || d.ceiling != 12000) return -1;
+    sf_route_table_init(&rt);
+    sf_route_entry_t a = test_route(0x0A010100u, 0x01010101u);
+    if (sf_damp_admit(&d, &rt, &a, SF_ROUTE_OP_UPSERT, 0) != 1 || d.used != 0) return -1;
+    sf_route_table_upsert(&rt, &a);
+    for (int k = 0; k < 3; ++k) {
+        if (sf_damp_admit(&d, &rt, &a, SF_ROUTE_OP_WITHDRAW, 0) != 1) return -1;
+        if (k < 2 && sf_damp_admit(&d, &rt, &a, SF_ROUTE_OP_UPSERT, 0) != 1) return -1;
+    }
+    if (d.suppressions != 1 || d.used != 1) return -1;
+    if (sf_damp_admit(&d, &rt, &a, SF_ROUTE_OP_UPSERT, 0) != 0) return -1;
+    if (sf_damp_collect(&d, 2000, ups, &nu, wds, &nw, 4) != 0 || nu || nw) return -1;
+    if (sf_damp_collect(&d, 2100, ups, &nu, wds, &nw, 4) != 0 || nu != 1 || nw) return -1;
+    if (ups[0].prefix_be != a.prefix_be || ups[0].next_hop_be != a.next_hop_be || ups[0].last_updated_ms != 2100) return -1;
+    if (d.nheld != 0) return -1;
+    sf_damp_free(&d);
+    sf_route_table_free(&rt);
+
+    /* Coalescing: changes inside the window collapse into the last one. */
+    sf_damp_default_config(&cfg);
+    cfg.coalesce_ms = 100;
+    if (sf_damp_init(&d, &cfg) != 0) return -1;
+    sf_route_table_init(&rt);
+    sf_route_entry_t b = test_route(0x0A020200u, 1);
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_UPSERT, 0) != 1) return -1;
+    b.next_hop_be = htonl(2);
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_UPSERT, 10) != 0) return -1;
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_WITHDRAW, 20) != 0) return -1;
+    b.next_hop_be = htonl(3);
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_UPSERT, 30) != 0 || d.coalesced != 2) return -1;
+    /* A snapshot carries the held change; the store keeps holding it. */
+    sf_route_table_t snap;
+    sf_route_table_init(&snap);
+    if (sf_damp_apply_held(&d, &snap, 40) != 0 || sf_route_table_count(&snap) != 1) return -1;
+    const sf_route_entry_t *got = sf_route_table_get(&snap, b.prefix_be, b.mask_bits);
+    if (!got || got->next_hop_be != htonl(3) || got->last_updated_ms != 40 || d.nheld != 1) return -1;
+    sf_route_table_free(&snap);
+    if (sf_damp_collect(&d, 99, ups, &nu, wds, &nw, 4) != 0 || nu || nw) return -1;
+    if (sf_damp_collect(&d, 100, ups, &nu, wds, &nw, 4) != 0 || nu != 1 || ups[0].next_hop_be != htonl(3)) return -1;
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_WITHDRAW, 150) != 0) return -1;
+    if (sf_damp_collect(&d, 200, ups, &nu, wds, &nw, 4) != 0 || nu || nw != 1) return -1;
+
+    /* A transaction's change drops what is held; collect stops when a buffer fills. */
+    if (sf_damp_admit(&d, &rt, &b, SF_ROUTE_OP_UPSERT, 250) != 0) return -1;
+    sf_damp_note(&d, &b, SF_ROUTE_OP_WITHDRAW, 260);
+    if (sf_damp_collect(&d, 400, ups, &nu, wds, &nw, 4) != 0 || nu || nw || d.nheld) return -1;
+    for (uint32_t i = 0; i < 3; ++i) {
+        sf_route_entry_t c = test_route(0x0B000000u + (i << 8), 1);
+        sf_damp_admit(&d, &rt, &c, SF_ROUTE_OP_UPSERT, 500);
+        if (sf_damp_admit(&d, &rt, &c, SF_ROUTE_OP_UPSERT, 501) != 0) return -1;
+    }
+    if (sf_damp_collect(&d, 600, ups, &nu, wds, &nw, 2) != 1 || nu != 2) return -1;
+    if (sf_damp_collect(&d, 600, ups, &nu, wds, &nw, 2) != 0 || nu != 1) return -1;
+    sf_damp_free(&d);
+
+    /* Records of quiet prefixes are dropped instead of growing the store. */
+    cfg.coalesce_ms = 1;
+    if (sf_damp_init(&d, &cfg) != 0) return -1;
+    for (uint32_t i = 0; i < 100000; ++i) {
+        sf_route_entry_t c = test_route(0x0C000000u + (i << 8), 1);
+        if (sf_damp_admit(&d, &rt, &c, SF_ROUTE_OP_UPSERT, i / 64) != 1) return -1;
+    }
+    if (d.cap > 4096) return -1;
+    sf_damp_free(&d);
+    sf_route_table_free(&rt);
+    return 0;
+}
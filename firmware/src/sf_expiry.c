@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include "sf_expiry.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/* a is at or after b, modulo 2^32. */
+static int time_reached(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+uint32_t sf_expiry_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+void sf_expiry_init(sf_expiry_t *x, uint32_t ttl_ms) {
+    memset(x, 0, sizeof(*x));
+    x->ttl_ms = ttl_ms;
+}
+
+void sf_expiry_free(sf_expiry_t *x) {
+    free(x->ring);
+    sf_expiry_init(x, x->ttl_ms);
+}
+
+static int grow(sf_expiry_t *x) {
+    size_t cap = x->cap ? x->cap * 2 : 1024;
+    sf_expiry_key_t *p = (sf_expiry_key_t *)malloc(cap * sizeof(*p));
+    if (!p) return -1;
+    /* Unwrap into the new ring so the head is at 0. */
+    for (size_t i = 0; i < x->len; ++i) p[i] = x->ring[(x->head + i) & (x->cap - 1)];
+    free(x->ring);
+    x->ring = p;
+    x->cap = cap;
+    x->head = 0;
+    return 0;
+}
+
+/* Drops the entries whose route is gone or carries a newer stamp, keeping
+   the rest in order. */
+static void sweep(sf_expiry_t *x, const sf_route_table_t *rt) {
+    size_t m = 0;
+    for (size_t i = 0; i < x->len; ++i) {
+        sf_expiry_key_t k = x->ring[(x->head + i) & (x->cap - 1)];
+        const sf_route_entry_t *r = sf_route_table_get(rt, k.prefix_be, k.mask_bits);
+        if (r && r->last_updated_ms == k.stamp_ms) x->ring[(x->head + m++) & (x->cap - 1)] = k;
+    }
+    x->len = m;
+}
+
+static int push_key(sf_expiry_t *x, const sf_route_table_t *rt, const sf_expiry_key_t *k) {
+    /* Sweeping costs the entries it visits; at least as many pushes came since the last one. */
+    if (x->len == x->cap && x->len >= 2 * sf_route_table_count(rt)) sweep(x, rt);
+    if (x->len == x->cap && grow(x) != 0) return -1;
+    x->ring[(x->head + x->len) & (x->cap - 1)] = *k;
+    x->len++;
+    return 0;
+}
+
+int sf_expiry_push(sf_expiry_t *x, const sf_route_table_t *rt, const sf_route_entry_t *e) {
+    if (!x->ttl_ms || e->last_updated_ms == 0) return 0;
+    sf_expiry_key_t k;
+    k.prefix_be = e->prefix_be;
+    k.mask_bits = e->mask_bits;
+    k.stamp_ms = e->last_updated_ms;
+    k.due_ms = e->last_updated_ms + x->ttl_ms;
+    return push_key(x, rt, &k);
+}
+
+typedef struct {
+    sf_expiry_key_t *keys;
+    size_t   n;
+    uint32_t now_ms;
+    uint32_t ttl_ms;
+} index_ctx_t;
+
+static int index_visit(const sf_route_entry_t *e, void *arg) {
+    index_ctx_t *c = (index_ctx_t *)arg;
+    if (e->last_updated_ms == 0) return 0;
+    sf_expiry_key_t *k = &c->keys[c->n++];
+    k->prefix_be = e->prefix_be;
+    k->mask_bits = e->mask_bits;
+    k->stamp_ms = e->last_updated_ms;
+    uint32_t from = time_reached(c->now_ms, e->last_updated_ms) ? e->last_updated_ms : c->now_ms;
+    k->due_ms = from + c->ttl_ms;
+    return 0;
+}
+
+static uint32_t g_sort_now;
+
+static int by_due(const void *a, const void *b) {
+    /* Relative to now, so that the order survives the 32-bit wrap. */
+    uint32_t da = ((const sf_expiry_key_t *)a)->due_ms - g_sort_now;
+    uint32_t db = ((const sf_expiry_key_t *)b)->due_ms - g_sort_now;
+    return (int32_t)da < (int32_t)db ? -1 : (int32_t)da > (int32_t)db;
+}
+
+int sf_expiry_index_table(sf_expiry_t *x, const sf_route_table_t *rt, uint32_t now_ms) {
+    sf_expiry_free(x);
+    if (!x->ttl_ms) return 0;
+    size_t n = sf_route_table_count(rt);
+    size_t cap = 1024;
+    while (cap < n) cap *= 2;
+    index_ctx_t c = {NULL, 0, now_ms, x->ttl_ms};
+    c.keys = (sf_expiry_key_t *)malloc(cap * sizeof(*c.keys));
+    if (!c.keys) return -1;
+    sf_route_table_foreach(rt, index_visit, &c);
+    /* Once, at startup or on enabling: every later push is already in order. */
+    g_sort_now = now_ms;
+    qsort(c.keys, c.n, sizeof(*c.keys), by_due);
+    x->ring = c.keys;
+    x->cap = cap;
+    x->head = 0;
+    x->len = c.n;
+    return 0;
+}
+
+int sf_expiry_due(const sf_expiry_t *x, uint32_t now_ms) {
+    return x->len && time_reached(now_ms, x->ring[x->head].due_ms);
+}
+
+size_t sf_expiry_pop_due(sf_expiry_t *x, uint32_t now_ms, sf_expiry_key_t *out, size_t max) {
+    size_t n = 0;
+    while (n < max && sf_expiry_due(x, now_ms)) {
+        out[n++] = x->ring[x->head];
+        x->head = (x->head + 1) & (x->cap - 1);
+        x->len--;
+    }
+    return n;
+}
+
+/* Ticker thread. */
+
+static struct {
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;
+    pthread_t       thread;
+    int             running;
+    int             stop;
+    uint32_t        interval_ms;
+    void          (*tick)(uint32_t now_ms);
+} g_ticker = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, NULL};
+
+static void *ticker_main(void *arg) {
+    (void)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    pthread_mutex_lock(&g_ticker.mu);
+    while (!g_ticker.stop) {
+        next.tv_nsec += (long)(g_ticker.interval_ms % 1000u) * 1000000L;
+        next.tv_sec += g_ticker.interval_ms / 1000u + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        while (!g_ticker.stop && pthread_cond_timedwait(&g_ticker.cv, &g_ticker.mu, &next) == 0) {
+        }
+        if (g_ticker.stop) break;
+        pthread_mutex_unlock(&g_ticker.mu);
+        g_ticker.tick(sf_expiry_now_ms());
+        pthread_mutex_lock(&g_ticker.mu);
+    }
+    pthread_mutex_unlock(&g_ticker.mu);
+    return NULL;
+}
+
+int sf_expiry_ticker_start(uint32_t interval_ms, void (*tick)(uint32_t now_ms)) {
+    if (!tick || !interval_ms || g_ticker.running) return -1;
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&g_ticker.cv);
+    pthread_cond_init(&g_ticker.cv, &ca);
+    pthread_condattr_destroy(&ca);
+    g_ticker.interval_ms = interval_ms;
+    g_ticker.tick = tick;
+    g_ticker.stop = 0;
+    if (pthread_create(&g_ticker.thread, NULL, ticker_main, NULL) != 0) return -1;
+    g_ticker.running = 1;
+    return 0;
+}
+
+void sf_expiry_ticker_stop(void) {
+    if (!g_ticker.running) return;
+    pthread_mutex_lock(&g_ticker.mu);
+    g_ticker.stop = 1;
+    pthread_cond_signal(&g_ticker.cv);
+    pthread_mutex_unlock(&g_ticker.mu);
+    pthread_join(g_ticker.thread, NULL);
+    g_ticker.running = 0;
+}
+
+static sf_route_entry_t test_route(uint32_t prefix, uint32_t stamp) {
+    sf_route_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.prefix_be = htonl(prefix);
+    e.mask_bits = 24;
+    e.last_updated_ms = stamp;
+    return e;
+}
+
+static _Atomic int g_test_ticks;
+
+static void test_tick(uint32_t now_ms) {
+    (void)now_ms;
+    g_test_ticks++;
+}
+
+int sf_expiry_self_test(void) {
+    sf_expiry_t x;
+    sf_expiry_key_t out[8];
+    sf_route_table_t rt;
+    sf_route_table_init(&rt);
+    sf_expiry_init(&x, 100);
+
+    /* Static routes are not indexed; due entries come out oldest first, across the 2^32 wrap. */
+    sf_route_entry_t e = test_route(0x0A000000u, 0);
+    if (sf_route_table_upsert(&rt, &e) != 0 || sf_expiry_push(&x, &rt, &e) != 0 || x.len != 0) return -1;
+    uint32_t t0 = 0xFFFFFFC0u;
+    for (uint32_t i = 0; i < 3000; ++i) {
+        e = test_route(0x0A000000u + (i << 8), t0 + i);
+        if (sf_route_table_upsert(&rt, &e) != 0 || sf_expiry_push(&x, &rt, &e) != 0) return -1;
+    }
+    if (sf_expiry_due(&x, t0 + 99)) return -1;
+    if (sf_expiry_pop_due(&x, t0 + 104, out, 8) != 5) return -1;
+    if (out[0].stamp_ms != t0 || out[4].due_ms != t0 + 104 || out[4].prefix_be != htonl(0x0A000400u)) return -1;
+    size_t left = x.len, got;
+    while ((got = sf_expiry_pop_due(&x, t0 + 3099, out, 8)) != 0) left -= got;
+    if (left != 0 || x.len != 0) return -1;
+    sf_expiry_free(&x);
+    sf_route_table_free(&rt);
+
+    /* Routes refreshed over and over keep the index near the table's size;
+       what is swept out is only what no longer matches. */
+    sf_route_table_init(&rt);
+    sf_expiry_init(&x, 100000);
+    for (uint32_t i = 0; i < 200000; ++i) {
+        e = test_route(0x0C000000u + ((i % 100) << 8), 1 + i);
+        if (sf_route_table_upsert(&rt, &e) != 0 || sf_expiry_push(&x, &rt, &e) != 0) return -1;
+    }
+    if (x.cap > 1024 || x.len < 100) return -1;
+    left = 0;
+    while ((got = sf_expiry_pop_due(&x, 300000, out, 8)) != 0) {
+        for (size_t i = 0; i < got; ++i) {
+            const sf_route_entry_t *r = sf_route_table_get(&rt, out[i].prefix_be, out[i].mask_bits);
+            left += r && r->last_updated_ms == out[i].stamp_ms;
+        }
+    }
+    if (left != 100) return -1;
+    sf_expiry_free(&x);
+    sf_route_table_free(&rt);
+
+    /* Indexing a table sorts by due time; a stamp from the future counts as now. */
+    sf_route_table_init(&rt);
+    uint32_t stamps[4] = {500, 0, 300, 9000};
+    for (uint32_t i = 0; i < 4; ++i) {
+        e = test_route(0x0B000000u + (i << 8), stamps[i]);
+        if (sf_route_table_upsert(&rt, &e) != 0) return -1;
+    }
+    sf_expiry_init(&x, 100);
+    if (sf_expiry_index_table(&x, &rt, 1000) != 0 || x.len != 3) return -1;
+    if (sf_expiry_pop_due(&x, 1099, out, 8) != 2) return -1;
+    if (out[0].stamp_ms != 300 || out[1].stamp_ms != 500) return -1;
+    if (sf_expiry_pop_due(&x, 1100, out, 8) != 1 || out[0].stamp_ms != 9000) return -1;
+    sf_expiry_free(&x);
+    sf_route_table_free(&rt);
+
+    if (sf_expiry_ticker_start(1, test_tick) != 0) return -1;
+    struct timespec ts = {0, 20 * 1000000L};
+    while (g_test_ticks < 3) nanosleep(&ts, NULL);
+    sf_expiry_ticker_stop();
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include "sf_fib.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Group routes are kept under this flag instead of SF_ROUTE_F_GROUP, so the
+   FIB's own (empty) next-hop table never has to know the groups. */
+#define FIB_F_GROUP 0x80u
+
+static uint32_t mask_from_bits(uint8_t bits) {
+    if (bits == 0) return 0u;
+    if (bits >= 32) return 0xFFFFFFFFu;
+    return 0xFFFFFFFFu << (32 - bits);
+}
+
+/* Whether a strictly contains e. */
+static int covers(const sf_route_entry_t *a, const sf_route_entry_t *e) {
+    return a->mask_bits < e->mask_bits && (ntohl(e->prefix_be) & mask_from_bits(a->mask_bits)) == ntohl(a->prefix_be);
+}
+
+/* Whether e forwards like p, its nearest covering route (NULL: none). */
+static int redundant(const sf_route_entry_t *e, const sf_route_entry_t *p) {
+    return p && p->next_hop_be == e->next_hop_be && (p->flags & SF_ROUTE_F_GROUP) == (e->flags & SF_ROUTE_F_GROUP);
+}
+
+static sf_route_entry_t to_fib(const sf_route_entry_t *e) {
+    sf_route_entry_t c = *e;
+    c.flags = (uint8_t)((e->flags & ~SF_ROUTE_F_GROUP) | ((e->flags & SF_ROUTE_F_GROUP) ? FIB_F_GROUP : 0));
+    return c;
+}
+
+void sf_fib_init(sf_fib_t *f) {
+    if (!f) return;
+    sf_route_table_init(&f->table);
+}
+
+void sf_fib_free(sf_fib_t *f) {
+    if (!f) return;
+    sf_route_table_free(&f->table);
+}
+
+size_t sf_fib_count(const sf_fib_t *f) {
+    return f ? sf_route_table_count(&f->table) : 0;
+}
+
+typedef struct {
+    sf_route_entry_t       *out;
+    size_t                  n;
+    const sf_route_entry_t *stack[33];  /* the chain of routes containing the current one */
+    size_t                  depth;
+} build_cursor_t;
+
+static int build_visit(const sf_route_entry_t *e, void *ctx) {
+    build_cursor_t *b = (build_cursor_t *)ctx;
+    /* Routes come in (prefix, length) order: every container precedes what it contains. */
+    while (b->depth && !covers(b->stack[b->depth - 1], e)) b->depth--;
+    if (!redundant(e, b->depth ? b->stack[b->depth - 1] : NULL)) b->out[b->n++] = to_fib(e);
+    b->stack[b->depth++] = e;
+    return 0;
+}
+
+int sf_fib_build(sf_fib_t *f, const sf_route_table_t *rib) {
+    if (!f || !rib) return -1;
+    size_t n = sf_route_table_count(rib);
+    build_cursor_t b;
+    b.out = (sf_route_entry_t *)malloc((n ? n : 1) * sizeof(*b.out));
+    b.n = 0;
+    b.depth = 0;
+    if (!b.out) return -1;
+    sf_route_table_foreach(rib, build_visit, &b);
+    sf_route_table_t t;
+    sf_route_table_init(&t);
+    int rc = b.n ? sf_route_table_build(&t, b.out, b.n) : 0;
+    free(b.out);
+    if (rc < 0) {
+        sf_route_table_free(&t);
+        return -1;
+    }
+    sf_route_table_free(&f->table);
+    f->table = t;
+    return 0;
+}
+
+/* Installs or drops RIB route e given its nearest covering RIB route p. */
+static int place(sf_fib_t *f, const sf_route_entry_t *e, const sf_route_entry_t *p) {
+    if (redundant(e, p)) {
+        sf_route_table_remove(&f->table, e->prefix_be, e->mask_bits);
+        return 0;
+    }
+    sf_route_entry_t c = to_fib(e);
+    const sf_route_entry_t *have = sf_route_table_get(&f->table, c.prefix_be, c.mask_bits);
+    if (have && have->next_hop_be == c.next_hop_be && have->flags == c.flags && have->metric == c.metric &&
+        have->last_updated_ms == c.last_updated_ms) {
+        return 0;
+    }
+    return sf_route_table_upsert(&f->table, &c);
+}
+
+static int last_visit(const sf_route_entry_t *e, void *ctx) {
+    *(const sf_route_entry_t **)ctx = e;
+    return 0;
+}
+
+typedef struct {
+    sf_fib_t               *f;
+    const sf_route_entry_t *parent;
+    int                     rc;
+} child_cursor_t;
+
+static int child_visit(const sf_route_entry_t *e, void *ctx) {
+    child_cursor_t *c = (child_cursor_t *)ctx;
+    if (place(c->f, e, c->parent) != 0) {
+        c->rc = -1;
+        return 1;
+    }
+    return 0;
+}
+
+int sf_fib_update(sf_fib_t *f, const sf_route_table_t *rib, uint32_t prefix_be, uint8_t mask_bits) {
+    if (!f || !rib || mask_bits > 32) return -1;
+    const sf_route_entry_t *parent = NULL;
+    if (mask_bits) sf_route_table_foreach_covering(rib, prefix_be, (uint8_t)(mask_bits - 1), last_visit, &parent);
+    const sf_route_entry_t *e = sf_route_table_get(rib, prefix_be, mask_bits);
+    if (e) {
+        if (place(f, e, parent) != 0) return -1;
+        parent = e;
+    } else {
+        sf_route_table_remove(&f->table, prefix_be, mask_bits);
+    }
+    /* The routes directly inside now hang off e, or off e's parent once e is gone. */
+    child_cursor_t c = {f, parent, 0};
+    sf_route_table_foreach_children(rib, prefix_be, mask_bits, child_visit, &c);
+    return c.rc;
+}
+
+int sf_fib_lookup(const sf_fib_t *f, uint32_t ip_be, sf_route_entry_t *out_best) {
+    if (!f || !out_best) return -1;
+    int r = sf_route_table_lookup(&f->table, ip_be, out_best);
+    if (r == 0 && (out_best->flags & FIB_F_GROUP)) {
+        out_best->flags = (uint8_t)((out_best->flags & ~FIB_F_GROUP) | SF_ROUTE_F_GROUP);
+    }
+    return r;
+}
+
+/* FIB and RIB forward every address in 10.0.0.0/12 alike. */
+static int forwards_alike(const sf_fib_t *f, const sf_route_table_t *rib, uint32_t *seed) {
+    sf_route_entry_t a, b;
+    for (int i = 0; i < 4000; ++i) {
+        *seed = *seed * 1103515245u + 12345u;
+        uint32_t ip = htonl(0x0A000000u | (*seed & 0x000FFFFFu));
+        int ra = sf_route_table_lookup(rib, ip, &a);
+        int rb = sf_fib_lookup(f, ip, &b);
+        if (ra != rb) return 0;
+        if (ra == 0 && (a.next_hop_be != b.next_hop_be || (a.flags & SF_ROUTE_F_GROUP) != (b.flags & SF_ROUTE_F_GROUP))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int sf_fib_self_test(void) {
+    sf_route_table_t rib;
+    sf_fib_t fib;
+    sf_route_table_init(&rib);
+    sf_fib_init(&fib);
+
+    /* 10/8 -> A covers 10.1/16 -> A (redundant) and 10.1.2/24 -> B. */
+    sf_route_entry_t r[3];
+    memset(r, 0, sizeof(r));
+    r[0].prefix_be = htonl(0x0A000000u);
+    r[0].mask_bits = 8;
+    r[0].next_hop_be = htonl(0xC0A80001u);
+    r[1].prefix_be = htonl(0x0A010000u);
+    r[1].mask_bits = 16;
+    r[1].next_hop_be = r[0].next_hop_be;
+    r[2].prefix_be = htonl(0x0A010200u);
+    r[2].mask_bits = 24;
+    r[2].next_hop_be = htonl(0xC0A80002u);
+    for (int i = 0; i < 3; ++i) {
+        if (sf_route_table_upsert(&rib, &r[i]) != 0 || sf_fib_update(&fib, &rib, r[i].prefix_be, r[i].mask_bits) != 0) {
+            return -1;
+        }
+    }
+    if (sf_fib_count(&fib) != 2 || sf_route_table_get(&fib.table, r[1].prefix_be, 16)) return -1;
+    /* Withdrawing the aggregate brings back the route it stood in for. */
+    if (sf_route_table_remove(&rib, r[0].prefix_be, 8) != 0 || sf_fib_update(&fib, &rib, r[0].prefix_be, 8) != 0) return -1;
+    if (sf_fib_count(&fib) != 2 || !sf_route_table_get(&fib.table, r[1].prefix_be, 16)) return -1;
+    sf_route_entry_t best;
+    if (sf_fib_lookup(&fib, htonl(0x0A010909u), &best) != 0 || best.next_hop_be != r[0].next_hop_be) return -1;
+    if (sf_fib_lookup(&fib, htonl(0x0A020000u), &best) != -1) return -1;
+    /* A group and a plain next hop with the same value do not merge. */
+    sf_nh_member_t m[2] = {{htonl(0xC0A80001u), 1, 0}, {htonl(0xC0A80002u), 1, 0}};
+    uint32_t gid = 0;
+    int created = 0;
+    if (sf_nh_define(&rib.nh, m, 2, &gid, &created) != 0) return -1;
+    r[2].next_hop_be = htonl(gid);
+    r[2].flags = SF_ROUTE_F_GROUP;
+    r[1].next_hop_be = htonl(gid);
+    if (sf_route_table_upsert(&rib, &r[1]) != 0 || sf_fib_update(&fib, &rib, r[1].prefix_be, 16) != 0) return -1;
+    if (sf_route_table_upsert(&rib, &r[2]) != 0 || sf_fib_update(&fib, &rib, r[2].prefix_be, 24) != 0) return -1;
+    if (sf_fib_count(&fib) != 2) return -1;
+    if (sf_fib_lookup(&fib, htonl(0x0A010203u), &best) != 0 || !(best.flags & SF_ROUTE_F_GROUP)) return -1;
+    sf_route_table_free(&rib);
+    sf_fib_free(&fib);
+
+    /* Random nested routes over three next hops and a group, changed one at
+       a time: the FIB forwards like the RIB throughout, is smaller, and is
+       the FIB a rebuild from scratch gives. */
+    enum { N = 3000 };
+    uint32_t seed = 4242u;
+    sf_route_table_init(&rib);
+    sf_fib_init(&fib);
+    if (sf_nh_define(&rib.nh, m, 2, &gid, &created) != 0) return -1;
+    for (int i = 0; i < N; ++i) {
+        sf_route_entry_t e;
+        memset(&e, 0, sizeof(e));
+        seed = seed * 1103515245u + 12345u;
+        e.mask_bits = (uint8_t)(8 + (seed >> 16) % 17u);
+        seed = seed * 1103515245u + 12345u;
+        e.prefix_be = htonl((0x0A000000u | (seed & 0x000FFFFFu)) & mask_from_bits(e.mask_bits));
+        uint32_t pick = (seed >> 24) % 4u;
+        e.next_hop_be = pick == 3 ? htonl(gid) : htonl(pick);
+        e.flags = pick == 3 ? SF_ROUTE_F_GROUP : 0;
+        if (i % 4 == 3 && sf_route_table_get(&rib, e.prefix_be, e.mask_bits)) {
+            if (sf_route_table_remove(&rib, e.prefix_be, e.mask_bits) != 0) return -1;
+        } else if (sf_route_table_upsert(&rib, &e) != 0) {
+            return -1;
+        }
+        if (sf_fib_update(&fib, &rib, e.prefix_be, e.mask_bits) != 0) return -1;
+        if (i % 500 == 499 && !forwards_alike(&fib, &rib, &seed)) return -1;
+    }
+    if (!forwards_alike(&fib, &rib, &seed)) return -1;
+    if (sf_fib_count(&fib) >= sf_route_table_count(&rib)) return -1;
+    sf_fib_t fresh;
+    sf_fib_init(&fresh);
+    if (sf_fib_build(&fresh, &rib) != 0 || sf_fib_count(&fresh) != sf_fib_count(&fib)) return -1;
+    if (!forwards_alike(&fresh, &rib, &seed)) return -1;
+    sf_fib_free(&fresh);
+    sf_route_table_free(&rib);
+    sf_fib_free(&fib);
+    return 0;
+}
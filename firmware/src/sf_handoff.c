@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include "sf_handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SF_HANDOFF_MAGIC   0x53464830u /* "SFH0" */
+#define SF_HANDOFF_VERSION 1u
+#define SF_HANDOFF_ACK     'K'
+#define SF_HANDOFF_TIMEOUT_S 5
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nfds;       /* listeners; the state fd follows them in SCM_RIGHTS */
+    uint32_t reserved;
+} sf_handoff_hello_t;
+
+static int fill_addr(const char *path, struct sockaddr_un *addr) {
+    if (!path || strlen(path) >= sizeof(addr->sun_path)) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static void set_timeouts(int fd) {
+    struct timeval tv = {SF_HANDOFF_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int sf_handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_addr(path, &addr) != 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int sf_handoff_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_addr(path, &addr) != 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+int sf_handoff_send(int conn_fd, const int *listen_fds, unsigned nfds, int state_fd) {
+    if (conn_fd < 0 || !listen_fds || nfds == 0 || nfds > SF_HANDOFF_MAX_FDS || state_fd < 0) return -1;
+
+    int flags = fcntl(conn_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(conn_fd, F_SETFL, flags & ~O_NONBLOCK);
+    set_timeouts(conn_fd);
+
+    sf_handoff_hello_t hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = SF_HANDOFF_MAGIC;
+    hello.version = SF_HANDOFF_VERSION;
+    hello.nfds = nfds;
+
+    int fds[SF_HANDOFF_MAX_FDS + 1];
+    memcpy(fds, listen_fds, nfds * sizeof(int));
+    fds[nfds] = state_fd;
+
+    union {
+        char           buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec iov = {&hello, sizeof(hello)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE((nfds + 1) * sizeof(int));
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN((nfds + 1) * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, (nfds + 1) * sizeof(int));
+
+    ssize_t sent = sendmsg(conn_fd, &msg, MSG_NOSIGNAL);
+    if (sent != (ssize_t)sizeof(hello)) return -1;
+
+    char ack = 0;
+    ssize_t r;
+    do {
+        r = read(conn_fd, &ack, 1);
+    } while (r < 0 && errno == EINTR);
+    return (r == 1 && ack == SF_HANDOFF_ACK) ? 0 : -1;
+}
+
+static void close_fds(const int *fds, size_t n) {
+    for (size_t i = 0; i < n; ++i) close(fds[i]);
+}
+
+int sf_handoff_receive(int conn_fd, sf_handoff_state_t *out) {
+    if (conn_fd < 0 || !out) return -1;
+    memset(out, 0, sizeof(*out));
+
+    sf_handoff_hello_t hello;
+    union {
+        char           buf[CMSG_SPACE((SF_HANDOFF_MAX_FDS + 1) * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = {&hello, sizeof(hello)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t r;
+    do {
+        r = recvmsg(conn_fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (r < 0 && errno == EINTR);
+
+    int fds[SF_HANDOFF_MAX_FDS + 1];
+    size_t nrecv = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (n > SF_HANDOFF_MAX_FDS + 1 - nrecv) n = SF_HANDOFF_MAX_FDS + 1 - nrecv;
+        memcpy(fds + nrecv, CMSG_DATA(cm), n * sizeof(int));
+        nrecv += n;
+    }
+
+    if (r != (ssize_t)sizeof(hello) || (msg.msg_flags & MSG_CTRUNC) || hello.magic != SF_HANDOFF_MAGIC ||
+        hello.version != SF_HANDOFF_VERSION || hello.nfds == 0 || nrecv != (size_t)hello.nfds + 1) {
+        close_fds(fds, nrecv);
+        return -1;
+    }
+    memcpy(out->listen_fds, fds, hello.nfds * sizeof(int));
+    out->nfds = hello.nfds;
+    out->state_fd = fds[hello.nfds];
+    return 0;
+}
+
+int sf_handoff_ack(int conn_fd) {
+    char ack = SF_HANDOFF_ACK;
+    return write_all(conn_fd, &ack, 1);
+}
+
+typedef struct {
+    int fd;
+    int listen_fds[2];
+    int state_fd;
+    int result;
+} handoff_test_t;
+
+static void *handoff_test_sender(void *arg) {
+    handoff_test_t *t = (handoff_test_t *)arg;
+    t->result = sf_handoff_send(t->fd, t->listen_fds, 2, t->state_fd);
+    return NULL;
+}
+
+int sf_handoff_self_test(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return -1;
+
+    static handoff_test_t t;
+    memset(&t, 0, sizeof(t));
+    t.fd = sv[0];
+    t.result = -1;
+    for (int i = 0; i < 2; ++i) t.listen_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+    t.state_fd = memfd_create("sf-handoff-test", MFD_CLOEXEC);
+    if (t.state_fd < 0 || write_all(t.state_fd, "state", 5) != 0) return -1;
+
+    int ok = 0;
+    pthread_t th;
+    if (pthread_create(&th, NULL, handoff_test_sender, &t) == 0) {
+        sf_handoff_state_t st;
+        if (sf_handoff_receive(sv[1], &st) == 0) {
+            char buf[8] = {0};
+            ok = st.nfds == 2 && pread(st.state_fd, buf, sizeof(buf), 0) == 5 && memcmp(buf, "state", 5) == 0;
+            close(st.state_fd);
+            /* Received descriptors are new fds for the same sockets. */
+            for (unsigned i = 0; i < st.nfds; ++i) {
+                int type = 0;
+                socklen_t len = sizeof(type);
+                if (getsockopt(st.listen_fds[i], SOL_SOCKET, SO_TYPE, &type, &len) != 0 || type != SOCK_STREAM) ok = 0;
+                if (st.listen_fds[i] == t.listen_fds[i]) ok = 0;
+                close(st.listen_fds[i]);
+            }
+            sf_handoff_ack(sv[1]);
+        }
+        pthread_join(th, NULL);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    for (int i = 0; i < 2; ++i) close(t.listen_fds[i]);
+    close(t.state_fd);
+    return (ok && t.result == 0) ? 0 : -1;
+}
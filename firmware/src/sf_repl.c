@@ -0,0 +1,916 @@
+#define _GNU_SOURCE
+
+#include "sf_repl.h"
+#include "sf_commands.h"
+#include "sf_protocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SF_REPL_FRAME_MAX (SF_PROTO_HEADER_LEN + SF_REPL_MAX_PAYLOAD)
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    uint32_t be = htonl(v);
+    memcpy(p, &be, 4);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t be;
+    memcpy(&be, p, 4);
+    return ntohl(be);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)(v >> 32));
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static uint32_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+/* Delta codec. */
+
+static size_t put_varint(uint8_t *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *out) {
+    uint32_t v = 0;
+    for (unsigned shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t zigzag(uint32_t diff) {
+    int32_t d = (int32_t)diff;
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static uint32_t unzigzag(uint32_t z) {
+    return (z >> 1) ^ (0u - (z & 1u));
+}
+
+size_t sf_repl_encode_routes(const sf_route_entry_t *e, size_t n, uint8_t *out, size_t cap, size_t *encoded) {
+    uint32_t prefix = 0, next_hop = 0, metric = 0;
+    size_t len = 0, i = 0;
+    for (; i < n && cap - len >= SF_REPL_MAX_RECORD; ++i) {
+        uint32_t p = ntohl(e[i].prefix_be), h = ntohl(e[i].next_hop_be), m = e[i].metric;
+        out[len++] = (uint8_t)(e[i].mask_bits | ((e[i].flags & SF_ROUTE_F_GROUP) ? SF_REPL_GROUP_BIT : 0));
+        len += put_varint(out + len, zigzag(p - prefix));
+        len += put_varint(out + len, zigzag(h - next_hop));
+        len += put_varint(out + len, zigzag(m - metric));
+        prefix = p;
+        next_hop = h;
+        metric = m;
+    }
+    if (encoded) *encoded = i;
+    return len;
+}
+
+int sf_repl_decode_routes(const uint8_t *in, size_t len, uint32_t count, sf_route_entry_t *out) {
+    const uint8_t *p = in, *end = in + len;
+    uint32_t prefix = 0, next_hop = 0, metric = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t dp, dh, dm;
+        if (p >= end || (*p & ~SF_REPL_GROUP_BIT) > 32) return -1;
+        uint8_t bits = *p & (uint8_t)~SF_REPL_GROUP_BIT;
+        uint8_t flags = (*p++ & SF_REPL_GROUP_BIT) ? SF_ROUTE_F_GROUP : 0;
+        if (!(p = get_varint(p, end, &dp)) || !(p = get_varint(p, end, &dh)) || !(p = get_varint(p, end, &dm))) {
+            return -1;
+        }
+        prefix += unzigzag(dp);
+        next_hop += unzigzag(dh);
+        metric += unzigzag(dm);
+        if (metric > 0xFFFFu) return -1;
+        memset(&out[i], 0, sizeof(out[i]));
+        out[i].prefix_be = htonl(prefix);
+        out[i].mask_bits = bits;
+        out[i].flags = flags;
+        out[i].metric = (uint16_t)metric;
+        out[i].next_hop_be = htonl(next_hop);
+    }
+    return p == end ? 0 : -1;
+}
+
+/* Splits one batch into REPL_BATCH frames and hands each to emit. */
+typedef int (*emit_fn)(const uint8_t *frame, size_t len, void *ctx);
+
+static int encode_batch(uint64_t origin, uint64_t seq, uint8_t op, uint8_t first_flags, const sf_route_entry_t *e,
+                        size_t n, emit_fn emit, void *ctx) {
+    uint8_t payload[SF_REPL_MAX_PAYLOAD];
+    uint8_t frame[SF_REPL_FRAME_MAX];
+    size_t i = 0;
+    uint8_t flags = first_flags;
+    do {
+        size_t k = 0;
+        size_t len = sf_repl_encode_routes(e + i, n - i, payload + SF_REPL_HEADER_LEN,
+                                           sizeof(payload) - SF_REPL_HEADER_LEN, &k);
+        i += k;
+        if (i < n) flags |= SF_REPL_MORE;
+        put_u64(payload, origin);
+        put_u64(payload + 8, seq);
+        payload[16] = op;
+        payload[17] = flags;
+        payload[18] = payload[19] = 0;
+        put_u32(payload + 20, (uint32_t)k);
+
+        sf_frame_t f;
+        memset(&f, 0, sizeof(f));
+        f.version = SF_PROTO_VERSION;
+        f.type = SF_MSG_REPL_BATCH;
+        size_t frame_len = 0;
+        if (sf_proto_encode(frame, sizeof(frame), &f, payload, SF_REPL_HEADER_LEN + len, &frame_len) != 0) return -1;
+        if (emit(frame, frame_len, ctx) != 0) return -1;
+        flags = 0;
+    } while (i < n);
+    return 0;
+}
+
+/* Leader: a ring of encoded frames. Offsets are absolute byte counts; tail is
+   always at a frame boundary and head - tail <= cap. */
+
+static struct {
+    pthread_mutex_t   mu;
+    uint8_t          *buf;
+    size_t            cap;
+    uint64_t          head;
+    uint64_t          tail;
+    uint64_t          last_seq;  /* last batch published */
+    uint64_t          origin;    /* this process's stream; followers of another one start over */
+    sf_repl_sub_t    *parked;
+    sf_repl_export_fn export_routes;
+    atomic_int        on;
+} g_lead = {
+    .mu = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Atomic uint64_t g_resyncs;
+
+static void ring_read(uint64_t off, uint8_t *dst, size_t len) {
+    size_t pos = (size_t)(off % g_lead.cap);
+    size_t first = g_lead.cap - pos < len ? g_lead.cap - pos : len;
+    memcpy(dst, g_lead.buf + pos, first);
+    memcpy(dst + first, g_lead.buf, len - first);
+}
+
+static void ring_write(uint64_t off, const uint8_t *src, size_t len) {
+    size_t pos = (size_t)(off % g_lead.cap);
+    size_t first = g_lead.cap - pos < len ? g_lead.cap - pos : len;
+    memcpy(g_lead.buf + pos, src, first);
+    memcpy(g_lead.buf, src + first, len - first);
+}
+
+static size_t ring_frame_len(uint64_t off) {
+    uint8_t h[SF_PROTO_HEADER_LEN];
+    ring_read(off, h, sizeof(h));
+    return SF_PROTO_HEADER_LEN + get_u32(h + 12);
+}
+
+static uint64_t ring_frame_seq(uint64_t off) {
+    uint8_t h[SF_PROTO_HEADER_LEN + 16];
+    ring_read(off, h, sizeof(h));
+    return get_u64(h + SF_PROTO_HEADER_LEN + 8);
+}
+
+static int ring_append(const uint8_t *frame, size_t len, void *ctx) {
+    (void)ctx;
+    while (g_lead.head + len - g_lead.tail > g_lead.cap) g_lead.tail += ring_frame_len(g_lead.tail);
+    ring_write(g_lead.head, frame, len);
+    g_lead.head += len;
+    return 0;
+}
+
+/* Where the first batch after seq starts; -1 if the backlog no longer has it. */
+static int ring_find(uint64_t seq, uint64_t *cursor) {
+    if (seq >= g_lead.last_seq) {
+        *cursor = g_lead.head;
+        return 0;
+    }
+    for (uint64_t off = g_lead.tail; off < g_lead.head; off += ring_frame_len(off)) {
+        uint64_t s = ring_frame_seq(off);
+        if (s <= seq) continue;
+        if (s != seq + 1) return -1;
+        *cursor = off;
+        return 0;
+    }
+    return -1;
+}
+
+static uint64_t new_origin(void) {
+    uint64_t o = 0;
+    if (getrandom(&o, sizeof(o), 0) != (ssize_t)sizeof(o)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        o = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+    }
+    return o ? o : 1;
+}
+
+int sf_repl_leader_init(const sf_repl_leader_config_t *cfg) {
+    if (!cfg || atomic_load(&g_lead.on)) return -1;
+    if (!cfg->backlog_bytes) return 0;
+    if (!cfg->export_routes || cfg->backlog_bytes < 2 * SF_REPL_FRAME_MAX) return -1;
+    uint8_t *buf = (uint8_t *)malloc(cfg->backlog_bytes);
+    if (!buf) return -1;
+    pthread_mutex_lock(&g_lead.mu);
+    g_lead.buf = buf;
+    g_lead.cap = cfg->backlog_bytes;
+    g_lead.head = g_lead.tail = 0;
+    g_lead.last_seq = 0;
+    g_lead.origin = new_origin();
+    g_lead.parked = NULL;
+    g_lead.export_routes = cfg->export_routes;
+    atomic_store(&g_lead.on, 1);
+    pthread_mutex_unlock(&g_lead.mu);
+    return 0;
+}
+
+void sf_repl_leader_shutdown(void) {
+    pthread_mutex_lock(&g_lead.mu);
+    atomic_store(&g_lead.on, 0);
+    free(g_lead.buf);
+    g_lead.buf = NULL;
+    g_lead.cap = 0;
+    g_lead.parked = NULL;
+    pthread_mutex_unlock(&g_lead.mu);
+}
+
+int sf_repl_leading(void) {
+    return atomic_load(&g_lead.on);
+}
+
+void sf_repl_publish(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    if (!atomic_load_explicit(&g_lead.on, memory_order_relaxed)) return;
+    pthread_mutex_lock(&g_lead.mu);
+    if (g_lead.buf) {
+        if (op == SF_REPL_OP_RESET) {
+            /* Subscribers of the old stream are woken below and told to
+               resubscribe by their next read. */
+            g_lead.origin = new_origin();
+            g_lead.tail = g_lead.head;
+        } else {
+            encode_batch(g_lead.origin, seq, (uint8_t)op, 0, entries, n, ring_append, NULL);
+        }
+        g_lead.last_seq = seq;
+        for (sf_repl_sub_t *s = g_lead.parked; s; s = s->next_parked) {
+            sf_task_t *t = s->parked;
+            s->parked = NULL;
+            sf_cq_post(t->cq, t);
+        }
+        g_lead.parked = NULL;
+    }
+    pthread_mutex_unlock(&g_lead.mu);
+}
+
+static int dump_append(const uint8_t *frame, size_t len, void *ctx) {
+    sf_repl_sub_t *s = (sf_repl_sub_t *)ctx;
+    if (s->dump_len + len > s->dump_off) {
+        size_t cap = s->dump_off ? s->dump_off * 2 : 64 * 1024;
+        while (cap < s->dump_len + len) cap *= 2;
+        uint8_t *p = (uint8_t *)realloc(s->dump, cap);
+        if (!p) return -1;
+        s->dump = p;
+        s->dump_off = cap; /* capacity while building; the read offset afterwards */
+    }
+    memcpy(s->dump + s->dump_len, frame, len);
+    s->dump_len += len;
+    return 0;
+}
+
+int sf_repl_subscribe(sf_repl_sub_t *s, uint64_t origin, uint64_t from_seq) {
+    if (!s || !atomic_load(&g_lead.on)) return -1;
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_lock(&g_lead.mu);
+    int resumed = origin == g_lead.origin && from_seq != 0 && from_seq <= g_lead.last_seq &&
+                  ring_find(from_seq, &s->cursor) == 0;
+    uint64_t stream = g_lead.origin;
+    sf_repl_export_fn export_routes = g_lead.export_routes;
+    s->origin = stream;
+    pthread_mutex_unlock(&g_lead.mu);
+    if (resumed) return 0;
+
+    /* Outside the backlog: send the table first, then what followed it. */
+    sf_route_entry_t *entries = NULL;
+    size_t n = 0, groups = 0;
+    uint64_t at = 0;
+    if (export_routes(&entries, &n, &groups, &at) != 0) return -1;
+    int rc = groups ? encode_batch(stream, at, SF_REPL_OP_GROUP, SF_REPL_RESET, entries, groups, dump_append, s) : 0;
+    if (rc == 0) rc = encode_batch(stream, at, SF_REPL_OP_UPSERT, SF_REPL_RESET, entries + groups, n - groups, dump_append, s);
+    free(entries);
+    s->dump_off = 0;
+    if (rc == 0) {
+        pthread_mutex_lock(&g_lead.mu);
+        rc = g_lead.buf && g_lead.origin == stream ? ring_find(at, &s->cursor) : -1;
+        pthread_mutex_unlock(&g_lead.mu);
+    }
+    if (rc != 0) {
+        free(s->dump);
+        memset(s, 0, sizeof(*s));
+        return -1;
+    }
+    atomic_fetch_add_explicit(&g_resyncs, 1, memory_order_relaxed);
+    return 0;
+}
+
+long sf_repl_read(sf_repl_sub_t *s, uint8_t *dst, size_t cap) {
+    size_t copied = 0;
+    while (s->dump && s->dump_off < s->dump_len) {
+        size_t len = SF_PROTO_HEADER_LEN + get_u32(s->dump + s->dump_off + 12);
+        if (len > cap - copied) return (long)copied;
+        memcpy(dst + copied, s->dump + s->dump_off, len);
+        s->dump_off += len;
+        copied += len;
+    }
+    if (s->dump) {
+        free(s->dump);
+        s->dump = NULL;
+        s->dump_len = s->dump_off = 0;
+    }
+
+    pthread_mutex_lock(&g_lead.mu);
+    if (!g_lead.buf || s->cursor < g_lead.tail || s->origin != g_lead.origin) {
+        pthread_mutex_unlock(&g_lead.mu);
+        return -1;
+    }
+    while (s->cursor < g_lead.head) {
+        size_t len = ring_frame_len(s->cursor);
+        if (len > cap - copied) break;
+        ring_read(s->cursor, dst + copied, len);
+        s->cursor += len;
+        copied += len;
+    }
+    pthread_mutex_unlock(&g_lead.mu);
+    return (long)copied;
+}
+
+int sf_repl_park(sf_repl_sub_t *s, sf_task_t *t) {
+    if (!s || !t) return -1;
+    pthread_mutex_lock(&g_lead.mu);
+    int ready = s->dump || !g_lead.buf || s->cursor != g_lead.head;
+    if (!ready && !s->parked) {
+        s->parked = t;
+        s->next_parked = g_lead.parked;
+        g_lead.parked = s;
+    }
+    pthread_mutex_unlock(&g_lead.mu);
+    return ready ? -1 : 0;
+}
+
+int sf_repl_unsubscribe(sf_repl_sub_t *s) {
+    if (!s) return 0;
+    int withdrawn = 0;
+    pthread_mutex_lock(&g_lead.mu);
+    if (s->parked) {
+        for (sf_repl_sub_t **pp = &g_lead.parked; *pp; pp = &(*pp)->next_parked) {
+            if (*pp == s) {
+                *pp = s->next_parked;
+                break;
+            }
+        }
+        s->parked = NULL;
+        withdrawn = 1;
+    }
+    pthread_mutex_unlock(&g_lead.mu);
+    free(s->dump);
+    s->dump = NULL;
+    s->dump_len = s->dump_off = 0;
+    return withdrawn;
+}
+
+uint64_t sf_repl_resyncs(void) {
+    return atomic_load_explicit(&g_resyncs, memory_order_relaxed);
+}
+
+/* Follower: reassembles batches from REPL_BATCH payloads and applies them. */
+
+typedef struct {
+    const sf_repl_follow_config_t *cfg;
+    uint64_t          origin;    /* stream the table follows, 0 before the first full table */
+    uint64_t          applied;   /* last sequence number applied */
+    sf_route_entry_t *pending;
+    size_t            npending;
+    size_t            cap;
+    uint64_t          pending_seq;
+    uint8_t           pending_op;
+    int               partial;   /* parts of pending_seq received, more to come */
+    int               reset;
+    sf_route_table_t  staged;    /* groups of the full table at staged_seq, until its routes arrive */
+    uint64_t          staged_seq;
+} follow_state_t;
+
+/* Returns 1 when a batch was applied, 0 when more parts are needed, -1 when
+   the stream does not continue the table (the follower resubscribes). */
+static int follow_feed(follow_state_t *st, const uint8_t *p, size_t len) {
+    if (len < SF_REPL_HEADER_LEN) return -1;
+    uint64_t origin = get_u64(p), seq = get_u64(p + 8);
+    uint8_t op = p[16], flags = p[17];
+    uint32_t count = get_u32(p + 20);
+    if ((op != SF_REPL_OP_UPSERT && op != SF_REPL_OP_WITHDRAW && op != SF_REPL_OP_GROUP && op != SF_REPL_OP_HELD) ||
+        count > (len - SF_REPL_HEADER_LEN)) {
+        return -1;
+    }
+    if ((flags & SF_REPL_RESET) && (op == SF_REPL_OP_WITHDRAW || op == SF_REPL_OP_HELD)) return -1;
+
+    if (!st->partial) {
+        if (!(flags & SF_REPL_RESET) && (origin != st->origin || seq != st->applied + 1)) return -1;
+        st->npending = 0;
+        st->pending_seq = seq;
+        st->pending_op = op;
+        st->reset = (flags & SF_REPL_RESET) != 0;
+    } else if (seq != st->pending_seq || (flags & SF_REPL_RESET)) {
+        return -1;
+    }
+    if (st->npending + count > st->cap) {
+        size_t cap = st->cap ? st->cap : 1024;
+        while (cap < st->npending + count) cap *= 2;
+        sf_route_entry_t *q = (sf_route_entry_t *)realloc(st->pending, cap * sizeof(*q));
+        if (!q) return -1;
+        st->pending = q;
+        st->cap = cap;
+    }
+    if (sf_repl_decode_routes(p + SF_REPL_HEADER_LEN, len - SF_REPL_HEADER_LEN, count, st->pending + st->npending) != 0) {
+        return -1;
+    }
+    st->npending += count;
+    st->partial = (flags & SF_REPL_MORE) != 0;
+    if (st->partial) return 0;
+
+    uint32_t now = monotonic_ms();
+    for (size_t i = 0; i < st->npending; ++i) st->pending[i].last_updated_ms = now;
+    if (st->reset && st->pending_op == SF_REPL_OP_GROUP) {
+        sf_route_table_free(&st->staged);
+        if (sf_route_table_define_groups(&st->staged, st->pending, st->npending) < 0) return -1;
+        st->staged_seq = seq;
+        return 0;
+    }
+    if (st->reset) {
+        sf_route_table_t rt;
+        sf_route_table_init(&rt);
+        if (st->staged_seq == seq) {
+            rt.nh = st->staged.nh;
+            sf_nh_table_init(&st->staged.nh);
+        }
+        sf_route_table_free(&st->staged);
+        st->staged_seq = 0;
+        if (st->npending && sf_route_table_build(&rt, st->pending, st->npending) < 0) {
+            sf_route_table_free(&rt);
+            return -1;
+        }
+        st->cfg->replace(&rt, seq);
+        sf_route_table_free(&rt);
+        st->origin = origin;
+        atomic_fetch_add_explicit(&g_resyncs, 1, memory_order_relaxed);
+    } else {
+        st->cfg->apply(seq, st->pending_op, st->pending, st->npending);
+    }
+    st->applied = seq;
+    return 1;
+}
+
+static struct {
+    pthread_mutex_t         mu;
+    pthread_cond_t          cv;      /* stop was asked */
+    pthread_t               thread;
+    int                     fd;      /* current leader connection, for stop */
+    int                     stop;
+    sf_repl_follow_config_t cfg;
+    char                    host[256];
+    follow_state_t          st;
+    sf_rxbuf_t              rx;
+    atomic_int              running;
+} g_follow = {
+    .mu = PTHREAD_MUTEX_INITIALIZER,
+    .cv = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+static int send_all(int fd, const uint8_t *p, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int connect_leader(void) {
+    char port[8];
+    snprintf(port, sizeof(port), "%u", (unsigned)g_follow.cfg.port);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(g_follow.host, port, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    /* origin(u64), from_seq(u64) */
+    uint8_t payload[16], frame[SF_PROTO_HEADER_LEN + sizeof(payload)];
+    put_u64(payload, g_follow.st.origin);
+    put_u64(payload + 8, g_follow.st.applied);
+    sf_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.version = SF_PROTO_VERSION;
+    f.type = SF_MSG_REPL_SUBSCRIBE;
+    f.seq = 1;
+    size_t len = 0;
+    if (sf_proto_encode(frame, sizeof(frame), &f, payload, sizeof(payload), &len) != 0 || send_all(fd, frame, len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Applies the stream until the connection drops or it stops continuing the table. */
+static void follow_stream(int fd) {
+    static uint8_t payload[SF_REPL_MAX_PAYLOAD];
+    sf_rxbuf_init(&g_follow.rx);
+    g_follow.st.partial = 0;
+    for (;;) {
+        ssize_t n = recv(fd, g_follow.rx.data + g_follow.rx.len, sizeof(g_follow.rx.data) - g_follow.rx.len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return;
+        }
+        g_follow.rx.len += (size_t)n;
+        for (;;) {
+            sf_frame_t f;
+            size_t len = 0;
+            int r = sf_proto_try_decode(&g_follow.rx, &f, payload, sizeof(payload), &len);
+            if (r < 0) return;
+            if (r == 0) break;
+            if (f.type == SF_MSG_ERROR) {
+                fprintf(stderr, "repl: leader refused: %.*s\n", (int)len, (const char *)payload);
+                return;
+            }
+            if (f.type != SF_MSG_REPL_BATCH) continue;
+            int applied = follow_feed(&g_follow.st, payload, len);
+            if (applied < 0) return;
+            if (applied && g_follow.st.reset) {
+                printf("following %s:%u at sequence %llu (%zu routes)\n", g_follow.host, (unsigned)g_follow.cfg.port,
+                       (unsigned long long)g_follow.st.applied, g_follow.st.npending);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+static void *follow_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_follow.mu);
+    while (!g_follow.stop) {
+        pthread_mutex_unlock(&g_follow.mu);
+        int fd = connect_leader();
+        pthread_mutex_lock(&g_follow.mu);
+        if (fd >= 0) {
+            if (g_follow.stop) {
+                close(fd);
+                break;
+            }
+            g_follow.fd = fd;
+            pthread_mutex_unlock(&g_follow.mu);
+            follow_stream(fd);
+            pthread_mutex_lock(&g_follow.mu);
+            g_follow.fd = -1;
+            close(fd);
+            if (!g_follow.stop) {
+                fprintf(stderr, "repl: lost leader %s:%u at sequence %llu, reconnecting\n", g_follow.host,
+                        (unsigned)g_follow.cfg.port, (unsigned long long)g_follow.st.applied);
+            }
+        }
+        if (g_follow.stop) break;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += (long)(g_follow.cfg.retry_ms % 1000u) * 1000000L;
+        until.tv_sec += g_follow.cfg.retry_ms / 1000u + until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&g_follow.cv, &g_follow.mu, &until);
+    }
+    pthread_mutex_unlock(&g_follow.mu);
+    return NULL;
+}
+
+int sf_repl_follow_start(const sf_repl_follow_config_t *cfg) {
+    if (!cfg || !cfg->host || !cfg->apply || !cfg->replace || atomic_load(&g_follow.running)) return -1;
+    if (strlen(cfg->host) >= sizeof(g_follow.host)) return -1;
+    g_follow.cfg = *cfg;
+    strcpy(g_follow.host, cfg->host);
+    g_follow.cfg.host = g_follow.host;
+    memset(&g_follow.st, 0, sizeof(g_follow.st));
+    g_follow.st.cfg = &g_follow.cfg;
+    g_follow.stop = 0;
+    if (pthread_create(&g_follow.thread, NULL, follow_main, NULL) != 0) return -1;
+    atomic_store(&g_follow.running, 1);
+    return 0;
+}
+
+void sf_repl_follow_stop(void) {
+    if (!atomic_load(&g_follow.running)) return;
+    pthread_mutex_lock(&g_follow.mu);
+    g_follow.stop = 1;
+    if (g_follow.fd >= 0) shutdown(g_follow.fd, SHUT_RDWR);
+    pthread_cond_signal(&g_follow.cv);
+    pthread_mutex_unlock(&g_follow.mu);
+    pthread_join(g_follow.thread, NULL);
+    free(g_follow.st.pending);
+    sf_route_table_free(&g_follow.st.staged);
+    memset(&g_follow.st, 0, sizeof(g_follow.st));
+    atomic_store(&g_follow.running, 0);
+}
+
+int sf_repl_following(void) {
+    return atomic_load(&g_follow.running);
+}
+
+/* Self-test: a leader over a local table and a follower fed by hand. */
+
+static sf_route_table_t g_test_leader;
+static sf_route_table_t g_test_follower;
+static uint64_t g_test_seq;
+
+static int test_collect(const sf_route_entry_t *e, void *ctx) {
+    sf_route_entry_t **cur = (sf_route_entry_t **)ctx;
+    *(*cur)++ = *e;
+    return 0;
+}
+
+static int test_export_all(sf_route_entry_t **out, size_t *n, size_t *groups, uint64_t *seq) {
+    size_t count = sf_route_table_count(&g_test_leader) + sf_route_table_group_records(&g_test_leader, NULL);
+    sf_route_entry_t *e = (sf_route_entry_t *)malloc((count ? count : 1) * sizeof(*e));
+    if (!e) return -1;
+    *groups = sf_route_table_group_records(&g_test_leader, e);
+    sf_route_entry_t *cur = e + *groups;
+    sf_route_table_foreach(&g_test_leader, test_collect, &cur);
+    *out = e;
+    *n = (size_t)(cur - e);
+    *seq = g_test_seq;
+    return 0;
+}
+
+static void test_apply(uint64_t seq, uint32_t op, const sf_route_entry_t *entries, size_t n) {
+    (void)seq;
+    if (op == SF_REPL_OP_WITHDRAW) sf_route_table_remove_batch(&g_test_follower, entries, n);
+    else if (op == SF_REPL_OP_GROUP) sf_route_table_define_groups(&g_test_follower, entries, n);
+    else for (size_t i = 0; i < n; ++i) sf_route_table_upsert(&g_test_follower, &entries[i]);
+}
+
+static void test_replace(sf_route_table_t *rt, uint64_t seq) {
+    (void)seq;
+    sf_route_table_free(&g_test_follower);
+    g_test_follower = *rt;
+    sf_route_table_init(rt);
+}
+
+static uint32_t test_rand(uint32_t *s) {
+    *s = *s * 1103515245u + 12345u;
+    return *s >> 1;
+}
+
+static void test_batch(sf_route_entry_t *e, size_t n, uint32_t *rs) {
+    for (size_t i = 0; i < n; ++i) {
+        memset(&e[i], 0, sizeof(e[i]));
+        e[i].mask_bits = (uint8_t)(8 + test_rand(rs) % 25);
+        uint32_t mask = 0xFFFFFFFFu << (32 - e[i].mask_bits);
+        e[i].prefix_be = htonl(test_rand(rs) & mask);
+        e[i].next_hop_be = htonl(0x0A000000u | (test_rand(rs) & 0xFFFF));
+        e[i].metric = (uint16_t)test_rand(rs);
+    }
+}
+
+/* The leader applies and publishes a batch, as the routing sink would. */
+static void test_publish(const sf_route_entry_t *e, size_t n) {
+    for (size_t i = 0; i < n; ++i) sf_route_table_upsert(&g_test_leader, &e[i]);
+    sf_repl_publish(++g_test_seq, SF_REPL_OP_UPSERT, e, n);
+}
+
+/* Drains s into the follower. Returns batches applied, or -1. */
+static long test_drain(sf_repl_sub_t *s, follow_state_t *st) {
+    static uint8_t buf[3 * SF_REPL_FRAME_MAX];
+    long batches = 0;
+    for (;;) {
+        long n = sf_repl_read(s, buf, sizeof(buf));
+        if (n <= 0) return n < 0 ? -1 : batches;
+        for (size_t off = 0; off < (size_t)n;) {
+            size_t plen = get_u32(buf + off + 12);
+            int r = follow_feed(st, buf + off + SF_PROTO_HEADER_LEN, plen);
+            if (r < 0) return -1;
+            batches += r;
+            off += SF_PROTO_HEADER_LEN + plen;
+        }
+    }
+}
+
+static int test_same(void) {
+    size_t n = sf_route_table_count(&g_test_leader);
+    if (sf_route_table_count(&g_test_follower) != n) return 0;
+    sf_route_entry_t *a = (sf_route_entry_t *)malloc((n + 1) * sizeof(*a));
+    sf_route_entry_t *b = (sf_route_entry_t *)malloc((n + 1) * sizeof(*b));
+    int same = 0;
+    if (a && b) {
+        sf_route_entry_t *ca = a, *cb = b;
+        sf_route_table_foreach(&g_test_leader, test_collect, &ca);
+        sf_route_table_foreach(&g_test_follower, test_collect, &cb);
+        same = 1;
+        for (size_t i = 0; i < n && same; ++i) {
+            same = a[i].prefix_be == b[i].prefix_be && a[i].mask_bits == b[i].mask_bits &&
+                   a[i].next_hop_be == b[i].next_hop_be && a[i].metric == b[i].metric && a[i].flags == b[i].flags;
+            /* A group must pick the same members. */
+            for (uint32_t f = 0; same && (a[i].flags & SF_ROUTE_F_GROUP) && f < 64; ++f) {
+                same = sf_nh_select(&g_test_leader.nh, ntohl(a[i].next_hop_be), f * 0x04000000u) ==
+                       sf_nh_select(&g_test_follower.nh, ntohl(b[i].next_hop_be), f * 0x04000000u);
+            }
+        }
+    }
+    free(a);
+    free(b);
+    return same;
+}
+
+int sf_repl_self_test(void) {
+    /* Codec round trip, including the widest deltas. */
+    static sf_route_entry_t in[600], out[600];
+    uint32_t rs = 7;
+    test_batch(in, 600, &rs);
+    in[1].prefix_be = htonl(0xFFFFFFFFu);
+    in[1].mask_bits = 32;
+    in[1].metric = 0xFFFF;
+    in[2].prefix_be = 0;
+    in[2].mask_bits = 0;
+    in[2].metric = 0;
+    in[3].flags = SF_ROUTE_F_GROUP;
+    static uint8_t enc[600 * SF_REPL_MAX_RECORD];
+    size_t k = 0;
+    size_t len = sf_repl_encode_routes(in, 600, enc, sizeof(enc), &k);
+    if (k != 600 || len >= 600 * 16) return -1;
+    if (sf_repl_decode_routes(enc, len, 600, out) != 0) return -1;
+    for (size_t i = 0; i < 600; ++i) {
+        if (out[i].prefix_be != in[i].prefix_be || out[i].mask_bits != in[i].mask_bits ||
+            out[i].next_hop_be != in[i].next_hop_be || out[i].metric != in[i].metric || out[i].flags != in[i].flags) {
+            return -1;
+        }
+    }
+    if (sf_repl_decode_routes(enc, len - 1, 600, out) == 0) return -1;
+    if (sf_repl_decode_routes(enc, len, 599, out) == 0) return -1;
+
+    int ok = 0;
+    sf_route_table_init(&g_test_leader);
+    sf_route_table_init(&g_test_follower);
+    g_test_seq = 0;
+    sf_repl_leader_config_t lc = {64 * 1024, test_export_all};
+    if (sf_repl_leader_init(&lc) != 0) return -1;
+
+    sf_repl_follow_config_t fc;
+    memset(&fc, 0, sizeof(fc));
+    fc.apply = test_apply;
+    fc.replace = test_replace;
+    follow_state_t st;
+    memset(&st, 0, sizeof(st));
+    st.cfg = &fc;
+
+    sf_completion_queue_t cq;
+    sf_cq_init(&cq, -1);
+    sf_task_t task;
+    memset(&task, 0, sizeof(task));
+    task.cq = &cq;
+
+    static sf_repl_sub_t sub, sub2;
+    do {
+        /* A table built before anyone subscribed arrives as a full table. */
+        for (int b = 0; b < 3; ++b) {
+            test_batch(in, 200, &rs);
+            test_publish(in, 200);
+        }
+        if (sf_repl_subscribe(&sub, 0, 0) != 0) break;
+        if (test_drain(&sub, &st) != 1 || st.applied != 3 || !test_same()) break;
+
+        /* Caught up: the subscriber parks until the next batch, which spans frames. */
+        if (sf_repl_park(&sub, &task) != 0 || sf_cq_pop(&cq) != NULL) break;
+        test_batch(in, 600, &rs);
+        test_publish(in, 600);
+        if (sf_cq_pop(&cq) != &task) break;
+        if (test_drain(&sub, &st) != 1 || st.applied != 4 || !test_same()) break;
+
+        /* A reconnecting follower resumes from the backlog, without a full table. */
+        uint64_t resyncs = sf_repl_resyncs();
+        follow_state_t st2 = st;
+        st2.pending = NULL;
+        st2.cap = 0;
+        st2.applied = 3;
+        if (sf_repl_subscribe(&sub2, st.origin, 3) != 0 || sub2.dump) break;
+        if (sf_repl_resyncs() != resyncs) break;
+        sf_route_table_t keep = g_test_follower;
+        sf_route_table_init(&g_test_follower);
+        long got = test_drain(&sub2, &st2);
+        sf_route_table_free(&g_test_follower);
+        g_test_follower = keep;
+        free(st2.pending);
+        sf_repl_unsubscribe(&sub2);
+        if (got != 1 || st2.applied != 4) break;
+
+        /* Another origin (a different leader process) starts over. */
+        if (sf_repl_subscribe(&sub2, st.origin + 1, 4) != 0 || !sub2.dump) break;
+        sf_repl_unsubscribe(&sub2);
+
+        /* Withdrawals travel as their own op. */
+        sf_route_table_remove_batch(&g_test_leader, in, 100);
+        sf_repl_publish(++g_test_seq, SF_REPL_OP_WITHDRAW, in, 100);
+        if (test_drain(&sub, &st) != 1 || st.applied != 5 || !test_same()) break;
+
+        /* So do next-hop groups; routes through one keep it. */
+        sf_nh_member_t m[3] = {{htonl(0xC0A80001u), 1, 0}, {htonl(0xC0A80002u), 2, 0}, {htonl(0xC0A80003u), 5, 0}};
+        uint32_t gid = 0;
+        if (sf_nh_define(&g_test_leader.nh, m, 3, &gid, NULL) != 0) break;
+        sf_repl_publish(++g_test_seq, SF_REPL_OP_GROUP, in, sf_route_table_group_records(&g_test_leader, in));
+        test_batch(in, 50, &rs);
+        for (size_t i = 0; i < 50; ++i) {
+            in[i].flags = SF_ROUTE_F_GROUP;
+            in[i].next_hop_be = htonl(gid);
+        }
+        test_publish(in, 50);
+        if (test_drain(&sub, &st) != 2 || st.applied != 7 || !test_same()) break;
+
+        /* A subscriber that falls out of the backlog is told to resubscribe. */
+        for (int b = 0; b < 40; ++b) {
+            test_batch(in, 200, &rs);
+            test_publish(in, 200);
+        }
+        if (test_drain(&sub, &st) != -1) break;
+        sf_repl_unsubscribe(&sub);
+        if (sf_repl_subscribe(&sub2, st.origin, st.applied) != 0 || !sub2.dump) break;
+        st.partial = 0;
+        /* The full table brings its groups along. */
+        if (test_drain(&sub2, &st) != 1 || st.applied != g_test_seq || !test_same()) break;
+        if (sf_nh_table_count(&g_test_follower.nh) != 1) break;
+        if (sf_repl_park(&sub2, &task) != 0 || sf_repl_unsubscribe(&sub2) != 1) break;
+
+        /* A table replaced outright starts a new stream: a follower of the old
+           one is dropped at once, cannot resume and gets the whole table again. */
+        uint64_t old_origin = st.origin;
+        if (sf_repl_subscribe(&sub2, old_origin, st.applied) != 0 || sub2.dump) break;
+        if (sf_repl_park(&sub2, &task) != 0) break;
+        sf_repl_publish(g_test_seq, SF_REPL_OP_RESET, NULL, 0);
+        if (sf_cq_pop(&cq) != &task || test_drain(&sub2, &st) != -1) break;
+        sf_repl_unsubscribe(&sub2);
+        if (sf_repl_subscribe(&sub2, old_origin, st.applied) != 0 || !sub2.dump) break;
+        if (test_drain(&sub2, &st) != 1 || st.origin == old_origin || !test_same()) break;
+        test_batch(in, 20, &rs);
+        test_publish(in, 20);
+        if (test_drain(&sub2, &st) != 1 || st.applied != g_test_seq || !test_same()) break;
+        sf_repl_unsubscribe(&sub2);
+        ok = 1;
+    } while (0);
+
+    sf_repl_unsubscribe(&sub);
+    sf_repl_unsubscribe(&sub2);
+    sf_repl_leader_shutdown();
+    free(st.pending);
+    sf_route_table_free(&st.staged);
+    sf_route_table_free(&g_test_leader);
+    sf_route_table_free(&g_test_follower);
+    return ok ? 0 : -1;
+}
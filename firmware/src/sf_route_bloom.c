@@ -0,0 +1,213 @@
+#include "sf_route_bloom.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_BYTES    64u
+#define BLOCK_COUNTERS (2u * BLOCK_BYTES)
+#define MAX_K          8u
+
+static uint32_t mask_from_bits(uint8_t bits) {
+    if (bits == 0) return 0u;
+    if (bits >= 32) return 0xFFFFFFFFu;
+    return 0xFFFFFFFFu << (32 - bits);
+}
+
+static uint64_t key_hash(uint32_t key, uint8_t bits) {
+    uint64_t h = ((uint64_t)key << 8 | bits) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 32);
+}
+
+/* The block a key lives in, from the top half of its hash; the counters in
+   it come from the bottom half by double hashing. */
+static uint8_t *block_of(const sf_route_bloom_t *b, uint64_t h) {
+    return b->blocks + (((h >> 32) * b->nblocks) >> 32) * BLOCK_BYTES;
+}
+
+static unsigned counter_at(uint64_t h, unsigned i) {
+    unsigned step = (unsigned)(h >> 16) | 1u;
+    return ((unsigned)h + i * step) & (BLOCK_COUNTERS - 1);
+}
+
+static unsigned get4(const uint8_t *blk, unsigned c) {
+    return (blk[c >> 1] >> ((c & 1u) * 4)) & 0xFu;
+}
+
+static void put4(uint8_t *blk, unsigned c, unsigned v) {
+    unsigned shift = (c & 1u) * 4;
+    blk[c >> 1] = (uint8_t)((blk[c >> 1] & ~(0xFu << shift)) | (v << shift));
+}
+
+int sf_route_bloom_init(sf_route_bloom_t *b, double fpr, uint32_t capacity) {
+    if (!b || !(fpr > 0.0) || fpr > SF_ROUTE_BLOOM_MAX_FPR) return -1;
+    memset(b, 0, sizeof(*b));
+    if (capacity < 1024) capacity = 1024;
+    /* The textbook sizing: with c counters per key and c ln 2 of them set per
+       key the rate is 0.6185^c, so c is stepped up until that is below fpr. */
+    double per_key = 0.0, rate = 1.0;
+    while (rate > fpr) {
+        per_key += 0.125;
+        rate *= 0.9417081;  /* 0.6185^(1/8) */
+    }
+    uint32_t k = (uint32_t)(per_key * 0.6931472 + 0.5);
+    b->k = k < 1 ? 1u : k > MAX_K ? MAX_K : k;
+    /* Keys do not spread evenly over blocks, and the fuller ones answer yes
+       more often; a quarter more counters brings the rate back down. */
+    uint64_t counters = (uint64_t)(per_key * 1.25 * capacity);
+    uint64_t blocks = (counters + BLOCK_COUNTERS - 1) / BLOCK_COUNTERS;
+    if (blocks > 0x7FFFFFFF) return -1;
+    b->nblocks = (uint32_t)blocks;
+    b->capacity = capacity;
+    b->fpr = fpr;
+    b->blocks = (uint8_t *)aligned_alloc(BLOCK_BYTES, (size_t)b->nblocks * BLOCK_BYTES);
+    b->lens = (uint32_t *)calloc(SF_ROUTE_DIR_SLOTS, sizeof(*b->lens));
+    if (!b->blocks || !b->lens) {
+        sf_route_bloom_free(b);
+        return -1;
+    }
+    memset(b->blocks, 0, (size_t)b->nblocks * BLOCK_BYTES);
+    return 0;
+}
+
+void sf_route_bloom_free(sf_route_bloom_t *b) {
+    if (!b) return;
+    free(b->blocks);
+    free(b->lens);
+    memset(b, 0, sizeof(*b));
+}
+
+int sf_route_bloom_copy(sf_route_bloom_t *dst, const sf_route_bloom_t *src) {
+    if (!dst || !src) return -1;
+    *dst = *src;
+    dst->blocks = (uint8_t *)aligned_alloc(BLOCK_BYTES, (size_t)src->nblocks * BLOCK_BYTES);
+    dst->lens = (uint32_t *)malloc(SF_ROUTE_DIR_SLOTS * sizeof(*dst->lens));
+    if (!dst->blocks || !dst->lens) {
+        sf_route_bloom_free(dst);
+        return -1;
+    }
+    memcpy(dst->blocks, src->blocks, (size_t)src->nblocks * BLOCK_BYTES);
+    memcpy(dst->lens, src->lens, SF_ROUTE_DIR_SLOTS * sizeof(*dst->lens));
+    return 0;
+}
+
+void sf_route_bloom_add(sf_route_bloom_t *b, uint32_t key, uint8_t bits) {
+    uint64_t h = key_hash(key, bits);
+    uint8_t *blk = block_of(b, h);
+    for (unsigned i = 0; i < b->k; ++i) {
+        unsigned c = counter_at(h, i), v = get4(blk, c);
+        if (v < 15) put4(blk, c, v + 1);
+    }
+    b->lens[key >> (32 - SF_ROUTE_DIR_BITS)] |= 1u << (bits - SF_ROUTE_BLOOM_MIN_BITS);
+    b->keys++;
+}
+
+void sf_route_bloom_del(sf_route_bloom_t *b, uint32_t key, uint8_t bits) {
+    /* The slot's length mask is the caller's to recompute. */
+    uint64_t h = key_hash(key, bits);
+    uint8_t *blk = block_of(b, h);
+    for (unsigned i = 0; i < b->k; ++i) {
+        unsigned c = counter_at(h, i), v = get4(blk, c);
+        if (v && v < 15) put4(blk, c, v - 1);
+    }
+    if (b->keys) b->keys--;
+}
+
+int sf_route_bloom_test(const sf_route_bloom_t *b, uint32_t key, uint8_t bits) {
+    uint64_t h = key_hash(key, bits);
+    const uint8_t *blk = block_of(b, h);
+    for (unsigned i = 0; i < b->k; ++i) {
+        if (!get4(blk, counter_at(h, i))) return 0;
+    }
+    return 1;
+}
+
+int sf_route_bloom_may_match(const sf_route_bloom_t *b, uint32_t ip) {
+    uint32_t lens = b->lens[ip >> (32 - SF_ROUTE_DIR_BITS)];
+    /* A route for the whole slot matches everything under it; past a few
+       lengths the probes cost more than the walk they would save. */
+    if ((lens & 1u) || __builtin_popcount(lens) > SF_ROUTE_BLOOM_MAX_PROBES) return 1;
+    while (lens) {
+        uint8_t bits = (uint8_t)(SF_ROUTE_BLOOM_MIN_BITS + 31 - __builtin_clz(lens));
+        if (sf_route_bloom_test(b, ip & mask_from_bits(bits), bits)) return 1;
+        lens &= ~(1u << (bits - SF_ROUTE_BLOOM_MIN_BITS));
+    }
+    return 0;
+}
+
+int sf_route_bloom_self_test(void) {
+    enum { N = 20000 };
+    sf_route_bloom_t b;
+    static uint32_t keys[N];
+    uint32_t seed = 31337u;
+
+    /* No false negatives, a false-positive rate near the target, and
+       removals that take keys back out. */
+    if (sf_route_bloom_init(&b, 0.01, N) != 0 || b.k != 7) return -1;
+    for (size_t i = 0; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        keys[i] = seed & 0xFFFFFF00u;
+        sf_route_bloom_add(&b, keys[i], 24);
+    }
+    for (size_t i = 0; i < N; ++i) {
+        if (!sf_route_bloom_test(&b, keys[i], 24)) return -1;
+    }
+    size_t fp = 0;
+    for (uint32_t i = 0; i < 100000; ++i) fp += sf_route_bloom_test(&b, i << 8, 25);
+    if (fp > 2000) return -1;
+    for (size_t i = 0; i < N; i += 2) sf_route_bloom_del(&b, keys[i], 24);
+    for (size_t i = 1; i < N; i += 2) {
+        if (!sf_route_bloom_test(&b, keys[i], 24)) return -1;
+    }
+    size_t back = 0;
+    for (size_t i = 0; i < N; i += 2) back += sf_route_bloom_test(&b, keys[i], 24);
+    if (back > N / 20 || b.keys != N / 2) return -1;
+    sf_route_bloom_free(&b);
+
+    /* may_match only probes the lengths under the address's slot. */
+    if (sf_route_bloom_init(&b, 0.001, 0) != 0) return -1;
+    sf_route_bloom_add(&b, 0x0A010200u, 24);
+    sf_route_bloom_add(&b, 0x0A018000u, 17);
+    if (b.lens[0x0A01] != ((1u << 8) | (1u << 1))) return -1;
+    if (!sf_route_bloom_may_match(&b, 0x0A010203u) || !sf_route_bloom_may_match(&b, 0x0A01FFFFu)) return -1;
+    if (sf_route_bloom_may_match(&b, 0x0A010303u) || sf_route_bloom_may_match(&b, 0x0A020203u)) return -1;
+    sf_route_bloom_free(&b);
+    if (sf_route_bloom_init(&b, 0.0, 10) != -1 || sf_route_bloom_init(&b, 0.6, 10) != -1) return -1;
+
+    /* On a table: the filters grow past the size they were set at, follow
+       batch removals, and leave every answer as it was. */
+    sf_route_table_t rt, plain;
+    sf_route_table_init(&rt);
+    sf_route_table_init(&plain);
+    if (sf_route_table_set_bloom(&rt, 0.02) != 0 || rt.bloom->capacity != 1024) return -1;
+    static sf_route_entry_t e[3000];
+    for (size_t i = 0; i < 3000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        memset(&e[i], 0, sizeof(e[i]));
+        e[i].mask_bits = (uint8_t)(i % 3 ? 24 : 20 + seed % 13u);
+        e[i].prefix_be = htonl(0x0A000000u | (seed & 0x00FFFFFFu));
+        e[i].next_hop_be = (uint32_t)i;
+        if (sf_route_table_upsert(&rt, &e[i]) != 0 || sf_route_table_upsert(&plain, &e[i]) != 0) return -1;
+    }
+    if (!rt.bloom || rt.bloom->capacity < 3000 || rt.bloom->keys != sf_route_table_count(&rt)) return -1;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t i = 0; i < 50000; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            uint32_t ip = htonl(0x0A000000u | (seed & 0x00FFFFFFu));
+            sf_route_entry_t x, y;
+            int rx = sf_route_table_lookup(&rt, ip, &x), ry = sf_route_table_lookup(&plain, ip, &y);
+            if (rx != ry || (rx == 0 && x.next_hop_be != y.next_hop_be)) return -1;
+        }
+        size_t from = pass ? 2000 : 0, n = pass ? 1000 : 2000;
+        if (sf_route_table_remove_batch(&rt, e + from, n) != sf_route_table_remove_batch(&plain, e + from, n)) return -1;
+    }
+    if (sf_route_table_count(&rt) || rt.bloom->keys) return -1;
+    for (uint32_t s = 0; s < SF_ROUTE_DIR_SLOTS; ++s) {
+        if (rt.bloom->lens[s]) return -1;
+    }
+    sf_route_table_free(&rt);
+    sf_route_table_free(&plain);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "sf_route_cache.h"
+
+#include <arpa/inet.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(sf_route_cache_set_t) == 64, "a set is one cache line");
+
+#define NO_ROUTE 0xFFu
+
+static uint32_t mask_from_bits(uint8_t bits) {
+    if (bits == 0) return 0u;
+    if (bits >= 32) return 0xFFFFFFFFu;
+    return 0xFFFFFFFFu << (32 - bits);
+}
+
+/* The owner is the only writer: a relaxed load/store pair, not a locked add. */
+static void count(_Atomic uint64_t *v) {
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/* The top bits of a multiplicative hash, which depend on every address bit. */
+static sf_route_cache_set_t *set_of(const sf_route_cache_t *c, uint32_t ip_be) {
+    uint32_t h = ip_be * 0x9E3779B1u;
+    return &c->sets[((uint64_t)h * ((uint64_t)c->mask + 1)) >> 32];
+}
+
+int sf_route_cache_init(sf_route_cache_t *c, uint32_t entries) {
+    if (!c || entries == 0 || entries > SF_ROUTE_CACHE_MAX_ENTRIES) return -1;
+    memset(c, 0, sizeof(*c));
+    uint32_t sets = 1;
+    while (sets * SF_ROUTE_CACHE_WAYS < entries) sets <<= 1;
+    c->sets = (sf_route_cache_set_t *)aligned_alloc(64, sets * sizeof(*c->sets));
+    if (!c->sets) return -1;
+    /* Epoch 0 is never current, so every set starts out empty. */
+    memset(c->sets, 0, sets * sizeof(*c->sets));
+    c->mask = sets - 1;
+    return 0;
+}
+
+void sf_route_cache_free(sf_route_cache_t *c) {
+    if (!c) return;
+    free(c->sets);
+    memset(c, 0, sizeof(*c));
+}
+
+int sf_route_cache_get(sf_route_cache_t *c, uint64_t epoch, uint32_t ip_be, int *found, sf_route_entry_t *out) {
+    const sf_route_cache_set_t *s = set_of(c, ip_be);
+    if (s->epoch == epoch) {
+        for (unsigned i = 0; i < SF_ROUTE_CACHE_WAYS; ++i) {
+            const sf_route_cache_way_t *w = &s->way[i];
+            if (!(s->valid & (1u << i)) || w->ip_be != ip_be) continue;
+            count(&c->hits);
+            *found = w->mask_bits != NO_ROUTE;
+            if (*found) {
+                out->prefix_be = htonl(ntohl(ip_be) & mask_from_bits(w->mask_bits));
+                out->mask_bits = w->mask_bits;
+                out->flags = w->flags;
+                out->metric = w->metric;
+                out->next_hop_be = w->next_hop_be;
+                out->last_updated_ms = 0;
+            }
+            return 1;
+        }
+    }
+    count(&c->misses);
+    return 0;
+}
+
+void sf_route_cache_put(sf_route_cache_t *c, uint64_t epoch, uint32_t ip_be, const sf_route_entry_t *best) {
+    sf_route_cache_set_t *s = set_of(c, ip_be);
+    if (s->epoch != epoch) {
+        s->epoch = epoch;
+        s->valid = 0;
+        s->victim = 0;
+    }
+    unsigned at = SF_ROUTE_CACHE_WAYS;
+    for (unsigned i = 0; i < SF_ROUTE_CACHE_WAYS && at == SF_ROUTE_CACHE_WAYS; ++i) {
+        if (!(s->valid & (1u << i)) || s->way[i].ip_be == ip_be) at = i;
+    }
+    if (at == SF_ROUTE_CACHE_WAYS) {
+        at = s->victim;
+        s->victim = (uint8_t)((s->victim + 1) % SF_ROUTE_CACHE_WAYS);
+    }
+    sf_route_cache_way_t *w = &s->way[at];
+    w->ip_be = ip_be;
+    w->next_hop_be = best ? best->next_hop_be : 0;
+    w->metric = best ? best->metric : 0;
+    w->mask_bits = best ? best->mask_bits : NO_ROUTE;
+    w->flags = best ? best->flags : 0;
+    s->valid |= (uint8_t)(1u << at);
+}
+
+int sf_route_cache_self_test(void) {
+    sf_route_cache_t c;
+    sf_route_entry_t e, got;
+    int found = 0;
+    memset(&e, 0, sizeof(e));
+
+    /* One set: answers and "no route" come back, a fifth address evicts the
+       oldest, and a new epoch empties it. */
+    if (sf_route_cache_init(&c, 1) != 0 || c.mask != 0) return -1;
+    e.prefix_be = htonl(0x0A010000u);
+    e.mask_bits = 16;
+    e.metric = 7;
+    e.next_hop_be = htonl(0xC0A80001u);
+    e.flags = SF_ROUTE_F_GROUP;
+    if (sf_route_cache_get(&c, 1, htonl(0x0A010203u), &found, &got) != 0) return -1;
+    sf_route_cache_put(&c, 1, htonl(0x0A010203u), &e);
+    sf_route_cache_put(&c, 1, htonl(0x0B000001u), NULL);
+    if (sf_route_cache_get(&c, 1, htonl(0x0A010203u), &found, &got) != 1 || !found) return -1;
+    if (got.prefix_be != e.prefix_be || got.mask_bits != 16 || got.metric != 7 || got.next_hop_be != e.next_hop_be ||
+        got.flags != SF_ROUTE_F_GROUP) {
+        return -1;
+    }
+    if (sf_route_cache_get(&c, 1, htonl(0x0B000001u), &found, &got) != 1 || found) return -1;
+    for (uint32_t i = 0; i < 3; ++i) sf_route_cache_put(&c, 1, htonl(0x0C000000u + i), NULL);
+    if (sf_route_cache_get(&c, 1, htonl(0x0A010203u), &found, &got) != 0) return -1;
+    if (sf_route_cache_get(&c, 1, htonl(0x0B000001u), &found, &got) != 1) return -1;
+    if (sf_route_cache_get(&c, 2, htonl(0x0B000001u), &found, &got) != 0) return -1;
+    if (c.hits != 3 || c.misses != 3) return -1;
+    sf_route_cache_free(&c);
+
+    /* Through a cache, lookups in a real table answer as the table does,
+       and a skewed stream of destinations mostly hits. */
+    sf_route_table_t rt;
+    sf_route_table_init(&rt);
+    uint32_t seed = 777u;
+    for (uint32_t i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        memset(&e, 0, sizeof(e));
+        e.mask_bits = (uint8_t)(8 + (seed >> 16) % 17u);
+        e.prefix_be = htonl(seed & 0x0FFFFFFFu);
+        e.next_hop_be = i;
+        e.metric = (uint16_t)i;
+        if (sf_route_table_upsert(&rt, &e) != 0) return -1;
+    }
+    if (sf_route_cache_init(&c, 1024) != 0 || c.mask != 255) return -1;
+    for (uint32_t i = 0; i < 50000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t ip = htonl((i % 10 ? (seed >> 16) % 512u : seed) & 0x0FFFFFFFu);
+        int ref = sf_route_table_lookup(&rt, ip, &e) == 0;
+        if (!sf_route_cache_get(&c, 1, ip, &found, &got)) {
+            found = sf_route_table_lookup(&rt, ip, &got) == 0;
+            sf_route_cache_put(&c, 1, ip, found ? &got : NULL);
+        }
+        if (found != ref) return -1;
+        if (found && (got.prefix_be != e.prefix_be || got.mask_bits != e.mask_bits || got.next_hop_be != e.next_hop_be)) {
+            return -1;
+        }
+    }
+    if (c.hits + c.misses != 50000 || c.hits < 40000) return -1;
+    sf_route_cache_free(&c);
+    sf_route_table_free(&rt);
+    return 0;
+}
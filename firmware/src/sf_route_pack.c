@@ -0,0 +1,219 @@
+#include "sf_route_pack.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+/* Dictionary slots while encoding: twice the most next hops a block holds. */
+#define PACK_SLOTS 512u
+
+static size_t varint_len(uint32_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *out) {
+    if (p < end && *p < 0x80) {
+        *out = *p;
+        return p + 1;
+    }
+    uint32_t v = 0;
+    for (unsigned shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint32_t hop[SF_ROUTE_PACK_MAX_HOPS];
+    uint16_t slot[PACK_SLOTS];  /* dictionary index + 1; 0 = empty */
+    uint32_t count;
+} pack_dict_t;
+
+/* The dictionary index of next hop h, or its free slot (returned as -1 - slot). */
+static int dict_find(const pack_dict_t *d, uint32_t h) {
+    uint32_t s = (h * 0x9E3779B1u) >> 23;
+    for (;; s = (s + 1) & (PACK_SLOTS - 1)) {
+        if (!d->slot[s]) return -1 - (int)s;
+        if (d->hop[d->slot[s] - 1] == h) return d->slot[s] - 1;
+    }
+}
+
+size_t sf_route_pack(const sf_route_entry_t *e, size_t n, uint8_t *out, size_t cap, size_t *encoded) {
+    if (encoded) *encoded = 0;
+    if (!out || cap < SF_ROUTE_PACK_HEADER) return 0;
+    pack_dict_t d;
+    memset(d.slot, 0, sizeof(d.slot));
+    d.count = 0;
+
+    /* Sizing pass: takes routes while they and any new next hops fit. */
+    size_t len = SF_ROUTE_PACK_HEADER, k = 0;
+    uint32_t prev = 0;
+    for (; k < n && k < 0xFFFFu; ++k) {
+        uint32_t p = ntohl(e[k].prefix_be);
+        size_t cost = 2 + varint_len(p - prev) + varint_len(e[k].metric);
+        int at = dict_find(&d, e[k].next_hop_be);
+        if (at < 0) {
+            if (d.count == SF_ROUTE_PACK_MAX_HOPS) break;
+            cost += 4;
+        }
+        if (len + cost > cap) break;
+        if (at < 0) {
+            d.hop[d.count++] = e[k].next_hop_be;
+            d.slot[-1 - at] = (uint16_t)d.count;
+        }
+        len += cost;
+        prev = p;
+    }
+
+    out[0] = (uint8_t)(k >> 8);
+    out[1] = (uint8_t)k;
+    out[2] = (uint8_t)d.count;
+    out[3] = 0;
+    uint8_t *w = out + SF_ROUTE_PACK_HEADER;
+    memcpy(w, d.hop, d.count * 4u);
+    w += d.count * 4u;
+    for (size_t i = 0; i < k; ++i) {
+        *w++ = (uint8_t)((e[i].mask_bits & 0x7Fu) | ((e[i].flags & SF_ROUTE_F_GROUP) ? SF_ROUTE_PACK_GROUP_BIT : 0));
+    }
+    for (size_t i = 0; i < k; ++i) *w++ = (uint8_t)dict_find(&d, e[i].next_hop_be);
+    prev = 0;
+    for (size_t i = 0; i < k; ++i) {
+        uint32_t p = ntohl(e[i].prefix_be);
+        w += put_varint(w, p - prev);
+        prev = p;
+    }
+    for (size_t i = 0; i < k; ++i) w += put_varint(w, e[i].metric);
+    if (encoded) *encoded = k;
+    return (size_t)(w - out);
+}
+
+long sf_route_pack_count(const uint8_t *in, size_t len) {
+    if (!in || len < SF_ROUTE_PACK_HEADER) return -1;
+    return ((long)in[0] << 8) | in[1];
+}
+
+long sf_route_unpack(const uint8_t *in, size_t len, sf_route_entry_t *out, size_t cap) {
+    long count = sf_route_pack_count(in, len);
+    if (count < 0 || (size_t)count > cap) return -1;
+    size_t hops = in[2];
+    size_t n = (size_t)count;
+    if (SF_ROUTE_PACK_HEADER + hops * 4 + n * 2 > len) return -1;
+    const uint8_t *dict = in + SF_ROUTE_PACK_HEADER;
+    const uint8_t *masks = dict + hops * 4;
+    const uint8_t *index = masks + n;
+    const uint8_t *p = index + n, *end = in + len;
+
+    /* The fixed-width columns are checked and spread in branch-free loops. */
+    unsigned bad = 0;
+    for (size_t i = 0; i < n; ++i) bad |= ((masks[i] & 0x7Fu) > 32) | (index[i] >= hops);
+    if (bad) return -1;
+    for (size_t i = 0; i < n; ++i) {
+        out[i].mask_bits = masks[i] & 0x7Fu;
+        out[i].flags = (masks[i] & SF_ROUTE_PACK_GROUP_BIT) ? SF_ROUTE_F_GROUP : 0;
+        memcpy(&out[i].next_hop_be, dict + (size_t)index[i] * 4, 4);
+        out[i].last_updated_ms = 0;
+    }
+
+    uint32_t prefix = 0, v;
+    for (size_t i = 0; i < n; ++i) {
+        if (!(p = get_varint(p, end, &v))) return -1;
+        prefix += v;
+        out[i].prefix_be = htonl(prefix);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (!(p = get_varint(p, end, &v)) || v > 0xFFFFu) return -1;
+        out[i].metric = (uint16_t)v;
+    }
+    return p == end ? count : -1;
+}
+
+int sf_route_pack_self_test(void) {
+    enum { N = 3000 };
+    static sf_route_entry_t in[N], back[N];
+    uint8_t buf[4096];
+    uint32_t seed = 99u;
+
+    /* A sorted table of /24s over a few next hops packs at least 3x smaller,
+       and blocks decode back to the same routes in order. */
+    for (size_t i = 0; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        memset(&in[i], 0, sizeof(in[i]));
+        in[i].prefix_be = htonl(0x0A000000u + (uint32_t)i * 256u);
+        in[i].mask_bits = 24;
+        in[i].metric = (uint16_t)(seed >> 16) % 100u;
+        in[i].next_hop_be = htonl(0xC0A80001u + (seed >> 8) % 8u);
+        in[i].flags = (i % 97 == 0) ? SF_ROUTE_F_GROUP : 0;
+    }
+    size_t done = 0, bytes = 0;
+    while (done < N) {
+        size_t k = 0;
+        size_t len = sf_route_pack(in + done, N - done, buf, sizeof(buf), &k);
+        if (k == 0 || len > sizeof(buf)) return -1;
+        if (sf_route_pack_count(buf, len) != (long)k) return -1;
+        if (sf_route_unpack(buf, len, back + done, N - done) != (long)k) return -1;
+        done += k;
+        bytes += len;
+    }
+    if (bytes * 3 > (size_t)N * 16) return -1;
+    for (size_t i = 0; i < N; ++i) {
+        if (back[i].prefix_be != in[i].prefix_be || back[i].mask_bits != in[i].mask_bits ||
+            back[i].metric != in[i].metric || back[i].next_hop_be != in[i].next_hop_be || back[i].flags != in[i].flags) {
+            return -1;
+        }
+    }
+
+    /* Unsorted routes and more next hops than one dictionary holds. */
+    for (size_t i = 0; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        in[i].prefix_be = seed;
+        in[i].mask_bits = (uint8_t)(seed % 33u);
+        in[i].next_hop_be = (uint32_t)i;
+        in[i].metric = 0xFFFFu;
+        in[i].flags = 0;
+    }
+    done = 0;
+    while (done < N) {
+        size_t k = 0;
+        size_t len = sf_route_pack(in + done, N - done, buf, sizeof(buf), &k);
+        if (k == 0 || k > SF_ROUTE_PACK_MAX_HOPS) return -1;
+        if (sf_route_unpack(buf, len, back + done, N - done) != (long)k) return -1;
+        done += k;
+    }
+    for (size_t i = 0; i < N; ++i) {
+        if (back[i].prefix_be != in[i].prefix_be || back[i].next_hop_be != in[i].next_hop_be) return -1;
+    }
+
+    /* Malformed blocks are refused. */
+    size_t k = 0;
+    size_t len = sf_route_pack(in, 10, buf, sizeof(buf), &k);
+    if (k != 10) return -1;
+    if (sf_route_unpack(buf, len - 1, back, N) != -1) return -1;     /* truncated */
+    if (sf_route_unpack(buf, len, back, 9) != -1) return -1;         /* more than cap */
+    buf[len] = 0;
+    if (sf_route_unpack(buf, len + 1, back, N) != -1) return -1;     /* trailing byte */
+    buf[SF_ROUTE_PACK_HEADER + 10 * 4 + 10] = 10;                     /* index past the dictionary */
+    if (sf_route_unpack(buf, len, back, N) != -1) return -1;
+    if (sf_route_pack(in, 10, buf, 3, &k) != 0 || k != 0) return -1;
+    len = sf_route_pack(in, 0, buf, sizeof(buf), &k);
+    if (len != SF_ROUTE_PACK_HEADER || sf_route_unpack(buf, len, back, N) != 0) return -1;
+    return 0;
+}
@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+
+#include "sf_routes_file.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SF_ROUTES_FILE_MAX_THREADS 16
+#define SF_ROUTES_FILE_MIN_CHUNK   (1u << 20)
+/* Shortest possible route line, "0.0.0.0 0 0.0.0.0 0": bounds routes per chunk. */
+#define SF_ROUTES_FILE_MIN_LINE    19u
+
+const char *sf_parse_ipv4(const char *s, const char *end, uint32_t *out_host) {
+    uint32_t v = 0;
+    for (int k = 0; k < 4; ++k) {
+        if (k) {
+            if (s >= end || *s != '.') return NULL;
+            s++;
+        }
+        if (s >= end) return NULL;
+        unsigned octet = (unsigned)(*s - '0');
+        if (octet > 9) return NULL;
+        s++;
+        /* Up to two more digits, none after a leading zero. */
+        for (int j = 0; j < 2 && octet && s < end && (unsigned)(*s - '0') <= 9; ++j, ++s) {
+            octet = octet * 10u + (unsigned)(*s - '0');
+        }
+        if (octet > 255) return NULL;
+        v = (v << 8) | octet;
+    }
+    if (s < end && ((unsigned)(*s - '0') <= 9 || *s == '.')) return NULL;
+    *out_host = v;
+    return s;
+}
+
+static const char *parse_uint(const char *s, const char *end, uint32_t max, uint32_t *out) {
+    uint32_t v = 0;
+    const char *start = s;
+    while (s < end && (unsigned)(*s - '0') <= 9) {
+        v = v * 10u + (unsigned)(*s - '0');
+        if (v > max) return NULL;
+        s++;
+    }
+    if (s == start) return NULL;
+    *out = v;
+    return s;
+}
+
+static const char *skip_blank(const char *s, const char *end) {
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    return s;
+}
+
+/* Requires at least one blank, then skips the rest. */
+static const char *field_sep(const char *s, const char *end) {
+    if (!s || s >= end || (*s != ' ' && *s != '\t')) return NULL;
+    return skip_blank(s, end);
+}
+
+/* Parses one line; returns 1 for a route, 0 for a blank or comment line, -1 on error. */
+static int parse_line(const char *s, const char *end, sf_route_entry_t *e, const char **why) {
+    s = skip_blank(s, end);
+    if (s == end || *s == '#' || (*s == '\r' && s + 1 == end)) return 0;
+
+    uint32_t prefix, mask, nh, metric;
+    *why = "bad prefix";
+    if (!(s = sf_parse_ipv4(s, end, &prefix))) return -1;
+    *why = "bad mask";
+    if (s < end && *s == '/') s++;
+    else if (!(s = field_sep(s, end))) return -1;
+    if (!(s = parse_uint(s, end, 32, &mask))) return -1;
+    *why = "bad next hop";
+    if (!(s = field_sep(s, end)) || !(s = sf_parse_ipv4(s, end, &nh))) return -1;
+    *why = "bad metric";
+    if (!(s = field_sep(s, end)) || !(s = parse_uint(s, end, 65535, &metric))) return -1;
+    *why = "trailing characters";
+    s = skip_blank(s, end);
+    if (s < end && *s == '\r') s++;
+    if (s < end && *s != '#') return -1;
+
+    memset(e, 0, sizeof(*e));
+    e->prefix_be = htonl(prefix);
+    e->mask_bits = (uint8_t)mask;
+    e->metric = (uint16_t)metric;
+    e->next_hop_be = htonl(nh);
+    return 1;
+}
+
+typedef struct {
+    const uint8_t    *begin;
+    const uint8_t    *end;
+    int               binary;
+    sf_route_entry_t *out;      /* room for every route the chunk can hold */
+    size_t            n;
+    size_t            lines;    /* text: lines in the chunk */
+    size_t            bad;      /* 1-based line or record within the chunk, 0 if none */
+    const char       *why;
+} parse_job_t;
+
+static void parse_text(parse_job_t *job) {
+    const char *s = (const char *)job->begin;
+    const char *end = (const char *)job->end;
+    while (s < end) {
+        const char *nl = (const char *)memchr(s, '\n', (size_t)(end - s));
+        const char *eol = nl ? nl : end;
+        job->lines++;
+        int r = parse_line(s, eol, &job->out[job->n], &job->why);
+        if (r < 0) {
+            job->bad = job->lines;
+            return;
+        }
+        job->n += (size_t)r;
+        s = nl ? nl + 1 : end;
+    }
+}
+
+static void parse_binary(parse_job_t *job) {
+    for (const uint8_t *p = job->begin; p < job->end; p += 16) {
+        sf_route_entry_t *e = &job->out[job->n];
+        memset(e, 0, sizeof(*e));
+        uint16_t metric_be;
+        memcpy(&e->prefix_be, p, 4);
+        e->mask_bits = p[4];
+        memcpy(&metric_be, p + 6, 2);
+        e->metric = ntohs(metric_be);
+        memcpy(&e->next_hop_be, p + 8, 4);
+        job->n++;
+        if (e->mask_bits > 32) {
+            job->bad = job->n;
+            job->why = "bad mask";
+            return;
+        }
+    }
+}
+
+static void *parse_job_run(void *arg) {
+    parse_job_t *job = (parse_job_t *)arg;
+    if (job->binary) parse_binary(job);
+    else parse_text(job);
+    return NULL;
+}
+
+static unsigned thread_count(unsigned threads, size_t len) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1u;
+        if (threads > len / SF_ROUTES_FILE_MIN_CHUNK + 1) threads = (unsigned)(len / SF_ROUTES_FILE_MIN_CHUNK + 1);
+    }
+    if (threads > SF_ROUTES_FILE_MAX_THREADS) threads = SF_ROUTES_FILE_MAX_THREADS;
+    return threads ? threads : 1u;
+}
+
+/* Splits [data, data + len) into jobs on line (text) or record (binary) boundaries. */
+static void split_jobs(const uint8_t *data, size_t len, int binary, parse_job_t *jobs, unsigned n) {
+    const uint8_t *end = data + len;
+    const uint8_t *p = data;
+    for (unsigned i = 0; i < n; ++i) {
+        const uint8_t *stop = (i + 1 == n) ? end : data + len / n * (i + 1);
+        if (stop < p) stop = p;
+        if (binary) {
+            stop = data + (size_t)(stop - data) / 16u * 16u;
+        } else if (stop < end) {
+            const uint8_t *nl = (const uint8_t *)memchr(stop, '\n', (size_t)(end - stop));
+            stop = nl ? nl + 1 : end;
+        }
+        memset(&jobs[i], 0, sizeof(jobs[i]));
+        jobs[i].begin = p;
+        jobs[i].end = stop;
+        jobs[i].binary = binary;
+        p = stop;
+    }
+}
+
+static int load_mapped(const uint8_t *data, size_t len, unsigned threads, sf_route_table_t *out, char *err,
+                       size_t err_len) {
+    int binary = len >= 8 && memcmp(data, SF_ROUTES_FILE_MAGIC, sizeof(SF_ROUTES_FILE_MAGIC)) == 0;
+    size_t cap = 0;
+    if (binary) {
+        uint32_t version_be, count_be;
+        if (len < SF_ROUTES_FILE_HEADER) {
+            snprintf(err, err_len, "truncated header");
+            return -1;
+        }
+        memcpy(&version_be, data + 8, 4);
+        memcpy(&count_be, data + 12, 4);
+        if (ntohl(version_be) != SF_ROUTES_FILE_VERSION) {
+            snprintf(err, err_len, "unsupported version %u", ntohl(version_be));
+            return -1;
+        }
+        cap = ntohl(count_be);
+        if (len != SF_ROUTES_FILE_HEADER + cap * 16u) {
+            snprintf(err, err_len, "size does not match %zu records", cap);
+            return -1;
+        }
+        data += SF_ROUTES_FILE_HEADER;
+        len -= SF_ROUTES_FILE_HEADER;
+    }
+
+    unsigned n = thread_count(threads, len);
+    parse_job_t jobs[SF_ROUTES_FILE_MAX_THREADS];
+    split_jobs(data, len, binary, jobs, n);
+
+    /* One array; each job writes into its own window, compacted afterwards. */
+    size_t total = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        size_t bytes = (size_t)(jobs[i].end - jobs[i].begin);
+        total += binary ? bytes / 16u : bytes / SF_ROUTES_FILE_MIN_LINE + 1;
+    }
+    sf_route_entry_t *all = (sf_route_entry_t *)malloc((total ? total : 1) * sizeof(*all));
+    if (!all) {
+        snprintf(err, err_len, "out of memory");
+        return -1;
+    }
+    size_t off = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        size_t bytes = (size_t)(jobs[i].end - jobs[i].begin);
+        jobs[i].out = all + off;
+        off += binary ? bytes / 16u : bytes / SF_ROUTES_FILE_MIN_LINE + 1;
+    }
+
+    pthread_t tids[SF_ROUTES_FILE_MAX_THREADS];
+    int started[SF_ROUTES_FILE_MAX_THREADS] = {0};
+    for (unsigned i = 1; i < n; ++i) {
+        started[i] = pthread_create(&tids[i], NULL, parse_job_run, &jobs[i]) == 0;
+        if (!started[i]) parse_job_run(&jobs[i]);
+    }
+    parse_job_run(&jobs[0]);
+    for (unsigned i = 1; i < n; ++i) {
+        if (started[i]) pthread_join(tids[i], NULL);
+    }
+
+    size_t routes = 0, base = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        if (jobs[i].bad) {
+            if (binary) snprintf(err, err_len, "record %zu: %s", base + jobs[i].bad, jobs[i].why);
+            else snprintf(err, err_len, "line %zu: %s", base + jobs[i].bad, jobs[i].why);
+            free(all);
+            return -1;
+        }
+        base += binary ? jobs[i].n : jobs[i].lines;
+        memmove(all + routes, jobs[i].out, jobs[i].n * sizeof(*all));
+        routes += jobs[i].n;
+    }
+
+    int rc = sf_route_table_build(out, all, routes);
+    free(all);
+    if (rc < 0) snprintf(err, err_len, "cannot build table");
+    return rc < 0 ? -1 : 0;
+}
+
+int sf_routes_file_load(const char *path, unsigned threads, sf_route_table_t *out, char *err, size_t err_len) {
+    char dummy[1];
+    if (!err) {
+        err = dummy;
+        err_len = sizeof(dummy);
+    }
+    if (!path || !out) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(err, err_len, "%s", strerror(errno));
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        snprintf(err, err_len, "%s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)sb.st_size;
+    void *data = NULL;
+    if (len) {
+        data = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            snprintf(err, err_len, "%s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    int rc = load_mapped((const uint8_t *)data, len, threads, out, err, err_len);
+    if (data) munmap(data, len);
+    return rc;
+}
+
+static int load_text(const char *text, unsigned threads, sf_route_table_t *rt, char *err, size_t err_len) {
+    sf_route_table_init(rt);
+    return load_mapped((const uint8_t *)text, strlen(text), threads, rt, err, err_len);
+}
+
+int sf_routes_file_self_test(void) {
+    static const struct {
+        const char *s;
+        int         ok;
+    } addrs[] = {
+        {"10.0.0.1", 1}, {"255.255.255.255", 1}, {"0.0.0.0", 1}, {"256.1.1.1", 0},
+        {"01.2.3.4", 0}, {"1.2.3", 0},           {"1.2.3.4.5", 0}, {"1.2.3.4444", 0},
+    };
+    for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); ++i) {
+        uint32_t v = 0;
+        const char *end = addrs[i].s + strlen(addrs[i].s);
+        const char *p = sf_parse_ipv4(addrs[i].s, end, &v);
+        if ((p == end) != addrs[i].ok) return -1;
+    }
+    const char *addr = "192.168.1.20";
+    uint32_t v = 0;
+    if (!sf_parse_ipv4(addr, addr + strlen(addr), &v) || v != 0xC0A80114u) return -1;
+
+    char err[64];
+    sf_route_table_t rt;
+    sf_route_entry_t best;
+    const char *text = "# comment\n\n10.0.0.0 8 192.168.0.1 10\r\n10.1.0.0/16\t192.168.0.2 5  # more\n"
+                       "10.0.0.0/8 192.168.0.3 7\n10.1.2.3/32 192.168.0.4 1";
+    if (load_text(text, 1, &rt, err, sizeof(err)) != 0 || sf_route_table_count(&rt) != 3) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0x0A020000u), &best) != 0 || best.metric != 7) return -1; /* last wins */
+    if (sf_route_table_lookup(&rt, htonl(0x0A010203u), &best) != 0 || best.mask_bits != 32) return -1;
+    sf_route_table_free(&rt);
+
+    /* A larger file split across threads gives the same table and absolute line numbers. */
+    enum { LINES = 300 };
+    static char big[LINES * 40];
+    size_t len = 0;
+    for (unsigned i = 0; i < LINES; ++i) {
+        len += (size_t)snprintf(big + len, sizeof(big) - len, "10.%u.%u.0 24 172.16.0.%u %u\n", i / 7, i % 7,
+                                i % 250 + 1, i);
+    }
+    sf_route_table_t one;
+    if (load_text(big, 1, &one, err, sizeof(err)) != 0 || load_text(big, 4, &rt, err, sizeof(err)) != 0) return -1;
+    int ok = sf_route_table_count(&rt) == LINES && sf_route_table_count(&one) == LINES;
+    for (unsigned i = 0; ok && i < LINES; ++i) {
+        sf_route_entry_t a;
+        uint32_t ip = htonl(0x0A000001u | ((i / 7) << 16) | ((i % 7) << 8));
+        ok = sf_route_table_lookup(&rt, ip, &best) == 0 && sf_route_table_lookup(&one, ip, &a) == 0 &&
+             best.metric == i && a.metric == i;
+    }
+    sf_route_table_free(&one);
+    sf_route_table_free(&rt);
+    if (!ok) return -1;
+    memcpy(strstr(big, "10.35."), "10.35,", 6); /* line 246 */
+    if (load_text(big, 4, &rt, err, sizeof(err)) == 0 || strcmp(err, "line 246: bad prefix") != 0) return -1;
+    sf_route_table_free(&rt);
+
+    /* Binary: header plus ROUTE_UPDATE records. */
+    uint8_t bin[SF_ROUTES_FILE_HEADER + 2 * 16];
+    memset(bin, 0, sizeof(bin));
+    memcpy(bin, SF_ROUTES_FILE_MAGIC, sizeof(SF_ROUTES_FILE_MAGIC));
+    uint32_t version_be = htonl(SF_ROUTES_FILE_VERSION), count_be = htonl(2);
+    memcpy(bin + 8, &version_be, 4);
+    memcpy(bin + 12, &count_be, 4);
+    for (int i = 0; i < 2; ++i) {
+        uint8_t *r = bin + SF_ROUTES_FILE_HEADER + i * 16;
+        uint32_t prefix_be = htonl(0x0B000000u), nh_be = htonl(0xC0A80001u + (uint32_t)i);
+        uint16_t metric_be = htons((uint16_t)(3 + i));
+        memcpy(r, &prefix_be, 4);
+        r[4] = (uint8_t)(8 + 8 * i);
+        memcpy(r + 6, &metric_be, 2);
+        memcpy(r + 8, &nh_be, 4);
+    }
+    sf_route_table_init(&rt);
+    if (load_mapped(bin, sizeof(bin), 2, &rt, err, sizeof(err)) != 0 || sf_route_table_count(&rt) != 2) return -1;
+    if (sf_route_table_lookup(&rt, htonl(0x0B000505u), &best) != 0 || best.metric != 4) return -1;
+    sf_route_table_free(&rt);
+    bin[SF_ROUTES_FILE_HEADER + 16 + 4] = 33;
+    if (load_mapped(bin, sizeof(bin), 2, &rt, err, sizeof(err)) == 0 || strcmp(err, "record 2: bad mask") != 0) {
+        return -1;
+    }
+    sf_route_table_free(&rt);
+    if (load_mapped(bin, sizeof(bin) - 1, 1, &rt, err, sizeof(err)) == 0) return -1;
+    return 0;
+}
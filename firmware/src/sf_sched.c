@@ -0,0 +1,163 @@
+#include "sf_sched.h"
+#include "sf_commands.h"
+
+#include <string.h>
+
+/* Smallest charge per service, so items that do no work still end a round. */
+#define SF_SCHED_MIN_CHARGE 64
+
+static const char *const class_names[SF_CLASS_COUNT] = {"control", "lookup", "probe"};
+
+void sf_sched_default_config(sf_sched_config_t *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    for (int t = 0; t < 256; ++t) out->class_by_type[t] = SF_CLASS_CONTROL;
+    out->class_by_type[SF_MSG_PING] = SF_CLASS_PROBE;
+    out->class_by_type[SF_MSG_ECHO] = SF_CLASS_PROBE;
+    out->class_by_type[SF_MSG_GET_STATS] = SF_CLASS_PROBE;
+    out->class_by_type[SF_MSG_ROUTE_LOOKUP] = SF_CLASS_LOOKUP;
+    out->class_by_type[SF_MSG_ROUTE_LOOKUP6] = SF_CLASS_LOOKUP;
+    out->weight[SF_CLASS_CONTROL] = 1;
+    out->weight[SF_CLASS_LOOKUP] = 4;
+    out->weight[SF_CLASS_PROBE] = 8;
+}
+
+int sf_sched_parse_class(const char *name, sf_msg_class_t *out) {
+    if (!name || !out) return -1;
+    for (int k = 0; k < SF_CLASS_COUNT; ++k) {
+        if (strcmp(name, class_names[k]) == 0) {
+            *out = (sf_msg_class_t)k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *sf_sched_class_name(sf_msg_class_t cls) {
+    if ((int)cls < 0 || cls >= SF_CLASS_COUNT) return "unknown";
+    return class_names[cls];
+}
+
+sf_msg_class_t sf_sched_classify(const sf_sched_config_t *cfg, uint8_t type, uint16_t flags) {
+    unsigned override = (flags & SF_FLAG_CLASS_MASK) >> SF_FLAG_CLASS_SHIFT;
+    if (override != 0 && override <= SF_CLASS_COUNT) return (sf_msg_class_t)(override - 1);
+    if (!cfg) return SF_CLASS_CONTROL;
+    return (sf_msg_class_t)cfg->class_by_type[type];
+}
+
+void sf_sched_init(sf_sched_t *s, const sf_sched_config_t *cfg) {
+    if (!s) return;
+    memset(s, 0, sizeof(*s));
+    if (cfg) s->cfg = *cfg;
+    else sf_sched_default_config(&s->cfg);
+}
+
+void sf_sched_push(sf_sched_t *s, sf_sched_item_t *item, sf_msg_class_t cls) {
+    if (!s || !item || item->queued) return;
+    if ((int)cls < 0 || cls >= SF_CLASS_COUNT) cls = SF_CLASS_CONTROL;
+    item->queued = 1;
+    item->next = NULL;
+    if (s->tail[cls]) s->tail[cls]->next = item;
+    else s->head[cls] = item;
+    s->tail[cls] = item;
+}
+
+void sf_sched_remove(sf_sched_t *s, sf_sched_item_t *item) {
+    if (!s || !item || !item->queued) return;
+    for (int k = 0; k < SF_CLASS_COUNT; ++k) {
+        sf_sched_item_t *prev = NULL;
+        for (sf_sched_item_t *p = s->head[k]; p; prev = p, p = p->next) {
+            if (p != item) continue;
+            if (prev) prev->next = p->next;
+            else s->head[k] = p->next;
+            if (s->tail[k] == p) s->tail[k] = prev;
+            item->queued = 0;
+            item->next = NULL;
+            return;
+        }
+    }
+}
+
+int sf_sched_pending(const sf_sched_t *s) {
+    if (!s) return 0;
+    for (int k = 0; k < SF_CLASS_COUNT; ++k) {
+        if (s->head[k]) return 1;
+    }
+    return 0;
+}
+
+static sf_sched_item_t *pop(sf_sched_t *s, int k) {
+    sf_sched_item_t *item = s->head[k];
+    if (!item) return NULL;
+    s->head[k] = item->next;
+    if (!s->head[k]) s->tail[k] = NULL;
+    item->next = NULL;
+    item->queued = 0;
+    return item;
+}
+
+void sf_sched_run_round(sf_sched_t *s, sf_sched_serve_fn serve, void *ctx) {
+    if (!s || !serve) return;
+    /* Highest class first so probes see the freshest state of the round. */
+    for (int k = SF_CLASS_COUNT - 1; k >= 0; --k) {
+        if (!s->head[k]) {
+            s->deficit[k] = 0;
+            continue;
+        }
+        s->deficit[k] += (size_t)s->cfg.weight[k] * SF_SCHED_QUANTUM_BYTES;
+        while (s->head[k] && s->deficit[k] > 0) {
+            sf_sched_item_t *item = pop(s, k);
+            size_t used = serve(item, (sf_msg_class_t)k, s->deficit[k], ctx);
+            if (used < SF_SCHED_MIN_CHARGE) used = SF_SCHED_MIN_CHARGE;
+            s->served_bytes[k] += used;
+            /* A frame larger than the remaining credit still runs; DRR just stops here. */
+            s->deficit[k] = used >= s->deficit[k] ? 0 : s->deficit[k] - used;
+        }
+        if (!s->head[k]) s->deficit[k] = 0;
+    }
+}
+
+typedef struct {
+    sf_sched_t      sched;
+    sf_sched_item_t items[3];
+    unsigned        served[3];
+} sched_test_t;
+
+/* Every test item is always busy: serve one quantum and go to the back of the lane. */
+static size_t test_serve(sf_sched_item_t *item, sf_msg_class_t cls, size_t credit, void *ctx) {
+    (void)credit;
+    sched_test_t *t = (sched_test_t *)ctx;
+    t->served[item - t->items]++;
+    sf_sched_push(&t->sched, item, cls);
+    return SF_SCHED_QUANTUM_BYTES;
+}
+
+int sf_sched_self_test(void) {
+    sf_sched_config_t cfg;
+    sf_sched_default_config(&cfg);
+    cfg.weight[SF_CLASS_CONTROL] = 1;
+    cfg.weight[SF_CLASS_PROBE] = 4;
+
+    if (sf_sched_classify(&cfg, SF_MSG_PING, 0) != SF_CLASS_PROBE) return -1;
+    if (sf_sched_classify(&cfg, SF_MSG_ROUTE_UPDATE, 0) != SF_CLASS_CONTROL) return -1;
+    uint16_t as_probe = (uint16_t)((SF_CLASS_PROBE + 1) << SF_FLAG_CLASS_SHIFT);
+    if (sf_sched_classify(&cfg, SF_MSG_ROUTE_UPDATE, as_probe) != SF_CLASS_PROBE) return -1;
+
+    static sched_test_t t;
+    memset(&t, 0, sizeof(t));
+    sf_sched_init(&t.sched, &cfg);
+
+    /* Two bulk control connections and one probe connection. */
+    sf_sched_push(&t.sched, &t.items[0], SF_CLASS_CONTROL);
+    sf_sched_push(&t.sched, &t.items[1], SF_CLASS_CONTROL);
+    sf_sched_push(&t.sched, &t.items[2], SF_CLASS_PROBE);
+    sf_sched_push(&t.sched, &t.items[2], SF_CLASS_PROBE); /* double push is a no-op */
+
+    for (int round = 0; round < 10; ++round) sf_sched_run_round(&t.sched, test_serve, &t);
+    if (t.served[2] != 40) return -1;
+    if (t.served[0] != 5 || t.served[1] != 5) return -1;
+
+    for (int i = 0; i < 3; ++i) sf_sched_remove(&t.sched, &t.items[i]);
+    if (sf_sched_pending(&t.sched)) return -1;
+    return 0;
+}
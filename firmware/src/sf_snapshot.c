@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+
+#include "sf_snapshot.h"
+#include "sf_crc32.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SF_SNAPSHOT_ALIGN 64u
+/* Version 2 headers end, and are checksummed, before the group fields. */
+#define SF_SNAPSHOT_V2_HEADER_LEN offsetof(sf_snapshot_header_t, groups_off)
+
+static uint64_t align_up(uint64_t v) {
+    return (v + SF_SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SF_SNAPSHOT_ALIGN - 1);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+typedef struct {
+    int      fd;
+    uint64_t pos;
+    uint32_t crc;
+} snap_writer_t;
+
+static int put(snap_writer_t *w, const void *data, size_t len) {
+    if (write_all(w->fd, data, len) != 0) return -1;
+    w->crc = sf_crc32_update(w->crc, data, len);
+    w->pos += len;
+    return 0;
+}
+
+static int pad_to(snap_writer_t *w, uint64_t off) {
+    static const uint8_t zeros[SF_SNAPSHOT_ALIGN];
+    while (w->pos < off) {
+        size_t n = (size_t)(off - w->pos);
+        if (n > sizeof(zeros)) n = sizeof(zeros);
+        if (put(w, zeros, n) != 0) return -1;
+    }
+    return 0;
+}
+
+static void header_for(const sf_route_table_t *rt, uint64_t seq, sf_snapshot_header_t *h) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SF_SNAPSHOT_MAGIC, sizeof(SF_SNAPSHOT_MAGIC));
+    h->version = SF_SNAPSHOT_VERSION;
+    h->header_size = SF_SNAPSHOT_HEADER_SIZE;
+    h->byte_order = 0x01020304u;
+    h->entry_size = (uint32_t)sizeof(sf_route_entry_t);
+    h->node_size = (uint32_t)sizeof(sf_route_node_t);
+    h->dir_slots = rt->dir ? SF_ROUTE_DIR_SLOTS : 0;
+    h->route_count = rt->count;
+    h->entry_used = rt->entry_used;
+    h->free_entry = rt->free_entry;
+    h->node_used = rt->node_used;
+    h->free_node = rt->free_node;
+    h->root = rt->root;
+    h->seq = seq;
+    h->entries_off = SF_SNAPSHOT_HEADER_SIZE;
+    h->nodes_off = align_up(h->entries_off + (uint64_t)rt->entry_used * sizeof(sf_route_entry_t));
+    h->dir_off = align_up(h->nodes_off + (uint64_t)rt->node_used * sizeof(sf_route_node_t));
+    h->group_size = (uint32_t)sizeof(sf_nh_group_t);
+    h->group_used = rt->nh.group_used;
+    h->free_group = rt->nh.free_group;
+    h->hop_used = rt->nh.hop_used;
+    h->groups_off = align_up(h->dir_off + (uint64_t)h->dir_slots * sizeof(sf_route_dir_t));
+    h->hops_off = align_up(h->groups_off + (uint64_t)h->group_used * sizeof(sf_nh_group_t));
+    h->file_size = h->hops_off + (uint64_t)h->hop_used * sizeof(sf_nh_hop_t);
+}
+
+int sf_snapshot_write_fd(int fd, const sf_route_table_t *rt, uint64_t seq, size_t *bytes_out) {
+    if (fd < 0 || !rt) return -1;
+    sf_snapshot_header_t h;
+    header_for(rt, seq, &h);
+
+    /* Reserve the header block; it is rewritten once the payload CRC is known. */
+    uint8_t block[SF_SNAPSHOT_HEADER_SIZE];
+    memset(block, 0, sizeof(block));
+    if (write_all(fd, block, sizeof(block)) != 0) return -1;
+
+    snap_writer_t w = {fd, SF_SNAPSHOT_HEADER_SIZE, 0};
+    if (put(&w, rt->entries, (size_t)rt->entry_used * sizeof(sf_route_entry_t)) != 0) return -1;
+    if (pad_to(&w, h.nodes_off) != 0) return -1;
+    if (put(&w, rt->nodes, (size_t)rt->node_used * sizeof(sf_route_node_t)) != 0) return -1;
+    if (pad_to(&w, h.dir_off) != 0) return -1;
+    if (h.dir_slots && put(&w, rt->dir, (size_t)h.dir_slots * sizeof(sf_route_dir_t)) != 0) return -1;
+    if (pad_to(&w, h.groups_off) != 0) return -1;
+    if (put(&w, rt->nh.groups, (size_t)h.group_used * sizeof(sf_nh_group_t)) != 0) return -1;
+    if (pad_to(&w, h.hops_off) != 0) return -1;
+    if (put(&w, rt->nh.hops, (size_t)h.hop_used * sizeof(sf_nh_hop_t)) != 0) return -1;
+
+    h.payload_crc = w.crc;
+    h.header_crc = sf_crc32(&h, sizeof(h));
+    memcpy(block, &h, sizeof(h));
+    if (pwrite(fd, block, sizeof(h), 0) != (ssize_t)sizeof(h)) return -1;
+    if (bytes_out) *bytes_out = (size_t)h.file_size;
+    return 0;
+}
+
+int sf_snapshot_save(const char *path, const sf_route_table_t *rt, uint64_t seq, size_t *bytes_out) {
+    if (!path || !rt) return -1;
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid()) >= (int)sizeof(tmp)) return -1;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    if (sf_snapshot_write_fd(fd, rt, seq, bytes_out) != 0 || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    /* Make the rename itself durable. */
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    int dfd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+
+static int header_valid(const sf_snapshot_header_t *h, uint64_t size) {
+    sf_snapshot_header_t copy = *h;
+    copy.header_crc = 0;
+    if (memcmp(h->magic, SF_SNAPSHOT_MAGIC, sizeof(SF_SNAPSHOT_MAGIC)) != 0) return 0;
+    if (h->version != SF_SNAPSHOT_VERSION && h->version != 2u) return 0;
+    int v2 = h->version == 2u;
+    if (sf_crc32(&copy, v2 ? SF_SNAPSHOT_V2_HEADER_LEN : sizeof(copy)) != h->header_crc) return 0;
+    if (h->header_size != SF_SNAPSHOT_HEADER_SIZE) return 0;
+    if (h->byte_order != 0x01020304u) return 0;
+    if (h->entry_size != sizeof(sf_route_entry_t) || h->node_size != sizeof(sf_route_node_t)) return 0;
+    if (h->dir_slots != 0 && h->dir_slots != SF_ROUTE_DIR_SLOTS) return 0;
+    if (h->file_size != size || h->route_count > h->entry_used) return 0;
+    if (h->root >= (h->node_used ? h->node_used : 1)) return 0;
+    if (h->route_count && !h->dir_slots) return 0;
+    if (h->entries_off != SF_SNAPSHOT_HEADER_SIZE ||
+        h->nodes_off < h->entries_off + (uint64_t)h->entry_used * sizeof(sf_route_entry_t) ||
+        h->dir_off < h->nodes_off + (uint64_t)h->node_used * sizeof(sf_route_node_t) ||
+        h->dir_off + (uint64_t)h->dir_slots * sizeof(sf_route_dir_t) > size) {
+        return 0;
+    }
+    /* The header block past a version 2 header is zero: no groups. */
+    if (v2) return h->group_used == 0 && h->hop_used == 0;
+    if (h->group_size != sizeof(sf_nh_group_t) ||
+        h->groups_off < h->dir_off + (uint64_t)h->dir_slots * sizeof(sf_route_dir_t) ||
+        h->hops_off < h->groups_off + (uint64_t)h->group_used * sizeof(sf_nh_group_t) ||
+        h->hops_off + (uint64_t)h->hop_used * sizeof(sf_nh_hop_t) > size) {
+        return 0;
+    }
+    return 1;
+}
+
+int sf_snapshot_map_fd(int fd, sf_route_table_t *out, uint64_t *seq) {
+    if (fd < 0 || !out) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (uint64_t)sb.st_size < SF_SNAPSHOT_HEADER_SIZE) return -1;
+    size_t len = (size_t)sb.st_size;
+
+    /* Private and writable: later mutations copy the touched pages. */
+    uint8_t *base = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) return -1;
+    const sf_snapshot_header_t *h = (const sf_snapshot_header_t *)base;
+    if (!header_valid(h, len) ||
+        sf_crc32(base + SF_SNAPSHOT_HEADER_SIZE, len - SF_SNAPSHOT_HEADER_SIZE) != h->payload_crc) {
+        munmap(base, len);
+        return -1;
+    }
+
+    sf_route_table_init(out);
+    if (h->group_used &&
+        sf_nh_table_load(&out->nh, (const sf_nh_group_t *)(base + h->groups_off), h->group_used, h->free_group,
+                         (const sf_nh_hop_t *)(base + h->hops_off), h->hop_used) != 0) {
+        munmap(base, len);
+        return -1;
+    }
+    out->entries = (sf_route_entry_t *)(base + h->entries_off);
+    out->entry_used = out->entry_cap = h->entry_used;
+    out->free_entry = h->free_entry;
+    out->nodes = (sf_route_node_t *)(base + h->nodes_off);
+    out->node_used = out->node_cap = h->node_used;
+    out->free_node = h->free_node;
+    out->root = h->root;
+    out->dir = h->dir_slots ? (sf_route_dir_t *)(base + h->dir_off) : NULL;
+    out->count = (size_t)h->route_count;
+    out->map = base;
+    out->map_len = len;
+    if (seq) *seq = h->seq;
+    return 0;
+}
+
+int sf_snapshot_load(const char *path, sf_route_table_t *out, uint64_t *seq) {
+    if (!path || !out) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int r = sf_snapshot_map_fd(fd, out, seq);
+    close(fd);
+    return r;
+}
+
+int sf_snapshot_self_test(void) {
+    sf_route_table_t rt;
+    sf_route_table_init(&rt);
+    for (uint32_t i = 0; i < 300; ++i) {
+        sf_route_entry_t e = {0};
+        e.prefix_be = htonl(0x0A000000u | (i << 8));
+        e.mask_bits = 24;
+        e.metric = (uint16_t)i;
+        e.next_hop_be = htonl(0xC0A80001u + i);
+        if (sf_route_table_upsert(&rt, &e) != 0) return -1;
+    }
+    sf_route_table_remove(&rt, htonl(0x0A000500u), 24); /* leave a free slot behind */
+
+    /* An image without groups is also a valid version 2 image. */
+    int fd = memfd_create("sf-snapshot-test", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    sf_route_table_t loaded;
+    sf_snapshot_header_t h;
+    int ok = sf_snapshot_write_fd(fd, &rt, 41, NULL) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+    if (ok) {
+        h.version = 2;
+        h.group_size = 0;
+        h.groups_off = h.hops_off = 0;
+        h.header_crc = 0;
+        h.header_crc = sf_crc32(&h, SF_SNAPSHOT_V2_HEADER_LEN);
+        ok = pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && sf_snapshot_map_fd(fd, &loaded, NULL) == 0;
+        if (ok) {
+            ok = sf_route_table_count(&loaded) == 299;
+            sf_route_table_free(&loaded);
+        }
+    }
+    close(fd);
+    if (!ok) return -1;
+
+    /* Routes through a next-hop group keep it. */
+    sf_nh_member_t m[2] = {{htonl(0xC0A80101u), 1, 0}, {htonl(0xC0A80102u), 3, 0}};
+    uint32_t group = 0;
+    if (sf_nh_define(&rt.nh, m, 2, &group, NULL) != 0) return -1;
+    sf_route_entry_t g = {0};
+    g.prefix_be = htonl(0x0C000000u);
+    g.mask_bits = 8;
+    g.flags = SF_ROUTE_F_GROUP;
+    g.next_hop_be = htonl(group);
+    if (sf_route_table_upsert(&rt, &g) != 0) return -1;
+
+    fd = memfd_create("sf-snapshot-test", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    size_t bytes = 0;
+    uint64_t seq = 0;
+    ok = sf_snapshot_write_fd(fd, &rt, 42, &bytes) == 0 && sf_snapshot_map_fd(fd, &loaded, &seq) == 0 && seq == 42;
+    if (ok) {
+        sf_route_entry_t best;
+        ok = sf_route_table_count(&loaded) == 300 &&
+             sf_route_table_lookup(&loaded, htonl(0x0C010203u), &best) == 0 && (best.flags & SF_ROUTE_F_GROUP) &&
+             sf_nh_select(&loaded.nh, ntohl(best.next_hop_be), 77u) == sf_nh_select(&rt.nh, group, 77u) &&
+             loaded.nh.groups[group].refs == 1 &&
+             sf_route_table_lookup(&loaded, htonl(0x0A000703u), &best) == 0 && best.metric == 7 &&
+             sf_route_table_lookup(&loaded, htonl(0x0A000503u), &best) != 0;
+        /* A loaded table stays mutable and reuses the free slot it was saved with. */
+        sf_route_entry_t e = {0};
+        e.prefix_be = htonl(0x0B000000u);
+        e.mask_bits = 8;
+        if (ok) ok = sf_route_table_upsert(&loaded, &e) == 0 && sf_route_table_count(&loaded) == 301;
+        if (ok) ok = sf_route_table_lookup(&loaded, htonl(0x0B010203u), &best) == 0 && best.mask_bits == 8;
+        sf_route_table_free(&loaded);
+    }
+
+    /* A flipped payload byte is caught by the checksum. */
+    uint8_t b;
+    if (ok && pread(fd, &b, 1, SF_SNAPSHOT_HEADER_SIZE + 5) == 1) {
+        b ^= 0x40;
+        ok = pwrite(fd, &b, 1, SF_SNAPSHOT_HEADER_SIZE + 5) == 1 && sf_snapshot_map_fd(fd, &loaded, NULL) != 0;
+    }
+    close(fd);
+    sf_route_table_free(&rt);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include "sf_vrf.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SF_VRF_ALIGN 4096u
+
+static uint64_t align_up(uint64_t v) {
+    return (v + SF_VRF_ALIGN - 1) & ~(uint64_t)(SF_VRF_ALIGN - 1);
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, uint64_t off) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+        ssize_t w = pwrite(fd, p, len, (off_t)off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        off += (uint64_t)w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+void sf_vrf_image_init(sf_vrf_image_t *img) {
+    if (!img) return;
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+    img->free_entry = SF_ROUTE_NONE;
+    sf_nh_table_init(&img->nh);
+}
+
+void sf_vrf_image_free(sf_vrf_image_t *img) {
+    if (!img) return;
+    if (img->fd >= 0) close(img->fd);
+    sf_nh_table_free(&img->nh);
+    sf_vrf_image_init(img);
+}
+
+int sf_vrf_image_make(sf_vrf_image_t *img, const sf_route_table_t *src, uint32_t slack) {
+    if (!img || !src) return -1;
+    sf_vrf_image_free(img);
+    if (sf_nh_table_load(&img->nh, src->nh.groups, src->nh.group_used, src->nh.free_group, src->nh.hops,
+                         src->nh.hop_used) != 0) {
+        return -1;
+    }
+    if (!src->dir) return 0; /* nothing to share: copies start empty */
+
+    /* The room past the used part of each array is a hole in the file: it
+       costs nothing until a copy writes there, and then only that copy. */
+    uint64_t entry_cap = (uint64_t)src->entry_used + slack;
+    uint64_t node_cap = (uint64_t)src->node_used + 2u * (uint64_t)slack;
+    if (entry_cap > 0xFFFFFFFFu || node_cap > 0xFFFFFFFFu) {
+        sf_vrf_image_free(img);
+        return -1;
+    }
+    img->nodes_off = align_up(entry_cap * sizeof(sf_route_entry_t));
+    img->dir_off = align_up(img->nodes_off + node_cap * sizeof(sf_route_node_t));
+    img->len = (size_t)(img->dir_off + (uint64_t)SF_ROUTE_DIR_SLOTS * sizeof(sf_route_dir_t));
+    img->fd = memfd_create("sf-vrf", MFD_CLOEXEC);
+    if (img->fd < 0 || ftruncate(img->fd, (off_t)img->len) != 0 ||
+        pwrite_all(img->fd, src->entries, (size_t)src->entry_used * sizeof(sf_route_entry_t), 0) != 0 ||
+        pwrite_all(img->fd, src->nodes, (size_t)src->node_used * sizeof(sf_route_node_t), img->nodes_off) != 0 ||
+        pwrite_all(img->fd, src->dir, SF_ROUTE_DIR_SLOTS * sizeof(sf_route_dir_t), img->dir_off) != 0) {
+        sf_vrf_image_free(img);
+        return -1;
+    }
+    img->entry_cap = (uint32_t)entry_cap;
+    img->entry_used = src->entry_used;
+    img->free_entry = src->free_entry;
+    img->node_cap = (uint32_t)node_cap;
+    img->node_used = src->node_used;
+    img->free_node = src->free_node;
+    img->root = src->root;
+    img->count = src->count;
+    return 0;
+}
+
+int sf_vrf_image_clone(const sf_vrf_image_t *img, sf_route_table_t *out) {
+    if (!img || !out) return -1;
+    sf_route_table_init(out);
+    if (sf_nh_table_load(&out->nh, img->nh.groups, img->nh.group_used, img->nh.free_group, img->nh.hops,
+                         img->nh.hop_used) != 0) {
+        return -1;
+    }
+    if (img->fd < 0) return 0;
+
+    /* Private and writable: a write copies the page it touches. */
+    uint8_t *base = (uint8_t *)mmap(NULL, img->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, img->fd, 0);
+    if (base == MAP_FAILED) {
+        sf_route_table_free(out);
+        return -1;
+    }
+    out->entries = (sf_route_entry_t *)base;
+    out->entry_cap = img->entry_cap;
+    out->entry_used = img->entry_used;
+    out->free_entry = img->free_entry;
+    out->nodes = (sf_route_node_t *)(base + img->nodes_off);
+    out->node_cap = img->node_cap;
+    out->node_used = img->node_used;
+    out->free_node = img->free_node;
+    out->root = img->root;
+    out->dir = (sf_route_dir_t *)(base + img->dir_off);
+    out->count = img->count;
+    out->map = base;
+    out->map_len = img->len;
+    return 0;
+}
+
+static size_t slot_of(uint32_t id, size_t cap) {
+    return (size_t)((id * 0x9E3779B1u) >> 7) & (cap - 1);
+}
+
+void sf_vrf_set_init(sf_vrf_set_t *s) {
+    if (!s) return;
+    memset(s, 0, sizeof(*s));
+}
+
+void sf_vrf_set_free(sf_vrf_set_t *s) {
+    if (!s) return;
+    for (size_t i = 0; i < s->cap; ++i) {
+        if (!s->slots[i]) continue;
+        sf_route_table_free(&s->slots[i]->table);
+        free(s->slots[i]);
+    }
+    free(s->slots);
+    sf_vrf_set_init(s);
+}
+
+size_t sf_vrf_set_count(const sf_vrf_set_t *s) {
+    return s ? s->count : 0;
+}
+
+sf_vrf_t *sf_vrf_find(const sf_vrf_set_t *s, uint32_t id) {
+    if (!s || !s->cap) return NULL;
+    for (size_t i = slot_of(id, s->cap);; i = (i + 1) & (s->cap - 1)) {
+        sf_vrf_t *v = s->slots[i];
+        if (!v || v->id == id) return v;
+    }
+}
+
+/* Keeps the index at most half full. */
+static int set_grow(sf_vrf_set_t *s) {
+    if ((s->count + 1) * 2 <= s->cap) return 0;
+    size_t cap = s->cap ? s->cap * 2 : 16;
+    sf_vrf_t **slots = (sf_vrf_t **)calloc(cap, sizeof(*slots));
+    if (!slots) return -1;
+    for (size_t i = 0; i < s->cap; ++i) {
+        sf_vrf_t *v = s->slots[i];
+        if (!v) continue;
+        size_t j = slot_of(v->id, cap);
+        while (slots[j]) j = (j + 1) & (cap - 1);
+        slots[j] = v;
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->cap = cap;
+    return 0;
+}
+
+sf_vrf_t *sf_vrf_add(sf_vrf_set_t *s, uint32_t id, sf_route_table_t *table) {
+    if (!s || !table || id == SF_VRF_MAIN || id == SF_VRF_EMPTY || sf_vrf_find(s, id)) return NULL;
+    if (set_grow(s) != 0) return NULL;
+    sf_vrf_t *v = (sf_vrf_t *)malloc(sizeof(*v));
+    if (!v) return NULL;
+    v->id = id;
+    v->version = 0;
+    v->table = *table;
+    sf_route_table_init(table);
+    size_t i = slot_of(id, s->cap);
+    while (s->slots[i]) i = (i + 1) & (s->cap - 1);
+    s->slots[i] = v;
+    s->count++;
+    return v;
+}
+
+int sf_vrf_remove(sf_vrf_set_t *s, uint32_t id) {
+    if (!s || !s->cap) return -1;
+    size_t mask = s->cap - 1, i = slot_of(id, s->cap);
+    while (s->slots[i] && s->slots[i]->id != id) i = (i + 1) & mask;
+    sf_vrf_t *v = s->slots[i];
+    if (!v) return -1;
+    sf_route_table_free(&v->table);
+    free(v);
+    s->slots[i] = NULL;
+    s->count--;
+    /* Backward-shift the rest of the run so lookups need no tombstones. */
+    for (size_t j = (i + 1) & mask; s->slots[j]; j = (j + 1) & mask) {
+        size_t home = slot_of(s->slots[j]->id, s->cap);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            s->slots[i] = s->slots[j];
+            s->slots[j] = NULL;
+            i = j;
+        }
+    }
+    return 0;
+}
+
+static sf_route_entry_t test_route(uint32_t prefix, uint8_t bits, uint32_t next_hop) {
+    sf_route_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.prefix_be = htonl(prefix);
+    e.mask_bits = bits;
+    e.metric = 1;
+    e.next_hop_be = htonl(next_hop);
+    return e;
+}
+
+static uint32_t next_hop_of(const sf_route_table_t *rt, uint32_t ip) {
+    sf_route_entry_t best;
+    return sf_route_table_lookup(rt, htonl(ip), &best) == 0 ? ntohl(best.next_hop_be) : 0;
+}
+
+int sf_vrf_self_test(void) {
+    sf_route_table_t src;
+    sf_route_table_init(&src);
+    for (uint32_t i = 0; i < 2000; ++i) {
+        sf_route_entry_t e = test_route(0x0A000000u | (i << 8), 24, 0xC0A80000u + i);
+        if (sf_route_table_upsert(&src, &e) != 0) return -1;
+    }
+    sf_route_entry_t def = test_route(0, 0, 0xC0A8FFFFu);
+    if (sf_route_table_upsert(&src, &def) != 0) return -1;
+    sf_nh_member_t m[2] = {{htonl(0xAC100001u), 1, 0}, {htonl(0xAC100002u), 1, 0}};
+    uint32_t group = 0;
+    if (sf_nh_define(&src.nh, m, 2, &group, NULL) != 0) return -1;
+    sf_route_entry_t g = test_route(0x0B000000u, 8, group);
+    g.flags = SF_ROUTE_F_GROUP;
+    if (sf_route_table_upsert(&src, &g) != 0) return -1;
+
+    sf_vrf_image_t img;
+    sf_vrf_image_init(&img);
+    sf_vrf_set_t set;
+    sf_vrf_set_init(&set);
+    if (sf_vrf_image_make(&img, &src, 16) != 0) return -1;
+
+    /* Copies answer like the source and are independent of it and of each other. */
+    int ok = 1;
+    for (uint32_t id = 1; ok && id <= 3; ++id) {
+        sf_route_table_t t;
+        ok = sf_vrf_image_clone(&img, &t) == 0 && sf_vrf_add(&set, id, &t) != NULL && t.count == 0;
+        sf_route_table_free(&t);
+    }
+    sf_vrf_t *a = sf_vrf_find(&set, 1), *b = sf_vrf_find(&set, 2);
+    if (ok) ok = a && b && a->table.count == src.count && next_hop_of(&a->table, 0x0A0003FFu) == 0xC0A80003u;
+    sf_route_entry_t best;
+    if (ok) ok = sf_route_table_lookup(&a->table, htonl(0x0B010101u), &best) == 0 && (best.flags & SF_ROUTE_F_GROUP) &&
+                 sf_nh_select(&a->table.nh, ntohl(best.next_hop_be), 9u) == sf_nh_select(&src.nh, group, 9u);
+    if (ok) {
+        sf_route_entry_t e = test_route(0x0A000500u, 24, 0x01010101u);
+        sf_route_entry_t more = test_route(0x0A000580u, 25, 0x02020202u);
+        ok = sf_route_table_upsert(&a->table, &e) == 0 && sf_route_table_upsert(&a->table, &more) == 0 &&
+             sf_route_table_remove(&a->table, htonl(0x0A000700u), 24) == 0;
+        /* Small changes stay within the image: the copy still shares it. */
+        ok = ok && a->table.map != NULL && next_hop_of(&a->table, 0x0A000501u) == 0x01010101u &&
+             next_hop_of(&a->table, 0x0A000581u) == 0x02020202u && next_hop_of(&a->table, 0x0A000701u) == 0xC0A8FFFFu;
+        ok = ok && next_hop_of(&b->table, 0x0A000501u) == 0xC0A80005u && next_hop_of(&b->table, 0x0A000581u) == 0xC0A80005u &&
+             next_hop_of(&b->table, 0x0A000701u) == 0xC0A80007u && next_hop_of(&src, 0x0A000501u) == 0xC0A80005u;
+    }
+    /* Outgrowing the room in the image moves a copy onto the heap. */
+    for (uint32_t i = 0; ok && i < 200; ++i) {
+        sf_route_entry_t e = test_route(0x0C000000u | (i << 8), 24, 0x03030303u);
+        ok = sf_route_table_upsert(&b->table, &e) == 0;
+    }
+    if (ok) ok = b->table.map == NULL && b->table.count == src.count + 200 &&
+                 next_hop_of(&b->table, 0x0C00C701u) == 0x03030303u && next_hop_of(&b->table, 0x0A000101u) == 0xC0A80001u;
+    /* A new image leaves existing copies alone. */
+    if (ok) {
+        sf_route_entry_t e = test_route(0x0A000100u, 24, 0x04040404u);
+        ok = sf_route_table_upsert(&src, &e) == 0 && sf_vrf_image_make(&img, &src, 0) == 0 &&
+             next_hop_of(&sf_vrf_find(&set, 3)->table, 0x0A000101u) == 0xC0A80001u;
+    }
+
+    /* The index survives growth and removals from the middle of a run. */
+    for (uint32_t id = 10; ok && id < 300; ++id) {
+        sf_route_table_t t;
+        sf_route_table_init(&t);
+        ok = sf_vrf_add(&set, id * 64u, &t) != NULL;
+    }
+    sf_route_table_t spare;
+    sf_route_table_init(&spare);
+    if (ok) ok = !sf_vrf_add(&set, 640, &spare) && !sf_vrf_add(&set, SF_VRF_MAIN, &spare) && sf_vrf_set_count(&set) == 293;
+    for (uint32_t id = 10; ok && id < 300; id += 3) ok = sf_vrf_remove(&set, id * 64u) == 0;
+    for (uint32_t id = 10; ok && id < 300; ++id) ok = (sf_vrf_find(&set, id * 64u) != NULL) == ((id - 10) % 3 != 0);
+    if (ok) ok = sf_vrf_remove(&set, 640) == -1 && sf_vrf_find(&set, 1) == a;
+
+    /* An empty source gives empty copies. */
+    if (ok) {
+        sf_route_table_t empty, t;
+        sf_route_table_init(&empty);
+        ok = sf_vrf_image_make(&img, &empty, 16) == 0 && sf_vrf_image_clone(&img, &t) == 0 && t.count == 0 &&
+             !t.map && sf_route_table_upsert(&t, &def) == 0 && next_hop_of(&t, 0x01020304u) == 0xC0A8FFFFu;
+        sf_route_table_free(&t);
+    }
+
+    sf_vrf_set_free(&set);
+    sf_vrf_image_free(&img);
+    sf_route_table_free(&src);
+    return ok ? 0 : -1;
+}
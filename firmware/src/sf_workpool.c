@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sf_workpool.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ---- completion queue (Vyukov intrusive MPSC) ---- */
+
+void sf_cq_init(sf_completion_queue_t *cq, int notify_fd) {
+    if (!cq) return;
+    atomic_store(&cq->stub.next, NULL);
+    atomic_store(&cq->head, &cq->stub);
+    cq->tail = &cq->stub;
+    atomic_store(&cq->signalled, 0);
+    cq->notify_fd = notify_fd;
+}
+
+static void mpsc_push(sf_completion_queue_t *cq, sf_mpsc_node_t *n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    sf_mpsc_node_t *prev = atomic_exchange_explicit(&cq->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+void sf_cq_post(sf_completion_queue_t *cq, sf_task_t *t) {
+    mpsc_push(cq, &t->done);
+    /* One wakeup per drain: only the first producer after a rearm writes the fd. */
+    if (cq->notify_fd >= 0 && !atomic_exchange(&cq->signalled, 1)) {
+        uint64_t one = 1;
+        ssize_t w = write(cq->notify_fd, &one, sizeof(one));
+        (void)w;
+    }
+}
+
+void sf_cq_rearm(sf_completion_queue_t *cq) {
+    if (!cq) return;
+    if (cq->notify_fd >= 0) {
+        uint64_t v;
+        ssize_t r = read(cq->notify_fd, &v, sizeof(v));
+        (void)r;
+    }
+    atomic_store(&cq->signalled, 0);
+}
+
+sf_task_t *sf_cq_pop(sf_completion_queue_t *cq) {
+    if (!cq) return NULL;
+    sf_mpsc_node_t *tail = cq->tail;
+    sf_mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &cq->stub) {
+        if (!next) return NULL;
+        cq->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (!next) {
+        /* tail is the last node unless a producer is halfway through a push;
+           in that case it will signal again once the link is visible. */
+        if (tail != atomic_load_explicit(&cq->head, memory_order_acquire)) return NULL;
+        mpsc_push(cq, &cq->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (!next) return NULL;
+    }
+    cq->tail = next;
+    return (sf_task_t *)((char *)tail - offsetof(sf_task_t, done));
+}
+
+/* ---- work-stealing pool ---- */
+
+typedef struct sf_deque {
+    pthread_mutex_t lock;
+    sf_task_t      *slots[SF_WORKPOOL_DEQUE_CAP];
+    size_t          head;   /* owner takes from here (oldest first) */
+    size_t          count;  /* thieves take from head + count - 1 (newest) */
+} sf_deque_t;
+
+typedef struct sf_worker {
+    pthread_t  thread;
+    unsigned   index;
+    sf_deque_t dq;
+} sf_worker_t;
+
+static sf_worker_t g_workers[SF_WORKPOOL_MAX_WORKERS];
+static unsigned    g_nworkers = 0;
+static sem_t       g_ready;     /* counts queued tasks */
+static atomic_int  g_stopping;
+static atomic_uint g_next_worker;
+
+static int deque_push(sf_deque_t *dq, sf_task_t *t) {
+    pthread_mutex_lock(&dq->lock);
+    int ok = dq->count < SF_WORKPOOL_DEQUE_CAP;
+    if (ok) {
+        dq->slots[(dq->head + dq->count) % SF_WORKPOOL_DEQUE_CAP] = t;
+        dq->count++;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok ? 0 : -1;
+}
+
+static sf_task_t *deque_take(sf_deque_t *dq, int steal) {
+    sf_task_t *t = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count) {
+        if (steal) {
+            t = dq->slots[(dq->head + dq->count - 1) % SF_WORKPOOL_DEQUE_CAP];
+        } else {
+            t = dq->slots[dq->head];
+            dq->head = (dq->head + 1) % SF_WORKPOOL_DEQUE_CAP;
+        }
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return t;
+}
+
+static void *worker_main(void *arg) {
+    sf_worker_t *w = (sf_worker_t *)arg;
+    for (;;) {
+        while (sem_wait(&g_ready) != 0) {
+        }
+        if (atomic_load(&g_stopping)) break;
+
+        /* The semaphore guarantees a task is queued somewhere: own deque first, then steal. */
+        sf_task_t *t = deque_take(&w->dq, 0);
+        for (unsigned i = 1; !t; ++i) {
+            t = deque_take(&g_workers[(w->index + i) % g_nworkers].dq, 1);
+        }
+        t->run(t);
+        if (t->cq) sf_cq_post(t->cq, t);
+    }
+    return NULL;
+}
+
+int sf_workpool_start(unsigned nworkers) {
+    if (g_nworkers) return -1;
+    if (nworkers == 0) return 0;
+    if (nworkers > SF_WORKPOOL_MAX_WORKERS) nworkers = SF_WORKPOOL_MAX_WORKERS;
+    if (sem_init(&g_ready, 0, 0) != 0) return -1;
+    atomic_store(&g_stopping, 0);
+    atomic_store(&g_next_worker, 0);
+
+    for (unsigned i = 0; i < nworkers; ++i) {
+        sf_worker_t *w = &g_workers[i];
+        memset(w, 0, sizeof(*w));
+        w->index = i;
+        pthread_mutex_init(&w->dq.lock, NULL);
+    }
+    g_nworkers = nworkers;
+    for (unsigned i = 0; i < nworkers; ++i) {
+        if (pthread_create(&g_workers[i].thread, NULL, worker_main, &g_workers[i]) != 0) {
+            perror("pthread_create");
+            g_nworkers = i;
+            sf_workpool_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void sf_workpool_stop(void) {
+    if (!g_nworkers) return;
+    atomic_store(&g_stopping, 1);
+    for (unsigned i = 0; i < g_nworkers; ++i) sem_post(&g_ready);
+    for (unsigned i = 0; i < g_nworkers; ++i) {
+        pthread_join(g_workers[i].thread, NULL);
+        pthread_mutex_destroy(&g_workers[i].dq.lock);
+    }
+    sem_destroy(&g_ready);
+    g_nworkers = 0;
+}
+
+unsigned sf_workpool_size(void) {
+    return g_nworkers;
+}
+
+int sf_workpool_submit(sf_task_t *t) {
+    if (!t || !t->run || !g_nworkers || atomic_load(&g_stopping)) return -1;
+    unsigned start = atomic_fetch_add(&g_next_worker, 1u);
+    for (unsigned i = 0; i < g_nworkers; ++i) {
+        if (deque_push(&g_workers[(start + i) % g_nworkers].dq, t) == 0) {
+            sem_post(&g_ready);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    sf_task_t task;
+    int       value;
+    int       result;
+} pool_test_task_t;
+
+static void pool_test_run(sf_task_t *t) {
+    pool_test_task_t *pt = (pool_test_task_t *)t;
+    pt->result = pt->value * 2;
+}
+
+int sf_workpool_self_test(void) {
+    static pool_test_task_t tasks[200];
+    sf_completion_queue_t cq;
+    sf_cq_init(&cq, -1);
+    if (sf_cq_pop(&cq) != NULL) return -1;
+
+    if (sf_workpool_start(3) != 0) return -1;
+    for (int i = 0; i < 200; ++i) {
+        memset(&tasks[i], 0, sizeof(tasks[i]));
+        tasks[i].task.run = pool_test_run;
+        tasks[i].task.cq = &cq;
+        tasks[i].value = i;
+        if (sf_workpool_submit(&tasks[i].task) != 0) {
+            sf_workpool_stop();
+            return -1;
+        }
+    }
+
+    int done = 0;
+    long sum = 0;
+    for (int spins = 0; done < 200 && spins < 20000; ++spins) {
+        sf_task_t *t;
+        while ((t = sf_cq_pop(&cq)) != NULL) {
+            sum += ((pool_test_task_t *)t)->result;
+            done++;
+        }
+        if (done < 200) {
+            struct timespec ts = {0, 100000};
+            nanosleep(&ts, NULL);
+        }
+    }
+    sf_workpool_stop();
+    if (done != 200) return -1;
+    if (sum != 2L * (199L * 200L / 2L)) return -1;
+    if (sf_workpool_submit(&tasks[0].task) != -1) return -1;
+    return 0;
+}
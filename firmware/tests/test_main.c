@@ -1,5 +1,22 @@
 #include "sf_protocol.h"
 #include "routing_table.h"
+#include "nexthop_table.h"
+#include "routing6_table.h"
+#include "sf_admission.h"
+#include "sf_sched.h"
+#include "sf_workpool.h"
+#include "sf_handoff.h"
+#include "sf_snapshot.h"
+#include "sf_vrf.h"
+#include "sf_routes_file.h"
+#include "sf_wal.h"
+#include "sf_repl.h"
+#include "sf_route_pack.h"
+#include "sf_expiry.h"
+#include "sf_damp.h"
+#include "sf_fib.h"
+#include "sf_route_cache.h"
+#include "sf_route_bloom.h"
 
 #include <stdio.h>
 
@@ -9,10 +26,78 @@ int main(void) {
         fprintf(stderr, "FAIL: protocol framing\n");
         ok = 0;
     }
+    if (sf_nh_table_self_test() != 0) {
+        fprintf(stderr, "FAIL: next-hop groups\n");
+        ok = 0;
+    }
     if (sf_route_table_self_test() != 0) {
         fprintf(stderr, "FAIL: routing table\n");
         ok = 0;
     }
+    if (sf_route6_table_self_test() != 0) {
+        fprintf(stderr, "FAIL: IPv6 routing table\n");
+        ok = 0;
+    }
+    if (sf_admission_self_test() != 0) {
+        fprintf(stderr, "FAIL: admission control\n");
+        ok = 0;
+    }
+    if (sf_sched_self_test() != 0) {
+        fprintf(stderr, "FAIL: priority lanes\n");
+        ok = 0;
+    }
+    if (sf_workpool_self_test() != 0) {
+        fprintf(stderr, "FAIL: worker pool\n");
+        ok = 0;
+    }
+    if (sf_handoff_self_test() != 0) {
+        fprintf(stderr, "FAIL: restart handoff\n");
+        ok = 0;
+    }
+    if (sf_snapshot_self_test() != 0) {
+        fprintf(stderr, "FAIL: route snapshot\n");
+        ok = 0;
+    }
+    if (sf_vrf_self_test() != 0) {
+        fprintf(stderr, "FAIL: VRF tables\n");
+        ok = 0;
+    }
+    if (sf_routes_file_self_test() != 0) {
+        fprintf(stderr, "FAIL: routes file\n");
+        ok = 0;
+    }
+    if (sf_wal_self_test() != 0) {
+        fprintf(stderr, "FAIL: write-ahead log\n");
+        ok = 0;
+    }
+    if (sf_repl_self_test() != 0) {
+        fprintf(stderr, "FAIL: route replication\n");
+        ok = 0;
+    }
+    if (sf_route_pack_self_test() != 0) {
+        fprintf(stderr, "FAIL: packed routes\n");
+        ok = 0;
+    }
+    if (sf_expiry_self_test() != 0) {
+        fprintf(stderr, "FAIL: route expiry\n");
+        ok = 0;
+    }
+    if (sf_damp_self_test() != 0) {
+        fprintf(stderr, "FAIL: route dampening\n");
+        ok = 0;
+    }
+    if (sf_fib_self_test() != 0) {
+        fprintf(stderr, "FAIL: compressed FIB\n");
+        ok = 0;
+    }
+    if (sf_route_cache_self_test() != 0) {
+        fprintf(stderr, "FAIL: destination cache\n");
+        ok = 0;
+    }
+    if (sf_route_bloom_self_test() != 0) {
+        fprintf(stderr, "FAIL: prefix-length filters\n");
+        ok = 0;
+    }
     if (ok) {
         printf("OK: firmware unit tests\n");
         return 0;
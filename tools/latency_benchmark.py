@@ -5,16 +5,22 @@ import time
 
 from sentryflow_client import Msg, request_once
 
-async def measure_latency(host: str, port: int, count: int, concurrency: int) -> list[float]:
+async def measure_latency(host: str, port: int, count: int, concurrency: int) -> tuple[list[float], int]:
     sem = asyncio.Semaphore(max(1, concurrency))
     samples: list[float] = []
+    shed = 0
 
     async def one(i: int) -> None:
+        nonlocal shed
         payload = f"ping-{i}".encode("utf-8")
         async with sem:
             start = time.perf_counter()
             try:
-                msg_type, _ = await request_once(host, port, Msg.PING, payload, seq=i + 1)
+                msg_type, reply = await request_once(host, port, Msg.PING, payload, seq=i + 1)
+                if msg_type == Msg.ERROR and reply == b"busy":
+                    # Shed by the engine's admission control; not part of admitted latency.
+                    shed += 1
+                    return
                 if msg_type != Msg.PONG:
                     raise RuntimeError(f"expected PONG, got {msg_type}")
             except Exception as exc:
@@ -24,9 +30,11 @@ async def measure_latency(host: str, port: int, count: int, concurrency: int) ->
             samples.append((end - start) * 1000.0)
 
     await asyncio.gather(*(one(i) for i in range(count)))
-    return samples
+    return samples, shed
 
-def summarize(samples: list[float]) -> None:
+def summarize(samples: list[float], shed: int = 0) -> None:
+    if shed:
+        print(f"shed={shed} (engine answered BUSY)")
     if not samples:
         print("no successful samples")
         return
@@ -54,8 +62,8 @@ def main() -> None:
     parser.add_argument("--concurrency", type=int, default=10)
     args = parser.parse_args()
 
-    samples = asyncio.run(measure_latency(args.host, args.port, args.requests, args.concurrency))
-    summarize(samples)
+    samples, shed = asyncio.run(measure_latency(args.host, args.port, args.requests, args.concurrency))
+    summarize(samples, shed)
 
 
 if __name__ == "__main__":
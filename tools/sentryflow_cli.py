@@ -3,12 +3,36 @@ import asyncio
 import json
 
 from sentryflow_client import (
+    QUERY_COVERED,
+    QUERY_COVERING,
+    VRF_EMPTY,
+    Flag,
     Msg,
+    encode_if_version,
+    encode_vrf,
+    encode_vrf_create,
+    encode_vrf_delete,
+    encode_nh_group,
+    encode_route6_entries,
+    encode_route6_lookup,
     encode_route_entries,
+    encode_route_group_entries,
     encode_route_lookup,
+    encode_route_query,
+    encode_route_withdraw,
+    pack_route_records,
+    parse_nh_group_ack,
+    parse_route6_reply,
+    parse_route6_version,
+    parse_route_ack,
+    parse_route_dump_reply,
+    parse_route_query_reply,
     parse_route_reply,
+    parse_route_version,
     parse_stats,
+    parse_vrf_ack,
     request_once,
+    request_stream,
 )
 
 
@@ -27,10 +51,41 @@ async def main_async() -> int:
     sub.add_parser("stats")
 
     ru = sub.add_parser("route-update")
-    ru.add_argument("--entry", action="append", required=True, help="prefix,mask,nextHop,metric (e.g. 10.0.0.0,8,10.0.0.1,10)")
+    ru.add_argument("--entry", action="append", required=True, help="prefix,mask,nextHop,metric (e.g. 10.0.0.0,8,10.0.0.1,10 or 2001:db8::,32,fe80::1,10); nextHop may be group:<id>")
+    ru.add_argument("--if-version", type=int, help="apply only if the table is at this version")
+    ru.add_argument("--vrf", type=int, default=0, help="VRF to update (0 = main table)")
+    ru.add_argument("--packed", action="store_true", help="send the routes as a packed block")
+
+    rw = sub.add_parser("route-withdraw")
+    rw.add_argument("--prefix", action="append", required=True, help="prefix/mask (e.g. 10.0.0.0/8)")
+    rw.add_argument("--vrf", type=int, default=0, help="VRF to withdraw from (0 = main table)")
 
     rl = sub.add_parser("route-lookup")
     rl.add_argument("ip")
+    rl.add_argument("--flow", help="flow key picking the next-hop group member (e.g. src,dst,proto,sport,dport)")
+
+    rl.add_argument("--vrf", type=int, default=0, help="VRF to look up in (0 = main table)")
+
+    rq = sub.add_parser("route-query")
+    rq.add_argument("prefix", help="prefix/mask (e.g. 10.0.0.0/8)")
+    rq.add_argument("--covering", action="store_true", help="routes containing the prefix instead of inside it")
+    rq.add_argument("--vrf", type=int, default=0, help="VRF to query (0 = main table)")
+
+    rd = sub.add_parser("route-dump")
+    rd.add_argument("--vrf", type=int, default=0, help="VRF to dump (0 = main table)")
+    rd.add_argument("--count", action="store_true", help="print the number of routes instead of the routes")
+    rd.add_argument("--packed", action="store_true", help="ask for packed records")
+
+    vc = sub.add_parser("vrf-create")
+    vc.add_argument("vrf", type=int)
+    vc.add_argument("--from", dest="source", type=int, default=0, help="VRF to copy (0 = main table)")
+    vc.add_argument("--empty", action="store_true", help="start empty instead of as a copy")
+
+    vd = sub.add_parser("vrf-delete")
+    vd.add_argument("vrf", type=int)
+
+    ng = sub.add_parser("nh-group")
+    ng.add_argument("--member", action="append", required=True, help="nextHop[,weight] (e.g. 10.0.0.1,2)")
 
     args = parser.parse_args()
 
@@ -58,19 +113,135 @@ async def main_async() -> int:
         for e in args.entry:
             prefix, mask, nh, metric = e.split(",")
             entries.append((prefix, int(mask), nh, int(metric)))
-        payload = encode_route_entries(entries)
-        t, p = await request_once(args.host, args.port, Msg.ROUTE_UPDATE, payload, seq=1)
-        print({"type": t, "payload_len": len(p)})
+        v6 = {":" in e[0] for e in entries}
+        if len(v6) > 1:
+            print({"error": "IPv4 and IPv6 entries go in separate updates"})
+            return 2
+        if True in v6:
+            if args.if_version is not None or args.vrf:
+                print({"error": "--if-version and --vrf apply to the IPv4 tables only"})
+                return 2
+            msg, payload = Msg.ROUTE_UPDATE6, encode_route6_entries(entries)
+        elif all(e[2].startswith("group:") for e in entries):
+            grouped = [(p, m, int(nh.split(":", 1)[1]), metric) for p, m, nh, metric in entries]
+            msg, payload = Msg.ROUTE_UPDATE, encode_route_group_entries(grouped)
+        elif any(e[2].startswith("group:") for e in entries):
+            print({"error": "routes over groups and over single next hops go in separate updates"})
+            return 2
+        else:
+            msg, payload = Msg.ROUTE_UPDATE, encode_route_entries(entries)
+        flags = 0
+        if args.packed:
+            if msg != Msg.ROUTE_UPDATE:
+                print({"error": "--packed applies to IPv4 routes only"})
+                return 2
+            payload, flags = pack_route_records(payload), Flag.PACKED
+        if args.if_version is not None:
+            payload = encode_if_version(args.if_version, payload)
+            flags |= Flag.IF_VERSION
+        if args.vrf:
+            payload = encode_vrf(args.vrf, payload)
+            flags |= Flag.VRF
+        t, p = await request_once(args.host, args.port, msg, payload, seq=1, flags=flags)
+        if t != Msg.ROUTE_ACK:
+            print({"type": t, "payload": p.decode("utf-8", "replace")})
+            return 1
+        applied, version = parse_route_ack(p)
+        print({"applied": applied, "version": version})
+        return 0
+
+    if args.cmd == "route-withdraw":
+        prefixes = []
+        for p in args.prefix:
+            prefix, mask = p.split("/")
+            prefixes.append((prefix, int(mask)))
+        payload, flags = encode_route_withdraw(prefixes), 0
+        if args.vrf:
+            payload, flags = encode_vrf(args.vrf, payload), Flag.VRF
+        t, p = await request_once(args.host, args.port, Msg.ROUTE_WITHDRAW, payload, seq=1, flags=flags)
+        if t != Msg.ROUTE_ACK:
+            print({"type": t, "payload": p.decode("utf-8", "replace")})
+            return 1
+        removed, version = parse_route_ack(p)
+        print({"removed": removed, "version": version})
+        return 0
+
+    if args.cmd in ("vrf-create", "vrf-delete"):
+        if args.cmd == "vrf-create":
+            msg, payload = Msg.VRF_CREATE, encode_vrf_create(args.vrf, VRF_EMPTY if args.empty else args.source)
+        else:
+            msg, payload = Msg.VRF_DELETE, encode_vrf_delete(args.vrf)
+        t, p = await request_once(args.host, args.port, msg, payload, seq=1)
+        if t != Msg.VRF_ACK:
+            print({"type": t, "payload": p.decode("utf-8", "replace")})
+            return 1
+        vrf, routes = parse_vrf_ack(p)
+        print({"vrf": vrf, "routes": routes})
+        return 0
+
+    if args.cmd == "nh-group":
+        members = []
+        for m in args.member:
+            nh, _, weight = m.partition(",")
+            members.append((nh, int(weight) if weight else 1))
+        t, p = await request_once(args.host, args.port, Msg.NH_GROUP, encode_nh_group(members), seq=1)
+        if t != Msg.NH_GROUP_ACK:
+            print({"type": t, "payload": p.decode("utf-8", "replace")})
+            return 1
+        group_id, version = parse_nh_group_ack(p)
+        print({"group": group_id, "version": version})
+        return 0
+
+    if args.cmd == "route-lookup" and ":" in args.ip:
+        t, p = await request_once(args.host, args.port, Msg.ROUTE_LOOKUP6, encode_route6_lookup(args.ip), seq=1)
+        if t != Msg.ROUTE_REPLY6:
+            print({"type": t, "payload": p.decode("utf-8", "replace")})
+            return 1
+        print({"result": parse_route6_reply(p), "version": parse_route6_version(p)})
         return 0
 
     if args.cmd == "route-lookup":
-        payload = encode_route_lookup(args.ip)
-        t, p = await request_once(args.host, args.port, Msg.ROUTE_LOOKUP, payload, seq=1)
+        payload, flags = encode_route_lookup(args.ip, args.flow.encode("utf-8") if args.flow else b""), 0
+        if args.vrf:
+            payload, flags = encode_vrf(args.vrf, payload), Flag.VRF
+        t, p = await request_once(args.host, args.port, Msg.ROUTE_LOOKUP, payload, seq=1, flags=flags)
         if t != Msg.ROUTE_REPLY:
             print({"type": t, "payload": p.decode("utf-8", "replace")})
             return 1
         r = parse_route_reply(p)
-        print({"result": r})
+        print({"result": r, "version": parse_route_version(p)})
+        return 0
+
+    if args.cmd == "route-query":
+        prefix, mask = args.prefix.split("/")
+        payload = encode_route_query(prefix, int(mask), QUERY_COVERING if args.covering else QUERY_COVERED)
+        flags = 0
+        if args.vrf:
+            payload, flags = encode_vrf(args.vrf, payload), Flag.VRF
+        frames = await request_stream(args.host, args.port, Msg.ROUTE_QUERY, payload, seq=1, flags=flags)
+        routes, version = [], 0
+        for t, p in frames:
+            if t != Msg.ROUTE_QUERY_REPLY:
+                print({"type": t, "payload": p.decode("utf-8", "replace")})
+                return 1
+            version, chunk = parse_route_query_reply(p)
+            routes.extend(chunk)
+        print({"version": version, "frames": len(frames), "routes": routes})
+        return 0
+
+    if args.cmd == "route-dump":
+        payload, flags = (encode_vrf(args.vrf), Flag.VRF) if args.vrf else (b"", 0)
+        if args.packed:
+            flags |= Flag.PACKED
+        frames = await request_stream(args.host, args.port, Msg.ROUTE_DUMP, payload, seq=1, flags=flags, timeout_s=30.0)
+        routes, version = [], 0
+        for t, p in frames:
+            if t != Msg.ROUTE_DUMP_REPLY:
+                print({"type": t, "payload": p.decode("utf-8", "replace")})
+                return 1
+            version, chunk = parse_route_dump_reply(p, packed=args.packed)
+            routes.extend(chunk)
+        print({"version": version, "frames": len(frames), "routes": len(routes) if args.count else routes})
         return 0
 
     return 2
@@ -20,9 +20,36 @@ class Msg:
     ROUTE_ACK = 8
     ROUTE_LOOKUP = 9
     ROUTE_REPLY = 10
+    SNAPSHOT = 11
+    SNAPSHOT_ACK = 12
+    REPL_SUBSCRIBE = 13
+    REPL_BATCH = 14
+    ROUTE_WITHDRAW = 15
+    ROUTE_UPDATE6 = 16
+    ROUTE_LOOKUP6 = 17
+    ROUTE_REPLY6 = 18
+    NH_GROUP = 19
+    NH_GROUP_ACK = 20
+    VRF_CREATE = 21
+    VRF_DELETE = 22
+    VRF_ACK = 23
+    ROUTE_QUERY = 24
+    ROUTE_QUERY_REPLY = 25
+    ROUTE_DUMP = 26
+    ROUTE_DUMP_REPLY = 27
     ERROR = 255
 
 
+class Flag:
+    ACK_REQUIRED = 1 << 0
+    TXN = 1 << 1         # ROUTE_UPDATE is part of a transaction
+    TXN_MORE = 1 << 2    # stage it; a later TXN frame without TXN_MORE commits
+    IF_VERSION = 1 << 3  # payload starts with the table version (u64_be) the commit requires
+    VRF = 1 << 4         # route payload starts with a VRF id (u32_be), ahead of any IF_VERSION version
+    MORE = 1 << 5        # reply continues in further frames with the same seq
+    PACKED = 1 << 6      # ROUTE_UPDATE routes / ROUTE_DUMP_REPLY records are a packed block
+
+
 @dataclass(frozen=True)
 class Stats:
     total_requests: int
@@ -31,6 +58,41 @@ class Stats:
     uptime_ms: int
     last_latency_us: int
     avg_latency_us: int
+    shed_requests: int = 0
+    shed_connections: int = 0
+    steer_misses: int = 0
+    busy_poll_hits: int = 0
+    busy_poll_spin_us: int = 0
+    wal_records: int = 0
+    wal_syncs: int = 0
+    route_seq: int = 0
+    repl_resyncs: int = 0
+    route_expired: int = 0
+    route_suppressed: int = 0
+    route_coalesced: int = 0
+    fib_routes: int = 0
+    route_cache_hits: int = 0
+    route_cache_misses: int = 0
+
+
+# u64 counters appended after the 40-byte core layout, in wire order.
+STATS_EXTENSION_FIELDS = (
+    "shed_requests",
+    "shed_connections",
+    "steer_misses",
+    "busy_poll_hits",
+    "busy_poll_spin_us",
+    "wal_records",
+    "wal_syncs",
+    "route_seq",
+    "repl_resyncs",
+    "route_expired",
+    "route_suppressed",
+    "route_coalesced",
+    "fib_routes",
+    "route_cache_hits",
+    "route_cache_misses",
+)
 
 
 async def read_exactly(reader: asyncio.StreamReader, n: int) -> bytes:
@@ -47,11 +109,12 @@ async def request_once(
     payload: bytes = b"",
     *,
     seq: int = 1,
+    flags: int = 0,
     timeout_s: float = 2.0,
 ) -> tuple[int, bytes]:
     reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout=timeout_s)
     try:
-        writer.write(encode_frame(msg_type, payload, seq=seq))
+        writer.write(encode_frame(msg_type, payload, seq=seq, flags=flags))
         await writer.drain()
 
         header = await asyncio.wait_for(read_exactly(reader, HEADER_SIZE), timeout=timeout_s)
@@ -66,11 +129,50 @@ async def request_once(
             await writer.wait_closed()
 
 
+async def request_stream(
+    host: str,
+    port: int,
+    msg_type: int,
+    payload: bytes = b"",
+    *,
+    seq: int = 1,
+    flags: int = 0,
+    timeout_s: float = 2.0,
+) -> list[tuple[int, bytes]]:
+    """Like request_once, for replies sent in several frames: returns every
+    (type, payload) up to the first frame not flagged MORE."""
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout=timeout_s)
+    try:
+        writer.write(encode_frame(msg_type, payload, seq=seq, flags=flags))
+        await writer.drain()
+
+        frames = []
+        while True:
+            header = await asyncio.wait_for(read_exactly(reader, HEADER_SIZE), timeout=timeout_s)
+            payload_len = struct.unpack(HEADER_FMT, header)[5]
+            payload_bytes = await asyncio.wait_for(read_exactly(reader, payload_len), timeout=timeout_s)
+            frame = decode_frame(header + payload_bytes)
+            frames.append((frame.msg_type, frame.payload))
+            if not frame.flags & Flag.MORE:
+                return frames
+    finally:
+        writer.close()
+        with contextlib.suppress(Exception):
+            await writer.wait_closed()
+
+
 def parse_stats(payload: bytes) -> Stats:
-    if len(payload) != 40:
+    # 40-byte core layout; newer engines append u64 counters after it.
+    if len(payload) < 40:
         raise ValueError("bad stats payload length")
     total, bad, routes, uptime = struct.unpack("!QQQQ", payload[:32])
-    last_us, avg_us = struct.unpack("!II", payload[32:])
+    last_us, avg_us = struct.unpack("!II", payload[32:40])
+    extra = {}
+    for i, name in enumerate(STATS_EXTENSION_FIELDS):
+        off = 40 + 8 * i
+        if len(payload) < off + 8:
+            break
+        extra[name] = struct.unpack("!Q", payload[off : off + 8])[0]
     return Stats(
         total_requests=total,
         bad_frames=bad,
@@ -78,6 +180,7 @@ def parse_stats(payload: bytes) -> Stats:
         uptime_ms=uptime,
         last_latency_us=last_us,
         avg_latency_us=avg_us,
+        **extra,
     )
 
 
@@ -85,7 +188,7 @@ def encode_route_entries(entries: list[tuple[str, int, str, int]]) -> bytes:
     """
     entries: list of (prefix_ip, mask_bits, next_hop_ip, metric)
     Layout per entry (16 bytes):
-      prefix(u32_be), mask(u8), reserved(u8=0), metric(u16_be), next_hop(u32_be), reserved(u32=0)
+      prefix(u32_be), mask(u8), flags(u8=0), metric(u16_be), next_hop(u32_be), reserved(u32=0)
     """
     import ipaddress
 
@@ -97,14 +200,277 @@ def encode_route_entries(entries: list[tuple[str, int, str, int]]) -> bytes:
     return bytes(out)
 
 
-def encode_route_lookup(ip: str) -> bytes:
+ROUTE_F_GROUP = 0x01     # ROUTE_UPDATE entry flag: next_hop holds a next-hop group id
+
+
+def encode_route_group_entries(entries: list[tuple[str, int, int, int]]) -> bytes:
+    """
+    entries: list of (prefix_ip, mask_bits, group_id, metric), routes over a
+    group returned by NH_GROUP_ACK. Same 16-byte layout as encode_route_entries
+    with flags=ROUTE_F_GROUP and the group id in place of the next hop.
+    """
     import ipaddress
 
-    return struct.pack("!I", int(ipaddress.IPv4Address(ip)))
+    out = bytearray()
+    for prefix, mask_bits, group_id, metric in entries:
+        p = int(ipaddress.IPv4Address(prefix))
+        out += struct.pack("!IBBHII", p, mask_bits & 0xFF, ROUTE_F_GROUP, metric & 0xFFFF, group_id, 0)
+    return bytes(out)
 
 
-def parse_route_reply(payload: bytes) -> Optional[tuple[int, int, str]]:
+def _put_varint(out: bytearray, v: int) -> None:
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+
+
+def pack_route_records(records: bytes) -> bytes:
+    """
+    Re-encodes 16-byte route records (encode_route_entries, encode_route_group_entries) as one
+    packed block for a ROUTE_UPDATE flagged PACKED, sorted by prefix:
+      count(u16_be), hops(u8), reserved(u8), hops x next_hop(u32_be),
+      count x mask(u8, bit 7 = group), count x next-hop index(u8),
+      count x varint prefix delta, count x varint metric
+    """
+    if len(records) % 16:
+        raise ValueError("route records are 16 bytes")
+    routes = sorted((struct.unpack("!IBBHI", records[off : off + 12]) for off in range(0, len(records), 16)),
+                    key=lambda r: r[0])
+    hops: dict[int, int] = {}
+    for r in routes:
+        hops.setdefault(r[4], len(hops))
+    if len(routes) > 0xFFFF or len(hops) > 255:
+        raise ValueError("too many routes or next hops for one packed block")
+    out = bytearray(struct.pack("!HBB", len(routes), len(hops), 0))
+    for nh in hops:
+        out += struct.pack("!I", nh)
+    out += bytes((mask & 0x7F) | (0x80 if flags & ROUTE_F_GROUP else 0) for _, mask, flags, _, _ in routes)
+    out += bytes(hops[r[4]] for r in routes)
+    prev = 0
+    for r in routes:
+        _put_varint(out, (r[0] - prev) & 0xFFFFFFFF)
+        prev = r[0]
+    for r in routes:
+        _put_varint(out, r[3])
+    return bytes(out)
+
+
+def unpack_routes(block: bytes) -> list[tuple[str, int, int, int, str]]:
+    """Decodes a packed block: [(prefix, mask, flags, metric, next hop)]."""
+    import ipaddress
+
+    if len(block) < 4:
+        raise ValueError("bad packed block")
+    count, nhops = struct.unpack("!HB", block[:3])
+    off = 4 + 4 * nhops
+    hops = [struct.unpack("!I", block[4 + 4 * i : 8 + 4 * i])[0] for i in range(nhops)]
+    masks, index = block[off : off + count], block[off + count : off + 2 * count]
+    off += 2 * count
+    prefixes, prefix = [], 0
+    for _ in range(count):
+        d, off = _varint(block, off)
+        prefix = (prefix + d) & 0xFFFFFFFF
+        prefixes.append(prefix)
+    routes = []
+    for i in range(count):
+        metric, off = _varint(block, off)
+        routes.append((str(ipaddress.IPv4Address(prefixes[i])), masks[i] & 0x7F, masks[i] >> 7, metric,
+                       str(ipaddress.IPv4Address(hops[index[i]]))))
+    if off != len(block):
+        raise ValueError("trailing bytes in packed block")
+    return routes
+
+
+def encode_nh_group(members: list[tuple[str, int]]) -> bytes:
+    """
+    members: list of (next_hop_ip, weight); weight 0 counts as 1.
+    Layout per member (8 bytes): next_hop(u32_be), weight(u16_be), reserved(u16=0)
+    """
+    import ipaddress
+
+    out = bytearray()
+    for next_hop, weight in members:
+        out += struct.pack("!IHH", int(ipaddress.IPv4Address(next_hop)), weight & 0xFFFF, 0)
+    return bytes(out)
+
+
+def parse_nh_group_ack(payload: bytes) -> tuple[int, int]:
+    """Returns (group id, table version after the definition)."""
+    if len(payload) != 12:
+        raise ValueError("bad nh group ack length")
+    return struct.unpack("!IQ", payload)
+
+
+def encode_route_withdraw(prefixes: list[tuple[str, int]]) -> bytes:
+    """
+    prefixes: list of (prefix_ip, mask_bits)
+    Layout per entry (8 bytes): prefix(u32_be), mask(u8), reserved(3)
+    """
+    import ipaddress
+
+    out = bytearray()
+    for prefix, mask_bits in prefixes:
+        out += struct.pack("!IB3x", int(ipaddress.IPv4Address(prefix)), mask_bits & 0xFF)
+    return bytes(out)
+
+
+def encode_routes_file(entries: list[tuple[str, int, str, int]]) -> bytes:
+    """Binary --routes-file image: "SFRLIST\\0", version(u32_be=1), count(u32_be), then ROUTE_UPDATE records."""
+    return b"SFRLIST\x00" + struct.pack("!II", 1, len(entries)) + encode_route_entries(entries)
+
+
+def encode_route_lookup(ip: str, flow_key: bytes = b"") -> bytes:
+    """flow_key (a packed 5-tuple or any bytes) picks the member of a next-hop
+    group; without it the destination address does."""
+    import ipaddress
+
+    return struct.pack("!I", int(ipaddress.IPv4Address(ip))) + flow_key
+
+
+def encode_route6_entries(entries: list[tuple[str, int, str, int]]) -> bytes:
+    """
+    entries: list of (prefix_ip6, mask_bits, next_hop_ip6, metric)
+    Layout per entry (40 bytes):
+      prefix(16), mask(u8), reserved(u8=0), metric(u16_be), next_hop(16), reserved(u32=0)
+    """
+    import ipaddress
+
+    out = bytearray()
+    for prefix, mask_bits, next_hop, metric in entries:
+        p = ipaddress.IPv6Address(prefix).packed
+        nh = ipaddress.IPv6Address(next_hop).packed
+        out += p + struct.pack("!BBH", mask_bits & 0xFF, 0, metric & 0xFFFF) + nh + b"\x00" * 4
+    return bytes(out)
+
+
+def encode_route6_lookup(ip: str) -> bytes:
+    import ipaddress
+
+    return ipaddress.IPv6Address(ip).packed
+
+
+def encode_if_version(version: int, payload: bytes = b"") -> bytes:
+    """Prefixes a ROUTE_UPDATE payload for a frame flagged IF_VERSION."""
+    return struct.pack("!Q", version) + payload
+
+
+VRF_MAIN = 0
+VRF_EMPTY = 0xFFFFFFFF   # VRF_CREATE source: start empty
+
+
+def encode_vrf(vrf: int, payload: bytes = b"") -> bytes:
+    """Prefixes a ROUTE_UPDATE/ROUTE_WITHDRAW/ROUTE_LOOKUP payload for a frame flagged VRF."""
+    return struct.pack("!I", vrf) + payload
+
+
+def encode_vrf_create(vrf: int, source: int = VRF_MAIN) -> bytes:
+    """VRF_CREATE: vrf(u32_be), source(u32_be): the table it starts as a copy of."""
+    return struct.pack("!II", vrf, source)
+
+
+def encode_vrf_delete(vrf: int) -> bytes:
+    return struct.pack("!I", vrf)
+
+
+def parse_vrf_ack(payload: bytes) -> tuple[int, int]:
+    """Returns (vrf, routes in it)."""
     if len(payload) != 8:
+        raise ValueError("bad vrf ack length")
+    return struct.unpack("!II", payload)
+
+
+QUERY_COVERED = 0    # the prefix and everything more specific
+QUERY_COVERING = 1   # the prefix and everything less specific
+
+
+def encode_route_query(prefix: str, mask_bits: int, mode: int = QUERY_COVERED) -> bytes:
+    """ROUTE_QUERY: prefix(4), mask_bits(1), mode(1), reserved(2)."""
+    import ipaddress
+
+    return ipaddress.IPv4Address(prefix).packed + struct.pack("!BBH", mask_bits, mode, 0)
+
+
+def parse_route_query_reply(payload: bytes) -> tuple[int, list[tuple[str, int, int, int, str]]]:
+    """One ROUTE_QUERY_REPLY frame: (version, [(prefix, mask, flags, metric, next hop)]).
+    A route over a next-hop group has flags bit 0 set and the group id as its next hop."""
+    if len(payload) < 8 or (len(payload) - 8) % 16:
+        raise ValueError("bad route query reply length")
+    import ipaddress
+
+    version = struct.unpack("!Q", payload[:8])[0]
+    routes = []
+    for off in range(8, len(payload), 16):
+        prefix, mask_bits, flags, metric, next_hop = struct.unpack("!IBBHI", payload[off : off + 12])
+        routes.append((str(ipaddress.IPv4Address(prefix)), mask_bits, flags, metric, str(ipaddress.IPv4Address(next_hop))))
+    return version, routes
+
+
+def _varint(payload: bytes, off: int) -> tuple[int, int]:
+    value, shift = 0, 0
+    while True:
+        if off >= len(payload) or shift > 28:
+            raise ValueError("bad varint")
+        b = payload[off]
+        off += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, off
+
+
+def parse_route_dump_reply(payload: bytes, packed: bool = False) -> tuple[int, list[tuple[str, int, int, int, str]]]:
+    """One ROUTE_DUMP_REPLY frame: (version, [(prefix, mask, flags, metric, next hop)]).
+    Routes are delta-encoded against the previous one in the frame: mask byte (bit 7 = next hop is a
+    group id), then varints of the zigzagged prefix, next hop and metric differences. With packed
+    (the dump was requested with Flag.PACKED) the version is followed by a packed block instead."""
+    if packed:
+        if len(payload) < 8:
+            raise ValueError("bad route dump reply length")
+        return struct.unpack("!Q", payload[:8])[0], unpack_routes(payload[8:])
+    if len(payload) < 12:
+        raise ValueError("bad route dump reply length")
+    import ipaddress
+
+    version, count = struct.unpack("!QI", payload[:12])
+    off, prefix, next_hop, metric = 12, 0, 0, 0
+    routes = []
+    for _ in range(count):
+        if off >= len(payload):
+            raise ValueError("truncated route dump reply")
+        mask_bits, off = payload[off], off + 1
+        deltas = []
+        for _ in range(3):
+            z, off = _varint(payload, off)
+            deltas.append((z >> 1) ^ -(z & 1))
+        prefix = (prefix + deltas[0]) & 0xFFFFFFFF
+        next_hop = (next_hop + deltas[1]) & 0xFFFFFFFF
+        metric = (metric + deltas[2]) & 0xFFFFFFFF
+        routes.append((str(ipaddress.IPv4Address(prefix)), mask_bits & 0x7F, mask_bits >> 7, metric,
+                       str(ipaddress.IPv4Address(next_hop))))
+    if off != len(payload):
+        raise ValueError("trailing bytes in route dump reply")
+    return version, routes
+
+
+def parse_route_ack(payload: bytes) -> tuple[int, int]:
+    """Returns (routes applied, table version after the update)."""
+    if len(payload) < 4:
+        raise ValueError("bad route ack length")
+    applied = struct.unpack("!I", payload[:4])[0]
+    version = struct.unpack("!Q", payload[4:12])[0] if len(payload) >= 12 else 0
+    return applied, version
+
+
+def parse_route_version(payload: bytes) -> int:
+    """Table version a ROUTE_REPLY was answered from (0 from engines that do not report it)."""
+    if len(payload) < 16:
+        return 0
+    return struct.unpack("!Q", payload[8:16])[0]
+
+
+def parse_route_reply(payload: bytes) -> Optional[tuple[int, int, str]]:
+    if len(payload) < 8:
         raise ValueError("bad route reply length")
     mask_bits = payload[0]
     metric = struct.unpack("!H", payload[2:4])[0]
@@ -115,3 +481,30 @@ def parse_route_reply(payload: bytes) -> Optional[tuple[int, int, str]]:
 
     return mask_bits, metric, str(ipaddress.IPv4Address(next_hop_int))
 
+
+def parse_route6_reply(payload: bytes) -> Optional[tuple[int, int, str]]:
+    """ROUTE_REPLY6: (mask, metric, next hop) or None when nothing matched."""
+    if len(payload) < 20:
+        raise ValueError("bad route6 reply length")
+    mask_bits = payload[0]
+    metric = struct.unpack("!H", payload[2:4])[0]
+    if mask_bits == 0 and metric == 0xFFFF:
+        return None
+    import ipaddress
+
+    return mask_bits, metric, str(ipaddress.IPv6Address(payload[4:20]))
+
+
+def parse_route6_version(payload: bytes) -> int:
+    """IPv6 table version a ROUTE_REPLY6 was answered from."""
+    if len(payload) < 32:
+        return 0
+    return struct.unpack("!Q", payload[24:32])[0]
+
+
+def parse_snapshot_ack(payload: bytes) -> tuple[int, int]:
+    """Returns (routes, bytes) written by a SNAPSHOT request."""
+    if len(payload) != 12:
+        raise ValueError("bad snapshot ack length")
+    routes, size = struct.unpack("!IQ", payload)
+    return routes, size